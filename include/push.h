@@ -3,6 +3,7 @@
 
 #include "exported.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 #define LIBPUSH_DISPLAY_HEIGHT 160
 #define LIBPUSH_DISPLAY_WIDTH 960
@@ -10,6 +11,8 @@
 #define LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES 128
 #define LIBPUSH_PAD_MATRIX_DIM 8
 #define LIBPUSH_TOUCH_STRIP_LEDS 30
+#define LIBPUSH_ENCODERS 11
+#define LIBPUSH_PEDAL_CONTACTS 5
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,6 +32,13 @@ typedef struct LibPushPadEvent {
   unsigned int x; //< (0-7) The x coordinate of the pad
   unsigned int y; //< (0-7) The y coordinate of the pad
   unsigned int velocity;
+  double
+      pressure; //< (0-1) The velocity or aftertouch as a fraction, with full resolution after signal conditioning
+  int note; //< (0-127) The note the pad plays in the current layout, or -1 if it plays none
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the message that caused the event arrived
+  unsigned long long
+      dispatch_timestamp; //< Monotonic time in nanoseconds when the event was dispatched
 } LibPushPadEvent;
 typedef void (*LibPushPadCallback)(LibPushPadEvent event, void *context);
 
@@ -43,6 +53,31 @@ typedef enum LibPushPadSensitivity {
   LP_LOW_SENSITIVITY = 2,
 } LibPushPadSensitivity;
 
+/// How notes are laid out on the pads, see libpush_set_pad_layout
+typedef enum LibPushPadLayoutType {
+  LP_LAYOUT_IN_KEY = 0,    //< Only notes of the scale, rising by a scale degree to the right
+  LP_LAYOUT_CHROMATIC = 1, //< Every note, rising by a semitone to the right
+  LP_LAYOUT_DRUM = 2, //< Four 4x4 blocks of 16 notes: bottom left, bottom right, top left, then top right
+} LibPushPadLayoutType;
+
+#define LIBPUSH_SCALE_MAJOR 0xAB5
+#define LIBPUSH_SCALE_MINOR 0x5AD
+
+typedef struct LibPushPadLayout {
+  LibPushPadLayoutType layout_type;
+  unsigned char root; //< (0-11) The pitch class of the root, 0 is C
+  unsigned short
+      scale; //< Bit n is set if the scale contains the note n semitones above the root. 0 for major
+  unsigned char
+      row_offset; //< How far each row is above the row below, in scale degrees when in key and semitones otherwise (5 is fourths). 0 for 3 in key and 5 chromatic
+  signed char
+      octave; //< (-1-9) The octave of the root on the bottom left pad, where the root note is (octave + 1) * 12 + root
+  unsigned char root_color;  //< (0-127) The palette index of pads that play the root
+  unsigned char scale_color; //< (0-127) The palette index of pads that play other notes of the scale
+  unsigned char
+      other_color; //< (0-127) The palette index of pads that play notes outside the scale. Alternate drum blocks are lit with it
+} LibPushPadLayout;
+
 /// All of Push's buttons
 typedef enum LibPushButton {
   LP_PLAY_BTN = 85,
@@ -98,6 +133,10 @@ typedef struct LibPushButtonEvent {
   LibPushButtonEventType event_type;
   LibPushButton button;
   int index; //< (0-7) Only relevant for buttons with type LP_DISPLAY_TOP, LP_DISPLAY_BOTTOM, or LP_SCENE_BTN
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the message that caused the event arrived
+  unsigned long long
+      dispatch_timestamp; //< Monotonic time in nanoseconds when the event was dispatched
 } LibPushButtonEvent;
 typedef void (*LibPushButtonCallback)(LibPushButtonEvent event, void *context);
 
@@ -113,6 +152,10 @@ typedef struct LibPushEncoderEvent {
   int index; //< (0-10) Encoders are indexed from left to right
   double
       delta; //< (-1.0 - 1.0) A full turn to the right has been made when the accumulated delta value is approximately 1. Only relevant for the LP_ENCODER_MOVED event type.
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the message that caused the event arrived
+  unsigned long long
+      dispatch_timestamp; //< Monotonic time in nanoseconds when the event was dispatched
 } LibPushEncoderEvent;
 
 typedef void (*LibPushEncoderCallback)(LibPushEncoderEvent event,
@@ -128,6 +171,10 @@ typedef enum LibPushTouchStripEventType {
 typedef struct LibPushTouchStripEvent {
   LibPushTouchStripEventType event_type;
   double position;
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the message that caused the event arrived
+  unsigned long long
+      dispatch_timestamp; //< Monotonic time in nanoseconds when the event was dispatched
 } LibPushTouchStripEvent;
 typedef void (*LibPushTouchStripCallback)(LibPushTouchStripEvent event,
                                           void *context);
@@ -154,10 +201,227 @@ typedef enum LibPushPedalContact {
 typedef struct LibPushPedalEvent {
   LibPushPedalContact contact;
   double value; //< (0-1)
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the message that caused the event arrived
+  unsigned long long
+      dispatch_timestamp; //< Monotonic time in nanoseconds when the event was dispatched
 } LibPushPedalEvent;
 
 typedef void (*LibPushPedalCallback)(LibPushPedalEvent event, void *context);
 
+typedef enum LibPushGestureType {
+  LP_GESTURE_DOUBLE_TAP = 0, //< A second press soon after the first
+  LP_GESTURE_LONG_PRESS = 1, //< A press held for a while
+  LP_GESTURE_REPEAT = 2,     //< Fired repeatedly while a press is held
+  LP_GESTURE_CHORD = 3,      //< Several pads pressed at about the same time
+} LibPushGestureType;
+
+typedef enum LibPushGestureSource {
+  LP_GESTURE_PAD = 0,
+  LP_GESTURE_BUTTON = 1,
+} LibPushGestureSource;
+
+/// Event synthesized from pad and button events, see libpush_set_gesture_config
+typedef struct LibPushGestureEvent {
+  LibPushGestureType event_type;
+  LibPushGestureSource source;
+  unsigned int x; //< (0-7) The pad, for pad gestures other than chords
+  unsigned int y; //< (0-7) The pad, for pad gestures other than chords
+  LibPushButton button; //< The button, for button gestures
+  int index; //< (0-7) Only relevant for buttons in a row, see LibPushButtonEvent
+  unsigned long long
+      pads; //< Mask of (1 << (y * 8 + x)) for the pad of a pad gesture, or the pads held in a chord
+  unsigned int repeat; //< The number of repeats so far, starting at 1
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the press that completed the gesture arrived, or when its timeout expired
+  unsigned long long
+      dispatch_timestamp; //< Monotonic time in nanoseconds when the event was dispatched
+} LibPushGestureEvent;
+
+typedef void (*LibPushGestureCallback)(LibPushGestureEvent event,
+                                       void *context);
+
+/// Selects the gestures that are recognized and their timing
+typedef struct LibPushGestureConfig {
+  unsigned int
+      gestures; //< Mask of (1 << gesture type) for the gestures to recognize, 0 to stop recognizing gestures
+  unsigned int double_tap_ms; //< The longest time between the presses of a double tap
+  unsigned int long_press_ms; //< How long a press is held before it's a long press
+  unsigned int repeat_delay_ms; //< How long a press is held before it starts repeating
+  unsigned int repeat_interval_ms; //< The time between repeats
+  unsigned int
+      chord_ms; //< The longest time between the first and last press of a chord
+  unsigned long long
+      pads; //< Mask of (1 << (y * 8 + x)) for the pads to recognize gestures on, 0 for all
+  unsigned long long buttons
+      [2]; //< Mask of the buttons to recognize gestures on, 0 for all. Button b is bit (b % 64) of buttons[b / 64]
+} LibPushGestureConfig;
+
+typedef enum LibPushEventType {
+  LP_PAD_EVENT = 0,
+  LP_BUTTON_EVENT = 1,
+  LP_ENCODER_EVENT = 2,
+  LP_TOUCH_STRIP_EVENT = 3,
+  LP_PEDAL_EVENT = 4,
+  LP_GESTURE_EVENT = 5,
+} LibPushEventType;
+
+/// An event of any type, as delivered by libpush_poll_events
+///
+/// \notes Only the member that corresponds to type is valid
+typedef struct LibPushEvent {
+  LibPushEventType type;
+  union {
+    LibPushPadEvent pad;
+    LibPushButtonEvent button;
+    LibPushEncoderEvent encoder;
+    LibPushTouchStripEvent touch_strip;
+    LibPushPedalEvent pedal;
+    LibPushGestureEvent gesture;
+  };
+} LibPushEvent;
+
+/// The current state of Push's controls, as seen by libpush_get_state_snapshot
+///
+/// \notes Masks use the same bit layout as LibPushEventFilter
+typedef struct LibPushControllerState {
+  unsigned long long
+      sequence; //< Increases with every update, so unchanged snapshots can be skipped
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the message behind the last update arrived
+  unsigned long long pads_held; //< Mask of (1 << (y * 8 + x)) for the pads being held
+  unsigned char pad_pressure
+      [LIBPUSH_PAD_MATRIX_DIM]
+      [LIBPUSH_PAD_MATRIX_DIM]; //< [y][x] The velocity of the press, then the latest aftertouch. 0 when not held
+  unsigned long long buttons_held
+      [2]; //< Button b is bit (b % 64) of buttons_held[b / 64]. Set for a row of buttons if any button in the row is held
+  unsigned char display_top_buttons_held;    //< Mask of (1 << index)
+  unsigned char display_bottom_buttons_held; //< Mask of (1 << index)
+  unsigned char scene_buttons_held;          //< Mask of (1 << index)
+  bool touch_strip_touched;
+  double touch_strip_position; //< (-1 - 1) The last position touched
+  unsigned int encoders_touched; //< Mask of (1 << index)
+  double encoder_positions
+      [LIBPUSH_ENCODERS]; //< The sum of each encoder's deltas since connecting
+  double pedal_values[LIBPUSH_PEDAL_CONTACTS]; //< (0-1) Indexed by LibPushPedalContact
+} LibPushControllerState;
+
+/// Selects which events a callback receives
+///
+/// \notes A zero mask matches everything, so a zero-initialized filter matches all events.
+/// Masks that don't apply to a callback's kind of event are ignored
+typedef struct LibPushEventFilter {
+  unsigned int
+      event_types; //< Mask of (1 << event_type) for the event types to receive. Pedal events have no type and always match
+  unsigned long long
+      pads; //< Mask of (1 << (y * 8 + x)) for the pads to receive events from, see libpush_pad_region. Chords match if any of their pads match
+  unsigned long long buttons
+      [2]; //< Mask of the buttons to receive events from, button b is bit (b % 64) of buttons[b / 64]
+  unsigned int
+      encoders; //< Mask of (1 << index) for the encoders to receive events from
+} LibPushEventFilter;
+
+#define LIBPUSH_LATENCY_BUCKETS 32
+
+/// The distribution of input latency for one type of event,
+/// measured from the arrival of a message to the return of the last callback
+///
+/// \notes Bucket i counts events with a latency in [2^i, 2^(i+1)) nanoseconds.
+/// The last bucket also counts all longer latencies.
+/// When callbacks run on worker threads, latency is measured on the worker, until the event's last
+/// callback returns. Events whose last call is dropped because the worker fell behind aren't counted
+typedef struct LibPushLatencyHistogram {
+  unsigned long long buckets[LIBPUSH_LATENCY_BUCKETS];
+  unsigned long long count;    //< The number of events measured
+  unsigned long long total_ns; //< The sum of all latencies
+  unsigned long long max_ns;   //< The longest latency
+} LibPushLatencyHistogram;
+
+/// Describes a callback that took longer than the callback budget
+typedef struct LibPushSlowCallbackReport {
+  int token; //< The token returned when the callback was registered
+  LibPushEventType event_type;
+  unsigned long long duration_ns; //< How long the callback took, or has run so far if it's still running
+  unsigned long long budget_ns;   //< The budget at the time
+  bool running; //< Whether the callback hadn't returned yet. It's reported again when it returns
+} LibPushSlowCallbackReport;
+
+typedef void (*LibPushSlowCallbackHandler)(LibPushSlowCallbackReport report,
+                                           void *context);
+
+/// Counters kept by the callback watchdog
+typedef struct LibPushWatchdogStats {
+  unsigned long long callbacks;      //< The number of callbacks measured
+  unsigned long long slow_callbacks; //< The number of callbacks over budget
+  unsigned long long
+      stall_ns; //< The total time that callbacks ran over budget, delaying the events after them
+  unsigned long long max_duration_ns; //< The longest time a callback took
+  unsigned long long
+      hung_callbacks; //< Callbacks on a worker found still running past the budget
+  unsigned long long
+      dropped_callbacks; //< Calls dropped because their worker's queue was full
+} LibPushWatchdogStats;
+
+/// A continuous input that can be conditioned, see libpush_set_signal_conditioning
+typedef enum LibPushSignal {
+  LP_SIGNAL_AFTERTOUCH = 0,  //< Polyphonic aftertouch, per pad
+  LP_SIGNAL_TOUCH_STRIP = 1, //< Touch strip position
+  LP_SIGNAL_PEDAL = 2,       //< Pedal values, per contact
+} LibPushSignal;
+
+#define LIBPUSH_SIGNALS 3
+
+/// The filters applied to a signal, in the order they are listed
+///
+/// \notes Amounts are in the units of the signal's value: (0-1) for aftertouch pressure and pedals,
+/// (-1 - 1) for the touch strip
+typedef struct LibPushSignalConfig {
+  bool enabled; //< Whether to condition the signal. When disabled, every event is delivered as decoded
+  double
+      min_cutoff_hz; //< One-Euro filter cutoff frequency at rest, or 0 for no smoothing. Lower is smoother but lags more
+  double
+      beta; //< How much the cutoff rises with speed, reducing lag on fast moves. 0 makes the filter a plain EMA
+  double derivative_cutoff_hz; //< Cutoff for the speed estimate, 1 if 0
+  double max_rate; //< The largest change per second, or 0 for no limit
+  double hysteresis; //< The change needed to reverse the direction of the value
+  double deadband; //< Smaller changes from the last delivered value are dropped
+} LibPushSignalConfig;
+
+#define LIBPUSH_PARAMETERS 64
+
+/// How an encoder's position maps to the value of a parameter
+typedef enum LibPushParameterCurve {
+  LP_CURVE_LINEAR = 0,
+  LP_CURVE_EXPONENTIAL = 1, //< Equal turns multiply the value by equal ratios, e.g. for frequencies. Requires a positive range
+} LibPushParameterCurve;
+
+/// Connects an encoder to a parameter, see libpush_bind_encoder
+typedef struct LibPushEncoderBinding {
+  int parameter; //< (0-63) The parameter the encoder changes, or -1 to unbind it
+  double min;    //< The value at the start of the range
+  double max;    //< The value at the end of the range
+  LibPushParameterCurve curve;
+  double turns; //< The number of full turns that sweep the whole range, 1 if 0
+  double
+      acceleration; //< How much the change grows with speed: a turn per second changes the value (1 + acceleration) times as much. 0 for none
+  double fine_scale; //< Scales changes while Shift is held, e.g. 0.1. 1 if 0
+} LibPushEncoderBinding;
+
+/// The new value of a parameter, see libpush_set_parameter_notifications
+typedef struct LibPushParameterChange {
+  int parameter;
+  double value;
+} LibPushParameterChange;
+
+typedef void (*LibPushParameterCallback)(const LibPushParameterChange *changes,
+                                         size_t count, void *context);
+
+/// What the event queue does with a new event when it is full
+typedef enum LibPushQueueOverflow {
+  LP_DROP_OLDEST = 0, //< Overwrite the oldest unread event
+  LP_DROP_NEWEST = 1, //< Discard the new event
+} LibPushQueueOverflow;
+
 typedef struct LibPushPedalSampleData {
   unsigned short pedal_1_ring;
   unsigned short pedal_1_tip;
@@ -165,6 +429,68 @@ typedef struct LibPushPedalSampleData {
   unsigned short pedal_2_tip;
 } LibPushPedalSampleData;
 
+#define LIBPUSH_PEDAL_SAMPLE_CHANNELS 4
+#define LIBPUSH_PEDAL_SAMPLE_RANGE 4096
+
+/// Maps raw pedal readings to values, see libpush_set_pedal_calibration
+typedef struct LibPushPedalCalibration {
+  unsigned short
+      heel_down; //< (0-4095) The raw reading with the pedal all the way up
+  unsigned short
+      toe_down; //< (0-4095) The raw reading with the pedal all the way down
+  double
+      curve; //< The exponent applied to the calibrated position: 1 is linear, above 1 changes slowly at first. 1 if 0
+} LibPushPedalCalibration;
+
+/// A calibrated reading of all pedal inputs, see libpush_start_pedal_sampling
+typedef struct LibPushPedalSample {
+  float values
+      [LIBPUSH_PEDAL_SAMPLE_CHANNELS]; //< (0-1) In the order of LibPushPedalSampleData
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds when the reading arrived
+} LibPushPedalSample;
+
+#define LIBPUSH_MAX_VOICES 64
+#define LIBPUSH_MPE_MAX_VOICES 15
+
+/// What happened to a voice, see libpush_enable_voice_tracking
+typedef enum LibPushVoiceUpdateType {
+  LP_VOICE_ON = 0,       //< A pad was pressed and assigned a voice
+  LP_VOICE_PRESSURE = 1, //< The pressure of a held voice changed
+  LP_VOICE_OFF = 2, //< The pad was released, or its voice was stolen by a new press
+} LibPushVoiceUpdateType;
+
+typedef struct LibPushVoiceUpdate {
+  LibPushVoiceUpdateType update_type;
+  unsigned int
+      voice_id; //< Identifies the voice from its onset to its release. Never 0 and not reused
+  unsigned char
+      slot; //< (0 - max_voices-1) The slot the voice plays in. In MPE form its channel is slot + 1
+  unsigned char x;        //< (0-7) The column of the pad that plays the voice
+  unsigned char y;        //< (0-7) The row of the pad that plays the voice
+  unsigned char note;     //< (0-127) The note the pad played when the voice started
+  unsigned char velocity; //< (0-127) The velocity the voice started with
+  double pressure;        //< (0-1) The current pressure of the pad
+  unsigned long long
+      onset_timestamp; //< Monotonic time in nanoseconds when the voice started
+  unsigned long long
+      release_timestamp; //< Monotonic time in nanoseconds when the voice ended, 0 while it is held
+  unsigned long long
+      timestamp; //< Monotonic time in nanoseconds of the input that caused the update
+  unsigned char mpe
+      [3]; //< In MPE form, the message for the update on the voice's channel: a note on, channel pressure or note off
+  unsigned char mpe_length; //< The length of the message in mpe, 0 if MPE form isn't enabled
+} LibPushVoiceUpdate;
+
+/// Which input to forward and how, see libpush_start_forwarding
+typedef struct LibPushForwardingConfig {
+  unsigned int
+      sources; //< Bit n is set to forward events of LibPushEventType n. Pad, encoder and touch strip events can be forwarded
+  unsigned char channel; //< (0-15) The MIDI channel of forwarded messages
+  unsigned char
+      encoder_cc; //< The cc number of the first encoder. Turns are sent as relative (two's complement) values
+} LibPushForwardingConfig;
+
 typedef struct LibPushLedColor {
   unsigned char r; //< Red (0-255)
   unsigned char g; //< Green (0-255)
@@ -172,6 +498,13 @@ typedef struct LibPushLedColor {
   unsigned char w; //< White (0-255)
 } LibPushLedColor;
 
+/// \param color_index The index of the palette entry
+/// \param color The color of the entry
+/// \param replied false if Push didn't reply in time, in which case color is zeroed
+typedef void (*LibPushPaletteEntryCallback)(unsigned char color_index,
+                                            LibPushLedColor color,
+                                            bool replied, void *context);
+
 /// Leds can be set to one of the following animations
 typedef enum LibPushLedAnimationType {
   LP_NO_TRANSITION = 0,
@@ -194,6 +527,22 @@ typedef struct LibPushLedAnimation {
   LibPushLedAnimationDuration duration;
 } LibPushLedAnimation;
 
+/// What a reflex led shows when its pad or button is released
+typedef enum LibPushReflexRelease {
+  LP_REFLEX_RESTORE = 0, //< The color the led was last set to, or off if it was never set
+  LP_REFLEX_SET = 1      //< release_color, which becomes the led's color
+} LibPushReflexRelease;
+
+/// Led feedback that the library shows as soon as a pad or button is pressed,
+/// without waiting for the application
+typedef struct LibPushLedReflex {
+  bool enabled; //< Whether presses change the led. When disabled, the led only shows the colors it is set to
+  unsigned char press_color; //< (0-127) The index of the color in the palette to show while pressed
+  LibPushLedAnimation press_animation; //< The animation to show while pressed
+  LibPushReflexRelease release; //< What to show when released
+  unsigned char release_color; //< (0-127) The color to show when released, for LP_REFLEX_SET
+} LibPushLedReflex;
+
 typedef enum LibPushMidiMode {
   LP_LIVE_MODE = 0,
   LP_USER_MODE = 1,
@@ -210,6 +559,42 @@ typedef struct LibPushStats {
   int uptime; //< Time since last reboot in seconds
 } LibPushStats;
 
+/// How often the library answered getters from its cache of Push's settings,
+/// see libpush_get_settings_cache_stats
+typedef struct LibPushSettingsCacheStats {
+  unsigned long long hits; //< Getter calls answered from the cache
+  unsigned long long misses; //< Getter calls that read the setting from Push
+  unsigned long long writes; //< Settings written to Push
+  unsigned long long
+      skipped_writes; //< Settings not written because Push already has the value
+} LibPushSettingsCacheStats;
+
+/// Rates of random input traffic generated by a simulated device
+///
+/// \notes A rate of 0 disables that kind of traffic
+typedef struct LibPushSimulatorConfig {
+  unsigned int pad_rate; //< Pad presses, releases and aftertouch per second
+  unsigned int encoder_rate; //< Encoder turns and touches per second
+  unsigned int button_rate; //< Button presses and releases per second
+  unsigned int touch_strip_rate; //< Touch strip movements per second
+  unsigned int seed; //< Seed for the random traffic generator
+} LibPushSimulatorConfig;
+
+typedef struct LibPushSimulatorStats {
+  unsigned long long messages_generated; //< Input messages sent to the host
+  unsigned long long sysex_commands; //< Sysex commands received from the host
+  unsigned long long
+      unknown_commands; //< Sysex commands the simulated device doesn't recognize
+  unsigned long long frames_received; //< Valid display frames received
+  unsigned long long
+      invalid_frames; //< Display transfers with a bad header, length or encoding
+  unsigned long long led_messages; //< Led color messages received from the host
+  unsigned long long
+      midi_writes; //< MIDI writes received from the host, which can hold several sysex messages
+  unsigned long long
+      forwarded_messages; //< Messages received by the forwarding output, see libpush_start_forwarding
+} LibPushSimulatorStats;
+
 /// Initialize libpush and attempt to connect to Push
 ///
 /// \param port the port to use for MIDI communication (Live or User)
@@ -219,6 +604,41 @@ typedef struct LibPushStats {
 /// \requires libpush is not already connected to Push
 EXPORTED bool libpush_connect(LibPushPort port);
 
+/// Initialize libpush and connect to a simulated Push
+///
+/// \returns true if the connection is made, false otherwise
+/// \effects Allows other libpush functions to be called without a physical Push.
+/// The simulated device answers sysex commands from its own model of Push's settings
+/// and validates frames drawn to the display
+/// \requires libpush is not already connected to Push
+EXPORTED bool libpush_connect_simulated();
+
+/// \param cfg The rates of random input traffic the simulated device should generate
+/// \effects Replaces any random traffic that is currently being generated
+/// \requires libpush is connected to a simulated Push
+EXPORTED void libpush_set_simulated_traffic(LibPushSimulatorConfig cfg);
+
+/// \param messages count 3 byte MIDI messages to send from the simulated device
+/// \param count The number of messages
+/// \param rate Messages per second, or 0 to send them as fast as possible
+/// \param loop Whether to start over when the end of the script is reached
+/// \effects Replaces any script that is currently playing
+/// \requires libpush is connected to a simulated Push
+EXPORTED void libpush_play_simulated_script(const unsigned char *messages,
+                                            size_t count, unsigned int rate,
+                                            bool loop);
+
+/// \param message The bytes of a MIDI message to send from the simulated device
+/// \param length The number of bytes in message
+/// \effects Handles the message on the calling thread as if Push had sent it
+/// \requires libpush is connected to a simulated Push
+EXPORTED void libpush_inject_simulated_message(const unsigned char *message,
+                                               size_t length);
+
+/// \returns Counters describing what the simulated device has received and sent
+/// \requires libpush is connected to a simulated Push
+EXPORTED LibPushSimulatorStats libpush_get_simulator_stats();
+
 /// Disconnect and cleanup
 ///
 /// \effects Disconnects from Push and cleans up after libpush
@@ -240,25 +660,329 @@ EXPORTED void libpush_set_display_brightness(unsigned char brightness);
 EXPORTED unsigned char libpush_get_display_brightness();
 
 /// \effects Registers a function to be called when a pad is pressed, released, or aftertouch data is received
-EXPORTED void libpush_register_pad_callback(LibPushPadCallback cb,
-                                            void *context);
+/// \returns A token that identifies the callback, or -1 if it can't be registered
+EXPORTED int libpush_register_pad_callback(LibPushPadCallback cb,
+                                           void *context);
 
 /// \effects Registers a function to be called when a button is pressed or released
-EXPORTED void libpush_register_button_callback(LibPushButtonCallback cb,
-                                               void *context);
+/// \returns A token that identifies the callback, or -1 if it can't be registered
+EXPORTED int libpush_register_button_callback(LibPushButtonCallback cb,
+                                              void *context);
 
 /// \effects Registers a function to be called when an encoder is turned
-EXPORTED void libpush_register_encoder_callback(LibPushEncoderCallback cb,
-                                                void *context);
+/// \returns A token that identifies the callback, or -1 if it can't be registered
+EXPORTED int libpush_register_encoder_callback(LibPushEncoderCallback cb,
+                                               void *context);
 
 /// \effects Registers a function to be called when the touch strip is pressed, moved, or released
-EXPORTED void
+/// \returns A token that identifies the callback, or -1 if it can't be registered
+EXPORTED int
 libpush_register_touch_strip_callback(LibPushTouchStripCallback cb,
                                       void *context);
 
 /// \effects Registers a function to be called when Push gets new pedal data
-EXPORTED void libpush_register_pedal_callback(LibPushPedalCallback cb,
-                                              void *context);
+/// \returns A token that identifies the callback, or -1 if it can't be registered
+EXPORTED int libpush_register_pedal_callback(LibPushPedalCallback cb,
+                                             void *context);
+
+/// \effects Registers a function to be called when a gesture is recognized, see libpush_set_gesture_config
+/// \returns A token that identifies the callback, or -1 if it can't be registered
+EXPORTED int libpush_register_gesture_callback(LibPushGestureCallback cb,
+                                               void *context);
+
+/// Recognize gestures from pad and button input
+///
+/// \param cfg The gestures to recognize and their timing
+/// \effects Gesture events are delivered through callbacks and the event queue like other events.
+/// Double taps are delivered right after the press that completes them. Long presses, repeats
+/// and chords are delivered from a background thread when their timeout expires, with a resolution of 1 ms
+/// \notes All pending timeouts share a single timer wheel, so the cost of an input event doesn't grow
+/// with the number of pads and buttons being held
+EXPORTED void libpush_set_gesture_config(LibPushGestureConfig cfg);
+
+/// \param token A token returned when registering a callback
+/// \param filter The events the callback should receive
+/// \returns false if token doesn't identify a registered callback
+/// \effects The callback is only called for events that match filter
+EXPORTED bool libpush_set_callback_filter(int token, LibPushEventFilter filter);
+
+/// \param token A token returned when registering a callback
+/// \returns false if token doesn't identify a registered callback
+/// \effects The callback won't be called for any event that is dispatched after this returns
+/// \notes Can be called from within a callback
+EXPORTED bool libpush_unregister_callback(int token);
+
+/// \param x1 (0-7) The x coordinate of one corner of the region
+/// \param y1 (0-7) The y coordinate of one corner of the region
+/// \param x2 (0-7) The x coordinate of the opposite corner of the region
+/// \param y2 (0-7) The y coordinate of the opposite corner of the region
+/// \returns A mask of the pads in the rectangle, for use in LibPushEventFilter::pads
+EXPORTED unsigned long long libpush_pad_region(unsigned char x1,
+                                               unsigned char y1,
+                                               unsigned char x2,
+                                               unsigned char y2);
+
+/// Run callbacks on a pool of worker threads instead of the MIDI input thread
+///
+/// \param workers The number of worker threads, or 0 to run callbacks on the MIDI input thread
+/// \param queue_capacity The number of callbacks that can wait for each worker
+/// \returns true if the workers were started
+/// \effects Events from the same source (e.g. one pad or one encoder) are always handled by the same
+/// worker, so their callbacks are called in order. When a worker's queue is full, the call is dropped
+/// and counted in libpush_get_watchdog_stats, so input handling never waits for a worker.
+/// Callbacks already waiting are run before the previous workers stop
+/// \notes Unregistering a callback doesn't remove calls to it that are already waiting.
+/// Must not be called from within a callback
+EXPORTED bool libpush_set_callback_workers(unsigned int workers,
+                                           size_t queue_capacity);
+
+/// Measure how long each callback takes
+///
+/// \param budget_ns The longest a callback should take, or 0 to stop measuring
+/// \param handler Called after each callback that took longer than budget_ns, or NULL
+/// \param context A pointer passed to handler
+/// \notes handler is called on the thread that ran the slow callback. Callbacks on workers are
+/// also checked while they run, so a callback that never returns is reported from a watchdog thread.
+/// handler must not change the budget when it's called from the watchdog thread
+EXPORTED void libpush_set_callback_budget(unsigned long long budget_ns,
+                                          LibPushSlowCallbackHandler handler,
+                                          void *context);
+
+/// \returns The counters of the callback watchdog
+EXPORTED LibPushWatchdogStats libpush_get_watchdog_stats();
+
+/// Filter a continuous input before it is delivered
+///
+/// \param signal The input to condition
+/// \param cfg The filters to apply
+/// \effects Each pad, the touch strip and each pedal contact is filtered separately. Events whose value
+/// doesn't change after filtering are dropped before they reach the state, callbacks or the event queue.
+/// Values at the ends of the range always pass the deadband and hysteresis, and aren't smoothed.
+/// Presses and releases restart the filters of their source and are never dropped
+/// \notes Filters run when an event arrives, so a smoothed or rate limited value catches up with the next event
+EXPORTED void libpush_set_signal_conditioning(LibPushSignal signal,
+                                              LibPushSignalConfig cfg);
+
+/// \returns The number of events dropped by signal conditioning since connecting
+EXPORTED unsigned long long libpush_get_conditioned_drop_count();
+
+/// \param encoder (0-10) The encoder to bind
+/// \param binding The parameter the encoder changes and how
+/// \returns false if the encoder or parameter is out of range
+/// \effects Turns of the encoder are applied to the parameter on the MIDI input thread,
+/// whether or not any callbacks are registered. The parameter is clamped into the new range.
+/// Several encoders can change the same parameter
+EXPORTED bool libpush_bind_encoder(int encoder, LibPushEncoderBinding binding);
+
+/// \param parameter (0-63) The parameter to read
+/// \returns The current value of the parameter, or 0 if it's out of range
+/// \notes Doesn't lock or allocate, so it can be called from real-time threads such as an audio callback
+EXPORTED double libpush_get_parameter(int parameter);
+
+/// \param parameter (0-63) The parameter to change
+/// \param value The new value
+/// \notes Doesn't lock or allocate. Encoders bound to the parameter continue from the new value
+EXPORTED void libpush_set_parameter(int parameter, double value);
+
+/// \returns A mask of (1 << parameter) for the parameters that changed since the last call
+/// \notes Shares the record of changes with libpush_set_parameter_notifications
+EXPORTED unsigned long long libpush_take_parameter_changes();
+
+/// Receive changed parameters in batches, e.g. once per frame
+///
+/// \param cb Called with the parameters that changed since the last call, or NULL to stop notifications
+/// \param context A pointer passed to cb
+/// \param interval_us How often to check for changes
+/// \effects cb is called from a background thread, at most once per interval and only if a parameter changed.
+/// A parameter that changed several times in an interval is reported once, with its latest value
+EXPORTED void libpush_set_parameter_notifications(LibPushParameterCallback cb,
+                                                  void *context,
+                                                  unsigned int interval_us);
+
+/// Sample the pedal inputs in the background
+///
+/// \param rate_hz (1-1000000) How many times per second to sample
+/// \param sample_size (0-19) log2 of the number of readings Push averages for each sample
+/// \param capacity The number of samples that can wait to be read
+/// \returns true if sampling started
+/// \effects Requests pedal data from a background thread, calibrates it and writes it to a lock-free
+/// ring buffer that can be read with libpush_read_pedal_samples. Samples that don't fit are dropped.
+/// Replaces any running sampler
+EXPORTED bool libpush_start_pedal_sampling(unsigned int rate_hz,
+                                           unsigned char sample_size,
+                                           size_t capacity);
+
+/// \returns The number of samples that were dropped because the ring buffer was full
+/// \effects Stops sampling. Samples that weren't read are discarded
+EXPORTED unsigned long long libpush_stop_pedal_sampling();
+
+/// \param out An array to copy samples into
+/// \param max The number of samples out can hold
+/// \returns The number of samples copied into out, oldest first
+/// \notes Doesn't lock or allocate. Only one thread should read samples at a time
+EXPORTED size_t libpush_read_pedal_samples(LibPushPedalSample *out, size_t max);
+
+/// \param channel (0-3) The pedal input, in the order of LibPushPedalSampleData
+/// \param calibration How to map the input's raw readings to values
+/// \effects Precomputes the value of every raw reading. Applies to samples taken after this returns
+EXPORTED void
+libpush_set_pedal_calibration(unsigned int channel,
+                              LibPushPedalCalibration calibration);
+
+/// Track pad presses as voices for polyphonic aftertouch
+///
+/// \param max_voices (1-64) How many voices can play at once, at most 15 in MPE form
+/// \param mpe Whether updates should also carry MPE messages, with a channel per voice (MIDI channels 2-16)
+/// \param capacity The number of updates that can wait to be read, at least twice max_voices
+/// \returns true if voice tracking started
+/// \effects Every press of a pad that plays a note is assigned a free voice, or steals the oldest voice if none is free.
+/// Voice starts, pressure changes and releases are written to a lock-free ring buffer that can be read
+/// with libpush_read_voice_updates. Starts and pressure changes that don't fit are dropped, but room is
+/// kept for the release of every voice whose start was written, so no voice is left hanging.
+/// Replaces any running tracker
+/// \notes Pressure changes are only received in LP_POLYPHONIC aftertouch mode
+EXPORTED bool libpush_enable_voice_tracking(unsigned int max_voices, bool mpe,
+                                            size_t capacity);
+
+/// \effects Stops tracking voices. Updates that haven't been read can still be read
+EXPORTED void libpush_disable_voice_tracking();
+
+/// \param out An array to copy updates into
+/// \param max The number of updates out can hold
+/// \returns The number of updates copied into out, oldest first
+/// \notes Doesn't lock or allocate, so it can be called from an audio callback.
+/// Only one thread should read updates at a time
+EXPORTED size_t libpush_read_voice_updates(LibPushVoiceUpdate *out, size_t max);
+
+/// \returns The number of voice updates dropped because the buffer was full
+EXPORTED unsigned long long libpush_get_dropped_voice_update_count();
+
+/// Forward input to another MIDI port from the input thread
+///
+/// \param port_name Part of the name of the output port to open, or the name of the virtual port to create.
+/// Ignored when simulating, where messages are looped back to the simulated device
+/// \param virtual_port Whether to create a virtual port that other applications can connect to
+/// \param cfg Which input to forward and how
+/// \returns true if forwarding started
+/// \effects Pad presses and releases are sent as notes from the current pad layout, aftertouch as
+/// polyphonic aftertouch, encoder turns as relative cc and touch strip moves as pitch bend.
+/// Messages are written as soon as input is decoded, before callbacks run, without allocating.
+/// Replaces any running forwarding
+EXPORTED bool libpush_start_forwarding(const char *port_name,
+                                       bool virtual_port,
+                                       LibPushForwardingConfig cfg);
+
+/// \effects Stops forwarding, after sending note offs for forwarded notes that are still held
+EXPORTED void libpush_stop_forwarding();
+
+/// \returns The latency of forwarded messages, from the arrival of the input to the return of the write
+EXPORTED LibPushLatencyHistogram libpush_get_forwarding_latency();
+
+/// \returns A consistent copy of the current state of Push's controls
+/// \notes Doesn't lock or allocate, so it can be called from real-time threads such as an audio callback.
+/// The state is kept up to date whether or not any callbacks are registered
+EXPORTED LibPushControllerState libpush_get_state_snapshot();
+
+/// \returns The current monotonic time in nanoseconds, on the same clock as event timestamps
+EXPORTED unsigned long long libpush_get_time_ns();
+
+/// \param type The type of event
+/// \returns The input latency distribution for events of that type since connecting or the last reset
+EXPORTED LibPushLatencyHistogram
+libpush_get_input_latency(LibPushEventType type);
+
+/// \effects Clears the input latency histograms of all event types and the forwarding latency histogram
+EXPORTED void libpush_reset_input_latency();
+
+/// Merge continuous events instead of delivering each one
+///
+/// \param enabled Whether to coalesce events
+/// \param interval_us How often pending events are flushed from a background thread,
+/// or 0 to only flush them with libpush_flush_coalesced_events
+/// \effects While enabled, encoder turns are summed per encoder and only the latest
+/// polyphonic aftertouch per pad and touch strip position are kept until the next flush.
+/// Presses, touches and releases are delivered immediately, after any pending events of the same kind
+/// \notes Flushed events are delivered from the flushing thread. Callbacks for one kind of event
+/// are never called concurrently
+EXPORTED void libpush_set_event_coalescing(bool enabled,
+                                           unsigned int interval_us);
+
+/// \effects Delivers all pending coalesced events, e.g. once per frame of the application
+EXPORTED void libpush_flush_coalesced_events();
+
+/// \param path The file to record to
+/// \returns true if recording started
+/// \effects Appends every raw MIDI message received from Push, with its arrival time, to a compact
+/// binary file. Messages are written from a background thread. Replaces any running recording
+EXPORTED bool libpush_start_input_recording(const char *path);
+
+/// \returns The number of messages that were dropped because the writer fell behind
+/// \effects Writes all remaining messages and closes the recording
+EXPORTED unsigned long long libpush_stop_input_recording();
+
+/// \param path A file written by libpush_start_input_recording
+/// \param original_timing Whether to keep the time between messages, or replay them as fast as possible
+/// \returns The number of messages replayed, or -1 if the recording can't be read
+/// or the library isn't connected with libpush_connect_simulated
+/// \effects Passes each message to the library as if Push had just sent it. Callbacks are called on the calling thread.
+/// Messages are injected into the simulator, so they are never handled at the same time as simulated input
+EXPORTED long long libpush_replay_input_recording(const char *path,
+                                                  bool original_timing);
+
+/// Queue events for polling instead of (or in addition to) receiving them through callbacks
+///
+/// \param capacity The number of events the queue can hold, rounded up to a power of 2
+/// \param overflow What to do with new events when a cursor has capacity unread events
+/// \returns true if the queue was enabled
+/// \effects Pad, button, encoder, touch strip, pedal and gesture events are written to a lock-free queue
+/// that can be read with libpush_poll_events from any thread. Replaces any previously enabled queue
+EXPORTED bool libpush_enable_event_queue(size_t capacity,
+                                         LibPushQueueOverflow overflow);
+
+/// \effects Stops queueing events
+EXPORTED void libpush_disable_event_queue();
+
+/// \param out An array to copy events into
+/// \param max The number of events out can hold
+/// \returns The number of events copied into out, oldest first
+/// \effects Reads events from the queue's default cursor
+/// \requires The event queue is enabled. Only one thread polls a cursor at a time
+EXPORTED size_t libpush_poll_events(LibPushEvent *out, size_t max);
+
+/// Add an independent reader of the event queue
+///
+/// \returns The id of a new cursor that will read events from now on, or -1 if none are available
+/// \requires The event queue is enabled
+EXPORTED int libpush_add_event_cursor();
+
+/// \param cursor A cursor returned by libpush_add_event_cursor
+/// \effects The cursor stops reading events and its id can be reused
+EXPORTED void libpush_remove_event_cursor(int cursor);
+
+/// \param cursor A cursor returned by libpush_add_event_cursor
+/// \param out An array to copy events into
+/// \param max The number of events out can hold
+/// \returns The number of events copied into out, oldest first
+/// \requires Only one thread polls a cursor at a time
+EXPORTED size_t libpush_poll_events_for_cursor(int cursor, LibPushEvent *out,
+                                               size_t max);
+
+/// \param cursor A cursor returned by libpush_add_event_cursor, or 0 for the default cursor
+/// \returns The number of events the cursor missed because the queue overflowed
+EXPORTED unsigned long long libpush_get_dropped_event_count(int cursor);
+
+/// \param layout The notes the pads should play and how they should be lit
+/// \returns true if the layout is valid
+/// \effects Compiles the layout into the note and color of every pad and swaps both in at once.
+/// Pad events decoded after this returns carry the notes of the new layout.
+/// Only pads whose color changes are relit
+EXPORTED bool libpush_set_pad_layout(LibPushPadLayout layout);
+
+/// \param x (0-7) The row of the pad
+/// \param y (0-7) The column of the pad
+/// \returns The note the pad plays in the current layout, or -1 if it plays none
+/// \notes Before a layout is set every pad plays its own note number (36-99)
+EXPORTED int libpush_get_pad_note(unsigned char x, unsigned char y);
 
 /// \param x (0-7) The row of the pad
 /// \param y (0-7) The column of the pad
@@ -316,11 +1040,42 @@ libpush_set_global_pad_sensitivity(LibPushPadSensitivity sensitivity);
 EXPORTED LibPushPadSensitivity libpush_get_pad_sensitivity(unsigned char x,
                                                            unsigned char y);
 
+/// \param sensitivities The sensitivity of every pad, indexed [y][x]
+/// \effects Writes only the pads whose sensitivity changes, all in one MIDI write.
+/// When most pads share a sensitivity, every pad is set to it with one command
+/// and only the other pads are set on their own
+EXPORTED void libpush_set_pad_sensitivity_map(
+    const LibPushPadSensitivity (
+        &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]);
+
+/// \param sensitivities Filled with the sensitivity of every pad, indexed [y][x]
+/// \returns false if a pad's sensitivity couldn't be read
+/// \effects Reads the pads that aren't cached with requests that are all sent
+/// before the first reply is waited for, so the map takes about one round trip
+EXPORTED bool libpush_get_pad_sensitivity_map(
+    LibPushPadSensitivity (
+        &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]);
+
 /// \param btn The button to set the color for
 /// \The index of the color in the current color palette
 EXPORTED void libpush_set_button_led_color(LibPushButton btn,
                                            unsigned int color_index);
 
+/// \param pads A bit for each pad to set the reflex for, bit y * 8 + x for the pad at (x, y)
+/// \param reflex What the pads' leds show when they are pressed and released
+/// \effects Presses of the pads change their leds on the MIDI input thread, right after they are decoded.
+/// While a pad is pressed, setting its color takes effect when it is released
+EXPORTED void libpush_set_pad_reflex(unsigned long long pads,
+                                     LibPushLedReflex reflex);
+
+/// \param btn The button to set the reflex for
+/// \param index (0-7) Only relevant for buttons with type LP_DISPLAY_TOP, LP_DISPLAY_BOTTOM, or LP_SCENE_BTN
+/// \param reflex What the button's led shows when it is pressed and released
+/// \returns false if btn and index don't name a button with a led
+/// \effects Presses of the button change its led on the MIDI input thread, right after they are decoded
+EXPORTED bool libpush_set_button_reflex(LibPushButton btn, int index,
+                                        LibPushLedReflex reflex);
+
 /// \param The configuration object
 /// \effects Updates the touch strip according to the configuration flags
 EXPORTED void libpush_set_touch_strip_config(LibPushTouchStripConfig cfg);
@@ -366,6 +1121,19 @@ EXPORTED void libpush_set_pedal_curve_entries(
 /// \effects Sets the palette entry at color_index to color. Change will not be visible until reapply_color_palette is called
 EXPORTED void libpush_set_led_color_palette_entry(unsigned char color_index,
                                                   LibPushLedColor color);
+/// Set consecutive LED color palette entries
+///
+/// \param first (0-127) The index of the first entry to set
+/// \param count The number of entries to set, at most 128 - first
+/// \param colors The color of each entry
+/// \param reapply Whether to reapply the color palette after setting the entries
+/// \effects Sends all the entries in as few MIDI writes as the connection allows,
+/// which is much faster than setting them one at a time
+EXPORTED void
+libpush_set_led_color_palette_entries(unsigned char first, unsigned char count,
+                                      const LibPushLedColor *colors,
+                                      bool reapply);
+
 /// Get an LED color palette entry
 ///
 /// \param color_index (0-127) the idnex of the color entry in the palette to get
@@ -373,6 +1141,29 @@ EXPORTED void libpush_set_led_color_palette_entry(unsigned char color_index,
 EXPORTED LibPushLedColor
 libpush_get_led_color_palette_entry(unsigned char color_index);
 
+/// Get consecutive LED color palette entries
+///
+/// \param first (0-127) The index of the first entry to get
+/// \param count The number of entries to get, at most 128 - first
+/// \param colors Filled with the color of each entry
+/// \returns false if an entry couldn't be read
+/// \effects Sends every request before waiting for the replies, so the whole palette is read in about one round trip
+EXPORTED bool libpush_get_led_color_palette_entries(unsigned char first,
+                                                    unsigned char count,
+                                                    LibPushLedColor *colors);
+
+/// Get an LED color palette entry without waiting for it
+///
+/// \param color_index (0-127) The index of the color entry in the palette to get
+/// \param cb Called with the color of the entry
+/// \param context A pointer passed to cb
+/// \returns false if the request couldn't be sent
+/// \notes cb is called on the MIDI input thread. Many requests can wait for replies at once
+EXPORTED bool
+libpush_get_led_color_palette_entry_async(unsigned char color_index,
+                                          LibPushPaletteEntryCallback cb,
+                                          void *context);
+
 /// Update the color palette to use new colors
 ///
 /// \effects All leds using a palette entry that was set to a different color since the last call to reapply_color_palette will be updated to the new color
@@ -403,6 +1194,34 @@ EXPORTED void libpush_set_midi_mode(LibPushMidiMode mode);
 /// \returns Power supply and uptime information
 EXPORTED LibPushStats libpush_get_statistics(unsigned char run_id);
 
+/// \param timeout_ms How long getters wait for Push to reply. Defaults to 1000
+/// \effects A getter that times out prints an error and returns a zeroed value
+EXPORTED void libpush_set_sysex_reply_timeout(unsigned int timeout_ms);
+
+/// \returns How often getters and setters used the cache of Push's settings since connecting
+/// \notes Getters read a setting from Push only until the library writes or reads it.
+/// Setters don't write values Push already has
+EXPORTED LibPushSettingsCacheStats libpush_get_settings_cache_stats();
+
+/// \effects Forgets the cached settings, so getters read them from Push again
+/// and setters write them even if they're unchanged
+/// \notes Use this if another application may have changed Push's settings
+EXPORTED void libpush_invalidate_settings_cache();
+
+/// \param path The file to save Push's settings to
+/// \returns true if the settings were saved
+/// \effects Saves brightness, white balance, palette, display, aftertouch, pad sensitivity and
+/// touch strip settings, reading from Push those that aren't cached.
+/// Velocity and pedal curves, curve limits, aftertouch range and pwm frequency
+/// can't be read from Push, so they are only saved if they were set since connecting
+EXPORTED bool libpush_save_state(const char *path);
+
+/// \param path A file written by libpush_save_state
+/// \returns The number of settings written to Push, or -1 if the file can't be restored
+/// \effects Writes the saved settings that differ from the cached ones in a single batch,
+/// so restoring settings Push already has writes nothing
+EXPORTED long long libpush_restore_state(const char *path);
+
 #ifdef __cplusplus
 }
 #endif
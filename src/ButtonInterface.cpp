@@ -24,13 +24,54 @@ unordered_set<uint> ButtonInterface::button_numbers = {
     LibPushButton::LP_SELECT_BTN};
 
 ButtonInterface::ButtonInterface(MidiInterface &midi, LedInterface &leds)
-    : leds(leds), listener(ButtonInterface::handle_message) {
+    : leds(leds), listener(*this) {
   midi.register_handler(&this->listener);
 }
 
-void ButtonInterface::register_callback(LibPushButtonCallback cb,
-                                        void *context) {
-  this->listener.register_callback(cb, context);
+int ButtonInterface::register_callback(LibPushButtonCallback cb,
+                                       void *context) {
+  return this->listener.register_callback(cb, context);
+}
+
+bool ButtonInterface::unregister_callback(int token) {
+  return this->listener.unregister_callback(token);
+}
+
+bool ButtonInterface::set_callback_filter(int token,
+                                          const LibPushEventFilter &filter) {
+  return this->listener.set_callback_filter(token, filter);
+}
+
+void ButtonInterface::set_event_queue(EventQueue *queue) {
+  this->listener.set_event_queue(queue);
+}
+
+void ButtonInterface::set_callback_runner(CallbackRunner *runner) {
+  this->listener.set_callback_runner(runner);
+}
+
+void ButtonInterface::set_controller_state(ControllerState *state) {
+  this->listener.set_controller_state(state);
+}
+
+bool ButtonInterface::add_event_observer(EventObserver *observer) {
+  return this->listener.add_event_observer(observer);
+}
+
+void ButtonInterface::remove_event_observer(EventObserver *observer) {
+  this->listener.remove_event_observer(observer);
+}
+
+bool ButtonInterface::add_event_forwarder(EventObserver *forwarder) {
+  return this->listener.add_event_forwarder(forwarder);
+}
+
+void ButtonInterface::remove_event_forwarder(EventObserver *forwarder) {
+  this->listener.remove_event_forwarder(forwarder);
+}
+
+LatencyHistogram &ButtonInterface::get_latency() {
+  return this->listener.get_latency();
 }
 
 void ButtonInterface::set_button_led_color(LibPushButton btn,
@@ -45,39 +86,83 @@ constexpr uint TOP_BTN_ROW_START = 102;
 constexpr uint BOTTOM_BTN_ROW_START = 20;
 constexpr uint SCENE_BTN_COL_START = 43;
 
-unique_ptr<LibPushButtonEvent>
-ButtonInterface::handle_message(byte msg_type, midi_msg &message) {
-  if (msg_type != MidiMsgType::cc) {
-    return nullptr;
+int ButtonInterface::get_button_number(LibPushButton btn, int index) {
+  bool in_row = index >= 0 && index < LIBPUSH_PAD_MATRIX_DIM;
+  switch (btn) {
+  case LibPushButton::LP_DISPLAY_TOP_BTN:
+    return in_row ? TOP_BTN_ROW_START + index : -1;
+  case LibPushButton::LP_DISPLAY_BOTTOM_BTN:
+    return in_row ? BOTTOM_BTN_ROW_START + index : -1;
+  case LibPushButton::LP_SCENE_BTN:
+    return in_row ? SCENE_BTN_COL_START - index : -1;
+  default:
+    return button_numbers.count(btn) ? btn : -1;
   }
+}
 
-  unique_ptr<LibPushButtonEvent> event = make_unique<LibPushButtonEvent>();
+array<ButtonInterface::ButtonMapping, 128> ButtonInterface::button_mappings =
+    [] {
+      array<ButtonMapping, 128> mappings;
+      for (uint n = 0; n < mappings.size(); ++n) {
+        mappings[n] = map_button(n);
+      }
+      return mappings;
+    }();
 
-  uint btn_number = get_midi_number(msg_type, message);
+ButtonInterface::ButtonMapping ButtonInterface::map_button(uint btn_number) {
+  ButtonMapping mapping;
+  mapping.is_button = true;
   if (btn_number >= TOP_BTN_ROW_START &&
       btn_number < TOP_BTN_ROW_START + LIBPUSH_PAD_MATRIX_DIM) {
-    event->button = LibPushButton::LP_DISPLAY_TOP_BTN;
-    event->index = btn_number - TOP_BTN_ROW_START;
+    mapping.button = LibPushButton::LP_DISPLAY_TOP_BTN;
+    mapping.index = btn_number - TOP_BTN_ROW_START;
   } else if (btn_number >= BOTTOM_BTN_ROW_START &&
              btn_number < BOTTOM_BTN_ROW_START + LIBPUSH_PAD_MATRIX_DIM) {
-    event->button = LibPushButton::LP_DISPLAY_BOTTOM_BTN;
-    event->index = btn_number - BOTTOM_BTN_ROW_START;
+    mapping.button = LibPushButton::LP_DISPLAY_BOTTOM_BTN;
+    mapping.index = btn_number - BOTTOM_BTN_ROW_START;
   } else if (btn_number <= SCENE_BTN_COL_START &&
              btn_number > SCENE_BTN_COL_START - LIBPUSH_PAD_MATRIX_DIM) {
-    event->button = LibPushButton::LP_SCENE_BTN;
-    event->index = SCENE_BTN_COL_START - btn_number;
+    mapping.button = LibPushButton::LP_SCENE_BTN;
+    mapping.index = SCENE_BTN_COL_START - btn_number;
   } else if (ButtonInterface::button_numbers.count(btn_number)) {
-    event->button = static_cast<LibPushButton>(btn_number);
-    event->index = -1;
+    mapping.button = static_cast<LibPushButton>(btn_number);
+    mapping.index = -1;
   } else {
-    return nullptr;
+    mapping.is_button = false;
   }
+  return mapping;
+}
+
+bool ButtonInterface::accepts_message(byte msg_type, byte number) {
+  return msg_type == MidiMsgType::cc && button_mappings[number].is_button;
+}
 
-  if (get_midi_value(msg_type, message)) {
-    event->event_type = LibPushButtonEventType::LP_BTN_PRESSED;
+bool ButtonInterface::decode_message(byte msg_type, midi_msg &message,
+                                     LibPushButtonEvent &event) {
+  if (msg_type != MidiMsgType::cc) {
+    return false;
+  }
+
+  const ButtonMapping &mapping = button_mappings[message[1] & 0x7F];
+  if (!mapping.is_button) {
+    return false;
+  }
+
+  event.button = mapping.button;
+  event.index = mapping.index;
+
+  if (message[2]) {
+    event.event_type = LibPushButtonEventType::LP_BTN_PRESSED;
   } else {
-    event->event_type = LibPushButtonEventType::LP_BTN_RELEASED;
+    event.event_type = LibPushButtonEventType::LP_BTN_RELEASED;
   }
 
-  return event;
+  return true;
+}
+
+int ButtonInterface::coalescing_key(const LibPushButtonEvent &event) {
+  return -1;
 }
+
+void ButtonInterface::coalesce(LibPushButtonEvent &pending,
+                               const LibPushButtonEvent &event) {}
@@ -4,24 +4,95 @@
 #include "MidiMessageListener.hpp"
 #include "MidiMsg.hpp"
 #include "push.h"
+#include <array>
 #include <memory>
+#include <unordered_set>
 /// This class provides an API for getting input
 /// from Push's buttons
 class ButtonInterface {
 public:
   ButtonInterface(MidiInterface &midi, LedInterface &leds);
 
-  void register_callback(LibPushButtonCallback cb, void *context);
+  /// \returns A token that identifies the callback
+  int register_callback(LibPushButtonCallback cb, void *context);
+
+  /// \param token A token returned by register_callback
+  /// \returns false if no callback of this interface has the token
+  bool unregister_callback(int token);
+
+  /// \param token A token returned by register_callback
+  /// \param filter The events the callback should receive
+  /// \returns false if no callback of this interface has the token
+  bool set_callback_filter(int token, const LibPushEventFilter &filter);
+
+  /// \param queue The queue to write events to, or nullptr to stop queueing events
+  void set_event_queue(EventQueue *queue);
+
+  /// \param runner Calls this interface's callbacks when it is active
+  void set_callback_runner(CallbackRunner *runner);
+
+  /// \param state The state to keep up to date with this interface's events
+  void set_controller_state(ControllerState *state);
+
+  /// \param observer Passed every event of this interface after it is delivered
+  /// \returns false if the interface has no room for another observer
+  bool add_event_observer(EventObserver *observer);
+
+  /// \param observer An observer passed to add_event_observer
+  void remove_event_observer(EventObserver *observer);
+
+  /// \param forwarder Passed every event of this interface before it is delivered
+  /// \returns false if the interface has no room for another forwarder
+  bool add_event_forwarder(EventObserver *forwarder);
+
+  /// \param forwarder A forwarder passed to add_event_forwarder
+  void remove_event_forwarder(EventObserver *forwarder);
+
+  /// \returns The latency of this interface's events, from arrival to the return of the last callback
+  LatencyHistogram &get_latency();
 
   /// \param btn The button to set the color for
   /// \The index of the color in the current color palette
   void set_button_led_color(LibPushButton btn, uint color_index);
 
+  /// \param btn A button
+  /// \param index (0-7) Only relevant for buttons with type LP_DISPLAY_TOP, LP_DISPLAY_BOTTOM, or LP_SCENE_BTN
+  /// \returns The cc number the button sends and its led is set with, or -1 if there is no such button
+  static int get_button_number(LibPushButton btn, int index);
+
 private:
+  /// The button that sends a cc number
+  struct ButtonMapping {
+    bool is_button;
+    LibPushButton button;
+    int index;
+  };
+
   LedInterface &leds;
-  MidiMessageListener<LibPushButtonEvent> listener;
-  static std::unique_ptr<LibPushButtonEvent> handle_message(byte msg_type,
-                                                            midi_msg &message);
+  MidiMessageListener<LibPushButtonEvent, ButtonInterface> listener;
+  friend class MidiMessageListener<LibPushButtonEvent, ButtonInterface>;
+
+  /// \param msg_type The type of the incoming message
+  /// \param message The incoming message
+  /// \param event Filled with the button event the message represents
+  /// \returns true if the message is a button event
+  static bool decode_message(byte msg_type, midi_msg &message,
+                             LibPushButtonEvent &event);
+
+  /// \returns true for cc messages sent by a button
+  static bool accepts_message(byte msg_type, byte number);
+
+  /// \returns -1, button events are never coalesced
+  static int coalescing_key(const LibPushButtonEvent &event);
+  static void coalesce(LibPushButtonEvent &pending,
+                       const LibPushButtonEvent &event);
+
+  /// \param btn_number A cc number
+  /// \returns The button that sends btn_number, if any
+  static ButtonMapping map_button(uint btn_number);
 
   static std::unordered_set<uint> button_numbers;
+
+  /// The result of map_button for every cc number
+  static std::array<ButtonMapping, 128> button_mappings;
 };
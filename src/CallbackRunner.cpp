@@ -0,0 +1,314 @@
+#include "CallbackRunner.hpp"
+
+using namespace std;
+
+CallbackRunner::CallbackRunner()
+    : pool(nullptr), producers(0), budget_ns(0), handler(nullptr),
+      handler_context(nullptr), callbacks(0), slow_callbacks(0), stall_ns(0),
+      max_duration_ns(0), hung_callbacks(0), dropped_callbacks(0) {}
+
+CallbackRunner::~CallbackRunner() {
+  this->watchdog.stop();
+  this->set_workers(0, 0);
+}
+
+void CallbackRunner::set_workers(unsigned int workers, size_t queue_capacity) {
+  lock_guard<mutex> guard(this->config_lock);
+
+  WorkerPool *pool = nullptr;
+  if (workers) {
+    pool = new WorkerPool();
+    for (unsigned int i = 0; i < workers; ++i) {
+      auto worker = make_unique<Worker>();
+      worker->capacity = queue_capacity ? queue_capacity : 1;
+      worker->calls = make_unique<Call[]>(worker->capacity);
+      worker->head = 0;
+      worker->count = 0;
+      worker->stopping = false;
+      worker->started_ns.store(0);
+      worker->reported_ns.store(0);
+      worker->thread = thread(&CallbackRunner::work, this, ref(*worker));
+      pool->workers.push_back(move(worker));
+    }
+  }
+
+  WorkerPool *replaced = this->pool.exchange(pool);
+
+  // Wait for calls that are being queued to the replaced pool, then let it finish them
+  while (this->producers.load()) {
+    this_thread::yield();
+  }
+  CallbackRunner::stop_pool(replaced);
+}
+
+void CallbackRunner::set_budget(unsigned long long budget_ns,
+                                LibPushSlowCallbackHandler handler,
+                                void *context) {
+  lock_guard<mutex> guard(this->config_lock);
+
+  this->handler_context.store(context);
+  this->handler.store(handler);
+  this->budget_ns.store(budget_ns);
+
+  if (!budget_ns) {
+    this->watchdog.stop();
+    return;
+  }
+
+  // Checks often enough to report a hung callback within about one and a half budgets
+  auto interval = chrono::microseconds(max(budget_ns / 2000, 1000ull));
+  this->watchdog.start(interval, [this] { this->check_workers(); });
+}
+
+bool CallbackRunner::is_active() {
+  return this->pool.load(memory_order_acquire) ||
+         this->budget_ns.load(memory_order_relaxed);
+}
+
+void CallbackRunner::run(Function fn, void *context, int token,
+                         const LibPushEvent &event,
+                         LatencyHistogram *latency) {
+  Call call = {fn, context, token, event, latency};
+
+  // Registers as a producer before loading the pool, so set_workers can't stop it while it's in use
+  this->producers.fetch_add(1);
+  WorkerPool *pool = this->pool.load();
+  if (!pool) {
+    this->producers.fetch_sub(1);
+    this->execute(call, nullptr);
+    return;
+  }
+
+  // Fibonacci hashing spreads neighbouring sources over the workers
+  unsigned int hash = event_source(event) * 2654435769u;
+  Worker &worker = *pool->workers[hash % pool->workers.size()];
+  bool queued = false;
+  {
+    lock_guard<mutex> guard(worker.lock);
+    if (worker.count < worker.capacity) {
+      worker.calls[(worker.head + worker.count) % worker.capacity] = call;
+      ++worker.count;
+      queued = true;
+    }
+  }
+  this->producers.fetch_sub(1);
+
+  // Waiting for a slow worker would stall input handling for every source
+  if (!queued) {
+    this->dropped_callbacks.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+  worker.not_empty.notify_one();
+}
+
+LibPushWatchdogStats CallbackRunner::get_stats() {
+  LibPushWatchdogStats stats;
+  stats.callbacks = this->callbacks.load(memory_order_relaxed);
+  stats.slow_callbacks = this->slow_callbacks.load(memory_order_relaxed);
+  stats.stall_ns = this->stall_ns.load(memory_order_relaxed);
+  stats.max_duration_ns = this->max_duration_ns.load(memory_order_relaxed);
+  stats.hung_callbacks = this->hung_callbacks.load(memory_order_relaxed);
+  stats.dropped_callbacks = this->dropped_callbacks.load(memory_order_relaxed);
+  return stats;
+}
+
+void CallbackRunner::execute(const Call &call, Worker *worker) {
+  unsigned long long budget = this->budget_ns.load(memory_order_relaxed);
+  if (!budget) {
+    CallbackRunner::invoke(call);
+    if (call.latency) {
+      call.latency->record(monotonic_time_ns() - event_timestamp(call.event));
+    }
+    return;
+  }
+
+  unsigned long long start = monotonic_time_ns();
+  if (worker) {
+    worker->token.store(call.token, memory_order_relaxed);
+    worker->event_type.store(call.event.type, memory_order_relaxed);
+    worker->started_ns.store(start, memory_order_release);
+  }
+  CallbackRunner::invoke(call);
+  unsigned long long end = monotonic_time_ns();
+  unsigned long long duration = end - start;
+  if (worker) {
+    worker->started_ns.store(0, memory_order_release);
+  }
+  if (call.latency) {
+    call.latency->record(end - event_timestamp(call.event));
+  }
+
+  this->callbacks.fetch_add(1, memory_order_relaxed);
+  unsigned long long max = this->max_duration_ns.load(memory_order_relaxed);
+  while (duration > max &&
+         !this->max_duration_ns.compare_exchange_weak(max, duration)) {
+  }
+
+  if (duration > budget) {
+    this->slow_callbacks.fetch_add(1, memory_order_relaxed);
+    this->stall_ns.fetch_add(duration - budget, memory_order_relaxed);
+
+    this->report({call.token, call.event.type, duration, budget, false});
+  }
+}
+
+void CallbackRunner::check_workers() {
+  unsigned long long budget = this->budget_ns.load(memory_order_relaxed);
+
+  // Pins the pool like a producer, so set_workers can't stop it while it's checked
+  this->producers.fetch_add(1);
+  WorkerPool *pool = this->pool.load();
+  if (!pool || !budget) {
+    this->producers.fetch_sub(1);
+    return;
+  }
+
+  unsigned long long now = monotonic_time_ns();
+  vector<LibPushSlowCallbackReport> reports;
+  for (auto &worker : pool->workers) {
+    unsigned long long start = worker->started_ns.load(memory_order_acquire);
+    if (!start || start > now || now - start <= budget) {
+      continue;
+    }
+
+    int token = worker->token.load(memory_order_relaxed);
+    auto type = (LibPushEventType)worker->event_type.load(memory_order_relaxed);
+    // The call may have finished and another started while it was read
+    if (worker->started_ns.load(memory_order_acquire) != start ||
+        worker->reported_ns.exchange(start) == start) {
+      continue;
+    }
+    reports.push_back({token, type, now - start, budget, true});
+  }
+  this->producers.fetch_sub(1);
+
+  for (auto &report : reports) {
+    this->hung_callbacks.fetch_add(1, memory_order_relaxed);
+    this->report(report);
+  }
+}
+
+void CallbackRunner::report(const LibPushSlowCallbackReport &report) {
+  LibPushSlowCallbackHandler handler = this->handler.load();
+  if (handler) {
+    handler(report, this->handler_context.load());
+  }
+}
+
+void CallbackRunner::work(Worker &worker) {
+  while (true) {
+    Call call;
+    {
+      unique_lock<mutex> guard(worker.lock);
+      worker.not_empty.wait(
+          guard, [&worker] { return worker.count || worker.stopping; });
+      if (!worker.count) {
+        return;
+      }
+
+      call = worker.calls[worker.head];
+      worker.head = (worker.head + 1) % worker.capacity;
+      --worker.count;
+    }
+
+    this->execute(call, &worker);
+  }
+}
+
+void CallbackRunner::stop_pool(WorkerPool *pool) {
+  if (!pool) {
+    return;
+  }
+
+  for (auto &worker : pool->workers) {
+    {
+      lock_guard<mutex> guard(worker->lock);
+      worker->stopping = true;
+    }
+    worker->not_empty.notify_one();
+  }
+  for (auto &worker : pool->workers) {
+    worker->thread.join();
+  }
+  delete pool;
+}
+
+unsigned int CallbackRunner::event_source(const LibPushEvent &event) {
+  unsigned int source = 0;
+  switch (event.type) {
+  case LP_PAD_EVENT:
+    source = event.pad.y * LIBPUSH_PAD_MATRIX_DIM + event.pad.x;
+    break;
+  case LP_BUTTON_EVENT:
+    // Buttons in the same row share a value and are told apart by their index
+    source = event.button.button * LIBPUSH_PAD_MATRIX_DIM + event.button.index;
+    break;
+  case LP_ENCODER_EVENT:
+    source = event.encoder.index;
+    break;
+  case LP_TOUCH_STRIP_EVENT:
+    source = 0;
+    break;
+  case LP_PEDAL_EVENT:
+    source = event.pedal.contact;
+    break;
+  case LP_GESTURE_EVENT:
+    // Keeps the gestures of a pad or button in order, chords share a source
+    if (event.gesture.source == LP_GESTURE_BUTTON) {
+      source = 0x8000 | (event.gesture.button * LIBPUSH_PAD_MATRIX_DIM +
+                         event.gesture.index);
+    } else if (event.gesture.event_type != LP_GESTURE_CHORD) {
+      source = event.gesture.y * LIBPUSH_PAD_MATRIX_DIM + event.gesture.x;
+    } else {
+      source = 0x4000;
+    }
+    break;
+  }
+  return (event.type << 16) | source;
+}
+
+unsigned long long CallbackRunner::event_timestamp(const LibPushEvent &event) {
+  switch (event.type) {
+  case LP_PAD_EVENT:
+    return event.pad.timestamp;
+  case LP_BUTTON_EVENT:
+    return event.button.timestamp;
+  case LP_ENCODER_EVENT:
+    return event.encoder.timestamp;
+  case LP_TOUCH_STRIP_EVENT:
+    return event.touch_strip.timestamp;
+  case LP_PEDAL_EVENT:
+    return event.pedal.timestamp;
+  case LP_GESTURE_EVENT:
+    return event.gesture.timestamp;
+  }
+  return 0;
+}
+
+void CallbackRunner::invoke(const Call &call) {
+  switch (call.event.type) {
+  case LP_PAD_EVENT:
+    reinterpret_cast<LibPushPadCallback>(call.fn)(call.event.pad, call.context);
+    break;
+  case LP_BUTTON_EVENT:
+    reinterpret_cast<LibPushButtonCallback>(call.fn)(call.event.button,
+                                                     call.context);
+    break;
+  case LP_ENCODER_EVENT:
+    reinterpret_cast<LibPushEncoderCallback>(call.fn)(call.event.encoder,
+                                                      call.context);
+    break;
+  case LP_TOUCH_STRIP_EVENT:
+    reinterpret_cast<LibPushTouchStripCallback>(call.fn)(
+        call.event.touch_strip, call.context);
+    break;
+  case LP_PEDAL_EVENT:
+    reinterpret_cast<LibPushPedalCallback>(call.fn)(call.event.pedal,
+                                                    call.context);
+    break;
+  case LP_GESTURE_EVENT:
+    reinterpret_cast<LibPushGestureCallback>(call.fn)(call.event.gesture,
+                                                      call.context);
+    break;
+  }
+}
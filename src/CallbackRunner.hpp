@@ -0,0 +1,138 @@
+#pragma once
+#include "LatencyHistogram.hpp"
+#include "PeriodicTimer.hpp"
+#include "push.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Calls event callbacks on behalf of the listeners
+///
+/// Callbacks are either called on the thread that dispatches the event or
+/// queued for a pool of worker threads. Events from the same source always go to the same
+/// worker, so their callbacks keep their order.
+///
+/// When a budget is set, each callback is timed and callbacks over budget are counted
+/// and reported to a handler. A watchdog thread also checks the calls workers are making,
+/// so a callback that hangs is reported before it returns.
+///
+/// The dispatching thread never waits for a worker: a call to a worker whose queue is full is dropped.
+class CallbackRunner {
+public:
+  /// A callback with its event type erased, cast back to the right type when it is called
+  using Function = void (*)();
+
+  CallbackRunner();
+  ~CallbackRunner();
+
+  /// \param workers The number of worker threads, or 0 to call callbacks on the dispatching thread
+  /// \param queue_capacity The number of calls that can wait for each worker
+  /// \effects Replaces the current workers once they have run all waiting calls
+  void set_workers(unsigned int workers, size_t queue_capacity);
+
+  /// \param budget_ns The longest a callback should take, or 0 to stop timing callbacks
+  /// \param handler Called after each callback over budget, or nullptr
+  /// \param context A pointer passed to handler
+  void set_budget(unsigned long long budget_ns,
+                  LibPushSlowCallbackHandler handler, void *context);
+
+  /// \returns Whether callbacks need to go through run, because there are workers or a budget
+  bool is_active();
+
+  /// \param fn The callback, which must take the type of event
+  /// \param context The pointer registered with the callback
+  /// \param token The token of the callback
+  /// \param event The event to pass to the callback
+  /// \param latency Records the time from the event's arrival to the return of fn, or nullptr
+  /// \effects Calls fn, or queues it for the worker that handles the event's source.
+  /// The call is dropped and counted if the worker's queue is full
+  void run(Function fn, void *context, int token, const LibPushEvent &event,
+           LatencyHistogram *latency = nullptr);
+
+  /// \returns The counters of the watchdog
+  LibPushWatchdogStats get_stats();
+
+private:
+  struct Call {
+    Function fn;
+    void *context;
+    int token;
+    LibPushEvent event;
+    LatencyHistogram *latency;
+  };
+
+  /// A thread with a bounded queue of calls
+  struct Worker {
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::unique_ptr<Call[]> calls;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool stopping;
+    std::thread thread;
+
+    // The call being made, for the watchdog. Only set while there is a budget
+    std::atomic<unsigned long long> started_ns; //< When the call started, or 0 when idle
+    std::atomic<int> token;
+    std::atomic<int> event_type;
+    std::atomic<unsigned long long> reported_ns; //< The start of the last call the watchdog reported
+  };
+
+  /// A set of workers that is replaced as a whole when the number of workers changes
+  struct WorkerPool {
+    std::vector<std::unique_ptr<Worker>> workers;
+  };
+
+  std::mutex config_lock; //< Serializes set_workers and set_budget
+  std::atomic<WorkerPool *> pool;
+  std::atomic<int> producers; //< The number of threads that may be queueing calls to pool
+
+  std::atomic<unsigned long long> budget_ns;
+  std::atomic<LibPushSlowCallbackHandler> handler;
+  std::atomic<void *> handler_context;
+
+  std::atomic<unsigned long long> callbacks;
+  std::atomic<unsigned long long> slow_callbacks;
+  std::atomic<unsigned long long> stall_ns;
+  std::atomic<unsigned long long> max_duration_ns;
+  std::atomic<unsigned long long> hung_callbacks;
+  std::atomic<unsigned long long> dropped_callbacks;
+
+  PeriodicTimer watchdog; //< Checks the calls of workers while there is a budget
+
+  /// \param call The call to make
+  /// \param worker The worker making the call, or nullptr on the dispatching thread
+  /// \effects Calls the callback, timing it if there is a budget
+  void execute(const Call &call, Worker *worker);
+
+  /// \effects Reports each call a worker has been making for longer than the budget, once
+  void check_workers();
+
+  /// \param report The callback to report
+  /// \effects Passes the report to the handler, if there is one
+  void report(const LibPushSlowCallbackReport &report);
+
+  /// \param worker The worker to run
+  /// \effects Makes queued calls until the worker is stopped and its queue is empty
+  void work(Worker &worker);
+
+  /// \param pool The pool to stop
+  /// \effects Waits for the workers to make all queued calls and exit, then frees the pool
+  static void stop_pool(WorkerPool *pool);
+
+  /// \param event An event
+  /// \returns An identifier of the pad, button, encoder, touch strip or pedal contact that caused the event
+  static unsigned int event_source(const LibPushEvent &event);
+
+  /// \param event An event
+  /// \returns When the event arrived
+  static unsigned long long event_timestamp(const LibPushEvent &event);
+
+  /// \param call The call to make
+  /// \effects Casts the callback back to the type of the event and calls it
+  static void invoke(const Call &call);
+};
@@ -0,0 +1,171 @@
+#include "ControllerState.hpp"
+#include <cstring>
+#include <memory>
+#include <new>
+
+using namespace std;
+
+ControllerState::ControllerState() {
+  void *aligned = this->storage;
+  size_t space = sizeof(this->storage);
+  align(CACHE_LINE_SIZE, sizeof(Block), aligned, space);
+  this->block = new (aligned) Block();
+  this->block->sequence.store(0);
+  memset(&this->block->state, 0, sizeof(this->block->state));
+}
+
+void ControllerState::begin_write() {
+  this->block->sequence.store(
+      this->block->sequence.load(memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+void ControllerState::end_write(unsigned long long timestamp) {
+  this->block->state.timestamp = timestamp;
+  unsigned long long sequence =
+      this->block->sequence.load(memory_order_relaxed) + 1;
+  this->block->state.sequence = sequence / 2;
+  this->block->sequence.store(sequence, memory_order_release);
+}
+
+void ControllerState::update(const LibPushPadEvent &event) {
+  if (event.x >= LIBPUSH_PAD_MATRIX_DIM || event.y >= LIBPUSH_PAD_MATRIX_DIM) {
+    return;
+  }
+  unsigned long long bit = 1ULL << (event.y * LIBPUSH_PAD_MATRIX_DIM + event.x);
+
+  this->begin_write();
+  unsigned char &pressure = this->block->state.pad_pressure[event.y][event.x];
+  switch (event.event_type) {
+  case LP_PAD_PRESSED:
+    // A note on with a velocity of 0 is a release
+    pressure = event.velocity;
+    if (event.velocity) {
+      this->block->state.pads_held |= bit;
+    } else {
+      this->block->state.pads_held &= ~bit;
+    }
+    break;
+  case LP_PAD_RELEASED:
+    pressure = 0;
+    this->block->state.pads_held &= ~bit;
+    break;
+  case LP_PAD_AFTERTOUCH:
+    if (this->block->state.pads_held & bit) {
+      pressure = event.velocity;
+    }
+    break;
+  }
+  this->end_write(event.timestamp);
+}
+
+void ControllerState::update(const LibPushButtonEvent &event) {
+  unsigned int button = event.button;
+  if (button >= 128) {
+    return;
+  }
+
+  this->begin_write();
+  bool pressed = event.event_type == LP_BTN_PRESSED;
+  bool held = pressed;
+
+  unsigned char *row = nullptr;
+  switch (event.button) {
+  case LP_DISPLAY_TOP_BTN:
+    row = &this->block->state.display_top_buttons_held;
+    break;
+  case LP_DISPLAY_BOTTOM_BTN:
+    row = &this->block->state.display_bottom_buttons_held;
+    break;
+  case LP_SCENE_BTN:
+    row = &this->block->state.scene_buttons_held;
+    break;
+  default:
+    break;
+  }
+  if (row && event.index >= 0 && event.index < 8) {
+    if (pressed) {
+      *row |= 1 << event.index;
+    } else {
+      *row &= ~(1 << event.index);
+    }
+    held = *row != 0;
+  }
+
+  unsigned long long bit = 1ULL << (button % 64);
+  if (held) {
+    this->block->state.buttons_held[button / 64] |= bit;
+  } else {
+    this->block->state.buttons_held[button / 64] &= ~bit;
+  }
+  this->end_write(event.timestamp);
+}
+
+void ControllerState::update(const LibPushEncoderEvent &event) {
+  if (event.index < 0 || event.index >= LIBPUSH_ENCODERS) {
+    return;
+  }
+
+  this->begin_write();
+  switch (event.event_type) {
+  case LP_ENCODER_TOUCHED:
+    this->block->state.encoders_touched |= 1 << event.index;
+    break;
+  case LP_ENCODER_MOVED:
+    this->block->state.encoder_positions[event.index] += event.delta;
+    break;
+  case LP_ENCODER_RELEASED:
+    this->block->state.encoders_touched &= ~(1 << event.index);
+    break;
+  }
+  this->end_write(event.timestamp);
+}
+
+void ControllerState::update(const LibPushTouchStripEvent &event) {
+  this->begin_write();
+  switch (event.event_type) {
+  case LP_TOUCH_STRIP_PRESSED:
+    this->block->state.touch_strip_touched = true;
+    break;
+  case LP_TOUCH_STRIP_MOVED:
+    this->block->state.touch_strip_position = event.position;
+    break;
+  case LP_TOUCH_STRIP_RELEASED:
+    this->block->state.touch_strip_touched = false;
+    break;
+  }
+  this->end_write(event.timestamp);
+}
+
+void ControllerState::update(const LibPushPedalEvent &event) {
+  unsigned int contact = event.contact;
+  if (contact >= LIBPUSH_PEDAL_CONTACTS) {
+    return;
+  }
+
+  this->begin_write();
+  this->block->state.pedal_values[contact] = event.value;
+  this->end_write(event.timestamp);
+}
+
+LibPushControllerState ControllerState::snapshot() {
+  LibPushControllerState copy;
+  while (true) {
+    unsigned long long before =
+        this->block->sequence.load(memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+
+    memcpy(&copy, &this->block->state, sizeof(copy));
+    atomic_thread_fence(memory_order_acquire);
+    if (this->block->sequence.load(memory_order_relaxed) == before) {
+      return copy;
+    }
+  }
+}
+
+const LibPushControllerState &ControllerState::current() {
+  return this->block->state;
+}
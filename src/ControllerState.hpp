@@ -0,0 +1,55 @@
+#pragma once
+#include "EventQueue.hpp"
+#include "push.h"
+#include <atomic>
+
+/// The current state of Push's controls, updated from decoded events
+///
+/// There is a single writer (the thread handling MIDI input) and any number of readers.
+/// The state is guarded by a seqlock: the writer makes the sequence odd while it updates the state,
+/// and readers copy the state and retry if the sequence was odd or changed during the copy.
+/// Readers never block the writer and neither side locks or allocates.
+///
+/// The block is aligned to cache lines of its own so that it doesn't share them with unrelated data.
+/// It's placed in an over-sized buffer by hand, since operator new doesn't honor alignas before C++17
+class ControllerState {
+public:
+  ControllerState();
+  ControllerState(const ControllerState &) = delete;
+  ControllerState &operator=(const ControllerState &) = delete;
+
+  /// \param event A decoded event
+  /// \effects Applies the event to the state
+  /// \requires Only one thread updates the state
+  void update(const LibPushPadEvent &event);
+  void update(const LibPushButtonEvent &event);
+  void update(const LibPushEncoderEvent &event);
+  void update(const LibPushTouchStripEvent &event);
+  void update(const LibPushPedalEvent &event);
+
+  /// Gestures are synthesized from pad and button events, which already updated the state
+  void update(const LibPushGestureEvent &event) {}
+
+  /// \returns A consistent copy of the state
+  LibPushControllerState snapshot();
+
+  /// \returns The state as it was last written
+  /// \requires Called from the thread that updates the state, which can read it without retrying
+  const LibPushControllerState &current();
+
+private:
+  struct alignas(CACHE_LINE_SIZE) Block {
+    std::atomic<unsigned long long> sequence; //< Odd while the state is being written
+    LibPushControllerState state;
+  };
+
+  unsigned char storage[sizeof(Block) + CACHE_LINE_SIZE - 1];
+  Block *block; //< Points to the aligned part of storage
+
+  /// \effects Makes the sequence odd before the state is modified
+  void begin_write();
+
+  /// \param timestamp The arrival time of the event being applied
+  /// \effects Publishes the modified state
+  void end_write(unsigned long long timestamp);
+};
@@ -1,7 +1,8 @@
 #pragma once
+#include "DisplayTransport.hpp"
 #include "MidiMsg.hpp"
+#include "SettingsCache.hpp"
 #include "SysexInterface.hpp"
-#include "libusb.h"
 #include "push.h"
 #include <exception>
 #include <functional>
@@ -20,35 +21,55 @@
 #define ROW_LENGTH (DISPLAY_WIDTH_BYTES + DISPLAY_PADDING_BYTES)
 /// The total length of a complete frame buffer
 #define FRAME_BUFFER_LENGTH (ROW_LENGTH * (DISPLAY_HEIGHT * 2))
+/// The length of the header sent before each frame buffer
+#define FRAME_HEADER_LENGTH 16
+/// The length of the pattern XORed with each row of pixels
+#define SIGNAL_SHAPING_PATTERN_LENGTH 4
 
 /// A convenient interface to Push's display
 ///
 /// Responsible for managing a connection to the bulk usb interface used for Push's display
-/// and drawing buffers of pixels to the display. Uses libusb under the hood.
+/// and drawing buffers of pixels to the display. Uses a DisplayTransport (libusb by default) under the hood.
 ///
 /// \notes The display's brightness is controlled by the MidiInterface
 class DisplayInterface {
 public:
   using Pixel = unsigned short int;
-  using DeviceHandlePtr =
-      std::unique_ptr<libusb_device_handle,
-                      std::function<void(libusb_device_handle *)>>;
 
   enum DisplaySysex : byte {
     SET_DISPLAY_BRIGHTNESS = 0x08,
     GET_DISPLAY_BRIGHTNESS = 0x09,
   };
 
-  DisplayInterface(SysexInterface &sysex);
+  using SetBrightness =
+      SysexCommand<SET_DISPLAY_BRIGHTNESS, SysexLayout<SysexU14>>;
+  using GetBrightness =
+      SysexCommand<GET_DISPLAY_BRIGHTNESS, SysexLayout<>, SysexLayout<SysexU14>>;
+
+  /// Bytes sent in a separate transfer before every frame buffer
+  static const unsigned char FRAME_HEADER[FRAME_HEADER_LENGTH];
+  /// Bytes XORed with the pixel data of each row in the frame buffer
+  static const unsigned char
+      SIGNAL_SHAPING_PATTERN[SIGNAL_SHAPING_PATTERN_LENGTH];
+
+  DisplayInterface(SysexInterface &sysex, SettingsCache &settings);
   ~DisplayInterface();
 
-  /// Connect to Push's display
+  /// Connect to Push's display over usb
   ///
   /// \effects Initializes libusb and enables draw_frame to be called successfully
   /// \requires The display is not already connected
   /// \throws [std::runtime_error]() if a connection can't be established
   void connect();
 
+  /// Connect to Push's display through the given transport
+  ///
+  /// \param transport The transport to write frames to
+  /// \effects Opens the transport and enables draw_frame to be called successfully
+  /// \requires The display is not already connected
+  /// \throws [std::runtime_error]() if a connection can't be established
+  void connect(std::unique_ptr<DisplayTransport> transport);
+
   /// Disconnect from Push's display
   ///
   /// \effects Closes the connection to the display and cleans up
@@ -66,24 +87,17 @@ public:
   /// \param (0-127) The display brightness
   void set_brightness(byte brightness);
 
-  /// \returns (0-127) The current display brightness
+  /// \returns (0-127) The current display brightness, read from Push only if it isn't cached
   byte get_brightness();
 
+  /// \param settings Settings to write
+  /// \param batch Filled with the command that writes the brightness, if it's known
+  static void add_settings(const DeviceSettings &settings, SysexBatch &batch);
+
 private:
-  DeviceHandlePtr push2_handle;
+  std::unique_ptr<DisplayTransport> transport;
   SysexInterface &sysex;
-
-  /// Find a usb device using libusb
-  ///
-  /// \param PRODUCT_ID The device's product identifier
-  /// \param VENDOR_ID The device's vendor identifier
-  /// \returns A handle for the device
-  static libusb_device_handle *find_device(unsigned int PRODUCT_ID,
-                                           unsigned int VENDOR_ID);
-  /// Get the list of available usb devices
-  ///
-  /// \returns A list of available usb devices
-  static libusb_device **get_device_list();
+  SettingsCache &settings;
 
   /// Fills a frame_buffer in the manner expected by Push
   ///
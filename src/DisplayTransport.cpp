@@ -0,0 +1,91 @@
+#include "DisplayTransport.hpp"
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+using DeviceHandlePtr = UsbDisplayTransport::DeviceHandlePtr;
+using DeviceListPtr =
+    unique_ptr<libusb_device *, function<void(libusb_device **)>>;
+
+constexpr unsigned int ABLETON_VENDOR_ID = 0x2982;
+constexpr unsigned int PUSH2_PRODUCT_ID = 0x1967;
+
+constexpr unsigned char PUSH2_BULK_EP_OUT = 0x01;
+constexpr unsigned int TRANSFER_TIMEOUT = 500;
+
+UsbDisplayTransport::UsbDisplayTransport() : push2_handle(nullptr) {}
+
+void UsbDisplayTransport::open() {
+  int result;
+  if ((result = libusb_init(NULL)) < 0) {
+    throw runtime_error(to_string(result) + " could not initialize libusb");
+  }
+
+  this->push2_handle =
+      DeviceHandlePtr(this->find_device(PUSH2_PRODUCT_ID, ABLETON_VENDOR_ID),
+                      [](libusb_device_handle *handle) {
+                        libusb_release_interface(handle, 0);
+                        libusb_close(handle);
+                      });
+
+  if (!this->push2_handle) {
+    throw runtime_error("Ableton Push 2 Device Not Found");
+  }
+}
+
+void UsbDisplayTransport::close() { this->push2_handle.reset(nullptr); }
+
+int UsbDisplayTransport::write(const unsigned char *data, int length) {
+  // libusb doesn't modify the buffer for an OUT transfer
+  return libusb_bulk_transfer(this->push2_handle.get(), PUSH2_BULK_EP_OUT,
+                              const_cast<unsigned char *>(data), length, NULL,
+                              TRANSFER_TIMEOUT);
+}
+
+libusb_device_handle *UsbDisplayTransport::find_device(unsigned int PRODUCT_ID,
+                                                       unsigned int VENDOR_ID) {
+
+  DeviceListPtr devices(get_device_list(), [](libusb_device **device_list) {
+    libusb_free_device_list(device_list, 1);
+  });
+
+  libusb_device_handle *device_handle = NULL;
+  libusb_device *device;
+  int result;
+
+  for (int i = 0; (device = devices.get()[i]) != NULL; i++) {
+    struct libusb_device_descriptor descriptor;
+    if ((result = libusb_get_device_descriptor(device, &descriptor)) < 0) {
+      continue;
+    }
+
+    if (descriptor.bDeviceClass == LIBUSB_CLASS_PER_INTERFACE &&
+        descriptor.idVendor == VENDOR_ID &&
+        descriptor.idProduct == PRODUCT_ID) {
+      if ((result = libusb_open(device, &device_handle)) < 0) {
+        throw runtime_error("error: " + to_string(result) +
+                            " could not open Ableton Push 2 device");
+      } else if ((result = libusb_claim_interface(device_handle, 0)) < 0) {
+        libusb_close(device_handle);
+        device_handle = NULL;
+        throw runtime_error("error: " + to_string(result) +
+                            " could not claim interface 0 of Push 2 device");
+      } else {
+        break; // successfully opened
+      }
+    }
+  }
+
+  return device_handle;
+}
+
+libusb_device **UsbDisplayTransport::get_device_list() {
+  libusb_device **devices;
+  ssize_t count = libusb_get_device_list(NULL, &devices);
+  if (count < 0) {
+    throw runtime_error(to_string(count) +
+                        " could not get the usb device list");
+  }
+
+  return devices;
+}
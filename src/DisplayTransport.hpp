@@ -0,0 +1,54 @@
+#pragma once
+#include "libusb.h"
+#include <functional>
+#include <memory>
+
+/// A connection that carries display frames from the host to Push
+///
+/// DisplayInterface writes frames through a transport so that the physical
+/// connection can be replaced, e.g. by a SimulatedDevice
+class DisplayTransport {
+public:
+  virtual ~DisplayTransport() {}
+
+  /// \effects Opens the connection to the display
+  /// \throws [std::runtime_error]() if a connection can't be established
+  virtual void open() = 0;
+
+  /// \effects Closes the connection to the display
+  virtual void close() = 0;
+
+  /// \param data The bytes to transfer
+  /// \param length The number of bytes in data
+  /// \returns 0 if the transfer succeeded, a negative error code otherwise
+  virtual int write(const unsigned char *data, int length) = 0;
+};
+
+/// A transport that writes to a physical Push's bulk usb endpoint using libusb
+class UsbDisplayTransport : public DisplayTransport {
+public:
+  using DeviceHandlePtr =
+      std::unique_ptr<libusb_device_handle,
+                      std::function<void(libusb_device_handle *)>>;
+
+  UsbDisplayTransport();
+
+  void open() override;
+  void close() override;
+  int write(const unsigned char *data, int length) override;
+
+private:
+  DeviceHandlePtr push2_handle;
+
+  /// Find a usb device using libusb
+  ///
+  /// \param PRODUCT_ID The device's product identifier
+  /// \param VENDOR_ID The device's vendor identifier
+  /// \returns A handle for the device
+  static libusb_device_handle *find_device(unsigned int PRODUCT_ID,
+                                           unsigned int VENDOR_ID);
+  /// Get the list of available usb devices
+  ///
+  /// \returns A list of available usb devices
+  static libusb_device **get_device_list();
+};
@@ -0,0 +1,151 @@
+#include "EncoderBindings.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+constexpr double NS_PER_S = 1e9;
+// Turns further apart than this start from rest
+constexpr double MAX_TURN_INTERVAL_S = 0.1;
+// Guards the speed estimate against messages that arrive together
+constexpr double MIN_TURN_INTERVAL_S = 1e-3;
+// The weight of each new speed measurement
+constexpr double SPEED_SMOOTHING = 0.5;
+
+EncoderBindings::EncoderBindings(ParameterStore &store, ControllerState &state)
+    : store(store), state(state), motion() {
+  for (auto &binding : this->settings) {
+    binding.sequence.store(0);
+    binding.parameter.store(-1);
+    binding.min.store(0);
+    binding.max.store(1);
+    binding.curve.store(LP_CURVE_LINEAR);
+    binding.turns.store(1);
+    binding.acceleration.store(0);
+    binding.fine_scale.store(1);
+  }
+}
+
+bool EncoderBindings::bind(int encoder, const LibPushEncoderBinding &binding) {
+  if (encoder < 0 || encoder >= LIBPUSH_ENCODERS ||
+      binding.parameter >= LIBPUSH_PARAMETERS) {
+    return false;
+  }
+
+  {
+    lock_guard<mutex> guard(this->bind_lock);
+    Settings &settings = this->settings[encoder];
+    unsigned int sequence = settings.sequence.load(memory_order_relaxed);
+    settings.sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    settings.parameter.store(binding.parameter < 0 ? -1 : binding.parameter,
+                             memory_order_relaxed);
+    settings.min.store(binding.min, memory_order_relaxed);
+    settings.max.store(binding.max, memory_order_relaxed);
+    settings.curve.store(binding.curve, memory_order_relaxed);
+    settings.turns.store(binding.turns > 0 ? binding.turns : 1,
+                         memory_order_relaxed);
+    settings.acceleration.store(binding.acceleration, memory_order_relaxed);
+    settings.fine_scale.store(binding.fine_scale > 0 ? binding.fine_scale : 1,
+                              memory_order_relaxed);
+
+    settings.sequence.store(sequence + 2, memory_order_release);
+  }
+
+  if (binding.parameter >= 0) {
+    this->store.update(binding.parameter, [&binding](double value) {
+      return from_position(binding, to_position(binding, value));
+    });
+  }
+  return true;
+}
+
+void EncoderBindings::load_binding(int encoder,
+                                   LibPushEncoderBinding &binding) {
+  Settings &settings = this->settings[encoder];
+  unsigned int begin;
+  unsigned int end;
+  do {
+    begin = settings.sequence.load(memory_order_acquire);
+    binding.parameter = settings.parameter.load(memory_order_relaxed);
+    binding.min = settings.min.load(memory_order_relaxed);
+    binding.max = settings.max.load(memory_order_relaxed);
+    binding.curve = static_cast<LibPushParameterCurve>(
+        settings.curve.load(memory_order_relaxed));
+    binding.turns = settings.turns.load(memory_order_relaxed);
+    binding.acceleration = settings.acceleration.load(memory_order_relaxed);
+    binding.fine_scale = settings.fine_scale.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    end = settings.sequence.load(memory_order_relaxed);
+  } while (begin != end || (begin & 1));
+}
+
+void EncoderBindings::observe(const LibPushEncoderEvent &event) {
+  if (event.event_type != LP_ENCODER_MOVED || event.index < 0 ||
+      event.index >= LIBPUSH_ENCODERS) {
+    return;
+  }
+
+  LibPushEncoderBinding binding;
+  this->load_binding(event.index, binding);
+  if (binding.parameter < 0) {
+    return;
+  }
+
+  Motion &motion = this->motion[event.index];
+  double interval = event.timestamp > motion.last_ns
+                        ? (event.timestamp - motion.last_ns) / NS_PER_S
+                        : 0;
+  motion.last_ns = event.timestamp;
+  if (interval > MAX_TURN_INTERVAL_S) {
+    motion.speed = 0;
+  } else {
+    double speed = fabs(event.delta) / max(interval, MIN_TURN_INTERVAL_S);
+    motion.speed += SPEED_SMOOTHING * (speed - motion.speed);
+  }
+
+  double step = event.delta / binding.turns *
+                (1 + binding.acceleration * motion.speed);
+
+  // The state is only written by this thread, so it can be read without the seqlock
+  const LibPushControllerState &controls = this->state.current();
+  if ((controls.buttons_held[LP_SHIFT_BTN / 64] >> (LP_SHIFT_BTN % 64)) & 1) {
+    step *= binding.fine_scale;
+  }
+
+  this->store.update(binding.parameter, [&binding, step](double value) {
+    double position = min(max(to_position(binding, value) + step, 0.0), 1.0);
+    return from_position(binding, position);
+  });
+}
+
+bool EncoderBindings::is_exponential(const LibPushEncoderBinding &binding) {
+  return binding.curve == LP_CURVE_EXPONENTIAL && binding.min > 0 &&
+         binding.max > 0;
+}
+
+double EncoderBindings::to_position(const LibPushEncoderBinding &binding,
+                                    double value) {
+  if (binding.max == binding.min) {
+    return 0;
+  }
+
+  double position;
+  if (is_exponential(binding)) {
+    position = value > 0 ? log(value / binding.min) /
+                               log(binding.max / binding.min)
+                         : 0;
+  } else {
+    position = (value - binding.min) / (binding.max - binding.min);
+  }
+  return min(max(position, 0.0), 1.0);
+}
+
+double EncoderBindings::from_position(const LibPushEncoderBinding &binding,
+                                      double position) {
+  if (is_exponential(binding)) {
+    return binding.min * pow(binding.max / binding.min, position);
+  }
+  return binding.min + (binding.max - binding.min) * position;
+}
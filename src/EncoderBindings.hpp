@@ -0,0 +1,79 @@
+#pragma once
+#include "ControllerState.hpp"
+#include "EventObserver.hpp"
+#include "ParameterStore.hpp"
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <mutex>
+
+/// Applies the turns of Push's encoders to parameters in a ParameterStore
+///
+/// Each encoder can be bound to a parameter with a range, a curve, acceleration and a fine
+/// mode that is active while Shift is held. Turns are applied on the MIDI input thread
+/// as each event is observed, by mapping the parameter's current value back to a position
+/// in the range, moving the position and mapping it forward again. Because the store is read
+/// on every turn, values set by the application are picked up without any extra state.
+///
+/// The bindings are guarded by a seqlock, so they can be changed from any thread
+/// while the input thread reads them without locking
+class EncoderBindings : public EventObserver {
+public:
+  /// \param store The parameters to change
+  /// \param state The state to read the Shift button from
+  EncoderBindings(ParameterStore &store, ControllerState &state);
+
+  /// \param encoder The encoder to bind
+  /// \param binding The parameter the encoder changes and how
+  /// \returns false if the encoder or parameter is out of range
+  /// \effects Clamps the parameter into the range of the binding
+  bool bind(int encoder, const LibPushEncoderBinding &binding);
+
+  /// \param event An encoder event that has been delivered
+  /// \effects Applies turns of bound encoders to their parameters
+  void observe(const LibPushEncoderEvent &event) override;
+
+private:
+  /// The binding of an encoder, written under a seqlock
+  struct Settings {
+    std::atomic<unsigned int> sequence; //< Odd while the binding is being written
+    std::atomic<int> parameter;
+    std::atomic<double> min;
+    std::atomic<double> max;
+    std::atomic<int> curve;
+    std::atomic<double> turns;
+    std::atomic<double> acceleration;
+    std::atomic<double> fine_scale;
+  };
+
+  /// How fast an encoder is being turned. Only used on the input thread
+  struct Motion {
+    unsigned long long last_ns; //< The arrival time of the last turn
+    double speed;               //< Smoothed speed in turns per second
+  };
+
+  ParameterStore &store;
+  ControllerState &state;
+  std::mutex bind_lock; //< Serializes writers of the settings
+  std::array<Settings, LIBPUSH_ENCODERS> settings;
+  std::array<Motion, LIBPUSH_ENCODERS> motion;
+
+  /// \param encoder The encoder to read
+  /// \param binding Filled with a consistent copy of the encoder's binding
+  void load_binding(int encoder, LibPushEncoderBinding &binding);
+
+  /// \param binding A binding
+  /// \param value A value of the binding's parameter
+  /// \returns (0-1) The position of the value in the binding's range
+  static double to_position(const LibPushEncoderBinding &binding,
+                            double value);
+
+  /// \param binding A binding
+  /// \param position (0-1) A position in the binding's range
+  /// \returns The value at the position
+  static double from_position(const LibPushEncoderBinding &binding,
+                              double position);
+
+  /// \returns Whether the binding uses an exponential curve over a positive range
+  static bool is_exponential(const LibPushEncoderBinding &binding);
+};
@@ -1,70 +1,156 @@
 #include "EncoderInterface.hpp"
+#include <cmath>
 
 using namespace std;
 EncoderInterface::EncoderInterface(MidiInterface &midi)
-    : listener(EncoderInterface::handle_message) {
+    : listener(*this) {
   midi.register_handler(&this->listener);
 }
 
-void EncoderInterface::register_callback(LibPushEncoderCallback cb,
-                                         void *context) {
-  this->listener.register_callback(cb, context);
+int EncoderInterface::register_callback(LibPushEncoderCallback cb,
+                                        void *context) {
+  return this->listener.register_callback(cb, context);
 }
 
+bool EncoderInterface::unregister_callback(int token) {
+  return this->listener.unregister_callback(token);
+}
+
+bool EncoderInterface::set_callback_filter(int token,
+                                           const LibPushEventFilter &filter) {
+  return this->listener.set_callback_filter(token, filter);
+}
+
+void EncoderInterface::set_event_queue(EventQueue *queue) {
+  this->listener.set_event_queue(queue);
+}
+
+void EncoderInterface::set_callback_runner(CallbackRunner *runner) {
+  this->listener.set_callback_runner(runner);
+}
+
+void EncoderInterface::set_controller_state(ControllerState *state) {
+  this->listener.set_controller_state(state);
+}
+
+bool EncoderInterface::add_event_observer(EventObserver *observer) {
+  return this->listener.add_event_observer(observer);
+}
+
+void EncoderInterface::remove_event_observer(EventObserver *observer) {
+  this->listener.remove_event_observer(observer);
+}
+
+bool EncoderInterface::add_event_forwarder(EventObserver *forwarder) {
+  return this->listener.add_event_forwarder(forwarder);
+}
+
+void EncoderInterface::remove_event_forwarder(EventObserver *forwarder) {
+  this->listener.remove_event_forwarder(forwarder);
+}
+
+LatencyHistogram &EncoderInterface::get_latency() {
+  return this->listener.get_latency();
+}
+
+void EncoderInterface::set_coalescing(bool enabled) {
+  this->listener.set_coalescing(enabled);
+}
+
+void EncoderInterface::flush_coalesced_events() { this->listener.flush(); }
+
 constexpr uint TOP_LEFT_ENCODER_CC = 14;
 constexpr uint ENCODER_CC_ROW_START = 71;
 constexpr uint TOP_LEFT_ENCODER_NN = 10;
 constexpr uint ENCODER_NN_ROW_START = 0;
 
-unique_ptr<LibPushEncoderEvent>
-EncoderInterface::handle_message(byte msg_type, midi_msg &message) {
+array<int, 128> EncoderInterface::turn_indices = [] {
+  array<int, 128> indices;
+  for (uint n = 0; n < indices.size(); ++n) {
+    if (n >= TOP_LEFT_ENCODER_CC && n < TOP_LEFT_ENCODER_CC + 2) {
+      indices[n] = n - TOP_LEFT_ENCODER_CC;
+    } else if (n >= ENCODER_CC_ROW_START &&
+               n < ENCODER_CC_ROW_START + LIBPUSH_PAD_MATRIX_DIM + 1) {
+      indices[n] = n - ENCODER_CC_ROW_START + 2;
+    } else {
+      indices[n] = -1;
+    }
+  }
+  return indices;
+}();
 
-  if (msg_type != MidiMsgType::cc && msg_type != MidiMsgType::note_on) {
-    return nullptr;
+array<int, 128> EncoderInterface::touch_indices = [] {
+  array<int, 128> indices;
+  for (uint n = 0; n < indices.size(); ++n) {
+    if (n <= TOP_LEFT_ENCODER_NN && n > TOP_LEFT_ENCODER_NN - 2) {
+      indices[n] = TOP_LEFT_ENCODER_NN - n;
+    } else if (n >= ENCODER_NN_ROW_START &&
+               n < ENCODER_NN_ROW_START + LIBPUSH_PAD_MATRIX_DIM + 1) {
+      indices[n] = n - ENCODER_NN_ROW_START + 2;
+    } else {
+      indices[n] = -1;
+    }
   }
+  return indices;
+}();
 
-  unique_ptr<LibPushEncoderEvent> event = make_unique<LibPushEncoderEvent>();
+bool EncoderInterface::accepts_message(byte msg_type, byte number) {
+  switch (msg_type) {
+  case MidiMsgType::cc:
+    return turn_indices[number] >= 0;
+  case MidiMsgType::note_on:
+    return touch_indices[number] >= 0;
+  default:
+    return false;
+  }
+}
+
+bool EncoderInterface::decode_message(byte msg_type, midi_msg &message,
+                                      LibPushEncoderEvent &event) {
+  uint encoder_number = message[1] & 0x7F;
+  uint val = message[2] & 0x7F;
+  int index;
 
-  uint encoder_number = get_midi_number(msg_type, message);
-  uint val = get_midi_value(msg_type, message);
   if (msg_type == MidiMsgType::cc) {
     // Encoder was turned
-    if (encoder_number >= TOP_LEFT_ENCODER_CC &&
-        encoder_number < TOP_LEFT_ENCODER_CC + 2) {
-      event->index = encoder_number - TOP_LEFT_ENCODER_CC;
-    } else if (encoder_number >= ENCODER_CC_ROW_START &&
-               encoder_number <
-                   ENCODER_CC_ROW_START + LIBPUSH_PAD_MATRIX_DIM + 1) {
-      event->index = encoder_number - ENCODER_CC_ROW_START + 2;
-    } else {
-      return nullptr;
+    if ((index = turn_indices[encoder_number]) < 0) {
+      return false;
     }
 
-    event->event_type = LibPushEncoderEventType::LP_ENCODER_MOVED;
-    event->delta = EncoderInterface::get_delta(val, event->index);
-
+    event.event_type = LibPushEncoderEventType::LP_ENCODER_MOVED;
+    event.delta = deltas[index > 0][val];
   } else if (msg_type == MidiMsgType::note_on) {
     // Encoder was touched or released
-    if (encoder_number <= TOP_LEFT_ENCODER_NN &&
-        encoder_number > TOP_LEFT_ENCODER_NN - 2) {
-      event->index = TOP_LEFT_ENCODER_NN - encoder_number;
-    } else if (encoder_number >= ENCODER_NN_ROW_START &&
-               encoder_number <
-                   ENCODER_NN_ROW_START + LIBPUSH_PAD_MATRIX_DIM + 1) {
-      event->index = encoder_number - ENCODER_NN_ROW_START + 2;
-    } else {
-      return nullptr;
+    if ((index = touch_indices[encoder_number]) < 0) {
+      return false;
     }
-    event->delta = 0.0;
 
+    event.delta = 0.0;
     if (val) {
-      event->event_type = LibPushEncoderEventType::LP_ENCODER_TOUCHED;
+      event.event_type = LibPushEncoderEventType::LP_ENCODER_TOUCHED;
     } else {
-      event->event_type = LibPushEncoderEventType::LP_ENCODER_RELEASED;
+      event.event_type = LibPushEncoderEventType::LP_ENCODER_RELEASED;
     }
+  } else {
+    return false;
+  }
+
+  event.index = index;
+  return true;
+}
+
+int EncoderInterface::coalescing_key(const LibPushEncoderEvent &event) {
+  if (event.event_type != LibPushEncoderEventType::LP_ENCODER_MOVED) {
+    return -1;
   }
+  return event.index;
+}
 
-  return event;
+void EncoderInterface::coalesce(LibPushEncoderEvent &pending,
+                                const LibPushEncoderEvent &event) {
+  double delta = pending.delta + event.delta;
+  pending = event;
+  pending.delta = delta;
 }
 
 constexpr double TEMPO_ENCODER_FULL_TURN = 18.0;
@@ -82,3 +168,18 @@ double EncoderInterface::get_delta(uint val, int index) {
   double full_turn = index > 0 ? ENCODER_FULL_TURN : TEMPO_ENCODER_FULL_TURN;
   return (val / full_turn) * sign; // Normalize and set sign
 }
+
+int EncoderInterface::get_steps(const LibPushEncoderEvent &event) {
+  double full_turn =
+      event.index > 0 ? ENCODER_FULL_TURN : TEMPO_ENCODER_FULL_TURN;
+  return lround(event.delta * full_turn);
+}
+
+array<array<double, 128>, 2> EncoderInterface::deltas = [] {
+  array<array<double, 128>, 2> deltas;
+  for (uint val = 0; val < 128; ++val) {
+    deltas[0][val] = get_delta(val, 0);
+    deltas[1][val] = get_delta(val, 1);
+  }
+  return deltas;
+}();
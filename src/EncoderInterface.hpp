@@ -3,6 +3,7 @@
 #include "MidiMessageListener.hpp"
 #include "MidiMsg.hpp"
 #include "push.h"
+#include <array>
 #include <memory>
 
 /// This class provides an API for getting input
@@ -11,12 +12,83 @@ class EncoderInterface {
 public:
   EncoderInterface(MidiInterface &midi);
 
-  void register_callback(LibPushEncoderCallback cb, void *context);
+  /// \returns A token that identifies the callback
+  int register_callback(LibPushEncoderCallback cb, void *context);
+
+  /// \param token A token returned by register_callback
+  /// \returns false if no callback of this interface has the token
+  bool unregister_callback(int token);
+
+  /// \param token A token returned by register_callback
+  /// \param filter The events the callback should receive
+  /// \returns false if no callback of this interface has the token
+  bool set_callback_filter(int token, const LibPushEventFilter &filter);
+
+  /// \param queue The queue to write events to, or nullptr to stop queueing events
+  void set_event_queue(EventQueue *queue);
+
+  /// \param runner Calls this interface's callbacks when it is active
+  void set_callback_runner(CallbackRunner *runner);
+
+  /// \param state The state to keep up to date with this interface's events
+  void set_controller_state(ControllerState *state);
+
+  /// \param observer Passed every event of this interface after it is delivered
+  /// \returns false if the interface has no room for another observer
+  bool add_event_observer(EventObserver *observer);
+
+  /// \param observer An observer passed to add_event_observer
+  void remove_event_observer(EventObserver *observer);
+
+  /// \param forwarder Passed every event of this interface before it is delivered
+  /// \returns false if the interface has no room for another forwarder
+  bool add_event_forwarder(EventObserver *forwarder);
+
+  /// \param forwarder A forwarder passed to add_event_forwarder
+  void remove_event_forwarder(EventObserver *forwarder);
+
+  /// \returns The latency of this interface's events, from arrival to the return of the last callback
+  LatencyHistogram &get_latency();
+
+  /// \param enabled Whether continuous events should be coalesced until the next flush
+  void set_coalescing(bool enabled);
+
+  /// \effects Delivers all pending coalesced events
+  void flush_coalesced_events();
+
+  /// \param event A turn of an encoder
+  /// \returns The number of steps the encoder turned, negative to the left
+  static int get_steps(const LibPushEncoderEvent &event);
 
 private:
-  MidiMessageListener<LibPushEncoderEvent> listener;
-  static std::unique_ptr<LibPushEncoderEvent> handle_message(byte msg_type,
-                                                             midi_msg &message);
+  MidiMessageListener<LibPushEncoderEvent, EncoderInterface> listener;
+  friend class MidiMessageListener<LibPushEncoderEvent, EncoderInterface>;
+
+  /// \param msg_type The type of the incoming message
+  /// \param message The incoming message
+  /// \param event Filled with the encoder event the message represents
+  /// \returns true if the message is an encoder event
+  static bool decode_message(byte msg_type, midi_msg &message,
+                             LibPushEncoderEvent &event);
+
+  /// \returns true for cc messages from turning an encoder and note messages from touching one
+  static bool accepts_message(byte msg_type, byte number);
+
+  /// \returns The index of the encoder for turns, -1 for touches and releases
+  static int coalescing_key(const LibPushEncoderEvent &event);
+
+  /// \effects Adds the deltas of both turns
+  static void coalesce(LibPushEncoderEvent &pending,
+                       const LibPushEncoderEvent &event);
+
+  /// The encoder index for every cc number, or -1 if the cc isn't sent by an encoder
+  static std::array<int, 128> turn_indices;
+
+  /// The encoder index for every note number, or -1 if the note isn't sent by an encoder
+  static std::array<int, 128> touch_indices;
+
+  /// The result of get_delta for every 7 bit value, for the tempo encoder (0) and other encoders (1)
+  static std::array<std::array<double, 128>, 2> deltas;
 
   /// \param val The 7 bit two's complement value representing the encoder delta
   /// \param index The index of the encoder that was moved
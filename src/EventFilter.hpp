@@ -0,0 +1,66 @@
+#pragma once
+#include "push.h"
+
+/// \param mask A mask from a LibPushEventFilter
+/// \param bit The bit to test
+/// \returns Whether the mask is empty (matches everything) or has the bit set
+inline bool mask_matches(unsigned long long mask, unsigned int bit) {
+  return !mask || (bit < 64 && (mask >> bit) & 1);
+}
+
+/// \param filter The filter of a callback
+/// \param event An event of a specific type
+/// \returns Whether the callback should receive the event
+inline bool filter_matches(const LibPushEventFilter &filter,
+                           const LibPushPadEvent &event) {
+  return mask_matches(filter.event_types, event.event_type) &&
+         mask_matches(filter.pads, event.y * LIBPUSH_PAD_MATRIX_DIM + event.x);
+}
+
+inline bool filter_matches(const LibPushEventFilter &filter,
+                           const LibPushButtonEvent &event) {
+  if (!mask_matches(filter.event_types, event.event_type)) {
+    return false;
+  }
+  if (!filter.buttons[0] && !filter.buttons[1]) {
+    return true;
+  }
+  unsigned int button = event.button;
+  return button < 128 && (filter.buttons[button / 64] >> (button % 64)) & 1;
+}
+
+inline bool filter_matches(const LibPushEventFilter &filter,
+                           const LibPushEncoderEvent &event) {
+  return mask_matches(filter.event_types, event.event_type) &&
+         mask_matches(filter.encoders, event.index);
+}
+
+inline bool filter_matches(const LibPushEventFilter &filter,
+                           const LibPushTouchStripEvent &event) {
+  return mask_matches(filter.event_types, event.event_type);
+}
+
+inline bool filter_matches(const LibPushEventFilter &filter,
+                           const LibPushPedalEvent &event) {
+  return true;
+}
+
+inline bool filter_matches(const LibPushEventFilter &filter,
+                           const LibPushGestureEvent &event) {
+  if (!mask_matches(filter.event_types, event.event_type)) {
+    return false;
+  }
+
+  if (event.source == LP_GESTURE_BUTTON) {
+    if (!filter.buttons[0] && !filter.buttons[1]) {
+      return true;
+    }
+    unsigned int button = event.button;
+    return button < 128 && (filter.buttons[button / 64] >> (button % 64)) & 1;
+  }
+
+  if (event.event_type == LP_GESTURE_CHORD) {
+    return !filter.pads || (filter.pads & event.pads);
+  }
+  return mask_matches(filter.pads, event.y * LIBPUSH_PAD_MATRIX_DIM + event.x);
+}
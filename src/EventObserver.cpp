@@ -0,0 +1,73 @@
+#include "EventObserver.hpp"
+#include <thread>
+
+using namespace std;
+
+ObserverList::ObserverList() : count(0) {
+  for (auto &slot : this->slots) {
+    slot.store(nullptr);
+  }
+  for (auto &observing : this->observing) {
+    observing.store(0);
+  }
+}
+
+bool ObserverList::add(EventObserver *observer) {
+  lock_guard<mutex> guard(this->lock);
+  int count = this->count.load();
+  int free_slot = -1;
+  for (int i = 0; i < count; ++i) {
+    EventObserver *added = this->slots[i].load();
+    if (added == observer) {
+      return true;
+    }
+    if (!added && free_slot < 0) {
+      free_slot = i;
+    }
+  }
+
+  if (free_slot >= 0) {
+    this->slots[free_slot].store(observer, memory_order_release);
+  } else if (count < MAX_EVENT_OBSERVERS) {
+    this->slots[count].store(observer, memory_order_release);
+    this->count.store(count + 1, memory_order_release);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void ObserverList::remove(EventObserver *observer) {
+  lock_guard<mutex> guard(this->lock);
+  this->remove_locked(observer);
+}
+
+void ObserverList::remove_and_wait(EventObserver *observer) {
+  lock_guard<mutex> guard(this->lock);
+  int slot = this->remove_locked(observer);
+  if (slot < 0) {
+    return;
+  }
+
+  // The slot can't be reused while the lock is held, so only events passed to observer are waited for
+  while (this->observing[slot].load()) {
+    this_thread::yield();
+  }
+}
+
+int ObserverList::remove_locked(EventObserver *observer) {
+  int count = this->count.load();
+  int removed = -1;
+  for (int i = 0; i < count; ++i) {
+    if (this->slots[i].load() == observer) {
+      this->slots[i].store(nullptr);
+      removed = i;
+    }
+  }
+
+  while (count > 0 && !this->slots[count - 1].load()) {
+    --count;
+  }
+  this->count.store(count, memory_order_release);
+  return removed;
+}
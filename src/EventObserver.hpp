@@ -0,0 +1,80 @@
+#pragma once
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#define MAX_EVENT_OBSERVERS 4
+
+/// Receives every event a listener decodes
+///
+/// Used to derive new events from input, e.g. to recognize gestures, or to react to input
+/// without a round trip through the application, e.g. to forward it.
+/// Observers are called on the MIDI input thread, so they must be quick
+class EventObserver {
+public:
+  virtual ~EventObserver() {}
+
+  /// \param event A decoded event
+  virtual void observe(const LibPushPadEvent &event) {}
+  virtual void observe(const LibPushButtonEvent &event) {}
+  virtual void observe(const LibPushEncoderEvent &event) {}
+  virtual void observe(const LibPushTouchStripEvent &event) {}
+  virtual void observe(const LibPushPedalEvent &event) {}
+  virtual void observe(const LibPushGestureEvent &event) {}
+};
+
+/// Up to MAX_EVENT_OBSERVERS observers, which can be added and removed while events are observed
+///
+/// Slots are reused rather than compacted, so that an event being observed while another observer
+/// is added or removed is still passed to every observer that stays added
+class ObserverList {
+public:
+  ObserverList();
+
+  /// \param observer Passed every observed event
+  /// \returns false if the list is full
+  /// \effects Adding an observer twice has no effect
+  /// \requires observer outlives the list
+  bool add(EventObserver *observer);
+
+  /// \param observer An observer passed to add
+  /// \effects The observer isn't passed events observed after this returns,
+  /// but may still be observing an event that was observed before
+  void remove(EventObserver *observer);
+
+  /// \param observer An observer passed to add
+  /// \effects Removes the observer and returns once it isn't observing an event, so it can be freed
+  /// \requires Not called while the list passes an event to an observer, e.g. from a callback
+  /// of an event an observer emits
+  void remove_and_wait(EventObserver *observer);
+
+  /// \returns false if no observer is added, without loading the slots
+  bool any() const { return this->count.load(std::memory_order_acquire); }
+
+  /// \param event A decoded event
+  /// \effects Passes the event to every observer, in slot order
+  template <typename Event> void observe(const Event &event) {
+    int count = this->count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+      // Registers before loading the slot, so remove_and_wait can wait until it's unused
+      this->observing[i].fetch_add(1);
+      EventObserver *observer = this->slots[i].load();
+      if (observer) {
+        observer->observe(event);
+      }
+      this->observing[i].fetch_sub(1);
+    }
+  }
+
+private:
+  std::mutex lock; //< Serializes changes
+  std::array<std::atomic<EventObserver *>, MAX_EVENT_OBSERVERS> slots;
+  std::atomic<int> count; //< One past the last used slot
+  std::array<std::atomic<int>, MAX_EVENT_OBSERVERS>
+      observing; //< The number of events being passed to the observer in each slot
+
+  /// \returns The slot the observer was removed from, or -1
+  /// \requires lock is held
+  int remove_locked(EventObserver *observer);
+};
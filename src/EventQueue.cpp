@@ -0,0 +1,165 @@
+#include "EventQueue.hpp"
+#include <thread>
+
+using namespace std;
+
+EventQueue::EventQueue(size_t capacity, LibPushQueueOverflow overflow)
+    : overflow(overflow), head(0) {
+  this->capacity = 2;
+  while (this->capacity < capacity) {
+    this->capacity <<= 1;
+  }
+  this->mask = this->capacity - 1;
+
+  this->slots = make_unique<Slot[]>(this->capacity);
+  for (uint64_t i = 0; i < this->capacity; ++i) {
+    this->slots[i].sequence.store(0, memory_order_relaxed);
+  }
+
+  for (auto &cursor : this->cursors) {
+    cursor.claimed.store(false, memory_order_relaxed);
+    cursor.active.store(false, memory_order_relaxed);
+    cursor.position.store(0, memory_order_relaxed);
+    cursor.dropped.store(0, memory_order_relaxed);
+  }
+  this->cursors[0].claimed.store(true, memory_order_relaxed);
+  this->cursors[0].active.store(true, memory_order_release);
+}
+
+void EventQueue::push(const LibPushEvent &event) {
+  // Reserves a position, so that concurrent producers write different slots
+  uint64_t position = this->head.load(memory_order_relaxed);
+  do {
+    if (this->overflow == LP_DROP_NEWEST && this->is_full(position)) {
+      for (auto &cursor : this->cursors) {
+        if (cursor.active.load(memory_order_relaxed)) {
+          cursor.dropped.fetch_add(1, memory_order_relaxed);
+        }
+      }
+      return;
+    }
+  } while (!this->head.compare_exchange_weak(position, position + 1,
+                                             memory_order_relaxed));
+
+  Slot &slot = this->slots[position & this->mask];
+  uint64_t sequence = slot.sequence.load(memory_order_relaxed);
+  while (true) {
+    if (sequence > 2 * position) {
+      // A producer a lap ahead already took the slot, so readers count this event as dropped
+      return;
+    }
+    if (sequence & 1) {
+      // A producer a lap behind is still writing, which only happens if it was
+      // preempted for as long as it takes to fill the whole ring
+      this_thread::yield();
+      sequence = slot.sequence.load(memory_order_relaxed);
+      continue;
+    }
+    if (slot.sequence.compare_exchange_weak(sequence, 2 * position + 1,
+                                            memory_order_relaxed)) {
+      break;
+    }
+  }
+
+  atomic_thread_fence(memory_order_release);
+  slot.event = event;
+  slot.sequence.store(2 * position + 2, memory_order_release);
+}
+
+int EventQueue::add_cursor() {
+  for (int i = 0; i < EVENT_QUEUE_MAX_CURSORS; ++i) {
+    Cursor &cursor = this->cursors[i];
+    bool claimed = false;
+    if (!cursor.claimed.compare_exchange_strong(claimed, true)) {
+      continue;
+    }
+
+    // Producers only read the position of an active cursor, so it's set first
+    cursor.dropped.store(0, memory_order_relaxed);
+    cursor.position.store(this->head.load(memory_order_acquire),
+                          memory_order_relaxed);
+    cursor.active.store(true, memory_order_release);
+    return i;
+  }
+
+  return -1;
+}
+
+void EventQueue::remove_cursor(int cursor) {
+  if (cursor > 0 && cursor < EVENT_QUEUE_MAX_CURSORS &&
+      this->cursors[cursor].active.load(memory_order_acquire)) {
+    this->cursors[cursor].active.store(false, memory_order_release);
+    this->cursors[cursor].claimed.store(false, memory_order_release);
+  }
+}
+
+size_t EventQueue::poll(int cursor, LibPushEvent *out, size_t max) {
+  if (!this->is_valid_cursor(cursor)) {
+    return 0;
+  }
+
+  Cursor &reader = this->cursors[cursor];
+  uint64_t position = reader.position.load(memory_order_relaxed);
+  unsigned long long dropped = 0;
+  size_t count = 0;
+
+  uint64_t head = this->head.load(memory_order_acquire);
+  while (count < max && position < head) {
+    // Skip past events that the producer has already overwritten
+    if (head - position > this->capacity) {
+      dropped += head - position - this->capacity;
+      position = head - this->capacity;
+    }
+
+    Slot &slot = this->slots[position & this->mask];
+    uint64_t expected = 2 * position + 2;
+    uint64_t sequence = slot.sequence.load(memory_order_acquire);
+    if (sequence < expected) {
+      break; // A producer reserved the position but hasn't written the event yet
+    }
+    if (sequence == expected) {
+      LibPushEvent event = slot.event;
+      atomic_thread_fence(memory_order_acquire);
+      if (slot.sequence.load(memory_order_relaxed) == expected) {
+        out[count++] = event;
+        ++position;
+        continue;
+      }
+    }
+
+    // A producer lapped the cursor before or while the event was being read
+    ++dropped;
+    ++position;
+    head = this->head.load(memory_order_acquire);
+  }
+
+  reader.position.store(position, memory_order_release);
+  if (dropped) {
+    reader.dropped.fetch_add(dropped, memory_order_relaxed);
+  }
+  return count;
+}
+
+unsigned long long EventQueue::get_dropped_count(int cursor) {
+  if (!this->is_valid_cursor(cursor)) {
+    return 0;
+  }
+  return this->cursors[cursor].dropped.load(memory_order_relaxed);
+}
+
+bool EventQueue::is_full(uint64_t position) {
+  // The slowest cursor decides whether there is room
+  for (auto &cursor : this->cursors) {
+    if (cursor.active.load(memory_order_acquire) &&
+        position - cursor.position.load(memory_order_acquire) >=
+            this->capacity) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool EventQueue::is_valid_cursor(int cursor) {
+  return cursor >= 0 && cursor < EVENT_QUEUE_MAX_CURSORS &&
+         this->cursors[cursor].active.load(memory_order_acquire);
+}
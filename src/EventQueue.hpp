@@ -0,0 +1,122 @@
+#pragma once
+#include "push.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#define EVENT_QUEUE_MAX_CURSORS 8
+#define CACHE_LINE_SIZE 64
+
+/// A bounded, lock-free queue of input events with any number of readers
+///
+/// Events are written into a ring of slots, mostly by the MIDI input thread. Each reader owns
+/// a cursor into the ring and sees every event written after the cursor was added,
+/// unless it falls a full ring behind. Readers never block, and nothing allocates.
+/// Timers (coalescing, gestures) push too, so each producer reserves a position with a CAS on
+/// the head and writes its slot without waiting for the others.
+///
+/// Each slot carries a sequence number that is odd while the slot is being written,
+/// so a reader that is overtaken by a producer can detect the torn copy and discard it,
+/// and a reader stops at a reserved position until its event is written.
+class EventQueue {
+public:
+  /// \param capacity The number of events the queue can hold, rounded up to a power of 2
+  /// \param overflow What to do with new events when a cursor has capacity unread events
+  /// \effects Creates the queue with the default cursor (0) added
+  EventQueue(size_t capacity, LibPushQueueOverflow overflow);
+
+  /// \param event The event to write
+  /// \effects Makes event visible to all cursors
+  void push(const LibPushEvent &event);
+
+  /// \returns The id of a cursor that reads events pushed from now on, or -1 if all are in use
+  int add_cursor();
+
+  /// \param cursor A cursor returned by add_cursor
+  /// \effects Frees the cursor so that it no longer holds back the producer
+  void remove_cursor(int cursor);
+
+  /// \param cursor The cursor to read with
+  /// \param out An array to copy events into
+  /// \param max The number of events out can hold
+  /// \returns The number of events copied into out, oldest first
+  /// \requires Only one thread polls a cursor at a time
+  size_t poll(int cursor, LibPushEvent *out, size_t max);
+
+  /// \param cursor The cursor to check
+  /// \returns The number of events the cursor has missed because the queue overflowed
+  unsigned long long get_dropped_count(int cursor);
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> sequence; //< 2 * position + 2 once written, odd while writing
+    LibPushEvent event;
+  };
+
+  /// Aligned so that readers don't share a cache line with each other or the producer
+  struct alignas(CACHE_LINE_SIZE) Cursor {
+    std::atomic<bool> claimed; //< Taken by add_cursor, which sets up the cursor before activating it
+    std::atomic<bool> active;
+    std::atomic<uint64_t> position; //< The position of the next event to read
+    std::atomic<unsigned long long> dropped;
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  uint64_t capacity;
+  uint64_t mask;
+  LibPushQueueOverflow overflow;
+
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; //< The next position to reserve
+  Cursor cursors[EVENT_QUEUE_MAX_CURSORS];
+
+  /// \param position The position an event would be written at
+  /// \returns Whether a cursor has capacity unread events before position
+  bool is_full(uint64_t position);
+
+  /// \returns Whether cursor is the id of an active cursor
+  bool is_valid_cursor(int cursor);
+};
+
+/// \param event An event of a specific type
+/// \returns The event wrapped in a LibPushEvent
+inline LibPushEvent make_event(const LibPushPadEvent &event) {
+  LibPushEvent wrapped;
+  wrapped.type = LP_PAD_EVENT;
+  wrapped.pad = event;
+  return wrapped;
+}
+
+inline LibPushEvent make_event(const LibPushButtonEvent &event) {
+  LibPushEvent wrapped;
+  wrapped.type = LP_BUTTON_EVENT;
+  wrapped.button = event;
+  return wrapped;
+}
+
+inline LibPushEvent make_event(const LibPushEncoderEvent &event) {
+  LibPushEvent wrapped;
+  wrapped.type = LP_ENCODER_EVENT;
+  wrapped.encoder = event;
+  return wrapped;
+}
+
+inline LibPushEvent make_event(const LibPushTouchStripEvent &event) {
+  LibPushEvent wrapped;
+  wrapped.type = LP_TOUCH_STRIP_EVENT;
+  wrapped.touch_strip = event;
+  return wrapped;
+}
+
+inline LibPushEvent make_event(const LibPushPedalEvent &event) {
+  LibPushEvent wrapped;
+  wrapped.type = LP_PEDAL_EVENT;
+  wrapped.pedal = event;
+  return wrapped;
+}
+
+inline LibPushEvent make_event(const LibPushGestureEvent &event) {
+  LibPushEvent wrapped;
+  wrapped.type = LP_GESTURE_EVENT;
+  wrapped.gesture = event;
+  return wrapped;
+}
@@ -0,0 +1,301 @@
+#include "GestureInterface.hpp"
+#include <bitset>
+
+using namespace std;
+
+constexpr unsigned long long NS_PER_MS = 1000000;
+constexpr int CHORD_TIMER_ID = -1;
+constexpr int LONG_PRESS_TIMER = 0;
+constexpr int REPEAT_TIMER = 1;
+
+GestureInterface::GestureInterface()
+    : listener(*this), enabled(false), config(), sources(),
+      wheel(monotonic_time_ns() / NS_PER_MS), chord_timer(), chord_pads(0),
+      fired_count(0) {
+  for (int i = 0; i < GESTURE_SOURCES; ++i) {
+    this->sources[i].long_press.id = 2 * i + LONG_PRESS_TIMER;
+    this->sources[i].repeat.id = 2 * i + REPEAT_TIMER;
+  }
+  this->chord_timer.id = CHORD_TIMER_ID;
+}
+
+GestureInterface::~GestureInterface() { this->ticker.stop(); }
+
+int GestureInterface::register_callback(LibPushGestureCallback cb,
+                                        void *context) {
+  return this->listener.register_callback(cb, context);
+}
+
+bool GestureInterface::unregister_callback(int token) {
+  return this->listener.unregister_callback(token);
+}
+
+bool GestureInterface::set_callback_filter(int token,
+                                           const LibPushEventFilter &filter) {
+  return this->listener.set_callback_filter(token, filter);
+}
+
+void GestureInterface::set_event_queue(EventQueue *queue) {
+  this->listener.set_event_queue(queue);
+}
+
+void GestureInterface::set_callback_runner(CallbackRunner *runner) {
+  this->listener.set_callback_runner(runner);
+}
+
+LatencyHistogram &GestureInterface::get_latency() {
+  return this->listener.get_latency();
+}
+
+void GestureInterface::set_config(const LibPushGestureConfig &config) {
+  this->ticker.stop();
+
+  {
+    lock_guard<mutex> guard(this->lock);
+    for (auto &source : this->sources) {
+      this->wheel.cancel(source.long_press);
+      this->wheel.cancel(source.repeat);
+      source.held = false;
+      source.tapped = false;
+      source.repeats = 0;
+    }
+    this->wheel.cancel(this->chord_timer);
+    this->chord_pads = 0;
+
+    this->config = config;
+    if (!this->config.repeat_interval_ms) {
+      this->config.repeat_interval_ms = 1;
+    }
+    this->wheel = TimerWheel(monotonic_time_ns() / NS_PER_MS);
+  }
+
+  this->enabled.store(config.gestures != 0);
+  if (config.gestures) {
+    this->ticker.start(chrono::microseconds(GESTURE_TICK_US),
+                       [this]() { this->tick(); });
+  }
+}
+
+bool GestureInterface::is_enabled(LibPushGestureType type) {
+  return (this->config.gestures >> type) & 1;
+}
+
+void GestureInterface::observe(const LibPushPadEvent &event) {
+  if (!this->enabled.load(memory_order_relaxed) ||
+      event.event_type == LP_PAD_AFTERTOUCH ||
+      event.x >= LIBPUSH_PAD_MATRIX_DIM || event.y >= LIBPUSH_PAD_MATRIX_DIM) {
+    return;
+  }
+
+  int source = event.y * LIBPUSH_PAD_MATRIX_DIM + event.x;
+  unsigned long long bit = 1ULL << source;
+  bool double_tap = false;
+  {
+    lock_guard<mutex> guard(this->lock);
+    if (!mask_matches(this->config.pads, source)) {
+      return;
+    }
+
+    // A note on with a velocity of 0 is a release
+    if (event.event_type == LP_PAD_PRESSED && event.velocity) {
+      double_tap = this->press(source, event.timestamp);
+
+      if (this->is_enabled(LP_GESTURE_CHORD)) {
+        if (!this->chord_timer.scheduled) {
+          this->chord_pads = 0;
+          this->wheel.schedule(this->chord_timer,
+                               event.timestamp / NS_PER_MS +
+                                   this->config.chord_ms);
+        }
+        this->chord_pads |= bit;
+      }
+    } else {
+      this->release(source);
+      this->chord_pads &= ~bit;
+    }
+  }
+
+  if (double_tap) {
+    LibPushGestureEvent gesture =
+        make_gesture(source, LP_GESTURE_DOUBLE_TAP, event.timestamp);
+    this->listener.emit(gesture);
+  }
+}
+
+void GestureInterface::observe(const LibPushButtonEvent &event) {
+  if (!this->enabled.load(memory_order_relaxed)) {
+    return;
+  }
+
+  unsigned int button = event.button;
+  int source;
+  if (button <= LP_SCENE_BTN) {
+    if (event.index < 0 || event.index >= LIBPUSH_PAD_MATRIX_DIM) {
+      return;
+    }
+    source = GESTURE_PAD_SOURCES + GESTURE_BUTTON_SOURCES +
+             button * LIBPUSH_PAD_MATRIX_DIM + event.index;
+  } else if (button < GESTURE_BUTTON_SOURCES) {
+    source = GESTURE_PAD_SOURCES + button;
+  } else {
+    return;
+  }
+
+  bool double_tap = false;
+  {
+    lock_guard<mutex> guard(this->lock);
+    const unsigned long long *buttons = this->config.buttons;
+    if ((buttons[0] || buttons[1]) &&
+        !((buttons[button / 64] >> (button % 64)) & 1)) {
+      return;
+    }
+
+    if (event.event_type == LP_BTN_PRESSED) {
+      double_tap = this->press(source, event.timestamp);
+    } else {
+      this->release(source);
+    }
+  }
+
+  if (double_tap) {
+    LibPushGestureEvent gesture =
+        make_gesture(source, LP_GESTURE_DOUBLE_TAP, event.timestamp);
+    this->listener.emit(gesture);
+  }
+}
+
+bool GestureInterface::press(int source, unsigned long long time_ns) {
+  Source &state = this->sources[source];
+  unsigned long long ms = time_ns / NS_PER_MS;
+  state.held = true;
+  state.repeats = 0;
+
+  bool double_tap = false;
+  if (this->is_enabled(LP_GESTURE_DOUBLE_TAP)) {
+    // The second press completes the double tap, so a third press starts a new one
+    if (state.tapped && ms >= state.last_press_ms &&
+        ms - state.last_press_ms <= this->config.double_tap_ms) {
+      double_tap = true;
+      state.tapped = false;
+    } else {
+      state.tapped = true;
+      state.last_press_ms = ms;
+    }
+  }
+
+  if (this->is_enabled(LP_GESTURE_LONG_PRESS)) {
+    this->wheel.schedule(state.long_press, ms + this->config.long_press_ms);
+  }
+  if (this->is_enabled(LP_GESTURE_REPEAT)) {
+    this->wheel.schedule(state.repeat, ms + this->config.repeat_delay_ms);
+  }
+
+  return double_tap;
+}
+
+void GestureInterface::release(int source) {
+  Source &state = this->sources[source];
+  state.held = false;
+  this->wheel.cancel(state.long_press);
+  this->wheel.cancel(state.repeat);
+}
+
+LibPushGestureEvent GestureInterface::make_gesture(
+    int source, LibPushGestureType type, unsigned long long timestamp) {
+  LibPushGestureEvent gesture = {};
+  gesture.event_type = type;
+  gesture.timestamp = timestamp;
+
+  if (source < GESTURE_PAD_SOURCES) {
+    gesture.source = LP_GESTURE_PAD;
+    gesture.x = source % LIBPUSH_PAD_MATRIX_DIM;
+    gesture.y = source / LIBPUSH_PAD_MATRIX_DIM;
+    gesture.pads = 1ULL << source;
+    return gesture;
+  }
+
+  gesture.source = LP_GESTURE_BUTTON;
+  source -= GESTURE_PAD_SOURCES;
+  if (source < GESTURE_BUTTON_SOURCES) {
+    gesture.button = static_cast<LibPushButton>(source);
+  } else {
+    source -= GESTURE_BUTTON_SOURCES;
+    gesture.button =
+        static_cast<LibPushButton>(source / LIBPUSH_PAD_MATRIX_DIM);
+    gesture.index = source % LIBPUSH_PAD_MATRIX_DIM;
+  }
+  return gesture;
+}
+
+void GestureInterface::tick() {
+  unsigned long long now = monotonic_time_ns() / NS_PER_MS;
+
+  while (true) {
+    {
+      lock_guard<mutex> guard(this->lock);
+      if (this->wheel.now() >= now) {
+        return;
+      }
+      this->fired_count = 0;
+      this->wheel.advance(this->wheel.now() + 1, &GestureInterface::timer_fired,
+                          this);
+    }
+
+    // Delivered without the lock so that callbacks don't hold up the input thread
+    for (size_t i = 0; i < this->fired_count; ++i) {
+      this->listener.emit(this->fired[i]);
+    }
+  }
+}
+
+void GestureInterface::timer_fired(TimerWheel::Timer &timer, void *this_ptr) {
+  GestureInterface *self = static_cast<GestureInterface *>(this_ptr);
+  unsigned long long timestamp = timer.expiry * NS_PER_MS;
+
+  if (timer.id == CHORD_TIMER_ID) {
+    if (bitset<64>(self->chord_pads).count() >= 2) {
+      LibPushGestureEvent gesture = {};
+      gesture.event_type = LP_GESTURE_CHORD;
+      gesture.source = LP_GESTURE_PAD;
+      gesture.pads = self->chord_pads;
+      gesture.timestamp = timestamp;
+      self->fired[self->fired_count++] = gesture;
+    }
+    self->chord_pads = 0;
+    return;
+  }
+
+  int source = timer.id / 2;
+  Source &state = self->sources[source];
+  if (!state.held) {
+    return;
+  }
+
+  if (timer.id % 2 == LONG_PRESS_TIMER) {
+    self->fired[self->fired_count++] =
+        make_gesture(source, LP_GESTURE_LONG_PRESS, timestamp);
+  } else {
+    LibPushGestureEvent gesture =
+        make_gesture(source, LP_GESTURE_REPEAT, timestamp);
+    gesture.repeat = ++state.repeats;
+    self->fired[self->fired_count++] = gesture;
+    self->wheel.schedule(timer,
+                         self->wheel.now() + self->config.repeat_interval_ms);
+  }
+}
+
+bool GestureInterface::accepts_message(byte msg_type, byte number) {
+  return false;
+}
+
+bool GestureInterface::decode_message(byte msg_type, midi_msg &message,
+                                      LibPushGestureEvent &event) {
+  return false;
+}
+
+int GestureInterface::coalescing_key(const LibPushGestureEvent &event) {
+  return -1;
+}
+
+void GestureInterface::coalesce(LibPushGestureEvent &pending,
+                                const LibPushGestureEvent &event) {}
@@ -0,0 +1,134 @@
+#pragma once
+#include "EventObserver.hpp"
+#include "MidiMessageListener.hpp"
+#include "MidiMsg.hpp"
+#include "PeriodicTimer.hpp"
+#include "TimerWheel.hpp"
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#define GESTURE_PAD_SOURCES 64
+#define GESTURE_BUTTON_SOURCES 128
+#define GESTURE_ROW_SOURCES 24 //< The display and scene rows share button values
+#define GESTURE_SOURCES                                                        \
+  (GESTURE_PAD_SOURCES + GESTURE_BUTTON_SOURCES + GESTURE_ROW_SOURCES)
+#define GESTURE_TICK_US 1000
+
+/// This class recognizes gestures from pad and button events
+/// and delivers them like any other kind of input
+///
+/// Every pad and button has a timer for long presses and one for repeats, and the pads
+/// share a timer for chords. All of them are kept on a single TimerWheel with a resolution of 1 ms,
+/// so arming or cancelling them on a press or release is O(1).
+/// The wheel is advanced from a background thread, which delivers the gestures whose timeouts expire.
+/// Double taps don't need a timeout and are delivered from the MIDI input thread
+class GestureInterface : public EventObserver {
+public:
+  GestureInterface();
+  ~GestureInterface();
+
+  /// \returns A token that identifies the callback
+  int register_callback(LibPushGestureCallback cb, void *context);
+
+  /// \param token A token returned by register_callback
+  /// \returns false if no callback of this interface has the token
+  bool unregister_callback(int token);
+
+  /// \param token A token returned by register_callback
+  /// \param filter The events the callback should receive
+  /// \returns false if no callback of this interface has the token
+  bool set_callback_filter(int token, const LibPushEventFilter &filter);
+
+  /// \param queue The queue to write events to, or nullptr to stop queueing events
+  void set_event_queue(EventQueue *queue);
+
+  /// \param runner Calls this interface's callbacks when it is active
+  void set_callback_runner(CallbackRunner *runner);
+
+  /// \returns The latency of gestures, from the press or timeout that completed them to the return of the last callback
+  LatencyHistogram &get_latency();
+
+  /// \param config The gestures to recognize and their timing
+  /// \effects Forgets all presses seen so far. Starts advancing the timers if any gesture is enabled,
+  /// otherwise stops
+  /// \notes Must not be called from within a gesture callback
+  void set_config(const LibPushGestureConfig &config);
+
+  /// \param event A pad event that has been delivered
+  /// \effects Arms or cancels the timers of the pad, delivers a double tap if the press completes one
+  void observe(const LibPushPadEvent &event) override;
+
+  /// \param event A button event that has been delivered
+  /// \effects Arms or cancels the timers of the button, delivers a double tap if the press completes one
+  void observe(const LibPushButtonEvent &event) override;
+
+private:
+  /// The gesture state of a pad or button
+  struct Source {
+    bool held;
+    bool tapped; //< Whether the last press can be the first of a double tap
+    unsigned long long last_press_ms;
+    unsigned int repeats;
+    TimerWheel::Timer long_press;
+    TimerWheel::Timer repeat;
+  };
+
+  MidiMessageListener<LibPushGestureEvent, GestureInterface> listener;
+  friend class MidiMessageListener<LibPushGestureEvent, GestureInterface>;
+
+  std::atomic<bool> enabled;
+  std::mutex lock; //< Guards the configuration, the sources and the wheel
+  LibPushGestureConfig config;
+  std::array<Source, GESTURE_SOURCES> sources;
+  TimerWheel wheel;
+  TimerWheel::Timer chord_timer; //< Armed by the first press of a possible chord
+  unsigned long long chord_pads; //< The pads pressed since then that are still held
+  PeriodicTimer ticker;
+
+  /// Gestures whose timeout expired in the current tick, delivered once the lock is released.
+  /// Each timer fires at most once per tick
+  std::array<LibPushGestureEvent, 2 * GESTURE_SOURCES + 1> fired;
+  size_t fired_count;
+
+  /// \returns Whether the gesture is enabled
+  /// \requires lock is held
+  bool is_enabled(LibPushGestureType type);
+
+  /// \param source The index of a pad or button in sources
+  /// \param time_ns The arrival time of the press
+  /// \returns Whether the press completes a double tap
+  /// \effects Arms the long press and repeat timers of the source
+  /// \requires lock is held
+  bool press(int source, unsigned long long time_ns);
+
+  /// \param source The index of a pad or button in sources
+  /// \effects Cancels the timers of the source
+  /// \requires lock is held
+  void release(int source);
+
+  /// \param source The index of a pad or button in sources
+  /// \param type The type of the gesture
+  /// \param timestamp The time the gesture was completed
+  /// \returns A gesture event for the pad or button
+  static LibPushGestureEvent make_gesture(int source, LibPushGestureType type,
+                                          unsigned long long timestamp);
+
+  /// \effects Advances the wheel to the current time one tick at a time,
+  /// delivering the gestures that expire in each tick
+  void tick();
+
+  /// \param timer A timer that expired
+  /// \param this_ptr The instance of GestureInterface that owns the timer
+  /// \effects Adds the gesture the timer completes to fired, and rearms repeats
+  static void timer_fired(TimerWheel::Timer &timer, void *this_ptr);
+
+  /// Gestures are synthesized, never decoded from MIDI
+  static bool accepts_message(byte msg_type, byte number);
+  static bool decode_message(byte msg_type, midi_msg &message,
+                             LibPushGestureEvent &event);
+  static int coalescing_key(const LibPushGestureEvent &event);
+  static void coalesce(LibPushGestureEvent &pending,
+                       const LibPushGestureEvent &event);
+};
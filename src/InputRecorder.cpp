@@ -0,0 +1,206 @@
+#include "InputRecorder.hpp"
+#include "LatencyHistogram.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <stdexcept>
+
+using namespace std;
+
+const char RECORDING_MAGIC[] = {'L', 'P', 'M', 'R'};
+const byte RECORDING_VERSION = 1;
+constexpr size_t BUFFER_MASK = INPUT_RECORDER_BUFFER_SIZE - 1;
+constexpr size_t MAX_VARINT_LENGTH = 10;
+const auto WRITE_INTERVAL = chrono::milliseconds(10);
+
+InputRecorder::InputRecorder()
+    : head(0), tail(0), recording(false), dropped(0), start_time(0),
+      last_time(0), file(nullptr), writer_running(false) {}
+
+InputRecorder::~InputRecorder() { this->stop(); }
+
+void InputRecorder::start(const string &path) {
+  this->stop();
+
+  this->file = fopen(path.c_str(), "wb");
+  if (!this->file) {
+    throw runtime_error("Can't open " + path + " for recording");
+  }
+  fwrite(RECORDING_MAGIC, 1, sizeof(RECORDING_MAGIC), this->file);
+  fwrite(&RECORDING_VERSION, 1, 1, this->file);
+
+  if (!this->buffer) {
+    this->buffer = make_unique<byte[]>(INPUT_RECORDER_BUFFER_SIZE);
+  }
+  // Discard anything recorded after the previous recording was stopped
+  this->tail.store(this->head.load(memory_order_acquire), memory_order_release);
+  this->dropped.store(0, memory_order_relaxed);
+  this->start_time = monotonic_time_ns();
+  this->last_time = this->start_time;
+
+  this->writer_running = true;
+  this->writer = thread(&InputRecorder::write_loop, this);
+  this->recording.store(true, memory_order_release);
+}
+
+void InputRecorder::stop() {
+  this->recording.store(false, memory_order_release);
+
+  if (this->writer.joinable()) {
+    {
+      lock_guard<mutex> guard(this->writer_lock);
+      this->writer_running = false;
+    }
+    this->writer_wakeup.notify_all();
+    this->writer.join();
+  }
+
+  if (this->file) {
+    this->drain();
+    fclose(this->file);
+    this->file = nullptr;
+  }
+}
+
+bool InputRecorder::is_recording() {
+  return this->recording.load(memory_order_acquire);
+}
+
+/// \param value The number to encode
+/// \param out Filled with the LEB128 encoding of value
+/// \returns The number of bytes written to out
+static size_t encode_varint(unsigned long long value,
+                            byte (&out)[MAX_VARINT_LENGTH]) {
+  size_t length = 0;
+  do {
+    byte b = value & 0x7F;
+    value >>= 7;
+    out[length++] = value ? (b | 0x80) : b;
+  } while (value);
+  return length;
+}
+
+void InputRecorder::record(const midi_msg &message,
+                           unsigned long long timestamp) {
+  // Messages can arrive with a timestamp taken just before recording started
+  unsigned long long delta =
+      timestamp > this->last_time ? timestamp - this->last_time : 0;
+
+  byte delta_bytes[MAX_VARINT_LENGTH];
+  byte length_bytes[MAX_VARINT_LENGTH];
+  size_t delta_length = encode_varint(delta, delta_bytes);
+  size_t length_length = encode_varint(message.size(), length_bytes);
+  size_t record_length = delta_length + length_length + message.size();
+
+  size_t head = this->head.load(memory_order_relaxed);
+  size_t tail = this->tail.load(memory_order_acquire);
+  if (INPUT_RECORDER_BUFFER_SIZE - (head - tail) < record_length) {
+    this->dropped.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+
+  byte *buffer = this->buffer.get();
+  for (size_t i = 0; i < delta_length; ++i) {
+    buffer[head++ & BUFFER_MASK] = delta_bytes[i];
+  }
+  for (size_t i = 0; i < length_length; ++i) {
+    buffer[head++ & BUFFER_MASK] = length_bytes[i];
+  }
+  for (byte b : message) {
+    buffer[head++ & BUFFER_MASK] = b;
+  }
+
+  this->last_time += delta;
+  this->head.store(head, memory_order_release);
+}
+
+unsigned long long InputRecorder::get_dropped_count() {
+  return this->dropped.load(memory_order_relaxed);
+}
+
+void InputRecorder::write_loop() {
+  unique_lock<mutex> guard(this->writer_lock);
+  while (this->writer_running) {
+    // Polling keeps the input thread from ever having to wake the writer
+    this->writer_wakeup.wait_for(guard, WRITE_INTERVAL);
+    this->drain();
+  }
+}
+
+void InputRecorder::drain() {
+  size_t tail = this->tail.load(memory_order_relaxed);
+  size_t head = this->head.load(memory_order_acquire);
+
+  while (tail != head) {
+    size_t start = tail & BUFFER_MASK;
+    size_t length = min(head - tail, INPUT_RECORDER_BUFFER_SIZE - start);
+    fwrite(this->buffer.get() + start, 1, length, this->file);
+    tail += length;
+  }
+
+  fflush(this->file);
+  this->tail.store(tail, memory_order_release);
+}
+
+/// \param data The bytes to read from
+/// \param position The position of the varint, moved past it
+/// \returns The decoded value
+/// \throws An [std::runtime_error]() exception if data ends before the varint does
+static unsigned long long decode_varint(const vector<byte> &data,
+                                        size_t &position) {
+  unsigned long long value = 0;
+  for (size_t shift = 0; shift < 7 * MAX_VARINT_LENGTH; shift += 7) {
+    if (position >= data.size()) {
+      break;
+    }
+    byte b = data[position++];
+    value |= (unsigned long long)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return value;
+    }
+  }
+  throw runtime_error("Input recording is truncated or corrupt");
+}
+
+vector<InputRecorder::RecordedMessage>
+InputRecorder::read(const string &path) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    throw runtime_error("Can't open input recording " + path);
+  }
+
+  vector<byte> data;
+  byte chunk[4096];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.insert(data.end(), chunk, chunk + count);
+  }
+  fclose(file);
+
+  size_t header_length = sizeof(RECORDING_MAGIC) + 1;
+  if (data.size() < header_length ||
+      !equal(begin(RECORDING_MAGIC), end(RECORDING_MAGIC), data.begin()) ||
+      data[sizeof(RECORDING_MAGIC)] != RECORDING_VERSION) {
+    throw runtime_error(path + " is not a libpush input recording");
+  }
+
+  vector<RecordedMessage> messages;
+  unsigned long long offset = 0;
+  size_t position = header_length;
+  while (position < data.size()) {
+    offset += decode_varint(data, position);
+    size_t length = decode_varint(data, position);
+    if (length > data.size() - position) {
+      throw runtime_error("Input recording is truncated or corrupt");
+    }
+
+    RecordedMessage recorded;
+    recorded.offset_ns = offset;
+    recorded.message.assign(data.begin() + position,
+                            data.begin() + position + length);
+    messages.push_back(move(recorded));
+    position += length;
+  }
+
+  return messages;
+}
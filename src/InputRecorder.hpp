@@ -0,0 +1,79 @@
+#pragma once
+#include "MidiMsg.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define INPUT_RECORDER_BUFFER_SIZE (1 << 20)
+
+/// Records raw MIDI input to a file
+///
+/// The file starts with the magic bytes "LPMR" and a version byte, followed by one record per message:
+/// the time since the previous message in nanoseconds, the length of the message, and its bytes.
+/// Both numbers are stored as LEB128 varints, so a typical 3 byte message takes 5-7 bytes.
+///
+/// Messages are copied into a ring buffer on the MIDI input thread without locking or allocating,
+/// and a background thread writes them to the file. Messages that don't fit in the
+/// buffer are dropped and counted.
+class InputRecorder {
+public:
+  /// A message read back from a recording
+  struct RecordedMessage {
+    unsigned long long offset_ns; //< Time since the start of the recording
+    midi_msg message;
+  };
+
+  InputRecorder();
+  ~InputRecorder();
+
+  /// \param path The file to record to
+  /// \effects Stops any running recording and starts recording to path
+  /// \throws An [std::runtime_error]() exception if the file can't be opened
+  void start(const std::string &path);
+
+  /// \effects Writes all buffered messages and closes the file
+  void stop();
+
+  /// \returns Whether messages passed to record are being recorded
+  bool is_recording();
+
+  /// \param message The raw message
+  /// \param timestamp Monotonic time in nanoseconds when the message arrived
+  /// \effects Buffers the message to be written to the file
+  /// \requires Only one thread records messages
+  void record(const midi_msg &message, unsigned long long timestamp);
+
+  /// \returns The number of messages dropped because the buffer was full
+  unsigned long long get_dropped_count();
+
+  /// \param path A file written by InputRecorder
+  /// \returns The messages in the file
+  /// \throws An [std::runtime_error]() exception if the file can't be read or is invalid
+  static std::vector<RecordedMessage> read(const std::string &path);
+
+private:
+  std::unique_ptr<byte[]> buffer;
+  std::atomic<size_t> head; //< Total bytes written to buffer
+  std::atomic<size_t> tail; //< Total bytes written to the file
+  std::atomic<bool> recording;
+  std::atomic<unsigned long long> dropped;
+  unsigned long long start_time;
+  unsigned long long last_time;
+
+  FILE *file;
+  std::mutex writer_lock;
+  std::condition_variable writer_wakeup;
+  bool writer_running;
+  std::thread writer;
+
+  /// \effects Writes buffered bytes to the file until stopped
+  void write_loop();
+
+  /// \effects Writes all buffered bytes to the file
+  void drain();
+};
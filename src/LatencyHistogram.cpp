@@ -0,0 +1,41 @@
+#include "LatencyHistogram.hpp"
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram() { this->reset(); }
+
+void LatencyHistogram::record(unsigned long long latency_ns) {
+  int bucket = 0;
+  while (latency_ns >> (bucket + 1) && bucket < LIBPUSH_LATENCY_BUCKETS - 1) {
+    ++bucket;
+  }
+
+  this->buckets[bucket].fetch_add(1, memory_order_relaxed);
+  this->count.fetch_add(1, memory_order_relaxed);
+  this->total_ns.fetch_add(latency_ns, memory_order_relaxed);
+  unsigned long long max = this->max_ns.load(memory_order_relaxed);
+  while (latency_ns > max &&
+         !this->max_ns.compare_exchange_weak(max, latency_ns,
+                                             memory_order_relaxed)) {
+  }
+}
+
+LibPushLatencyHistogram LatencyHistogram::get() {
+  LibPushLatencyHistogram histogram;
+  for (int i = 0; i < LIBPUSH_LATENCY_BUCKETS; ++i) {
+    histogram.buckets[i] = this->buckets[i].load(memory_order_relaxed);
+  }
+  histogram.count = this->count.load(memory_order_relaxed);
+  histogram.total_ns = this->total_ns.load(memory_order_relaxed);
+  histogram.max_ns = this->max_ns.load(memory_order_relaxed);
+  return histogram;
+}
+
+void LatencyHistogram::reset() {
+  for (auto &bucket : this->buckets) {
+    bucket.store(0, memory_order_relaxed);
+  }
+  this->count.store(0, memory_order_relaxed);
+  this->total_ns.store(0, memory_order_relaxed);
+  this->max_ns.store(0, memory_order_relaxed);
+}
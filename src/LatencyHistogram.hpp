@@ -0,0 +1,36 @@
+#pragma once
+#include "push.h"
+#include <atomic>
+#include <chrono>
+
+/// \returns The current monotonic time in nanoseconds
+inline unsigned long long monotonic_time_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Counts latencies in power of 2 nanosecond buckets
+///
+/// Recording is lock-free so it can be done on the MIDI input thread, gesture timers
+/// and emitting threads at once, while other threads read the histogram
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  /// \param latency_ns The latency to count
+  /// \notes May be called from any number of threads at once
+  void record(unsigned long long latency_ns);
+
+  /// \returns A copy of the histogram
+  LibPushLatencyHistogram get();
+
+  /// \effects Clears all counts
+  void reset();
+
+private:
+  std::atomic<unsigned long long> buckets[LIBPUSH_LATENCY_BUCKETS];
+  std::atomic<unsigned long long> count;
+  std::atomic<unsigned long long> total_ns;
+  std::atomic<unsigned long long> max_ns;
+};
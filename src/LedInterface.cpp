@@ -1,98 +1,320 @@
 #include "LedInterface.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 using namespace std;
 
-LedInterface::LedInterface(MidiInterface &midi, SysexInterface &sysex)
-    : sysex(sysex), midi(midi) {
-  sysex.register_command_with_reply(LedSysex::GET_LED_COLOR_PALETTE_ENTRY);
+LedInterface::LedInterface(MidiInterface &midi, SysexInterface &sysex,
+                           SettingsCache &settings)
+    : sysex(sysex), midi(midi), settings(settings), reflex_count(0),
+      message(3) {
+  for (int i = 0; i < SHADOWED_LEDS; ++i) {
+    MidiMsgType msg_type =
+        i < 128 ? MidiMsgType::note_on : MidiMsgType::cc;
+    LedShadow &led = this->shadow[i];
+    // Leds that were never set are restored to off
+    led.message = format(msg_type, i & 0x7F, 0);
+    led.known = false;
+    led.has_reflex = false;
+    led.showing_reflex = false;
+    led.restore = true;
+  }
+  // Palette replies start with the index, so a lost reply only fails its own read
+  sysex.register_command_with_reply(LedSysex::GET_LED_COLOR_PALETTE_ENTRY, 1);
   sysex.register_command_with_reply(LedSysex::GET_LED_BRIGHTNESS);
   sysex.register_command_with_reply(LedSysex::GET_LED_WHITE_BALANCE);
 }
 
 void LedInterface::set_led_color_palette_entry(byte color_index,
                                                LibPushLedColor color) {
-  midi_msg args({color_index});
+  bool written = this->settings.write(
+      this->settings.palette[color_index & 0x7F], color, [&] {
+        sysex.sysex_call(format_palette_entry(color_index, color));
+      });
+  if (written) {
+    this->settings.remember(this->settings.palette_changed, true);
+  }
+}
 
-  args.push_back(color.r & 0x7F);
-  args.push_back(color.r >> 7);
-  args.push_back(color.g & 0x7F);
-  args.push_back(color.g >> 7);
-  args.push_back(color.b & 0x7F);
-  args.push_back(color.b >> 7);
-  args.push_back(color.w & 0x7F);
-  args.push_back(color.w >> 7);
+void LedInterface::set_led_color_palette_entries(byte first, byte count,
+                                                 const LibPushLedColor *colors,
+                                                 bool reapply) {
+  // Entries Push already has are left out of the batch
+  size_t written = this->settings.write_each(
+      this->settings.palette, first, count, colors,
+      [&](const bitset<LED_PALETTE_ENTRIES> &changed) {
+        SysexBatch batch;
+        for (byte i = 0; i < count; ++i) {
+          if (!changed[first + i]) {
+            continue;
+          }
+          batch.add(format_palette_entry(first + i, colors[i]));
+        }
+        if (reapply) {
+          batch.add(ReapplyPalette::format());
+        }
+        sysex.send_batch(batch);
+      });
 
-  sysex.sysex_call(LedSysex::SET_LED_COLOR_PALETTE_ENTRY, args);
+  if (written) {
+    this->settings.remember(this->settings.palette_changed, !reapply);
+  } else if (reapply) {
+    this->reapply_color_palette();
+  }
 }
 
 LibPushLedColor LedInterface::get_led_color_palette_entry(byte color_index) {
+  return this->settings.read(this->settings.palette[color_index & 0x7F], [&] {
+    midi_msg reply = sysex.sysex_call(GetPaletteEntry::format(color_index));
+    return parse_palette_entry(reply);
+  });
+}
+
+void LedInterface::get_led_color_palette_entries(byte first, byte count,
+                                                 LibPushLedColor *colors) {
+  // Every request is sent before the first reply is waited for
+  vector<future<midi_msg>> replies(count);
+  for (byte i = 0; i < count; ++i) {
+    if (this->settings.lookup(this->settings.palette[first + i], colors[i])) {
+      continue;
+    }
+    replies[i] = sysex.sysex_call_async(GetPaletteEntry::format(first + i));
+  }
+
+  for (byte i = 0; i < count; ++i) {
+    if (replies[i].valid()) {
+      colors[i] = parse_palette_entry(
+          sysex.get_reply(replies[i], GetPaletteEntry::command));
+      this->settings.learn(this->settings.palette[first + i], colors[i]);
+    }
+  }
+}
+
+void LedInterface::get_led_color_palette_entry_async(
+    byte color_index, LibPushPaletteEntryCallback cb, void *context) {
+  LibPushLedColor color;
+  if (this->settings.lookup(this->settings.palette[color_index & 0x7F],
+                            color)) {
+    cb(color_index, color, true, context);
+    return;
+  }
+
+  auto request = make_unique<PaletteRequest>();
+  request->settings = &this->settings;
+  request->color_index = color_index;
+  request->cb = cb;
+  request->context = context;
+
+  sysex.sysex_call_async(GetPaletteEntry::format(color_index),
+                         &LedInterface::complete_palette_request,
+                         request.get());
+  request.release(); // Deleted by complete_palette_request
+}
+
+LibPushLedColor LedInterface::parse_palette_entry(const midi_msg &reply) {
   LibPushLedColor color;
-  midi_msg args({color_index});
-  midi_msg reply =
-      sysex.sysex_call(LedSysex::GET_LED_COLOR_PALETTE_ENTRY, args);
-  // Color data starts at second byte of reply args
-  color.r = (reply[1] & 0x7F) | (reply[2] << 7);
-  color.g = (reply[3] & 0x7F) | (reply[4] << 7);
-  color.b = (reply[5] & 0x7F) | (reply[6] << 7);
-  color.w = (reply[7] & 0x7F) | (reply[8] << 7);
+  // Color data starts after the echoed index
+  color.r = GetPaletteEntry::reply_field<1>(reply);
+  color.g = GetPaletteEntry::reply_field<2>(reply);
+  color.b = GetPaletteEntry::reply_field<3>(reply);
+  color.w = GetPaletteEntry::reply_field<4>(reply);
   return color;
 }
 
+void LedInterface::complete_palette_request(const midi_msg *reply,
+                                            void *context) {
+  unique_ptr<PaletteRequest> request(static_cast<PaletteRequest *>(context));
+  LibPushLedColor color = {};
+  bool replied =
+      reply && reply->size() >= GetPaletteEntry::Replies::length;
+  if (replied) {
+    color = parse_palette_entry(*reply);
+    request->settings->learn(
+        request->settings->palette[request->color_index & 0x7F], color);
+  }
+  request->cb(request->color_index, color, replied, request->context);
+}
+
 void LedInterface::reapply_color_palette() {
-  midi_msg args;
-  sysex.sysex_call(LedSysex::REAPPLY_COLOR_PALETTE, args);
+  this->settings.write(this->settings.palette_changed, false, [&] {
+    sysex.sysex_call(ReapplyPalette::format());
+  });
 }
 
 void LedInterface::set_global_led_brightness(byte brightness) {
-  midi_msg args({brightness});
-  sysex.sysex_call(LedSysex::SET_LED_BRIGHTNESS, args);
+  this->settings.write(this->settings.led_brightness, brightness, [&] {
+    sysex.sysex_call(SetBrightness::format(brightness));
+  });
 }
 
 byte LedInterface::get_global_led_brightness() {
-  midi_msg args;
-  midi_msg reply = sysex.sysex_call(LedSysex::GET_LED_BRIGHTNESS, args);
-  return reply[0];
+  return this->settings.read(this->settings.led_brightness, [&] {
+    midi_msg reply = sysex.sysex_call(GetBrightness::format());
+    return (byte)GetBrightness::reply_field<0>(reply);
+  });
 }
 
 void LedInterface::set_led_pwm_freq(int freq) {
-  midi_msg args;
-  // Calculate correction factor from frequency according to formula
-  // found in push interface documentation
-  uint correction_factor = (5000000 / freq) - 42752;
-  correction_factor &= 0x1FFFFF; // Keep only the first 21 bits
-
-  uint low_seven = correction_factor & 0x7F;
-  uint mid_seven = (correction_factor & 0x3F80) >> 7;
-  uint high_seven = (correction_factor & 0x1FC000) >> 14;
-
-  args.push_back(low_seven);
-  args.push_back(mid_seven);
-  args.push_back(high_seven);
-  sysex.sysex_call(LedSysex::SET_LED_PWM_FREQ_CORRECTION, args);
+  if (freq < LED_PWM_FREQ_MIN || freq > LED_PWM_FREQ_MAX) {
+    throw runtime_error("The led pwm frequency must be between " +
+                        to_string(LED_PWM_FREQ_MIN) + " and " +
+                        to_string(LED_PWM_FREQ_MAX) + " Hz");
+  }
+  this->settings.write(this->settings.led_pwm_freq, freq, [&] {
+    sysex.sysex_call(SetPwmFreqCorrection::format(pwm_correction(freq)));
+  });
 }
 
 void LedInterface::set_led_white_balance(LedColorGroup color_group,
                                          unsigned short balance_factor) {
-  midi_msg args({color_group});
   balance_factor &= 0x7FF; // Keep only the first 11 bits
-  args.push_back(balance_factor & 0x7F);
-  args.push_back(balance_factor >> 7);
-  sysex.sysex_call(LedSysex::SET_LED_WHITE_BALANCE, args);
+  CachedSetting<unsigned short> &setting =
+      this->settings.white_balance[color_group % LED_WHITE_BALANCE_GROUPS];
+  this->settings.write(setting, balance_factor, [&] {
+    sysex.sysex_call(SetWhiteBalance::format(color_group, balance_factor));
+  });
 }
 
 unsigned short LedInterface::get_led_white_balance(LedColorGroup color_group) {
-  midi_msg args({color_group});
-  midi_msg reply = sysex.sysex_call(LedSysex::GET_LED_WHITE_BALANCE, args);
-  return (reply[0] | (reply[1] << 7));
+  CachedSetting<unsigned short> &setting =
+      this->settings.white_balance[color_group % LED_WHITE_BALANCE_GROUPS];
+  return this->settings.read(setting, [&] {
+    midi_msg reply = sysex.sysex_call(GetWhiteBalance::format(color_group));
+    return (unsigned short)GetWhiteBalance::reply_field<0>(reply);
+  });
+}
+
+void LedInterface::add_settings(const DeviceSettings &settings,
+                                SysexBatch &batch) {
+  if (settings.led_brightness.known) {
+    batch.add(SetBrightness::format(settings.led_brightness.value));
+  }
+  if (settings.led_pwm_freq.known) {
+    batch.add(SetPwmFreqCorrection::format(
+        pwm_correction(settings.led_pwm_freq.value)));
+  }
+  for (byte group = 0; group < LED_WHITE_BALANCE_GROUPS; ++group) {
+    if (settings.white_balance[group].known) {
+      batch.add(
+          SetWhiteBalance::format(group, settings.white_balance[group].value));
+    }
+  }
+
+  bool palette_changed = false;
+  for (byte i = 0; i < LED_PALETTE_ENTRIES; ++i) {
+    if (settings.palette[i].known) {
+      batch.add(format_palette_entry(i, settings.palette[i].value));
+      palette_changed = true;
+    }
+  }
+  if (palette_changed) {
+    batch.add(ReapplyPalette::format());
+  }
 }
 
 void LedInterface::set_led_color(MidiMsgType msg_type, uint midi_number,
                                  LibPushLedAnimation animation,
                                  uint color_index) {
-  midi_msg message;
   byte animation_byte = animation.type + animation.duration;
-  message.push_back(msg_type | animation_byte);
-  message.push_back(midi_number);
-  message.push_back(color_index);
-  this->midi.send_message(message);
+  lock_guard<mutex> guard(this->led_lock);
+  LedShadow &led = this->shadow[shadow_index(msg_type, midi_number)];
+  led.message = format(msg_type | animation_byte, midi_number, color_index);
+  led.known = true;
+  if (!led.showing_reflex) {
+    this->send(led.message);
+  }
+}
+
+int LedInterface::get_led_color(MidiMsgType msg_type, uint midi_number) {
+  lock_guard<mutex> guard(this->led_lock);
+  const LedShadow &led = this->shadow[shadow_index(msg_type, midi_number)];
+  // The animation is in the channel of the status byte
+  if (!led.known || (led.message[0] & 0x0F)) {
+    return -1;
+  }
+  return led.message[2];
+}
+
+void LedInterface::set_reflex(MidiMsgType msg_type, uint midi_number,
+                              const LibPushLedReflex &reflex) {
+  byte animation_byte =
+      reflex.press_animation.type + reflex.press_animation.duration;
+  lock_guard<mutex> guard(this->led_lock);
+  LedShadow &led = this->shadow[shadow_index(msg_type, midi_number)];
+  if (led.has_reflex != reflex.enabled) {
+    this->reflex_count.fetch_add(reflex.enabled ? 1 : -1);
+  }
+
+  led.has_reflex = reflex.enabled;
+  led.restore = reflex.release != LibPushReflexRelease::LP_REFLEX_SET;
+  led.press_message = format(msg_type | animation_byte, midi_number,
+                             reflex.press_color & 0x7F);
+  led.release_message =
+      format(msg_type, midi_number, reflex.release_color & 0x7F);
+
+  // A reflex that is removed while it shows would never end
+  if (!led.has_reflex && led.showing_reflex) {
+    led.showing_reflex = false;
+    this->send(led.message);
+  }
+}
+
+void LedInterface::trigger_reflex(MidiMsgType msg_type, uint midi_number,
+                                  bool pressed) {
+  if (!this->reflex_count.load(memory_order_acquire)) {
+    return;
+  }
+
+  lock_guard<mutex> guard(this->led_lock);
+  LedShadow &led = this->shadow[shadow_index(msg_type, midi_number)];
+  if (!led.has_reflex) {
+    return;
+  }
+
+  try {
+    if (pressed) {
+      led.showing_reflex = true;
+      this->send(led.press_message);
+    } else if (led.showing_reflex) {
+      led.showing_reflex = false;
+      if (!led.restore) {
+        led.message = led.release_message;
+        led.known = true;
+      }
+      this->send(led.message);
+    }
+  } catch (exception &ex) {
+    // Input replayed without a connection has no leds to show reflexes on
+    cerr << "Exception while showing led reflex: " << ex.what() << endl;
+  }
+}
+
+LedInterface::SetPaletteEntry::Message
+LedInterface::format_palette_entry(byte color_index,
+                                   const LibPushLedColor &color) {
+  return SetPaletteEntry::format(color_index, color.r, color.g, color.b,
+                                 color.w);
+}
+
+uint LedInterface::pwm_correction(int freq) {
+  // Calculate correction factor from frequency according to formula
+  // found in push interface documentation. SysexU21 keeps the first 21 bits
+  return (5000000 / freq) - 42752;
+}
+
+int LedInterface::shadow_index(MidiMsgType msg_type, uint midi_number) {
+  return (msg_type == MidiMsgType::cc ? 128 : 0) + (midi_number & 0x7F);
+}
+
+array<byte, 3> LedInterface::format(byte status, uint midi_number,
+                                    uint color_index) {
+  return {{status, (byte)midi_number, (byte)color_index}};
+}
+
+void LedInterface::send(const array<byte, 3> &message) {
+  copy(message.begin(), message.end(), this->message.begin());
+  this->midi.send_message(this->message);
 }
@@ -1,7 +1,13 @@
 #pragma once
 #include "MidiMsg.hpp"
 #include "RtMidi.h"
+#include "SettingsCache.hpp"
 #include "SysexInterface.hpp"
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#define SHADOWED_LEDS 256 //< Note leds (0-127), then cc leds (128-255)
 
 /// Responsible for controlling Push's white and rgb leds
 class LedInterface {
@@ -17,6 +23,29 @@ public:
     GET_LED_WHITE_BALANCE = 0x15
   };
 
+  /// Index, then the red, green, blue and white values of the entry
+  using SetPaletteEntry =
+      SysexCommand<SET_LED_COLOR_PALETTE_ENTRY,
+                   SysexLayout<SysexU7, SysexU14, SysexU14, SysexU14, SysexU14>>;
+  /// Replies with the index, then the red, green, blue and white values of the entry
+  using GetPaletteEntry =
+      SysexCommand<GET_LED_COLOR_PALETTE_ENTRY, SysexLayout<SysexU7>,
+                   SysexLayout<SysexU7, SysexU14, SysexU14, SysexU14, SysexU14>>;
+  using ReapplyPalette = SysexCommand<REAPPLY_COLOR_PALETTE>;
+  using SetBrightness =
+      SysexCommand<SET_LED_BRIGHTNESS, SysexLayout<SysexU7>>;
+  using GetBrightness =
+      SysexCommand<GET_LED_BRIGHTNESS, SysexLayout<>, SysexLayout<SysexU7>>;
+  /// The correction factor computed from the pwm frequency
+  using SetPwmFreqCorrection =
+      SysexCommand<SET_LED_PWM_FREQ_CORRECTION, SysexLayout<SysexU21>>;
+  /// Color group, then balance factor
+  using SetWhiteBalance =
+      SysexCommand<SET_LED_WHITE_BALANCE, SysexLayout<SysexU7, SysexU14>>;
+  /// Replies with the balance factor of the color group
+  using GetWhiteBalance = SysexCommand<GET_LED_WHITE_BALANCE, SysexLayout<SysexU7>,
+                                       SysexLayout<SysexU14>>;
+
   enum LedColorGroup : byte {
     RGB_BTN_RED = 0,
     RGB_BTN_GREEN = 1,
@@ -31,7 +60,8 @@ public:
     TOUCH_STRIP = 10,
   };
 
-  LedInterface(MidiInterface &midi, SysexInterface &sysex);
+  LedInterface(MidiInterface &midi, SysexInterface &sysex,
+               SettingsCache &settings);
 
   /// Set an LED color palette entry
   ///
@@ -42,18 +72,52 @@ public:
   /// Reapply color palette is called
   /// \param color_index (0-127) the index of the color entry in the palette
   /// \param color the color to set the entry to
-  /// \effects Sets the palette entry at color_index to color. Change will not be visible until reapply_color_palette is called
+  /// \effects Sets the palette entry at color_index to color. Change will not be visible until reapply_color_palette is called.
+  /// Nothing is sent if the entry already has the color
   void set_led_color_palette_entry(byte color_index, LibPushLedColor color);
 
+  /// Set consecutive LED color palette entries
+  ///
+  /// \param first (0-127) The index of the first entry to set
+  /// \param count The number of entries to set, at most 128 - first
+  /// \param colors The color of each entry
+  /// \param reapply Whether to reapply the color palette after setting the entries
+  /// \effects Sends the entries that change in as few writes as the connection allows
+  void set_led_color_palette_entries(byte first, byte count,
+                                     const LibPushLedColor *colors,
+                                     bool reapply);
+
   /// Get an LED color palette entry
   ///
   /// \param color_index (0-127) the idnex of the color entry in the palette to get
-  /// \returns The color of the palette entry at color_index
+  /// \returns The color of the palette entry at color_index, read from Push only if it isn't cached
   LibPushLedColor get_led_color_palette_entry(byte color_index);
 
+  /// Get consecutive LED color palette entries
+  ///
+  /// \param first (0-127) The index of the first entry to get
+  /// \param count The number of entries to get, at most 128 - first
+  /// \param colors Filled with the color of each entry
+  /// \effects Sends a request for every entry that isn't cached before waiting for the replies,
+  /// so the entries are read in about one round trip
+  /// \throws An [std::runtime_error]() exception if a reply is lost or doesn't arrive in time
+  void get_led_color_palette_entries(byte first, byte count,
+                                     LibPushLedColor *colors);
+
+  /// Get an LED color palette entry without waiting for it
+  ///
+  /// \param color_index (0-127) The index of the color entry in the palette to get
+  /// \param cb Called on the MIDI input thread with the color of the entry,
+  /// or before returning if the entry is cached
+  /// \param context A pointer passed to cb
+  void get_led_color_palette_entry_async(byte color_index,
+                                         LibPushPaletteEntryCallback cb,
+                                         void *context);
+
   /// Update the color palette to use new colors
   ///
-  /// \effects All leds using a palette entry that was set to a different color since the last call to reapply_color_palette will be updated to the new color
+  /// \effects All leds using a palette entry that was set to a different color since the last call to reapply_color_palette will be updated to the new color.
+  /// Nothing is sent if no entry changed
   void reapply_color_palette();
 
   /// Sets the brightness of all Push's leds
@@ -63,13 +127,14 @@ public:
 
   /// Get the global brightness of Push's leds
   ///
-  /// \returns (0-127) The current global brightness
+  /// \returns (0-127) The current global brightness, read from Push only if it isn't cached
   byte get_global_led_brightness();
 
   /// Sets the led pwm frequency
   ///
   /// Used to avoid conflicts with the shuttering frequency of video cameras
   /// \param (20-116) The pwm frequency in Hz
+  /// \throws An [std::runtime_error]() exception if freq is out of range
   void set_led_pwm_freq(int freq);
 
   /// Sets the led white balance
@@ -84,13 +149,101 @@ public:
   /// Gets the led white balance
   ///
   /// \param color_group Which led color group to get the balance factor for
-  /// \returns (0-1024) A white balance factor
+  /// \returns (0-1024) A white balance factor, read from Push only if it isn't cached
   unsigned short get_led_white_balance(LedColorGroup color_group);
 
+  /// \param settings Settings to write
+  /// \param batch Filled with the commands that write the known brightness, pwm frequency,
+  /// white balance and palette settings. The palette is reapplied after its entries
+  static void add_settings(const DeviceSettings &settings, SysexBatch &batch);
+
+  /// \param msg_type note_on for pad leds, cc for button leds
+  /// \param midi_number (0-127) The number of the led
+  /// \param animation The animation to use
+  /// \param color_index (0-127) The index of the color in the palette
+  /// \effects Sets the led and remembers its color. While a reflex is showing on the led,
+  /// the color is only shown when the reflex ends
   void set_led_color(MidiMsgType msg_type, uint midi_number,
                      LibPushLedAnimation animation, uint color_index);
 
+  /// \param msg_type note_on for pad leds, cc for button leds
+  /// \param midi_number (0-127) The number of the led
+  /// \returns The color the led was last set to, or -1 if it was never set or is animated
+  int get_led_color(MidiMsgType msg_type, uint midi_number);
+
+  /// \param msg_type note_on for pad leds, cc for button leds
+  /// \param midi_number (0-127) The number of the led
+  /// \param reflex What the led shows when its pad or button is pressed and released
+  /// \effects Preformats the press and release messages so a trigger is a single write
+  void set_reflex(MidiMsgType msg_type, uint midi_number,
+                  const LibPushLedReflex &reflex);
+
+  /// \param msg_type note_on for pad leds, cc for button leds
+  /// \param midi_number (0-127) The number of the led
+  /// \param pressed Whether the pad or button was pressed or released
+  /// \effects Shows the led's reflex, if it has one
+  /// \notes Called on the MIDI input thread. Doesn't lock while no led has a reflex
+  void trigger_reflex(MidiMsgType msg_type, uint midi_number, bool pressed);
+
 private:
+  /// What the library knows about a led
+  struct LedShadow {
+    std::array<byte, 3> message; //< The message the led was last set with
+    bool known; //< Whether the led was set since connecting
+    bool has_reflex;
+    bool showing_reflex; //< Whether the led shows press_message instead of message
+    bool restore; //< Whether a release shows message, or sets it to release_message
+    std::array<byte, 3> press_message;
+    std::array<byte, 3> release_message;
+  };
+
   MidiInterface &midi;
   SysexInterface &sysex;
+  SettingsCache &settings;
+
+  std::mutex led_lock; //< Guards shadow and message
+  std::array<LedShadow, SHADOWED_LEDS> shadow;
+  std::atomic<int> reflex_count; //< The number of leds with a reflex
+  midi_msg message; //< Reused for every led message
+
+  /// A palette entry read with get_led_color_palette_entry_async
+  struct PaletteRequest {
+    SettingsCache *settings; //< Remembers the color once it's read
+    byte color_index;
+    LibPushPaletteEntryCallback cb;
+    void *context;
+  };
+
+  /// \param color_index The index of the palette entry
+  /// \param color The color of the entry
+  /// \returns The message that sets the entry
+  static SetPaletteEntry::Message format_palette_entry(byte color_index,
+                                                       const LibPushLedColor &color);
+
+  /// \param freq (20-116) The pwm frequency in Hz
+  /// \returns The correction factor Push takes instead of the frequency
+  static uint pwm_correction(int freq);
+
+  /// \param reply The reply to GET_LED_COLOR_PALETTE_ENTRY
+  /// \returns The color in the reply
+  /// \throws An [std::runtime_error]() exception if the reply is too short
+  static LibPushLedColor parse_palette_entry(const midi_msg &reply);
+
+  /// \effects Passes the reply to the callback of the PaletteRequest passed as context, then deletes it
+  static void complete_palette_request(const midi_msg *reply, void *context);
+
+  /// \returns The index of the led in shadow
+  static int shadow_index(MidiMsgType msg_type, uint midi_number);
+
+  /// \param status The status byte, including the animation
+  /// \param midi_number The number of the led
+  /// \param color_index The index of the color in the palette
+  /// \returns The message that sets the led
+  static std::array<byte, 3> format(byte status, uint midi_number,
+                                    uint color_index);
+
+  /// \param message A preformatted led message
+  /// \effects Writes the message
+  /// \requires led_lock is held
+  void send(const std::array<byte, 3> &message);
 };
@@ -0,0 +1,51 @@
+#include "LedReflexes.hpp"
+#include "ButtonInterface.hpp"
+#include "PadInterface.hpp"
+
+using namespace std;
+
+LedReflexes::LedReflexes(LedInterface &leds) : leds(leds) {}
+
+void LedReflexes::set_pad_reflex(unsigned long long pads,
+                                 const LibPushLedReflex &reflex) {
+  for (int pad = 0; pad < LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM;
+       ++pad) {
+    if (pads & (1ULL << pad)) {
+      uint n = PadInterface::pad_coordinates_to_number(
+          pad % LIBPUSH_PAD_MATRIX_DIM, pad / LIBPUSH_PAD_MATRIX_DIM);
+      this->leds.set_reflex(MidiMsgType::note_on, n, reflex);
+    }
+  }
+}
+
+bool LedReflexes::set_button_reflex(LibPushButton btn, int index,
+                                    const LibPushLedReflex &reflex) {
+  int n = ButtonInterface::get_button_number(btn, index);
+  if (n < 0) {
+    return false;
+  }
+  this->leds.set_reflex(MidiMsgType::cc, n, reflex);
+  return true;
+}
+
+void LedReflexes::observe(const LibPushPadEvent &event) {
+  if (event.event_type == LibPushPadEventType::LP_PAD_AFTERTOUCH) {
+    return;
+  }
+
+  // A note on with a velocity of 0 is a release
+  bool pressed = event.event_type == LibPushPadEventType::LP_PAD_PRESSED &&
+                 event.velocity;
+  uint n = PadInterface::pad_coordinates_to_number(event.x, event.y);
+  this->leds.trigger_reflex(MidiMsgType::note_on, n, pressed);
+}
+
+void LedReflexes::observe(const LibPushButtonEvent &event) {
+  int n = ButtonInterface::get_button_number(event.button, event.index);
+  if (n < 0) {
+    return;
+  }
+  this->leds.trigger_reflex(
+      MidiMsgType::cc, n,
+      event.event_type == LibPushButtonEventType::LP_BTN_PRESSED);
+}
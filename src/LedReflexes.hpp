@@ -0,0 +1,32 @@
+#pragma once
+#include "EventObserver.hpp"
+#include "LedInterface.hpp"
+#include "push.h"
+
+/// Shows led reflexes for pad and button presses
+///
+/// Added as a forwarder of the pad and button listeners, so a press changes its led
+/// on the MIDI input thread right after it is decoded, before callbacks are called.
+/// The reflexes themselves are kept by LedInterface, with the colors the leds were set to
+class LedReflexes : public EventObserver {
+public:
+  LedReflexes(LedInterface &leds);
+
+  /// \param pads A bit for each pad to set the reflex for, bit y * 8 + x for the pad at (x, y)
+  /// \param reflex What the pads' leds show when they are pressed and released
+  void set_pad_reflex(unsigned long long pads, const LibPushLedReflex &reflex);
+
+  /// \param btn The button to set the reflex for
+  /// \param index (0-7) Only relevant for buttons with type LP_DISPLAY_TOP, LP_DISPLAY_BOTTOM, or LP_SCENE_BTN
+  /// \param reflex What the button's led shows when it is pressed and released
+  /// \returns false if btn and index don't name a button
+  bool set_button_reflex(LibPushButton btn, int index,
+                         const LibPushLedReflex &reflex);
+
+  /// \effects Shows the reflex of the pressed or released pad or button
+  void observe(const LibPushPadEvent &event) override;
+  void observe(const LibPushButtonEvent &event) override;
+
+private:
+  LedInterface &leds;
+};
@@ -0,0 +1,127 @@
+#include "MidiForwarder.hpp"
+#include "EncoderInterface.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+MidiForwarder::MidiForwarder() : sources(0), config(), message(3) {
+  this->held_notes.fill(-1);
+}
+
+void MidiForwarder::start(unique_ptr<MidiOutput> output,
+                          const LibPushForwardingConfig &config) {
+  this->stop();
+
+  lock_guard<mutex> guard(this->output_lock);
+  this->output = move(output);
+  this->config = config;
+  this->config.channel &= 0x0F;
+  this->sources.store(this->config.sources, memory_order_release);
+}
+
+void MidiForwarder::stop() {
+  lock_guard<mutex> guard(this->output_lock);
+  this->sources.store(0, memory_order_release);
+  this->config.sources = 0;
+  if (!this->output) {
+    return;
+  }
+
+  unsigned long long now = monotonic_time_ns();
+  for (int &note : this->held_notes) {
+    if (note >= 0) {
+      this->send(MidiMsgType::note_off, note, 0, now);
+      note = -1;
+    }
+  }
+  this->output.reset();
+}
+
+void MidiForwarder::observe(const LibPushPadEvent &event) {
+  if (!this->forwards(LP_PAD_EVENT)) {
+    return;
+  }
+
+  lock_guard<mutex> guard(this->output_lock);
+  if (!this->output || !(this->config.sources & (1 << LP_PAD_EVENT))) {
+    return;
+  }
+
+  int &held = this->held_notes[event.y * LIBPUSH_PAD_MATRIX_DIM + event.x];
+  if (event.event_type == LP_PAD_AFTERTOUCH) {
+    if (held >= 0) {
+      this->send(MidiMsgType::aftertouch, held, event.velocity,
+                 event.timestamp);
+    }
+    return;
+  }
+
+  // A press of a held pad ends its note first. A note on with a velocity of 0 is a release
+  if (held >= 0) {
+    this->send(MidiMsgType::note_off, held, 0, event.timestamp);
+    held = -1;
+  }
+  if (event.event_type == LP_PAD_PRESSED && event.velocity &&
+      event.note >= 0) {
+    held = event.note;
+    this->send(MidiMsgType::note_on, held, event.velocity, event.timestamp);
+  }
+}
+
+void MidiForwarder::observe(const LibPushEncoderEvent &event) {
+  if (!this->forwards(LP_ENCODER_EVENT) ||
+      event.event_type != LP_ENCODER_MOVED) {
+    return;
+  }
+
+  lock_guard<mutex> guard(this->output_lock);
+  int steps = EncoderInterface::get_steps(event);
+  int number = this->config.encoder_cc + event.index;
+  if (!this->output || !(this->config.sources & (1 << LP_ENCODER_EVENT)) ||
+      !steps || number > 127) {
+    return;
+  }
+
+  // Relative values are sent the way Push sends them, as 7 bit two's complement
+  steps = min(max(steps, -64), 63);
+  this->send(MidiMsgType::cc, number, steps & 0x7F, event.timestamp);
+}
+
+void MidiForwarder::observe(const LibPushTouchStripEvent &event) {
+  if (!this->forwards(LP_TOUCH_STRIP_EVENT) ||
+      event.event_type != LP_TOUCH_STRIP_MOVED) {
+    return;
+  }
+
+  lock_guard<mutex> guard(this->output_lock);
+  if (!this->output || !(this->config.sources & (1 << LP_TOUCH_STRIP_EVENT))) {
+    return;
+  }
+
+  long bend = lround(event.position * 8192) + 8192; //(-1.0 - 1.0) -> (0-16383)
+  bend = min(max(bend, 0L), 16383L);
+  this->send(MidiMsgType::pitch_bend, bend & 0x7F, bend >> 7,
+             event.timestamp);
+}
+
+bool MidiForwarder::forwards(LibPushEventType type) const {
+  return this->sources.load(memory_order_acquire) & (1 << type);
+}
+
+LatencyHistogram &MidiForwarder::get_latency() { return this->latency; }
+
+void MidiForwarder::send(byte status, byte data1, byte data2,
+                         unsigned long long timestamp) {
+  this->message[0] = status | this->config.channel;
+  this->message[1] = data1;
+  this->message[2] = data2;
+  try {
+    this->output->send(this->message);
+  } catch (exception &ex) {
+    cerr << "Exception while forwarding midi: " << ex.what() << endl;
+    return;
+  }
+  this->latency.record(monotonic_time_ns() - timestamp);
+}
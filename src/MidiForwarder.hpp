@@ -0,0 +1,65 @@
+#pragma once
+#include "EventObserver.hpp"
+#include "LatencyHistogram.hpp"
+#include "MidiMsg.hpp"
+#include "MidiTransport.hpp"
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#define FORWARDED_PADS (LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM)
+
+/// Translates input events into MIDI messages and writes them to another output
+///
+/// Set as the forwarder of the pad, encoder and touch strip listeners, so events are
+/// translated on the MIDI input thread before they are delivered. Messages are built in
+/// a buffer that is reused, so forwarding doesn't allocate.
+///
+/// The note each pad press was forwarded with is kept until the pad is released,
+/// so a layout change while a pad is held doesn't leave a note hanging
+class MidiForwarder : public EventObserver {
+public:
+  MidiForwarder();
+
+  /// \param output Where to write forwarded messages
+  /// \param config Which input to forward and how
+  /// \effects Stops any running forwarding and starts forwarding to output
+  void start(std::unique_ptr<MidiOutput> output,
+             const LibPushForwardingConfig &config);
+
+  /// \effects Sends note offs for forwarded notes that are still held, then stops forwarding
+  void stop();
+
+  /// \effects Forwards the event if forwarding is running
+  void observe(const LibPushPadEvent &event) override;
+  void observe(const LibPushEncoderEvent &event) override;
+  void observe(const LibPushTouchStripEvent &event) override;
+
+  /// \returns The latency of forwarded messages, from the arrival of the input to the return of the write
+  LatencyHistogram &get_latency();
+
+private:
+  std::atomic<unsigned int>
+      sources; //< The forwarded sources, 0 while stopped. Lets other events skip the lock
+  std::mutex output_lock; //< Keeps the output and config from being replaced during a write
+  std::unique_ptr<MidiOutput> output;
+  LibPushForwardingConfig config; //< Read and written with output_lock held
+  midi_msg message;
+  std::array<int, FORWARDED_PADS> held_notes; //< The note forwarded for each held pad, or -1
+  LatencyHistogram latency;
+
+  /// \param type The type of an input event
+  /// \returns Whether events of the type were being forwarded when checked. Recheck config under output_lock before sending
+  bool forwards(LibPushEventType type) const;
+
+  /// \param status The status byte, without the channel
+  /// \param data1 The first data byte
+  /// \param data2 The second data byte
+  /// \param timestamp When the input that caused the message arrived
+  /// \effects Writes the message on the configured channel
+  /// \requires output_lock is held and output is set
+  void send(byte status, byte data1, byte data2,
+            unsigned long long timestamp);
+};
@@ -2,94 +2,174 @@
 
 using namespace std;
 
-const string COMMON_PORT_NAME = "Ableton Push 2";
-const vector<string> USER_PORT_STRINGS = {":1", "MIDI", "User"};
-
-MidiInterface::MidiInterface() : midi_in(nullptr), midi_out(nullptr) {}
+MidiInterface::MidiInterface() : transport(nullptr) { this->build_routes(); }
 
 void MidiInterface::connect(LibPushPort port) {
-  if (this->midi_in || this->midi_out) {
+  this->connect(make_unique<RtMidiTransport>(), port);
+}
+
+void MidiInterface::connect(unique_ptr<MidiTransport> transport,
+                            LibPushPort port) {
+  if (this->transport) {
     throw runtime_error("Can't connect to Push midi port if already connected");
   }
 
-  this->midi_in = make_unique<RtMidiIn>();
-  this->midi_out = make_unique<RtMidiOut>();
-
-  int in_port = MidiInterface::find_port(this->midi_in.get(), port);
-  int out_port = MidiInterface::find_port(this->midi_out.get(), port);
-
-  this->midi_in->openPort(in_port);
-  this->midi_in->setCallback(&MidiInterface::handle_midi_input, this);
-  this->midi_in->ignoreTypes(false, true, true); // Don't ignore sysex messages
-
-  this->midi_out->openPort(out_port);
+  this->build_routes();
+  transport->open(port, &MidiInterface::handle_midi_input, this);
+  this->transport = move(transport);
 }
 
 void MidiInterface::register_handler(MidiMessageHandler *handler) {
+  if (this->handlers.size() >= 255) {
+    throw runtime_error("Can't register more than 255 midi message handlers");
+  }
+
   this->handlers.push_back(handler);
+  if (this->transport) {
+    this->build_routes();
+  }
+}
+
+void MidiInterface::build_routes() {
+  for (uint status = 0; status < 256; ++status) {
+    for (uint data1 = 0; data1 < 128; ++data1) {
+      byte route = 0;
+      // Status bytes always have the high bit set
+      if (status & 0x80) {
+        for (size_t i = 0; i < this->handlers.size(); ++i) {
+          if (this->handlers[i]->accepts(status, data1)) {
+            route = i + 1;
+            break;
+          }
+        }
+      }
+      this->routes[status][data1] = route;
+    }
+  }
 }
 
 void MidiInterface::send_message(midi_msg &message) {
-  if (!this->midi_out) {
+  lock_guard<mutex> guard(this->send_lock);
+  if (!this->transport) {
     throw runtime_error("Can't send midi message with no connected output");
   }
-  this->midi_out->sendMessage(&message);
+  this->transport->send(message);
 }
 
-bool string_contains_any_substring(string s, vector<string> substrings) {
-  for (const auto &substr : substrings) {
-    if (s.find(substr) != string::npos) {
-      return true;
-    }
+void MidiInterface::send_message(const byte *message, size_t length) {
+  lock_guard<mutex> guard(this->send_lock);
+  if (!this->transport) {
+    throw runtime_error("Can't send midi message with no connected output");
   }
-  return false;
+  this->write_buffer.assign(message, message + length);
+  this->transport->send(this->write_buffer);
 }
 
-int MidiInterface::find_port(RtMidi *rtmidi, LibPushPort port) {
-  unsigned int port_count = rtmidi->getPortCount();
-  string port_name;
-  for (unsigned int i = 0; i < port_count; ++i) {
-    port_name = rtmidi->getPortName(i);
-    if (port_name.find(COMMON_PORT_NAME) != string::npos) {
-      if (port == LibPushPort::USER &&
-          string_contains_any_substring(port_name, USER_PORT_STRINGS)) {
-        return i;
-      } else if (port == LibPushPort::LIVE &&
-                 !string_contains_any_substring(port_name, USER_PORT_STRINGS)) {
-        return i;
-      }
-    }
+void MidiInterface::send_messages(midi_msg &buffer,
+                                  const vector<size_t> &message_ends) {
+  lock_guard<mutex> guard(this->send_lock);
+  if (!this->transport) {
+    throw runtime_error("Can't send midi message with no connected output");
+  }
+  if (message_ends.empty()) {
+    return;
+  }
+
+  size_t max_length = this->transport->get_max_write_length();
+  if (buffer.size() <= max_length) {
+    this->transport->send(buffer);
+    return;
   }
 
-  throw runtime_error(
-      "Can't find Push midi inputs and outputs for chosen port");
+  // Each write is as many whole messages as fit, or a single message
+  size_t start = 0;
+  size_t i = 0;
+  while (i < message_ends.size()) {
+    size_t end = message_ends[i++];
+    while (i < message_ends.size() && message_ends[i] - start <= max_length) {
+      end = message_ends[i++];
+    }
+    this->write_buffer.assign(buffer.begin() + start, buffer.begin() + end);
+    this->transport->send(this->write_buffer);
+    start = end;
+  }
 }
 
 void MidiInterface::disconnect() {
-  if (!this->midi_in || !this->midi_out) {
+  if (!this->transport) {
     throw runtime_error(
         "Can't disconnect from Push midi port unless already connected");
   }
 
-  this->midi_in.reset(nullptr);
-  this->midi_out.reset(nullptr);
+  this->transport->close();
+  lock_guard<mutex> guard(this->send_lock);
+  this->transport.reset(nullptr);
 }
 
 void MidiInterface::handle_midi_input(double delta, midi_msg *message,
                                       void *this_ptr) {
   MidiInterface *self = static_cast<MidiInterface *>(this_ptr);
 
+  if (message->empty()) {
+    return;
+  }
+
+  if (self->recorder.is_recording()) {
+    self->recorder.record(*message, monotonic_time_ns());
+  }
+
+  self->route_message(*message);
+}
+
+void MidiInterface::route_message(midi_msg &message) {
+  byte status = message[0];
+  byte data1 = message.size() > 1 ? message[1] & 0x7F : 0;
+  byte route = this->routes[status][data1];
+  if (!route) {
+    return;
+  }
+
+  // Taken before any decoding so that it's as close as possible to the message's arrival.
+  // Unrouted messages are filtered out first so they don't pay for reading the clock
+  unsigned long long timestamp = monotonic_time_ns();
+
   try {
-    for (const auto &handler : self->handlers) {
-      handler->handle_message(*message);
-    }
+    this->handlers[route - 1]->handle_message(message, timestamp);
   } catch (exception &ex) {
     cerr << "Exception on MIDI thread: " << ex.what() << endl;
   }
 }
 
+InputRecorder &MidiInterface::get_recorder() { return this->recorder; }
+
+size_t MidiInterface::replay(const string &path, bool original_timing) {
+  vector<InputRecorder::RecordedMessage> recording = InputRecorder::read(path);
+
+  auto start = chrono::steady_clock::now();
+  for (auto &recorded : recording) {
+    if (original_timing) {
+      this_thread::sleep_until(start +
+                               chrono::nanoseconds(recorded.offset_ns));
+    }
+    if (recorded.message.empty()) {
+      continue;
+    }
+
+    // Input from the transport's thread would be handled at the same time as the replay
+    if (!this->transport) {
+      this->route_message(recorded.message);
+    } else if (!this->transport->inject(recorded.message)) {
+      throw runtime_error(
+          "Can't replay a recording while connected to a device whose "
+          "input would be mixed with it");
+    }
+  }
+
+  return recording.size();
+}
+
 MidiInterface::~MidiInterface() {
-  if (this->midi_in && this->midi_out) {
+  if (this->transport) {
     this->disconnect();
   }
 }
@@ -1,11 +1,15 @@
 #pragma once
+#include "InputRecorder.hpp"
+#include "LatencyHistogram.hpp"
 #include "MidiMessageHandler.hpp"
 #include "MidiMessageListener.hpp"
 #include "MidiMsg.hpp"
-#include "RtMidi.h"
+#include "MidiTransport.hpp"
 #include "push.h"
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <string>
 
 /// An API for Midi I/O with Push
 ///
@@ -13,44 +17,91 @@
 /// Push also sends messages back to the host when the user
 /// interacts with pads, buttons, or the touch strip.
 /// These can be received by registering MidiMessageHandler instances with this class.
+///
+/// Each incoming message is routed to a single handler through a table indexed by
+/// the message's status byte and first data byte. The table is built when connecting.
 class MidiInterface {
 public:
   MidiInterface();
   ~MidiInterface();
 
   /// \param port The MIDI port to connect to (Live or User)
-  /// \effects Connect midi_in and midi_out to Push, setup callback for incoming MIDI
+  /// \effects Connect to Push over RtMidi, setup callback for incoming MIDI
   /// \requires Not already connected
   /// \throws An [std::runtime_error]() exception if a connection can't be made
   void connect(LibPushPort port);
 
+  /// \param transport The transport to send and receive messages with
+  /// \param port The MIDI port to connect to (Live or User)
+  /// \effects Opens the transport, setup callback for incoming MIDI
+  /// \requires Not already connected
+  /// \throws An [std::runtime_error]() exception if a connection can't be made
+  void connect(std::unique_ptr<MidiTransport> transport, LibPushPort port);
+
   /// \effects Clean up the MIDI input and output
   /// \requires Currently connected
   /// \throws An [std::runtime_error]() exception if not currently connected
   void disconnect();
 
   /// \params handler The handler to register
-  /// \effects Passes all incoming midi messages to the handler
+  /// \effects Passes incoming midi messages that the handler accepts to the handler,
+  /// unless a handler registered earlier accepts them
+  /// \requires Not called while MIDI input is being handled
   void register_handler(MidiMessageHandler *handler);
 
   /// Sends a raw midi message to the output
   ///
   /// \params message A vector of 3 bytes representing the midi message
   /// \effects Sends the message to the connected output
+  /// \notes Can be called from the MIDI input thread, e.g. for reflex leds
   void send_message(midi_msg &message);
 
+  /// Sends a message that was built outside a midi_msg, e.g. on the stack
+  ///
+  /// \param message The bytes of the message
+  /// \param length The number of bytes
+  /// \effects Copies the message into a buffer that is reused for every such message, then sends it
+  /// \throws An [std::runtime_error]() exception if not connected
+  void send_message(const byte *message, size_t length);
+
+  /// Sends consecutive sysex messages in as few writes as the transport allows
+  ///
+  /// \param buffer The messages, one after another
+  /// \param message_ends The offset one past the end of each message in buffer
+  /// \effects Writes as many whole messages at once as the transport accepts,
+  /// or each message on its own if it accepts one per write
+  /// \throws An [std::runtime_error]() exception if not connected
+  void send_messages(midi_msg &buffer, const std::vector<size_t> &message_ends);
+
+  /// \returns The recorder that incoming messages are passed to before they are handled
+  InputRecorder &get_recorder();
+
+  /// Feed a recording made with InputRecorder through the registered handlers
+  ///
+  /// \param path The recording to replay
+  /// \param original_timing Whether to wait between messages as long as when they were recorded,
+  /// or to replay them as fast as possible
+  /// \returns The number of messages replayed
+  /// \effects Handles each recorded message on the calling thread as if it had just arrived.
+  /// While connected, messages are injected through the transport so they are never handled
+  /// at the same time as its input
+  /// \throws An [std::runtime_error]() exception if the recording can't be read,
+  /// or if the connected transport can't inject input, e.g. a physical Push
+  size_t replay(const std::string &path, bool original_timing);
+
 private:
-  std::unique_ptr<RtMidiIn> midi_in;
-  std::unique_ptr<RtMidiOut> midi_out;
+  std::unique_ptr<MidiTransport> transport;
+  std::mutex send_lock; //< Serializes writes from the application and the input thread
+  midi_msg write_buffer; //< Holds the part of a batch or the message that is being written
   std::vector<MidiMessageHandler *> handlers;
+  InputRecorder recorder;
 
-  /// Find the given MIDI port
-  ///
-  /// \param rtmidi A pointer to either an RtMidiIn or RtMidiOut object
-  /// \param port The port to look for (Live or User)
-  /// \returns The index of the port
-  /// \throws An [std::runtime_error]() exception if the port is not found
-  static int find_port(RtMidi *rtmidi, LibPushPort port);
+  /// For each status byte and first data byte, 1 + the index of the handler
+  /// that accepts the message, or 0 if no handler accepts it
+  byte routes[256][128];
+
+  /// \effects Fills routes by asking each handler which messages it accepts
+  void build_routes();
 
   /// Handler called when a MIDI message is received from Push
   ///
@@ -60,4 +111,8 @@ private:
   /// \effects Delegates message handling to handlers
   static void handle_midi_input(double delta, midi_msg *message,
                                 void *this_ptr);
+
+  /// \param message A non-empty message
+  /// \effects Passes the message to the handler that accepts it, if any
+  void route_message(midi_msg &message);
 };
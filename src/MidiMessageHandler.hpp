@@ -4,7 +4,15 @@
 /// An interface for midi message handlers like SysexInterface, PadInterface, etc
 class MidiMessageHandler {
 public:
+  /// \param status The status byte of a message, including its channel
+  /// \param data1 The first data byte of the message, or 0 if it has none
+  /// \returns Whether the handler should receive messages that start with these bytes
+  /// \notes Used by MidiInterface to route each message to a single handler
+  virtual bool accepts(byte status, byte data1) = 0;
+
   /// \param message The incoming MIDI message
+  /// \param timestamp Monotonic time in nanoseconds when the message arrived
   /// \effects Determined by implementation
-  virtual void handle_message(midi_msg &message) = 0;
+  virtual void handle_message(midi_msg &message,
+                              unsigned long long timestamp) = 0;
 };
@@ -1,44 +1,366 @@
 #include "MidiMessageListener.hpp"
+#include "ButtonInterface.hpp"
+#include "EncoderInterface.hpp"
+#include "GestureInterface.hpp"
+#include "PadInterface.hpp"
+#include "PedalInterface.hpp"
+#include "TouchStripInterface.hpp"
+#include <algorithm>
+#include <thread>
 
 using namespace std;
 
-template <typename Event>
-using callback = typename MidiMessageListener<Event>::callback;
+template <typename Event, typename Decoder>
+using callback = typename MidiMessageListener<Event, Decoder>::callback;
 
-template <typename Event>
-using handler_fn = typename MidiMessageListener<Event>::handler_fn;
+/// Shared by all listeners so that a token identifies a single callback
+static atomic<int> next_token(0);
 
-template <typename Event>
-MidiMessageListener<Event>::MidiMessageListener(handler_fn handler)
-    : handler_func(handler) {}
+template <typename Event, typename Decoder>
+MidiMessageListener<Event, Decoder>::MidiMessageListener(Decoder &decoder)
+    : decoder(decoder), subscriptions(new SubscriptionList()),
+      subscription_count(0), readers(0), has_retired(false), queue(nullptr),
+      queue_writers(0),
+      runner(nullptr),
+      state(nullptr), conditioner(nullptr), coalescing(false),
+      has_pending(), pending_count(0) {}
 
-template <typename Event>
-void MidiMessageListener<Event>::register_callback(callback cb, void *context) {
-  this->callbacks.push_back(make_tuple(cb, context));
+template <typename Event, typename Decoder>
+MidiMessageListener<Event, Decoder>::~MidiMessageListener() {
+  delete this->subscriptions.load();
 }
 
-template <typename Event>
-void MidiMessageListener<Event>::handle_message(midi_msg &message) {
-  if (!this->callbacks.size()) {
+template <typename Event, typename Decoder>
+bool MidiMessageListener<Event, Decoder>::accepts(byte status, byte data1) {
+  return this->decoder.accepts_message(status & 0xF0, data1);
+}
+
+template <typename Event, typename Decoder>
+int MidiMessageListener<Event, Decoder>::register_callback(callback cb,
+                                                           void *context) {
+  lock_guard<mutex> guard(this->registry_lock);
+  auto updated = make_unique<SubscriptionList>(*this->subscriptions.load());
+  Subscription subscription = {cb, context, {}, next_token++};
+  updated->push_back(subscription);
+  this->publish(move(updated));
+  return subscription.token;
+}
+
+template <typename Event, typename Decoder>
+bool MidiMessageListener<Event, Decoder>::unregister_callback(int token) {
+  lock_guard<mutex> guard(this->registry_lock);
+  auto updated = make_unique<SubscriptionList>(*this->subscriptions.load());
+  auto it = find_if(
+      updated->begin(), updated->end(),
+      [token](const Subscription &s) { return s.token == token; });
+  if (it == updated->end()) {
+    return false;
+  }
+
+  updated->erase(it);
+  this->publish(move(updated));
+  return true;
+}
+
+template <typename Event, typename Decoder>
+bool MidiMessageListener<Event, Decoder>::set_callback_filter(
+    int token, const LibPushEventFilter &filter) {
+  lock_guard<mutex> guard(this->registry_lock);
+  auto updated = make_unique<SubscriptionList>(*this->subscriptions.load());
+  auto it = find_if(
+      updated->begin(), updated->end(),
+      [token](const Subscription &s) { return s.token == token; });
+  if (it == updated->end()) {
+    return false;
+  }
+
+  it->filter = filter;
+  this->publish(move(updated));
+  return true;
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::publish(
+    unique_ptr<SubscriptionList> subscriptions) {
+  size_t count = subscriptions->size();
+  const SubscriptionList *replaced =
+      this->subscriptions.exchange(subscriptions.release());
+  this->subscription_count.store(count);
+  this->retired.emplace_back(replaced);
+  this->reclaim();
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::reclaim() {
+  // A dispatch registers as a reader before loading the list, so if there are no readers now,
+  // no dispatch can still be reading a replaced list. Otherwise the last reader frees them.
+  // This never waits, which also makes it safe to change the list from within a callback
+  this->has_retired.store(!this->retired.empty());
+  if (this->readers.load() == 0) {
+    this->retired.clear();
+    this->has_retired.store(false);
+  }
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::set_event_queue(EventQueue *queue) {
+  this->queue.store(queue);
+  // Writes hold the queue only while pushing, so this never waits for a callback
+  while (this->queue_writers.load()) {
+    this_thread::yield();
+  }
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::set_callback_runner(
+    CallbackRunner *runner) {
+  this->runner.store(runner, memory_order_release);
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::set_controller_state(
+    ControllerState *state) {
+  this->state.store(state, memory_order_release);
+}
+
+template <typename Event, typename Decoder>
+bool MidiMessageListener<Event, Decoder>::add_event_forwarder(
+    EventObserver *forwarder) {
+  return this->forwarders.add(forwarder);
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::remove_event_forwarder(
+    EventObserver *forwarder) {
+  this->forwarders.remove(forwarder);
+}
+
+template <typename Event, typename Decoder>
+bool MidiMessageListener<Event, Decoder>::add_event_observer(
+    EventObserver *observer) {
+  return this->observers.add(observer);
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::remove_event_observer(
+    EventObserver *observer, bool wait) {
+  if (wait) {
+    this->observers.remove_and_wait(observer);
+  } else {
+    this->observers.remove(observer);
+  }
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::set_signal_conditioner(
+    SignalConditioner *conditioner) {
+  this->conditioner.store(conditioner, memory_order_release);
+}
+
+template <typename Event, typename Decoder>
+LatencyHistogram &MidiMessageListener<Event, Decoder>::get_latency() {
+  return this->latency;
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::set_coalescing(bool enabled) {
+  lock_guard<recursive_mutex> delivering(this->delivery_lock);
+  if (enabled) {
+    lock_guard<mutex> guard(this->coalescing_lock);
+    this->coalescing.store(true, memory_order_release);
+    return;
+  }
+
+  PendingEvents taken;
+  while (true) {
+    {
+      lock_guard<mutex> guard(this->coalescing_lock);
+      this->take_pending(taken);
+      // Only stops once nothing is pending, so that no event overtakes an older pending one
+      if (!taken.count) {
+        this->coalescing.store(false, memory_order_release);
+        return;
+      }
+    }
+    this->dispatch_pending(taken);
+  }
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::flush() {
+  lock_guard<recursive_mutex> delivering(this->delivery_lock);
+  PendingEvents taken;
+  {
+    lock_guard<mutex> guard(this->coalescing_lock);
+    this->take_pending(taken);
+  }
+  this->dispatch_pending(taken);
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::handle_message(
+    midi_msg &message, unsigned long long timestamp) {
+  bool queueing = this->queue.load(memory_order_relaxed);
+  ControllerState *state = this->state.load(memory_order_acquire);
+  if (!this->subscription_count.load(memory_order_relaxed) && !queueing &&
+      !state && !this->forwarders.any() && !this->observers.any()) {
     return;
   }
 
   byte msg_type = get_midi_type(message);
-  unique_ptr<Event> result = this->handler_func(msg_type, message);
-  if (result) {
-    for (const auto &cb : this->callbacks) {
-      callback fn = get<0>(cb);
-      void *context = get<1>(cb);
-      fn(*result, context);
+  Event event;
+  if (!this->decoder.decode_message(msg_type, message, event)) {
+    return;
+  }
+  event.timestamp = timestamp;
+
+  // Events that conditioning drops are treated as if they never arrived
+  SignalConditioner *conditioner =
+      this->conditioner.load(memory_order_acquire);
+  if (conditioner && !conditioner->condition(event)) {
+    return;
+  }
+
+  // The state always reflects the latest input, even while events are being coalesced
+  if (state) {
+    state->update(event);
+  }
+
+  // Forwarded before delivery so that callbacks don't delay forwarded messages
+  this->forwarders.observe(event);
+  if (this->subscription_count.load(memory_order_relaxed) || queueing) {
+    this->deliver(event);
+  }
+
+  // Observed last, so that events derived from this one are delivered after it
+  this->observers.observe(event);
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::emit(Event &event) {
+  if (this->subscription_count.load(memory_order_relaxed) ||
+      this->queue.load(memory_order_relaxed)) {
+    this->dispatch(event);
+  }
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::deliver(Event &event) {
+  if (!this->coalescing.load(memory_order_acquire)) {
+    this->dispatch(event);
+    return;
+  }
+
+  int key = Decoder::coalescing_key(event);
+  if (key >= 0) {
+    unique_lock<mutex> guard(this->coalescing_lock);
+    // Coalescing may have been disabled, and the pending events flushed, since it was checked
+    if (!this->coalescing.load(memory_order_relaxed)) {
+      guard.unlock();
+      this->dispatch(event);
+    } else if (this->has_pending[key]) {
+      Decoder::coalesce(this->pending[key], event);
+    } else {
+      this->pending[key] = event;
+      this->has_pending[key] = true;
+      this->pending_order[this->pending_count++] = key;
+    }
+    return;
+  }
+
+  // A discrete event is delivered after the pending events
+  lock_guard<recursive_mutex> delivering(this->delivery_lock);
+  PendingEvents taken;
+  {
+    lock_guard<mutex> guard(this->coalescing_lock);
+    this->take_pending(taken);
+  }
+  this->dispatch_pending(taken);
+  this->dispatch(event);
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::dispatch(Event &event) {
+  event.dispatch_timestamp = monotonic_time_ns();
+
+  CallbackRunner *runner = this->runner.load(memory_order_acquire);
+  if (runner && !runner->is_active()) {
+    runner = nullptr;
+  }
+
+  LibPushEvent wrapped = make_event(event);
+  if (this->queue.load(memory_order_relaxed)) {
+    // Registers as a writer before loading the queue, so set_event_queue can wait until it's unused
+    this->queue_writers.fetch_add(1);
+    EventQueue *queue = this->queue.load();
+    if (queue) {
+      queue->push(wrapped);
+    }
+    this->queue_writers.fetch_sub(1);
+  }
+
+  this->readers.fetch_add(1);
+  const SubscriptionList *subscriptions = this->subscriptions.load();
+  // Held back, so that the runner records the latency once the event's last callback returns
+  const Subscription *last = nullptr;
+  for (const auto &subscription : *subscriptions) {
+    if (!filter_matches(subscription.filter, event)) {
+      continue;
+    }
+
+    if (!runner) {
+      subscription.fn(event, subscription.context);
+      continue;
+    }
+    if (last) {
+      runner->run(reinterpret_cast<CallbackRunner::Function>(last->fn),
+                  last->context, last->token, wrapped);
     }
+    last = &subscription;
+  }
+  if (last) {
+    runner->run(reinterpret_cast<CallbackRunner::Function>(last->fn),
+                last->context, last->token, wrapped, &this->latency);
+  }
+  if (this->readers.fetch_sub(1) == 1 && this->has_retired.load()) {
+    // Lists replaced while they were read. A registry change in progress frees them itself
+    unique_lock<mutex> guard(this->registry_lock, try_to_lock);
+    if (guard.owns_lock()) {
+      this->reclaim();
+    }
+  }
+
+  if (!last) {
+    this->latency.record(monotonic_time_ns() - event.timestamp);
+  }
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::take_pending(PendingEvents &taken) {
+  for (int i = 0; i < this->pending_count; ++i) {
+    int key = this->pending_order[i];
+    this->has_pending[key] = false;
+    taken.events[i] = this->pending[key];
+  }
+  taken.count = this->pending_count;
+  this->pending_count = 0;
+}
+
+template <typename Event, typename Decoder>
+void MidiMessageListener<Event, Decoder>::dispatch_pending(
+    PendingEvents &taken) {
+  for (int i = 0; i < taken.count; ++i) {
+    this->dispatch(taken.events[i]);
   }
+  taken.count = 0;
 }
 
 // It's necessary to define the specific instances of the template that are going to be used
 // in the library in order to avoid linking errors
 // Alternatively the template implementation could be defined in the header
-template class MidiMessageListener<LibPushPadEvent>;
-template class MidiMessageListener<LibPushButtonEvent>;
-template class MidiMessageListener<LibPushEncoderEvent>;
-template class MidiMessageListener<LibPushTouchStripEvent>;
-template class MidiMessageListener<LibPushPedalEvent>;
+template class MidiMessageListener<LibPushPadEvent, PadInterface>;
+template class MidiMessageListener<LibPushButtonEvent, ButtonInterface>;
+template class MidiMessageListener<LibPushEncoderEvent, EncoderInterface>;
+template class MidiMessageListener<LibPushTouchStripEvent, TouchStripInterface>;
+template class MidiMessageListener<LibPushPedalEvent, PedalInterface>;
+template class MidiMessageListener<LibPushGestureEvent, GestureInterface>;
@@ -1,34 +1,205 @@
 #pragma once
+#include "CallbackRunner.hpp"
+#include "ControllerState.hpp"
+#include "EventFilter.hpp"
+#include "EventObserver.hpp"
+#include "EventQueue.hpp"
+#include "LatencyHistogram.hpp"
 #include "MidiMessageHandler.hpp"
 #include "MidiMsg.hpp"
+#include "SignalConditioner.hpp"
 #include "push.h"
-#include <functional>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 /// A MidiMessageListener handles midi messages
-/// by calling a handler function and then
-/// calling all registered callbacks if the function
-/// doesn't return nullptr
-template <typename Event>
+/// by asking its decoder to translate them into an event and then
+/// calling all registered callbacks if the decoder produced one.
+/// Events are also written to an EventQueue if one is set
+///
+/// When coalescing is enabled, continuous events from the same source (e.g. the turns of one encoder)
+/// are merged until the next flush instead of being delivered one by one.
+/// Discrete events are still delivered immediately, after flushing any pending continuous events
+/// so that the order of events is kept
+///
+/// Callbacks are stored in an immutable list that is replaced on every change (copy-on-write),
+/// so registering and unregistering never blocks or races the dispatch of an event.
+/// Replaced lists are freed once no dispatch can still be reading them.
+///
+/// Listeners also deliver events that are synthesized rather than decoded (see emit),
+/// in which case the decoder accepts no messages.
+///
+/// The decoder is resolved at compile time and events are built on the stack,
+/// so handling a message doesn't allocate.
+/// Decoder must provide the following members (static or not):
+///
+/// `bool accepts_message(byte msg_type, byte number)`
+/// `bool decode_message(byte msg_type, midi_msg &message, Event &event)`
+/// `static int coalescing_key(const Event &event)`
+/// `static void coalesce(Event &pending, const Event &event)`
+///
+/// coalescing_key returns the source of a continuous event in [0, MAX_COALESCED_SOURCES),
+/// or -1 if the event is discrete. coalesce merges event into the pending event from the same source
+#define MAX_COALESCED_SOURCES 64
+
+template <typename Event, typename Decoder>
 class MidiMessageListener : public MidiMessageHandler {
 public:
-  using handler_fn =
-      std::function<std::unique_ptr<Event>(byte msg_type, midi_msg &message)>;
   using callback = void (*)(Event, void *);
 
-  // \param handler The message handler that translates an incoming midi message into an Event object
-  MidiMessageListener(handler_fn handler);
+  // \param decoder The object that translates incoming midi messages into Event objects
+  MidiMessageListener(Decoder &decoder);
+  ~MidiMessageListener();
 
   // \param cb A C style callback that will be called when an event occurs
   // \param context A pointer to any data that needs to accessed when the callback is called
+  // \returns A token that identifies the callback, unique among all listeners
   // \effects Ensures cb will be called when this handler detects an event
-  void register_callback(callback cb, void *context);
+  int register_callback(callback cb, void *context);
+
+  /// \param token A token returned by register_callback
+  /// \returns false if no callback of this listener has the token
+  /// \effects The callback is not called for events dispatched after this returns
+  /// \notes Can be called from within a callback
+  bool unregister_callback(int token);
+
+  /// \param token A token returned by register_callback
+  /// \param filter The events the callback should receive
+  /// \returns false if no callback of this listener has the token
+  bool set_callback_filter(int token, const LibPushEventFilter &filter);
+
+  /// \param queue The queue to write events to, or nullptr to stop queueing events
+  /// \effects Returns once no event is being written to the replaced queue, so it can be freed
+  /// \requires queue outlives the listener or is replaced before it is destroyed
+  void set_event_queue(EventQueue *queue);
+
+  /// \returns Whether the decoder accepts the message type and number
+  bool accepts(byte status, byte data1) override;
+
+  /// \param runner Calls callbacks when it is active, e.g. on worker threads
+  /// \requires runner outlives the listener
+  void set_callback_runner(CallbackRunner *runner);
+
+  /// \param state The state to apply every decoded event to, or nullptr
+  /// \requires state outlives the listener
+  void set_controller_state(ControllerState *state);
+
+  /// \param conditioner Filters every decoded event before it is used, or nullptr
+  /// \requires conditioner outlives the listener
+  void set_signal_conditioner(SignalConditioner *conditioner);
+
+  /// \param forwarder Passed every decoded event before it is delivered, so that callbacks don't delay it
+  /// \returns false if MAX_EVENT_OBSERVERS forwarders are already added
+  /// \requires forwarder outlives the listener
+  bool add_event_forwarder(EventObserver *forwarder);
+
+  /// \param forwarder A forwarder passed to add_event_forwarder
+  void remove_event_forwarder(EventObserver *forwarder);
+
+  /// \param observer Passed every decoded event after it is delivered
+  /// \returns false if MAX_EVENT_OBSERVERS observers are already added
+  /// \effects Adding an observer twice has no effect
+  /// \requires observer outlives the listener
+  bool add_event_observer(EventObserver *observer);
+
+  /// \param observer An observer passed to add_event_observer
+  /// \param wait Whether to return only once the observer isn't observing an event, so it can be freed
+  /// \effects The observer isn't passed events decoded after this returns,
+  /// but unless wait is set may still be observing an event that was decoded before
+  /// \requires wait isn't set from within an observer of this listener, or a callback it runs
+  void remove_event_observer(EventObserver *observer, bool wait = false);
+
+  /// \param enabled Whether continuous events should be coalesced
+  /// \effects Pending events are flushed when coalescing is disabled
+  void set_coalescing(bool enabled);
+
+  /// \effects Delivers all pending coalesced events in the order their sources first became pending
+  /// \notes May be called from any thread, including from a callback. Delivery is serialized
+  /// with the MIDI input thread
+  void flush();
+
+  /// \returns The latency of this listener's events, from arrival to the return of the last callback,
+  /// which the callback runner records when the callback runs on a worker
+  LatencyHistogram &get_latency();
 
   /// \param message The incoming MIDI message
-  /// \effects Determines if the message should trigger an event. If so, construct the event object and pass it to all registered callbacks
-  void handle_message(midi_msg &message) override;
+  /// \param timestamp Monotonic time in nanoseconds when the message arrived
+  /// \effects Determines if the message should trigger an event. If so, construct the event object, stamp it and pass it to all registered callbacks
+  void handle_message(midi_msg &message, unsigned long long timestamp) override;
+
+  /// \param event A synthesized event with its timestamp set
+  /// \effects Passes the event to the queue and all registered callbacks, without coalescing it
+  /// \notes May be called from any thread
+  void emit(Event &event);
 
 private:
-  handler_fn handler_func;
-  std::vector<std::tuple<callback, void *>> callbacks;
+  struct Subscription {
+    callback fn;
+    void *context;
+    LibPushEventFilter filter;
+    int token;
+  };
+  using SubscriptionList = std::vector<Subscription>;
+
+  Decoder &decoder;
+
+  std::atomic<const SubscriptionList *> subscriptions;
+  std::atomic<size_t> subscription_count; //< Lets dispatch skip decoding without reading the list
+  std::atomic<int> readers; //< The number of dispatches that may be reading a subscription list
+  std::mutex registry_lock; //< Serializes changes to the subscription list
+  std::vector<std::unique_ptr<const SubscriptionList>>
+      retired; //< Replaced lists that a dispatch may still be reading
+  std::atomic<bool> has_retired; //< Whether retired has lists left for the last reader to free
+  std::atomic<EventQueue *> queue;
+  std::atomic<int> queue_writers; //< The number of dispatches that may be writing to queue
+  std::atomic<CallbackRunner *> runner;
+  std::atomic<ControllerState *> state;
+  ObserverList forwarders;
+  ObserverList observers;
+  std::atomic<SignalConditioner *> conditioner;
+  LatencyHistogram latency;
+
+  std::atomic<bool> coalescing;
+  std::recursive_mutex delivery_lock; //< Serializes delivering pending events, and lets callbacks flush
+  std::mutex coalescing_lock; //< Guards the pending events. Never held while callbacks run
+  std::array<Event, MAX_COALESCED_SOURCES> pending;
+  std::array<bool, MAX_COALESCED_SOURCES> has_pending;
+  std::array<int, MAX_COALESCED_SOURCES> pending_order;
+  int pending_count;
+
+  /// Pending events taken out to be delivered without holding coalescing_lock
+  struct PendingEvents {
+    std::array<Event, MAX_COALESCED_SOURCES> events;
+    int count;
+  };
+
+  /// \param event A decoded event
+  /// \effects Dispatches the event, or holds it back if it is being coalesced
+  void deliver(Event &event);
+
+  /// \param event The event to deliver
+  /// \effects Stamps the event with the dispatch time and passes it to the queue and all callbacks
+  void dispatch(Event &event);
+
+  /// \param subscriptions The new list of subscriptions
+  /// \effects Replaces the current list and frees replaced lists that are no longer read
+  /// \requires registry_lock is held
+  void publish(std::unique_ptr<SubscriptionList> subscriptions);
+
+  /// \effects Frees the retired lists if no dispatch is reading a list
+  /// \requires registry_lock is held
+  void reclaim();
+
+  /// \param taken Filled with the pending events, in the order their sources first became pending
+  /// \effects Clears the pending events
+  /// \requires coalescing_lock is held
+  void take_pending(PendingEvents &taken);
+
+  /// \param taken Events taken by take_pending
+  /// \effects Dispatches the events in order
+  /// \requires delivery_lock is held and coalescing_lock isn't
+  void dispatch_pending(PendingEvents &taken);
 };
@@ -0,0 +1,93 @@
+#include "MidiTransport.hpp"
+
+using namespace std;
+
+const string COMMON_PORT_NAME = "Ableton Push 2";
+const vector<string> USER_PORT_STRINGS = {":1", "MIDI", "User"};
+
+void RtMidiTransport::open(LibPushPort port, InputCallback callback,
+                           void *context) {
+  this->midi_in = make_unique<RtMidiIn>();
+  this->midi_out = make_unique<RtMidiOut>();
+
+  int in_port = RtMidiTransport::find_port(this->midi_in.get(), port);
+  int out_port = RtMidiTransport::find_port(this->midi_out.get(), port);
+
+  this->midi_in->openPort(in_port);
+  this->midi_in->setCallback(callback, context);
+  this->midi_in->ignoreTypes(false, true, true); // Don't ignore sysex messages
+
+  this->midi_out->openPort(out_port);
+}
+
+void RtMidiTransport::close() {
+  this->midi_in.reset(nullptr);
+  this->midi_out.reset(nullptr);
+}
+
+void RtMidiTransport::send(midi_msg &message) {
+  this->midi_out->sendMessage(&message);
+}
+
+size_t RtMidiTransport::get_max_write_length() {
+  // These APIs split a write into the messages it contains, the others
+  // expect a single message per write
+  switch (this->midi_out->getCurrentApi()) {
+  case RtMidi::LINUX_ALSA:
+  case RtMidi::WINDOWS_MM:
+    return MAX_SYSEX_WRITE_LENGTH;
+  default:
+    return 0;
+  }
+}
+
+bool string_contains_any_substring(string s, vector<string> substrings) {
+  for (const auto &substr : substrings) {
+    if (s.find(substr) != string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int RtMidiTransport::find_port(RtMidi *rtmidi, LibPushPort port) {
+  unsigned int port_count = rtmidi->getPortCount();
+  string port_name;
+  for (unsigned int i = 0; i < port_count; ++i) {
+    port_name = rtmidi->getPortName(i);
+    if (port_name.find(COMMON_PORT_NAME) != string::npos) {
+      if (port == LibPushPort::USER &&
+          string_contains_any_substring(port_name, USER_PORT_STRINGS)) {
+        return i;
+      } else if (port == LibPushPort::LIVE &&
+                 !string_contains_any_substring(port_name, USER_PORT_STRINGS)) {
+        return i;
+      }
+    }
+  }
+
+  throw runtime_error(
+      "Can't find Push midi inputs and outputs for chosen port");
+}
+
+RtMidiOutput::RtMidiOutput(const string &port_name, bool virtual_port)
+    : midi_out(make_unique<RtMidiOut>()) {
+  if (virtual_port) {
+    this->midi_out->openVirtualPort(port_name);
+    return;
+  }
+
+  unsigned int port_count = this->midi_out->getPortCount();
+  for (unsigned int i = 0; i < port_count; ++i) {
+    if (this->midi_out->getPortName(i).find(port_name) != string::npos) {
+      this->midi_out->openPort(i);
+      return;
+    }
+  }
+
+  throw runtime_error("Can't find midi output port " + port_name);
+}
+
+void RtMidiOutput::send(midi_msg &message) {
+  this->midi_out->sendMessage(&message);
+}
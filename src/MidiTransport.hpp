@@ -0,0 +1,95 @@
+#pragma once
+#include "MidiMsg.hpp"
+#include "RtMidi.h"
+#include "push.h"
+#include <memory>
+#include <string>
+
+#define MAX_SYSEX_WRITE_LENGTH 4096 //< The most bytes of sysex messages written at once
+
+/// A connection that carries MIDI messages between the host and Push
+///
+/// MidiInterface talks to Push through a transport so that the physical
+/// connection can be replaced, e.g. by a SimulatedDevice
+class MidiTransport {
+public:
+  /// Called for each incoming message
+  ///
+  /// Matches the signature of RtMidi's input callback.
+  /// The message is owned by the transport and is only valid during the call,
+  /// so the transport can reuse one buffer instead of allocating per message
+  using InputCallback = void (*)(double delta, midi_msg *message,
+                                 void *context);
+
+  virtual ~MidiTransport() {}
+
+  /// \param port The MIDI port to connect to (Live or User)
+  /// \param callback Called on the transport's input thread for each incoming message
+  /// \param context A pointer passed to callback
+  /// \effects Opens the connection and starts delivering input to callback
+  /// \throws An [std::runtime_error]() exception if a connection can't be made
+  virtual void open(LibPushPort port, InputCallback callback,
+                    void *context) = 0;
+
+  /// \effects Stops delivering input and closes the connection
+  virtual void close() = 0;
+
+  /// \param message The raw message bytes
+  /// \effects Sends the message to Push
+  virtual void send(midi_msg &message) = 0;
+
+  /// \returns The most bytes of consecutive sysex messages that one send can write,
+  /// or 0 if each message must be sent on its own
+  virtual size_t get_max_write_length() { return 0; }
+
+  /// \param message The raw message bytes
+  /// \returns Whether the message was delivered, or false if the transport can't inject input
+  /// \effects Delivers the message to the input callback as if Push had sent it,
+  /// serialized with the transport's own input
+  virtual bool inject(midi_msg &message) { return false; }
+};
+
+/// A transport that connects to a physical Push using RtMidi
+class RtMidiTransport : public MidiTransport {
+public:
+  void open(LibPushPort port, InputCallback callback, void *context) override;
+  void close() override;
+  void send(midi_msg &message) override;
+  size_t get_max_write_length() override;
+
+private:
+  std::unique_ptr<RtMidiIn> midi_in;
+  std::unique_ptr<RtMidiOut> midi_out;
+
+  /// Find the given MIDI port
+  ///
+  /// \param rtmidi A pointer to either an RtMidiIn or RtMidiOut object
+  /// \param port The port to look for (Live or User)
+  /// \returns The index of the port
+  /// \throws An [std::runtime_error]() exception if the port is not found
+  static int find_port(RtMidi *rtmidi, LibPushPort port);
+};
+
+/// A MIDI output that isn't Push, e.g. a port of a DAW that input is forwarded to
+class MidiOutput {
+public:
+  virtual ~MidiOutput() {}
+
+  /// \param message The raw message bytes
+  /// \effects Sends the message to the output
+  virtual void send(midi_msg &message) = 0;
+};
+
+/// An output port opened with RtMidi
+class RtMidiOutput : public MidiOutput {
+public:
+  /// \param port_name Part of the name of the port to open, or the name of the virtual port to create
+  /// \param virtual_port Whether to create a virtual port that other applications can connect to
+  /// \throws An [std::runtime_error]() exception if no port matches port_name
+  RtMidiOutput(const std::string &port_name, bool virtual_port);
+
+  void send(midi_msg &message) override;
+
+private:
+  std::unique_ptr<RtMidiOut> midi_out;
+};
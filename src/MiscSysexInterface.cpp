@@ -5,19 +5,16 @@ MiscSysexInterface::MiscSysexInterface(SysexInterface &sysex) : sysex(sysex) {
 }
 
 void MiscSysexInterface::set_midi_mode(LibPushMidiMode mode) {
-  midi_msg args({static_cast<unsigned char>(mode)});
-  midi_msg reply =
-      this->sysex.sysex_call(MiscSysexInterface::SET_MIDI_MODE, args);
+  this->sysex.sysex_call(SetMidiMode::format(mode));
 }
 
 LibPushStats MiscSysexInterface::get_statistics(byte run_id) {
-  midi_msg args({run_id});
-  midi_msg reply = this->sysex.sysex_call(MiscSysex::REQUEST_STATISTICS, args);
+  midi_msg reply = this->sysex.sysex_call(RequestStatistics::format(run_id));
 
   LibPushStats stats;
-  stats.power_supply_status = static_cast<LibPushPowerSupplyStatus>(reply[0]);
-  stats.uptime =
-      (reply[2] | (reply[3] << 7) | (reply[4] << 14) | (reply[5] << 21));
+  stats.power_supply_status = static_cast<LibPushPowerSupplyStatus>(
+      RequestStatistics::reply_field<0>(reply));
+  stats.uptime = RequestStatistics::reply_field<2>(reply);
 
   return stats;
 }
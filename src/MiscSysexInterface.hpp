@@ -9,6 +9,12 @@ public:
     REQUEST_STATISTICS = 0x1A,
   };
 
+  using SetMidiMode = SysexCommand<SET_MIDI_MODE, SysexLayout<SysexU7>>;
+  /// Replies with the power supply status, the run id and the uptime in seconds
+  using RequestStatistics =
+      SysexCommand<REQUEST_STATISTICS, SysexLayout<SysexU7>,
+                   SysexLayout<SysexU7, SysexU7, SysexU28>>;
+
   MiscSysexInterface(SysexInterface &sysex);
 
   void set_midi_mode(LibPushMidiMode mode);
@@ -1,86 +1,324 @@
 #include "PadInterface.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
 
 using namespace std;
 
 PadInterface::PadInterface(MidiInterface &midi, SysexInterface &sysex,
-                           LedInterface &leds)
-    : sysex(sysex), leds(leds), listener(PadInterface::handle_message) {
+                           LedInterface &leds, SettingsCache &settings)
+    : sysex(sysex), leds(leds), settings(settings), listener(*this),
+      layout(new PadLayout()),
+      layout_readers(0), has_retired_layouts(false) {
   midi.register_handler(&this->listener);
   sysex.register_command_with_reply(PadSysex::GET_AFTERTOUCH_MODE);
-  sysex.register_command_with_reply(PadSysex::GET_SELECTED_PAD_SETTINGS);
+  // Pad settings replies start with the row and column of the pad
+  sysex.register_command_with_reply(PadSysex::GET_SELECTED_PAD_SETTINGS, 2);
 }
 
-void PadInterface::register_callback(LibPushPadCallback cb, void *context) {
-  this->listener.register_callback(cb, context);
+PadInterface::~PadInterface() { delete this->layout.load(); }
+
+int PadInterface::register_callback(LibPushPadCallback cb, void *context) {
+  return this->listener.register_callback(cb, context);
+}
+
+bool PadInterface::unregister_callback(int token) {
+  return this->listener.unregister_callback(token);
+}
+
+bool PadInterface::set_callback_filter(int token,
+                                       const LibPushEventFilter &filter) {
+  return this->listener.set_callback_filter(token, filter);
+}
+
+void PadInterface::set_event_queue(EventQueue *queue) {
+  this->listener.set_event_queue(queue);
 }
 
+void PadInterface::set_callback_runner(CallbackRunner *runner) {
+  this->listener.set_callback_runner(runner);
+}
+
+void PadInterface::set_controller_state(ControllerState *state) {
+  this->listener.set_controller_state(state);
+}
+
+void PadInterface::set_signal_conditioner(SignalConditioner *conditioner) {
+  this->listener.set_signal_conditioner(conditioner);
+}
+
+bool PadInterface::add_event_observer(EventObserver *observer) {
+  return this->listener.add_event_observer(observer);
+}
+
+void PadInterface::remove_event_observer(EventObserver *observer,
+                                         bool wait) {
+  this->listener.remove_event_observer(observer, wait);
+}
+
+bool PadInterface::add_event_forwarder(EventObserver *forwarder) {
+  return this->listener.add_event_forwarder(forwarder);
+}
+
+void PadInterface::remove_event_forwarder(EventObserver *forwarder) {
+  this->listener.remove_event_forwarder(forwarder);
+}
+
+LatencyHistogram &PadInterface::get_latency() {
+  return this->listener.get_latency();
+}
+
+void PadInterface::set_coalescing(bool enabled) {
+  this->listener.set_coalescing(enabled);
+}
+
+void PadInterface::flush_coalesced_events() { this->listener.flush(); }
+
 void PadInterface::set_global_aftertouch_range(unsigned short low,
                                                unsigned short high) {
-  midi_msg args({0, 0, 0, 0, (byte)(low & 0x7F), (byte)(low >> 7),
-                 (byte)(high & 0x7F), (byte)(high >> 7)});
-  this->sysex.sysex_call(PadSysex::SET_PAD_PARAMETERS, args);
+  array<unsigned short, 2> range = {{low, high}};
+  this->settings.write(this->settings.aftertouch_range, range, [&] {
+    this->sysex.sysex_call(SetPadParameters::format(0, 0, low, high));
+  });
 }
 
 void PadInterface::set_global_aftertouch_mode(LibPushAftertouchMode mode) {
   byte mode_byte = static_cast<byte>(mode);
-  midi_msg args({mode_byte});
-  this->sysex.sysex_call(PadSysex::SET_AFTERTOUCH_MODE, args);
+  this->settings.write(this->settings.aftertouch_mode, mode_byte, [&] {
+    this->sysex.sysex_call(SetAftertouchMode::format(mode_byte));
+  });
 }
 
 LibPushAftertouchMode PadInterface::get_global_aftertouch_mode() {
-  LibPushAftertouchMode mode;
-  midi_msg args;
-  midi_msg reply = this->sysex.sysex_call(PadSysex::GET_AFTERTOUCH_MODE, args);
-  return static_cast<LibPushAftertouchMode>(reply[0]);
+  byte mode_byte = this->settings.read(this->settings.aftertouch_mode, [&] {
+    midi_msg reply = this->sysex.sysex_call(GetAftertouchMode::format());
+    return (byte)GetAftertouchMode::reply_field<0>(reply);
+  });
+  return static_cast<LibPushAftertouchMode>(mode_byte);
 }
 
 constexpr byte CURVE_STEP = LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES / 16;
 void PadInterface::set_global_pad_velocity_curve(
     byte (&entries)[LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES]) {
+  array<byte, LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES> curve;
+  copy_n(entries, LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES, curve.begin());
+  this->settings.write(this->settings.velocity_curve, curve, [&] {
+    SysexBatch batch;
+    add_velocity_curve(curve, batch);
+    sysex.send_batch(batch);
+  });
+}
+
+void PadInterface::add_velocity_curve(
+    const array<byte, LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES> &curve,
+    SysexBatch &batch) {
   for (byte i = 0; i < LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES; i += CURVE_STEP) {
-    midi_msg args({i});
-    for (byte j = i; j < i + CURVE_STEP; ++j) {
-      args.push_back(entries[j]);
-    }
-    sysex.sysex_call(PadSysex::SET_PAD_VELOCITY_CURVE_ENTRY, args);
+    batch.add(SetVelocityCurveEntries::format(i, curve.data() + i));
   }
 }
 
 void PadInterface::set_pad_sensitivity(byte x, byte y,
                                        LibPushPadSensitivity sensitivity) {
-  x += 1;
-  y = LIBPUSH_PAD_MATRIX_DIM - y;
-  midi_msg args({y, x, static_cast<byte>(sensitivity)});
-  sysex.sysex_call(PadSysex::SELECT_PAD_SETTINGS, args);
+  int pad = pad_index(x, y);
+  byte sensitivity_byte = static_cast<byte>(sensitivity);
+  CachedSetting<byte> &setting = this->settings.pad_sensitivity[pad];
+  this->settings.write(setting, sensitivity_byte, [&] {
+    array<byte, 2> location = pad_settings_location(pad);
+    sysex.sysex_call(
+        SelectPadSettings::format(location[0], location[1], sensitivity_byte));
+  });
 }
 
 void PadInterface::set_global_pad_sensitivity(
     LibPushPadSensitivity sensitivity) {
-  midi_msg args({0, 0, static_cast<byte>(sensitivity)});
-  sysex.sysex_call(PadSysex::SELECT_PAD_SETTINGS, args);
+  array<byte, LAYOUT_PADS> values;
+  values.fill(static_cast<byte>(sensitivity));
+  // A single command sets every pad, even if only some of them change
+  this->settings.write_each(
+      this->settings.pad_sensitivity, 0, LAYOUT_PADS, values.data(),
+      [&](const bitset<LAYOUT_PADS> &changed) {
+        sysex.sysex_call(SelectPadSettings::format(0, 0, sensitivity));
+      });
 }
 
 LibPushPadSensitivity PadInterface::get_pad_sensitivity(byte x, byte y) {
-  x += 1;
-  y = LIBPUSH_PAD_MATRIX_DIM - y;
-  midi_msg args({y, x});
-  midi_msg reply = sysex.sysex_call(PadSysex::GET_SELECTED_PAD_SETTINGS, args);
-  return static_cast<LibPushPadSensitivity>(reply[2]);
+  int pad = pad_index(x, y);
+  CachedSetting<byte> &setting = this->settings.pad_sensitivity[pad];
+  byte sensitivity = this->settings.read(setting, [&] {
+    array<byte, 2> location = pad_settings_location(pad);
+    midi_msg reply = sysex.sysex_call(
+        GetSelectedPadSettings::format(location[0], location[1]));
+    return (byte)GetSelectedPadSettings::reply_field<2>(reply);
+  });
+  return static_cast<LibPushPadSensitivity>(sensitivity);
+}
+
+int PadInterface::pad_index(byte x, byte y) {
+  // Wrapping would read or write the cached setting of another pad
+  if (x >= LIBPUSH_PAD_MATRIX_DIM || y >= LIBPUSH_PAD_MATRIX_DIM) {
+    throw runtime_error("Pad (" + to_string(x) + ", " + to_string(y) +
+                        ") is outside the " +
+                        to_string(LIBPUSH_PAD_MATRIX_DIM) + "x" +
+                        to_string(LIBPUSH_PAD_MATRIX_DIM) + " pad matrix");
+  }
+  return y * LIBPUSH_PAD_MATRIX_DIM + x;
+}
+
+array<byte, 2> PadInterface::pad_settings_location(int pad) {
+  byte row = LIBPUSH_PAD_MATRIX_DIM - pad / LIBPUSH_PAD_MATRIX_DIM;
+  byte col = pad % LIBPUSH_PAD_MATRIX_DIM + 1;
+  return {{row, col}};
+}
+
+void PadInterface::add_settings(const DeviceSettings &settings,
+                                SysexBatch &batch) {
+  if (settings.aftertouch_mode.known) {
+    batch.add(SetAftertouchMode::format(settings.aftertouch_mode.value));
+  }
+  if (settings.aftertouch_range.known) {
+    batch.add(SetPadParameters::format(0, 0, settings.aftertouch_range.value[0],
+                                       settings.aftertouch_range.value[1]));
+  }
+  if (settings.velocity_curve.known) {
+    add_velocity_curve(settings.velocity_curve.value, batch);
+  }
+
+  array<byte, LAYOUT_PADS> values;
+  bitset<LAYOUT_PADS> known;
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    values[pad] = settings.pad_sensitivity[pad].value;
+    known[pad] = settings.pad_sensitivity[pad].known;
+  }
+  add_pad_sensitivities(values, known, known.all(), batch);
+}
+
+void PadInterface::set_pad_sensitivities(
+    const LibPushPadSensitivity (
+        &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]) {
+  array<byte, LAYOUT_PADS> values;
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    values[pad] = static_cast<byte>(
+        sensitivities[pad / LIBPUSH_PAD_MATRIX_DIM][pad % LIBPUSH_PAD_MATRIX_DIM]);
+  }
+
+  this->settings.write_each(this->settings.pad_sensitivity, 0, LAYOUT_PADS,
+                            values.data(),
+                            [&](const bitset<LAYOUT_PADS> &changed) {
+                              SysexBatch batch;
+                              add_pad_sensitivities(values, changed, true,
+                                                    batch);
+                              sysex.send_batch(batch);
+                            });
+}
+
+void PadInterface::get_pad_sensitivities(
+    LibPushPadSensitivity (
+        &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]) {
+  // Every request is sent before the first reply is waited for
+  array<future<midi_msg>, LAYOUT_PADS> replies;
+  array<byte, LAYOUT_PADS> values;
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    if (this->settings.lookup(this->settings.pad_sensitivity[pad],
+                              values[pad])) {
+      continue;
+    }
+    array<byte, 2> location = pad_settings_location(pad);
+    replies[pad] = sysex.sysex_call_async(
+        GetSelectedPadSettings::format(location[0], location[1]));
+  }
+
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    if (replies[pad].valid()) {
+      values[pad] = GetSelectedPadSettings::reply_field<2>(
+          sysex.get_reply(replies[pad], GetSelectedPadSettings::command));
+      this->settings.learn(this->settings.pad_sensitivity[pad], values[pad]);
+    }
+    sensitivities[pad / LIBPUSH_PAD_MATRIX_DIM][pad % LIBPUSH_PAD_MATRIX_DIM] =
+        static_cast<LibPushPadSensitivity>(values[pad]);
+  }
+}
+
+void PadInterface::add_pad_sensitivities(const array<byte, LAYOUT_PADS> &values,
+                                         const bitset<LAYOUT_PADS> &changed,
+                                         bool every_pad, SysexBatch &batch) {
+  // Push has no command for a row, only for one pad or every pad
+  int most_common = -1;
+  size_t others = LAYOUT_PADS;
+  if (every_pad) {
+    array<size_t, 128> counts = {};
+    for (byte value : values) {
+      if (++counts[value & 0x7F] > LAYOUT_PADS - others) {
+        most_common = value & 0x7F;
+        others = LAYOUT_PADS - counts[most_common];
+      }
+    }
+  }
+
+  if (most_common >= 0 && 1 + others < changed.count()) {
+    // Row and column 0 select every pad
+    batch.add(SelectPadSettings::format(0, 0, most_common));
+    for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+      if (values[pad] != most_common) {
+        array<byte, 2> location = pad_settings_location(pad);
+        batch.add(SelectPadSettings::format(location[0], location[1],
+                                            values[pad]));
+      }
+    }
+    return;
+  }
+
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    if (changed[pad]) {
+      array<byte, 2> location = pad_settings_location(pad);
+      batch.add(
+          SelectPadSettings::format(location[0], location[1], values[pad]));
+    }
+  }
+}
+
+void PadInterface::set_layout(const LibPushPadLayout &layout) {
+  auto compiled = make_unique<const PadLayout>(layout);
+
+  {
+    lock_guard<mutex> guard(this->layout_lock);
+    const PadLayout *replaced = this->layout.exchange(compiled.release());
+    this->retired_layouts.emplace_back(replaced);
+    this->reclaim_layouts();
+  }
+
+  // Relit without holding layout_lock, so that lookups don't wait for the led writes.
+  // Relights are serialized and use the current layout, so the last one lights the latest layout
+  lock_guard<mutex> relighting(this->relight_lock);
+  const PadLayout *current = this->acquire_layout();
+  try {
+    for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+      uint n = pad_coordinates_to_number(pad % LIBPUSH_PAD_MATRIX_DIM,
+                                         pad / LIBPUSH_PAD_MATRIX_DIM);
+      if (this->leds.get_led_color(MidiMsgType::note_on, n) !=
+          current->get_color(pad)) {
+        this->light_pad(pad, current->get_color(pad));
+      }
+    }
+  } catch (...) {
+    this->release_layout();
+    throw;
+  }
+  this->release_layout();
+}
+
+int PadInterface::get_note(byte x, byte y) {
+  int note = this->acquire_layout()->get_note(y * LIBPUSH_PAD_MATRIX_DIM + x);
+  this->release_layout();
+  return note;
 }
 
 void PadInterface::set_pad_color(byte x, byte y, uint color_index) {
-  uint n = pad_coordinates_to_number(x, y);
-  LibPushLedAnimation anim;
-  anim.type = LibPushLedAnimationType::LP_NO_TRANSITION;
-  anim.duration = LibPushLedAnimationDuration::LP_24TH;
-  this->leds.set_led_color(MidiMsgType::note_on, n, anim, color_index);
+  this->light_pad(y * LIBPUSH_PAD_MATRIX_DIM + x, color_index);
 }
 
 void PadInterface::set_global_pad_color(uint color_index) {
-  for (byte x = 0; x < LIBPUSH_PAD_MATRIX_DIM; ++x) {
-    for (byte y = 0; y < LIBPUSH_PAD_MATRIX_DIM; ++y) {
-      this->set_pad_color(x, y, color_index);
-    }
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    this->light_pad(pad, color_index);
   }
 }
 
@@ -90,10 +328,42 @@ void PadInterface::set_pad_animation(byte x, byte y, uint color_index,
   this->leds.set_led_color(MidiMsgType::note_on, n, anim, color_index);
 }
 
+void PadInterface::light_pad(int pad, uint color_index) {
+  uint n = pad_coordinates_to_number(pad % LIBPUSH_PAD_MATRIX_DIM,
+                                     pad / LIBPUSH_PAD_MATRIX_DIM);
+  LibPushLedAnimation anim;
+  anim.type = LibPushLedAnimationType::LP_NO_TRANSITION;
+  anim.duration = LibPushLedAnimationDuration::LP_24TH;
+  this->leds.set_led_color(MidiMsgType::note_on, n, anim, color_index);
+}
+
 constexpr uint FIRST_PAD_N = 36;
+constexpr uint PAD_COUNT = LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM;
+
+array<PadInterface::PadLocation, 128> PadInterface::pad_locations = [] {
+  array<PadLocation, 128> locations;
+  for (uint n = 0; n < locations.size(); ++n) {
+    auto pad_coords = pad_number_to_coordinates(n);
+    locations[n].is_pad = n >= FIRST_PAD_N && n < FIRST_PAD_N + PAD_COUNT;
+    locations[n].x = get<0>(pad_coords);
+    locations[n].y = get<1>(pad_coords);
+  }
+  return locations;
+}();
+
+bool PadInterface::accepts_message(byte msg_type, byte number) {
+  switch (msg_type) {
+  case MidiMsgType::note_on:
+  case MidiMsgType::note_off:
+  case MidiMsgType::aftertouch:
+    return pad_locations[number].is_pad;
+  default:
+    return false;
+  }
+}
 
-unique_ptr<LibPushPadEvent> PadInterface::handle_message(byte msg_type,
-                                                         midi_msg &message) {
+bool PadInterface::decode_message(byte msg_type, midi_msg &message,
+                                  LibPushPadEvent &event) {
   LibPushPadEventType event_type;
   switch (msg_type) {
   case MidiMsgType::note_on:
@@ -102,29 +372,67 @@ unique_ptr<LibPushPadEvent> PadInterface::handle_message(byte msg_type,
   case MidiMsgType::note_off:
     event_type = LibPushPadEventType::LP_PAD_RELEASED;
     break;
-  case MidiMsgType::channel_pressure:
   case MidiMsgType::aftertouch:
     event_type = LibPushPadEventType::LP_PAD_AFTERTOUCH;
     break;
   default:
-    return nullptr;
+    return false;
   }
-  int pad_number = get_midi_number(msg_type, message);
-  if (pad_number < FIRST_PAD_N ||
-      pad_number >=
-          FIRST_PAD_N + LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM) {
-    return nullptr;
+
+  const PadLocation &pad = pad_locations[message[1] & 0x7F];
+  if (!pad.is_pad) {
+    return false;
   }
 
-  unique_ptr<LibPushPadEvent> event = make_unique<LibPushPadEvent>();
-  event->event_type = event_type;
-  event->velocity = get_midi_value(msg_type, message);
+  event.event_type = event_type;
+  event.velocity = message[2];
+  event.pressure = event.velocity / 127.0;
+  event.x = pad.x;
+  event.y = pad.y;
+
+  event.note = this->acquire_layout()->get_note(
+      pad.y * LIBPUSH_PAD_MATRIX_DIM + pad.x);
+  this->release_layout();
 
-  auto pad_coords = pad_number_to_coordinates(pad_number);
-  event->x = get<0>(pad_coords);
-  event->y = get<1>(pad_coords);
+  return true;
+}
+
+const PadLayout *PadInterface::acquire_layout() {
+  this->layout_readers.fetch_add(1);
+  return this->layout.load();
+}
+
+void PadInterface::release_layout() {
+  if (this->layout_readers.fetch_sub(1) == 1 &&
+      this->has_retired_layouts.load()) {
+    // Layouts replaced while they were read. A layout change in progress frees them itself
+    unique_lock<mutex> guard(this->layout_lock, try_to_lock);
+    if (guard.owns_lock()) {
+      this->reclaim_layouts();
+    }
+  }
+}
+
+void PadInterface::reclaim_layouts() {
+  // Same as replacing a listener's subscription list: with no readers now,
+  // no decode can still be reading a replaced layout. Otherwise the last reader frees them
+  this->has_retired_layouts.store(!this->retired_layouts.empty());
+  if (this->layout_readers.load() == 0) {
+    this->retired_layouts.clear();
+    this->has_retired_layouts.store(false);
+  }
+}
+
+int PadInterface::coalescing_key(const LibPushPadEvent &event) {
+  if (event.event_type != LibPushPadEventType::LP_PAD_AFTERTOUCH) {
+    return -1;
+  }
+  return event.y * LIBPUSH_PAD_MATRIX_DIM + event.x;
+}
 
-  return event;
+void PadInterface::coalesce(LibPushPadEvent &pending,
+                            const LibPushPadEvent &event) {
+  pending = event;
 }
 
 tuple<uint, uint> PadInterface::pad_number_to_coordinates(uint n) {
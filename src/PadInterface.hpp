@@ -3,9 +3,16 @@
 #include "MidiInterface.hpp"
 #include "MidiMessageListener.hpp"
 #include "MidiMsg.hpp"
+#include "PadLayout.hpp"
+#include "SettingsCache.hpp"
 #include "SysexInterface.hpp"
 #include "push.h"
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 /// This class provides an API for getting input
 /// from Push's encoders
@@ -20,9 +27,78 @@ public:
     GET_SELECTED_PAD_SETTINGS = 0x29
   };
 
-  PadInterface(MidiInterface &midi, SysexInterface &sysex, LedInterface &leds);
+  /// Two fields sent as 0, then the low and high aftertouch thresholds
+  using SetPadParameters =
+      SysexCommand<SET_PAD_PARAMETERS,
+                   SysexLayout<SysexU14, SysexU14, SysexU14, SysexU14>>;
+  using SetAftertouchMode =
+      SysexCommand<SET_AFTERTOUCH_MODE, SysexLayout<SysexU7>>;
+  using GetAftertouchMode =
+      SysexCommand<GET_AFTERTOUCH_MODE, SysexLayout<>, SysexLayout<SysexU7>>;
+  /// Index of the first entry, then a sixteenth of the curve's entries
+  using SetVelocityCurveEntries = SysexCommand<
+      SET_PAD_VELOCITY_CURVE_ENTRY,
+      SysexLayout<SysexU7,
+                  SysexArray<SysexU7, LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES / 16>>>;
+  /// Row and column of the pad (0 and 0 for every pad), then the sensitivity
+  using SelectPadSettings =
+      SysexCommand<SELECT_PAD_SETTINGS, SysexLayout<SysexU7, SysexU7, SysexU7>>;
+  /// Row and column of the pad. Replies with the row, column and sensitivity
+  using GetSelectedPadSettings =
+      SysexCommand<GET_SELECTED_PAD_SETTINGS, SysexLayout<SysexU7, SysexU7>,
+                   SysexLayout<SysexU7, SysexU7, SysexU7>>;
 
-  void register_callback(LibPushPadCallback cb, void *context);
+  PadInterface(MidiInterface &midi, SysexInterface &sysex, LedInterface &leds,
+               SettingsCache &settings);
+  ~PadInterface();
+
+  /// \returns A token that identifies the callback
+  int register_callback(LibPushPadCallback cb, void *context);
+
+  /// \param token A token returned by register_callback
+  /// \returns false if no callback of this interface has the token
+  bool unregister_callback(int token);
+
+  /// \param token A token returned by register_callback
+  /// \param filter The events the callback should receive
+  /// \returns false if no callback of this interface has the token
+  bool set_callback_filter(int token, const LibPushEventFilter &filter);
+
+  /// \param queue The queue to write events to, or nullptr to stop queueing events
+  void set_event_queue(EventQueue *queue);
+
+  /// \param runner Calls this interface's callbacks when it is active
+  void set_callback_runner(CallbackRunner *runner);
+
+  /// \param state The state to keep up to date with this interface's events
+  void set_controller_state(ControllerState *state);
+
+  /// \param conditioner Filters this interface's continuous events before they are used, or nullptr
+  void set_signal_conditioner(SignalConditioner *conditioner);
+
+  /// \param observer Passed every event of this interface after it is delivered
+  /// \returns false if the interface has no room for another observer
+  bool add_event_observer(EventObserver *observer);
+
+  /// \param observer An observer passed to add_event_observer
+  /// \param wait Whether to return only once the observer isn't observing an event, so it can be freed
+  void remove_event_observer(EventObserver *observer, bool wait = false);
+
+  /// \param forwarder Passed every event of this interface before it is delivered
+  /// \returns false if the interface has no room for another forwarder
+  bool add_event_forwarder(EventObserver *forwarder);
+
+  /// \param forwarder A forwarder passed to add_event_forwarder
+  void remove_event_forwarder(EventObserver *forwarder);
+
+  /// \returns The latency of this interface's events, from arrival to the return of the last callback
+  LatencyHistogram &get_latency();
+
+  /// \param enabled Whether continuous events should be coalesced until the next flush
+  void set_coalescing(bool enabled);
+
+  /// \effects Delivers all pending coalesced events
+  void flush_coalesced_events();
 
   /// \param low The lowest weight value that will trigger a pad's aftertoucuh
   /// \param high The highest weight value that will trigger a pad's aftertoucuh
@@ -33,7 +109,7 @@ public:
   /// \effects Sets the aftertouch mode for all pads to mode
   void set_global_aftertouch_mode(LibPushAftertouchMode mode);
 
-  /// \returns The current aftertouch mode for Push's pads
+  /// \returns The current aftertouch mode for Push's pads, read from Push only if it isn't cached
   LibPushAftertouchMode get_global_aftertouch_mode();
 
   /// \param entries An array representing a velocity curve
@@ -45,6 +121,7 @@ public:
   /// \param y (0-7) The column of the pad to set the sensitivity for
   /// \param sensitivity The sensitivity value to use
   /// \effects Sets the pad at (x, y) to the given sensitivity
+  /// \throws An [std::runtime_error]() exception if x or y is out of range
   void set_pad_sensitivity(byte x, byte y, LibPushPadSensitivity sensitivity);
 
   /// \param sensitivity The sensitivity value to use
@@ -53,9 +130,36 @@ public:
 
   /// \param x (0-7) The row of the pad
   /// \param y (0-7) The column of the pad
-  /// \returns The sensitivity value of the pad at (x, y)
+  /// \returns The sensitivity value of the pad at (x, y), read from Push only if it isn't cached
+  /// \throws An [std::runtime_error]() exception if x or y is out of range
   LibPushPadSensitivity get_pad_sensitivity(byte x, byte y);
 
+  /// \param sensitivities The sensitivity of every pad, indexed [y][x]
+  /// \effects Writes the pads whose sensitivity changes in one batch. If enough pads share a
+  /// sensitivity, every pad is set to it with one command and only the others are set on their own
+  void set_pad_sensitivities(
+      const LibPushPadSensitivity (
+          &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]);
+
+  /// \param sensitivities Filled with the sensitivity of every pad, indexed [y][x]
+  /// \effects Sends a request for every pad that isn't cached before waiting for the replies,
+  /// so the pads are read in about one round trip
+  /// \throws An [std::runtime_error]() exception if a reply is lost or doesn't arrive in time
+  void get_pad_sensitivities(
+      LibPushPadSensitivity (
+          &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]);
+
+  /// \param layout The notes the pads should play and how they should be lit
+  /// \effects Compiles the layout and swaps it in for the input thread,
+  /// then relights the pads whose color differs from the new layout
+  /// \throws An [std::runtime_error]() exception if the layout is invalid
+  void set_layout(const LibPushPadLayout &layout);
+
+  /// \param x (0-7) The row of the pad
+  /// \param y (0-7) The column of the pad
+  /// \returns The note the pad plays in the current layout, or -1 if it plays none
+  int get_note(byte x, byte y);
+
   /// \param x (0-7) The row of the pad
   /// \param y (0-7) The column of the pad
   /// \param color_index (0-127) The index of the color in the palette
@@ -74,6 +178,11 @@ public:
   void set_pad_animation(byte x, byte y, uint color_index,
                          LibPushLedAnimation anim);
 
+  /// \param settings Settings to write
+  /// \param batch Filled with the commands that write the known aftertouch, velocity curve
+  /// and sensitivity settings. Sets every pad at once if they all have the same sensitivity
+  static void add_settings(const DeviceSettings &settings, SysexBatch &batch);
+
   /// \param n The midi note number of a pad
   /// \returns The (x, y) coordinates the pad with note number n
   static std::tuple<uint, uint> pad_number_to_coordinates(uint n);
@@ -84,9 +193,82 @@ public:
   static uint pad_coordinates_to_number(byte x, byte y);
 
 private:
+  /// The pad that sends a note number
+  struct PadLocation {
+    bool is_pad;
+    uint x;
+    uint y;
+  };
+
   SysexInterface &sysex;
   LedInterface &leds;
-  MidiMessageListener<LibPushPadEvent> listener;
-  static std::unique_ptr<LibPushPadEvent> handle_message(byte msg_type,
-                                                         midi_msg &message);
+  SettingsCache &settings;
+  MidiMessageListener<LibPushPadEvent, PadInterface> listener;
+  friend class MidiMessageListener<LibPushPadEvent, PadInterface>;
+
+  std::atomic<const PadLayout *> layout;
+  std::atomic<int> layout_readers; //< The number of decodes and lookups that may be reading a layout
+  std::mutex layout_lock; //< Serializes layout changes
+  std::mutex relight_lock; //< Serializes relighting the pads after a layout change
+  std::vector<std::unique_ptr<const PadLayout>>
+      retired_layouts; //< Replaced layouts that a decode may still be reading
+  std::atomic<bool> has_retired_layouts; //< Whether retired_layouts has layouts left for the last reader to free
+
+  /// \effects Frees the retired layouts if no decode is reading a layout
+  /// \requires layout_lock is held
+  void reclaim_layouts();
+
+  /// \returns The current layout, which isn't freed until release_layout is called
+  const PadLayout *acquire_layout();
+
+  /// \effects Ends a read started by acquire_layout, freeing replaced layouts if it was the last
+  void release_layout();
+
+  /// \param msg_type The type of the incoming message
+  /// \param message The incoming message
+  /// \param event Filled with the pad event the message represents
+  /// \returns true if the message is a pad event
+  bool decode_message(byte msg_type, midi_msg &message,
+                      LibPushPadEvent &event);
+
+  /// \param pad The index of the pad
+  /// \param color_index (0-127) The index of the color in the palette
+  void light_pad(int pad, uint color_index);
+
+  /// \param curve The entries of the velocity curve
+  /// \param batch Filled with the commands that set the curve
+  static void add_velocity_curve(
+      const std::array<byte, LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES> &curve,
+      SysexBatch &batch);
+
+  /// \param x (0-7) The row of the pad
+  /// \param y (0-7) The column of the pad
+  /// \returns The index of the pad
+  /// \throws An [std::runtime_error]() exception if x or y is out of range
+  static int pad_index(byte x, byte y);
+
+  /// \param pad The index of the pad
+  /// \returns The row and column Push uses for the pad in pad settings commands
+  static std::array<byte, 2> pad_settings_location(int pad);
+
+  /// \param values The sensitivity of each pad
+  /// \param changed The pads to write
+  /// \param every_pad Whether values holds the sensitivity every pad should have,
+  /// so pads that aren't changed may be written too
+  /// \param batch Filled with the fewest commands that write the changed pads
+  static void add_pad_sensitivities(const std::array<byte, LAYOUT_PADS> &values,
+                                    const std::bitset<LAYOUT_PADS> &changed,
+                                    bool every_pad, SysexBatch &batch);
+
+  /// \returns true for pad presses, releases and polyphonic aftertouch
+  static bool accepts_message(byte msg_type, byte number);
+
+  /// \returns The index of the pad for aftertouch events, -1 for presses and releases
+  static int coalescing_key(const LibPushPadEvent &event);
+
+  /// \effects Keeps the latest aftertouch value
+  static void coalesce(LibPushPadEvent &pending, const LibPushPadEvent &event);
+
+  /// The location of the pad for every note number, precomputed with pad_number_to_coordinates
+  static std::array<PadLocation, 128> pad_locations;
 };
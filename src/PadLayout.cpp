@@ -0,0 +1,82 @@
+#include "PadLayout.hpp"
+#include "PadInterface.hpp"
+#include <stdexcept>
+
+using namespace std;
+
+constexpr int DRUM_BLOCK_DIM = 4;
+
+PadLayout::PadLayout() {
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    this->notes[pad] = PadInterface::pad_coordinates_to_number(
+        pad % LIBPUSH_PAD_MATRIX_DIM, pad / LIBPUSH_PAD_MATRIX_DIM);
+  }
+  this->colors.fill(0);
+}
+
+PadLayout::PadLayout(const LibPushPadLayout &layout) {
+  if (layout.root > 11) {
+    throw runtime_error("The root of a layout must be a pitch class (0-11)");
+  }
+
+  // The root is always part of the scale
+  unsigned short scale = layout.scale ? layout.scale : LIBPUSH_SCALE_MAJOR;
+  scale = (scale | 1) & 0xFFF;
+  array<int, 12> intervals;
+  int degrees = 0;
+  for (int interval = 0; interval < 12; ++interval) {
+    if (scale & (1 << interval)) {
+      intervals[degrees++] = interval;
+    }
+  }
+
+  int root_note = (layout.octave + 1) * 12 + layout.root;
+  for (int pad = 0; pad < LAYOUT_PADS; ++pad) {
+    int x = pad % LIBPUSH_PAD_MATRIX_DIM;
+    // Rows are counted from the bottom, where pad y coordinates end
+    int row = LIBPUSH_PAD_MATRIX_DIM - 1 - pad / LIBPUSH_PAD_MATRIX_DIM;
+
+    int note;
+    switch (layout.layout_type) {
+    case LP_LAYOUT_IN_KEY: {
+      int degree = x + row * (layout.row_offset ? layout.row_offset : 3);
+      note = root_note + degree / degrees * 12 + intervals[degree % degrees];
+      break;
+    }
+    case LP_LAYOUT_CHROMATIC:
+      note = root_note + x + row * (layout.row_offset ? layout.row_offset : 5);
+      break;
+    case LP_LAYOUT_DRUM: {
+      int block = row / DRUM_BLOCK_DIM * 2 + x / DRUM_BLOCK_DIM;
+      note = root_note + block * DRUM_BLOCK_DIM * DRUM_BLOCK_DIM +
+             row % DRUM_BLOCK_DIM * DRUM_BLOCK_DIM + x % DRUM_BLOCK_DIM;
+      break;
+    }
+    default:
+      throw runtime_error("Unknown pad layout type");
+    }
+
+    if (note < 0 || note > 127) {
+      this->notes[pad] = -1;
+      this->colors[pad] = 0;
+      continue;
+    }
+    this->notes[pad] = note;
+
+    if (layout.layout_type == LP_LAYOUT_DRUM) {
+      // Blocks are lit like a checkerboard so that their edges are visible
+      int block = row / DRUM_BLOCK_DIM + x / DRUM_BLOCK_DIM;
+      this->colors[pad] = block % 2 ? layout.other_color : layout.scale_color;
+    } else {
+      int interval = (note - layout.root + 12) % 12;
+      if (!interval) {
+        this->colors[pad] = layout.root_color;
+      } else if (scale & (1 << interval)) {
+        this->colors[pad] = layout.scale_color;
+      } else {
+        this->colors[pad] = layout.other_color;
+      }
+    }
+    this->colors[pad] &= 0x7F;
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "MidiMsg.hpp"
+#include "push.h"
+#include <array>
+
+#define LAYOUT_PADS (LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM)
+
+/// A pad layout compiled into the note and LED color of every pad
+///
+/// Pads are indexed by y * LIBPUSH_PAD_MATRIX_DIM + x, so translating a pad to a note
+/// is a single table lookup. Layouts are immutable once compiled
+class PadLayout {
+public:
+  /// \effects Creates the layout Push starts with, where every pad plays its own note number
+  /// and no pad is lit
+  PadLayout();
+
+  /// \param layout The layout to compile
+  /// \throws An [std::runtime_error]() exception if the layout type or root is invalid
+  PadLayout(const LibPushPadLayout &layout);
+
+  /// \param pad The index of a pad
+  /// \returns (0-127) The note the pad plays, or -1 if it plays none
+  int get_note(int pad) const { return this->notes[pad]; }
+
+  /// \param pad The index of a pad
+  /// \returns (0-127) The palette index the pad is lit with
+  byte get_color(int pad) const { return this->colors[pad]; }
+
+private:
+  std::array<signed char, LAYOUT_PADS> notes;
+  std::array<byte, LAYOUT_PADS> colors;
+};
@@ -0,0 +1,57 @@
+#include "ParameterStore.hpp"
+
+using namespace std;
+
+ParameterStore::ParameterStore() : changed(0) {
+  for (auto &value : this->values) {
+    value.store(0);
+  }
+}
+
+ParameterStore::~ParameterStore() { this->notifier.stop(); }
+
+double ParameterStore::get(int parameter) {
+  if (parameter < 0 || parameter >= LIBPUSH_PARAMETERS) {
+    return 0;
+  }
+  return this->values[parameter].load(memory_order_acquire);
+}
+
+void ParameterStore::set(int parameter, double value) {
+  if (parameter < 0 || parameter >= LIBPUSH_PARAMETERS) {
+    return;
+  }
+  this->update(parameter, [value](double) { return value; });
+}
+
+unsigned long long ParameterStore::take_changes() {
+  return this->changed.exchange(0, memory_order_acquire);
+}
+
+void ParameterStore::set_notifications(LibPushParameterCallback cb,
+                                       void *context,
+                                       unsigned int interval_us) {
+  this->notifier.stop();
+  if (cb && interval_us) {
+    this->notifier.start(chrono::microseconds(interval_us),
+                         [this, cb, context]() { this->notify(cb, context); });
+  }
+}
+
+void ParameterStore::notify(LibPushParameterCallback cb, void *context) {
+  unsigned long long mask = this->take_changes();
+  if (!mask) {
+    return;
+  }
+
+  LibPushParameterChange changes[LIBPUSH_PARAMETERS];
+  size_t count = 0;
+  for (int parameter = 0; parameter < LIBPUSH_PARAMETERS; ++parameter) {
+    if ((mask >> parameter) & 1) {
+      changes[count].parameter = parameter;
+      changes[count].value = this->get(parameter);
+      ++count;
+    }
+  }
+  cb(changes, count, context);
+}
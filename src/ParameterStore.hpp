@@ -0,0 +1,65 @@
+#pragma once
+#include "PeriodicTimer.hpp"
+#include "push.h"
+#include <array>
+#include <atomic>
+
+/// A fixed set of parameter values that can be shared between threads without locks
+///
+/// Each value is an atomic double, so real-time threads (e.g. an audio callback) can read
+/// values while the MIDI input thread writes them. Changes are recorded in a mask
+/// that is taken by the application, or by a background thread that reports them
+/// in batches at a fixed interval
+class ParameterStore {
+public:
+  ParameterStore();
+  ~ParameterStore();
+
+  /// \param parameter The parameter to read
+  /// \returns The current value, or 0 if parameter is out of range
+  double get(int parameter);
+
+  /// \param parameter The parameter to write
+  /// \param value The new value
+  void set(int parameter, double value);
+
+  /// \param parameter The parameter to modify
+  /// \param modify Computes the new value from the current value. May be called several times
+  /// if another thread changes the parameter at the same time
+  /// \returns The new value
+  /// \requires parameter is in range
+  template <typename Modify> double update(int parameter, Modify modify) {
+    std::atomic<double> &value = this->values[parameter];
+    double current = value.load(std::memory_order_relaxed);
+    double next;
+    do {
+      next = modify(current);
+    } while (!value.compare_exchange_weak(current, next,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+
+    if (next != current) {
+      this->changed.fetch_or(1ULL << parameter, std::memory_order_release);
+    }
+    return next;
+  }
+
+  /// \returns A mask of (1 << parameter) for the parameters that changed since the last call
+  unsigned long long take_changes();
+
+  /// \param cb Called with the parameters that changed in each interval, or nullptr to stop
+  /// \param context A pointer passed to cb
+  /// \param interval_us How often to take changes
+  void set_notifications(LibPushParameterCallback cb, void *context,
+                         unsigned int interval_us);
+
+private:
+  std::array<std::atomic<double>, LIBPUSH_PARAMETERS> values;
+  std::atomic<unsigned long long> changed;
+  PeriodicTimer notifier;
+
+  /// \param cb The callback to call
+  /// \param context A pointer passed to cb
+  /// \effects Calls cb once with all parameters that changed, if any
+  void notify(LibPushParameterCallback cb, void *context);
+};
@@ -1,30 +1,33 @@
 #include "PedalInterface.hpp"
+#include <algorithm>
 
 using namespace std;
 
 unordered_set<byte> PedalInterface::possible_cc_numbers = {64, 65, 66, 69};
 
-PedalInterface::PedalInterface(MidiInterface &midi, SysexInterface &sysex)
-    : sysex(sysex),
-      listener([this](byte msg_type,
-                      midi_msg &message) -> unique_ptr<LibPushPedalEvent> {
-        return this->handle_message(msg_type, message);
-      }) {
+PedalInterface::PedalInterface(MidiInterface &midi, SysexInterface &sysex,
+                               SettingsCache &settings)
+    : sysex(sysex), settings(settings), listener(*this) {
   midi.register_handler(&this->listener);
+  sysex.register_command_with_reply(PedalSysex::SAMPLE_PEDAL_DATA);
   this->available_cc_numbers = {65, 66};
   this->contact_cc_numbers = {{LibPushPedalContact::LP_PEDAL_1_RING, 64},
                               {LibPushPedalContact::LP_PEDAL_2_RING, 69}};
+  this->cc_contacts.fill(-1);
+  for (const auto &contact_cc : this->contact_cc_numbers) {
+    this->cc_contacts[contact_cc.second] = contact_cc.first;
+  }
 }
 
 LibPushPedalSampleData PedalInterface::sample_pedals(byte sample_size) {
-  midi_msg args({sample_size});
-  midi_msg reply = this->sysex.sysex_call(PedalSysex::SAMPLE_PEDAL_DATA, args);
+  midi_msg reply =
+      this->sysex.sysex_call(SamplePedalData::format(sample_size));
 
   LibPushPedalSampleData data;
-  data.pedal_1_ring = reply[0] | (reply[1] << 7);
-  data.pedal_1_tip = reply[2] | (reply[3] << 7);
-  data.pedal_2_ring = reply[4] | (reply[5] << 7);
-  data.pedal_2_tip = reply[6] | (reply[7] << 7);
+  data.pedal_1_ring = SamplePedalData::reply_field<0>(reply);
+  data.pedal_1_tip = SamplePedalData::reply_field<1>(reply);
+  data.pedal_2_ring = SamplePedalData::reply_field<2>(reply);
+  data.pedal_2_tip = SamplePedalData::reply_field<3>(reply);
   return data;
 }
 
@@ -42,6 +45,7 @@ void PedalInterface::set_pedal_configuration(LibPushPedalContact contact,
     cc_val = this->available_cc_numbers.back();
     this->available_cc_numbers.pop_back();
     this->contact_cc_numbers[contact] = cc_val;
+    this->cc_contacts[cc_val] = contact;
   } else {
     auto key = this->contact_cc_numbers.find(contact);
     if (key == this->contact_cc_numbers.end()) {
@@ -53,64 +57,121 @@ void PedalInterface::set_pedal_configuration(LibPushPedalContact contact,
 
     // Get the cc value assigned to the contact and add it to the available list
     this->available_cc_numbers.push_back(key->second);
+    this->cc_contacts[key->second] = -1;
     this->contact_cc_numbers.erase(key);
   }
 
-  midi_msg args({static_cast<byte>(contact), cc_val, 0, 0});
-  sysex.sysex_call(PedalSysex::SET_PEDAL_CONFIGURATION, args);
+  sysex.sysex_call(SetConfiguration::format(contact, cc_val, 0, 0));
 }
 
 void PedalInterface::set_pedal_curve_limits(LibPushPedalContact contact,
                                             unsigned short heel_down,
                                             unsigned short toe_down) {
-  midi_msg args({static_cast<byte>(contact),
-                 static_cast<byte>(heel_down & 0x7F),
-                 static_cast<byte>((heel_down & 0x1F) >> 7),
-                 static_cast<byte>(toe_down & 0x7F),
-                 static_cast<byte>((toe_down & 0x1F) >> 7)});
-  sysex.sysex_call(PedalSysex::SET_PEDAL_CURVE_LIMITS, args);
+  array<unsigned short, 2> limits = {{heel_down, toe_down}};
+  this->settings.write(
+      this->settings.pedal_curve_limits[contact % LIBPUSH_PEDAL_CONTACTS],
+      limits, [&] {
+        sysex.sysex_call(SetCurveLimits::format(contact, heel_down, toe_down));
+      });
 }
 
 constexpr byte CURVE_STEP = LIBPUSH_PEDAL_CURVE_ENTRIES / 4;
 void PedalInterface::set_pedal_curve_entries(
     LibPushPedalContact contact, byte (&entries)[LIBPUSH_PEDAL_CURVE_ENTRIES]) {
+  array<byte, LIBPUSH_PEDAL_CURVE_ENTRIES> curve;
+  copy_n(entries, LIBPUSH_PEDAL_CURVE_ENTRIES, curve.begin());
+  this->settings.write(
+      this->settings.pedal_curves[contact % LIBPUSH_PEDAL_CONTACTS], curve,
+      [&] {
+        SysexBatch batch;
+        add_curve(contact, curve, batch);
+        sysex.send_batch(batch);
+      });
+}
 
+void PedalInterface::add_curve(
+    byte contact, const array<byte, LIBPUSH_PEDAL_CURVE_ENTRIES> &curve,
+    SysexBatch &batch) {
   for (byte i = 0; i < LIBPUSH_PEDAL_CURVE_ENTRIES; i += CURVE_STEP) {
-    // Entries are set 4 at a time
-    midi_msg args({static_cast<byte>(contact), i});
-    for (byte j = i; j < i + CURVE_STEP; ++j) {
-      args.push_back(entries[j] & 0x7F);
-      args.push_back(entries[j] >> 7);
+    // A quarter of the entries is set at a time
+    batch.add(SetCurveEntries::format(contact, i, curve.data() + i));
+  }
+}
+
+void PedalInterface::add_settings(const DeviceSettings &settings,
+                                  SysexBatch &batch) {
+  for (byte contact = 0; contact < LIBPUSH_PEDAL_CONTACTS; ++contact) {
+    if (settings.pedal_curves[contact].known) {
+      add_curve(contact, settings.pedal_curves[contact].value, batch);
+    }
+    const auto &limits = settings.pedal_curve_limits[contact];
+    if (limits.known) {
+      batch.add(
+          SetCurveLimits::format(contact, limits.value[0], limits.value[1]));
     }
-    sysex.sysex_call(PedalSysex::SET_PEDAL_CURVE_ENTRIES, args);
   }
 }
 
-void PedalInterface::register_callback(LibPushPedalCallback cb, void *context) {
-  this->listener.register_callback(cb, context);
+int PedalInterface::register_callback(LibPushPedalCallback cb, void *context) {
+  return this->listener.register_callback(cb, context);
+}
+
+bool PedalInterface::unregister_callback(int token) {
+  return this->listener.unregister_callback(token);
+}
+
+bool PedalInterface::set_callback_filter(int token,
+                                         const LibPushEventFilter &filter) {
+  return this->listener.set_callback_filter(token, filter);
+}
+
+void PedalInterface::set_event_queue(EventQueue *queue) {
+  this->listener.set_event_queue(queue);
+}
+
+void PedalInterface::set_callback_runner(CallbackRunner *runner) {
+  this->listener.set_callback_runner(runner);
 }
 
-unique_ptr<LibPushPedalEvent>
-PedalInterface::handle_message(byte msg_type, midi_msg &message) {
+void PedalInterface::set_controller_state(ControllerState *state) {
+  this->listener.set_controller_state(state);
+}
+
+void PedalInterface::set_signal_conditioner(SignalConditioner *conditioner) {
+  this->listener.set_signal_conditioner(conditioner);
+}
+
+LatencyHistogram &PedalInterface::get_latency() {
+  return this->listener.get_latency();
+}
+
+bool PedalInterface::accepts_message(byte msg_type, byte number) {
+  return msg_type == MidiMsgType::cc &&
+         PedalInterface::possible_cc_numbers.count(number);
+}
+
+bool PedalInterface::decode_message(byte msg_type, midi_msg &message,
+                                    LibPushPedalEvent &event) {
   if (msg_type != MidiMsgType::cc) {
-    return nullptr;
+    return false;
   }
-  byte cc_number = get_midi_number(msg_type, message);
-  if (!PedalInterface::possible_cc_numbers.count(cc_number)) {
-    return nullptr;
+
+  // Messages for cc numbers that no contact is assigned to are ignored
+  int contact = this->cc_contacts[message[1] & 0x7F];
+  if (contact < 0) {
+    return false;
   }
 
-  byte val = get_midi_value(msg_type, message);
-  unique_ptr<LibPushPedalEvent> event = make_unique<LibPushPedalEvent>();
-  event->value = (val / 127);
+  byte val = message[2];
+  event.value = val / 127.0;
+  event.contact = static_cast<LibPushPedalContact>(contact);
 
-  for (auto itr = this->contact_cc_numbers.begin();
-       itr != this->contact_cc_numbers.end(); ++itr) {
-    if (cc_number == itr->second) {
-      event->contact = itr->first;
-      break;
-    }
-  }
+  return true;
+}
 
-  return event;
+int PedalInterface::coalescing_key(const LibPushPedalEvent &event) {
+  return -1;
 }
+
+void PedalInterface::coalesce(LibPushPedalEvent &pending,
+                              const LibPushPedalEvent &event) {}
@@ -3,8 +3,10 @@
 #include "MidiMessageHandler.hpp"
 #include "MidiMessageListener.hpp"
 #include "MidiMsg.hpp"
+#include "SettingsCache.hpp"
 #include "SysexInterface.hpp"
 #include "push.h"
+#include <array>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
@@ -22,10 +24,31 @@ public:
     SET_PEDAL_CURVE_ENTRIES = 0x32
   };
 
-  PedalInterface(MidiInterface &midi, SysexInterface &sysex);
+  /// Log2 of the sample size. Replies with the pedal 1 ring, pedal 1 tip,
+  /// pedal 2 ring and pedal 2 tip values
+  using SamplePedalData =
+      SysexCommand<SAMPLE_PEDAL_DATA, SysexLayout<SysexU7>,
+                   SysexLayout<SysexU14, SysexU14, SysexU14, SysexU14>>;
+  /// Contact, cc number (127 unassigns the contact), then two bytes sent as 0
+  using SetConfiguration =
+      SysexCommand<SET_PEDAL_CONFIGURATION,
+                   SysexLayout<SysexU7, SysexU7, SysexU7, SysexU7>>;
+  /// Contact, heel down, then toe down
+  using SetCurveLimits =
+      SysexCommand<SET_PEDAL_CURVE_LIMITS,
+                   SysexLayout<SysexU7, SysexU14, SysexU14>>;
+  /// Contact, index of the first entry, then a quarter of the curve's entries
+  using SetCurveEntries = SysexCommand<
+      SET_PEDAL_CURVE_ENTRIES,
+      SysexLayout<SysexU7, SysexU7,
+                  SysexArray<SysexU14, LIBPUSH_PEDAL_CURVE_ENTRIES / 4>>>;
+
+  PedalInterface(MidiInterface &midi, SysexInterface &sysex,
+                 SettingsCache &settings);
 
   /// \param (0-19) log2 of the number of samples to average when sampling the pedal data
   /// \returns The average value over sample_size samples
+  /// \throws An [std::runtime_error]() exception if the reply is malformed
   LibPushPedalSampleData sample_pedals(byte sample_size);
 
   /// \param contact Which pedal contact to configure
@@ -46,17 +69,72 @@ public:
   void set_pedal_curve_entries(LibPushPedalContact contact,
                                byte (&entries)[LIBPUSH_PEDAL_CURVE_ENTRIES]);
 
-  void register_callback(LibPushPedalCallback cb, void *context);
+  /// \param settings Settings to write
+  /// \param batch Filled with the commands that write the known curves and curve limits
+  static void add_settings(const DeviceSettings &settings, SysexBatch &batch);
+
+  /// \returns A token that identifies the callback
+  int register_callback(LibPushPedalCallback cb, void *context);
+
+  /// \param token A token returned by register_callback
+  /// \returns false if no callback of this interface has the token
+  bool unregister_callback(int token);
+
+  /// \param token A token returned by register_callback
+  /// \param filter The events the callback should receive
+  /// \returns false if no callback of this interface has the token
+  bool set_callback_filter(int token, const LibPushEventFilter &filter);
+
+  /// \param queue The queue to write events to, or nullptr to stop queueing events
+  void set_event_queue(EventQueue *queue);
+
+  /// \param runner Calls this interface's callbacks when it is active
+  void set_callback_runner(CallbackRunner *runner);
+
+  /// \param state The state to keep up to date with this interface's events
+  void set_controller_state(ControllerState *state);
+
+  /// \param conditioner Filters this interface's continuous events before they are used, or nullptr
+  void set_signal_conditioner(SignalConditioner *conditioner);
+
+  /// \returns The latency of this interface's events, from arrival to the return of the last callback
+  LatencyHistogram &get_latency();
 
 private:
   SysexInterface &sysex;
+  SettingsCache &settings;
+
+  MidiMessageListener<LibPushPedalEvent, PedalInterface> listener;
+  friend class MidiMessageListener<LibPushPedalEvent, PedalInterface>;
+
+  /// \param msg_type The type of the incoming message
+  /// \param message The incoming message
+  /// \param event Filled with the pedal event the message represents
+  /// \returns true if the message is from a pedal contact that is assigned a cc number
+  bool decode_message(byte msg_type, midi_msg &message,
+                      LibPushPedalEvent &event);
+
+  /// \param contact The contact the curve is for
+  /// \param curve The entries of the curve
+  /// \param batch Filled with the commands that set the curve
+  static void add_curve(byte contact,
+                        const std::array<byte, LIBPUSH_PEDAL_CURVE_ENTRIES> &curve,
+                        SysexBatch &batch);
+
+  /// \returns -1, pedal events are never coalesced
+  static int coalescing_key(const LibPushPedalEvent &event);
+  static void coalesce(LibPushPedalEvent &pending,
+                       const LibPushPedalEvent &event);
 
-  MidiMessageListener<LibPushPedalEvent> listener;
-  std::unique_ptr<LibPushPedalEvent> handle_message(byte msg_type,
-                                                    midi_msg &message);
   std::vector<byte>
       available_cc_numbers; //< Which cc numbers can be used for pedals
   std::unordered_map<LibPushPedalContact, byte>
       contact_cc_numbers; //< What cc number is each contact currently set to
+  std::array<int, 128>
+      cc_contacts; //< The contact assigned to each cc number, or -1 if none is
+
+  /// \returns true for cc messages with a number that a pedal can be assigned to
+  static bool accepts_message(byte msg_type, byte number);
+
   static std::unordered_set<byte> possible_cc_numbers;
 };
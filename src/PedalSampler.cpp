@@ -0,0 +1,112 @@
+#include "PedalSampler.hpp"
+#include "LatencyHistogram.hpp"
+#include <cmath>
+
+using namespace std;
+
+PedalSampler::PedalSampler(PedalInterface &pedals)
+    : pedals(pedals), sample_size(0), capacity(0), head(0), tail(0),
+      dropped(0) {
+  LibPushPedalCalibration linear = {0, LIBPUSH_PEDAL_SAMPLE_RANGE - 1, 1};
+  for (unsigned int channel = 0; channel < LIBPUSH_PEDAL_SAMPLE_CHANNELS;
+       ++channel) {
+    this->set_calibration(channel, linear);
+  }
+}
+
+PedalSampler::~PedalSampler() { this->stop(); }
+
+void PedalSampler::start(unsigned int rate_hz, byte sample_size,
+                         size_t capacity) {
+  if (!rate_hz || !capacity) {
+    throw runtime_error("Pedal sampling needs a rate and a capacity");
+  }
+  if (rate_hz > MAX_PEDAL_SAMPLE_RATE_HZ) {
+    throw runtime_error("Pedal sampling rate can't be above 1 MHz");
+  }
+
+  this->stop();
+  this->buffer = make_unique<LibPushPedalSample[]>(capacity);
+  this->capacity = capacity;
+  this->head.store(0);
+  this->tail.store(0);
+  this->dropped.store(0);
+  this->sample_size = sample_size;
+
+  this->timer.start(chrono::microseconds(1000000 / rate_hz),
+                    [this]() { this->sample(); });
+}
+
+unsigned long long PedalSampler::stop() {
+  this->timer.stop();
+  return this->dropped.load();
+}
+
+size_t PedalSampler::read(LibPushPedalSample *out, size_t max) {
+  if (!this->buffer) {
+    return 0;
+  }
+
+  size_t tail = this->tail.load(memory_order_relaxed);
+  size_t head = this->head.load(memory_order_acquire);
+  size_t count = 0;
+  while (count < max && tail < head) {
+    out[count++] = this->buffer[tail % this->capacity];
+    ++tail;
+  }
+  this->tail.store(tail, memory_order_release);
+  return count;
+}
+
+void PedalSampler::set_calibration(unsigned int channel,
+                                   const LibPushPedalCalibration &calibration) {
+  if (channel >= LIBPUSH_PEDAL_SAMPLE_CHANNELS) {
+    return;
+  }
+
+  // Built outside of the lock so that the sampler is only held up by the copy
+  Table table;
+  double heel = calibration.heel_down;
+  double toe = calibration.toe_down;
+  double curve = calibration.curve > 0 ? calibration.curve : 1;
+  for (size_t raw = 0; raw < table.size(); ++raw) {
+    // A reversed range works for pedals that read lower when pressed
+    double position = heel == toe ? 0 : (raw - heel) / (toe - heel);
+    position = min(max(position, 0.0), 1.0);
+    table[raw] = pow(position, curve);
+  }
+
+  lock_guard<mutex> guard(this->tables_lock);
+  this->tables[channel] = table;
+}
+
+void PedalSampler::sample() {
+  LibPushPedalSampleData data;
+  try {
+    data = this->pedals.sample_pedals(this->sample_size);
+  } catch (exception &ex) {
+    cerr << "Exception while sampling pedals: " << ex.what() << endl;
+    return;
+  }
+
+  LibPushPedalSample sample;
+  sample.timestamp = monotonic_time_ns();
+  unsigned short raw[LIBPUSH_PEDAL_SAMPLE_CHANNELS] = {
+      data.pedal_1_ring, data.pedal_1_tip, data.pedal_2_ring, data.pedal_2_tip};
+  {
+    lock_guard<mutex> guard(this->tables_lock);
+    for (int channel = 0; channel < LIBPUSH_PEDAL_SAMPLE_CHANNELS; ++channel) {
+      size_t reading =
+          min<size_t>(raw[channel], LIBPUSH_PEDAL_SAMPLE_RANGE - 1);
+      sample.values[channel] = this->tables[channel][reading];
+    }
+  }
+
+  size_t head = this->head.load(memory_order_relaxed);
+  if (head - this->tail.load(memory_order_acquire) >= this->capacity) {
+    this->dropped.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+  this->buffer[head % this->capacity] = sample;
+  this->head.store(head + 1, memory_order_release);
+}
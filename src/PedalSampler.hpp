@@ -0,0 +1,66 @@
+#pragma once
+#include "PedalInterface.hpp"
+#include "PeriodicTimer.hpp"
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#define MAX_PEDAL_SAMPLE_RATE_HZ 1000000 //< The sampling period is a whole number of microseconds
+
+/// Samples Push's pedal inputs from a background thread
+///
+/// Each sample is requested with PedalInterface::sample_pedals, mapped through a lookup table
+/// per input that holds the calibrated value of every raw reading, and written to a
+/// single producer, single consumer ring buffer. Reading samples never blocks or allocates.
+/// Samples that don't fit in the buffer are dropped and counted.
+class PedalSampler {
+public:
+  /// \param pedals The interface to request samples from
+  PedalSampler(PedalInterface &pedals);
+  ~PedalSampler();
+
+  /// \param rate_hz How many times per second to sample
+  /// \param sample_size log2 of the number of readings Push averages for each sample
+  /// \param capacity The number of samples the buffer can hold
+  /// \effects Stops any running sampler and starts sampling into a new buffer
+  /// \requires Not called while samples are being read
+  /// \throws An [std::runtime_error]() exception if rate_hz or capacity is 0, or rate_hz is above MAX_PEDAL_SAMPLE_RATE_HZ
+  void start(unsigned int rate_hz, byte sample_size, size_t capacity);
+
+  /// \returns The number of samples dropped since start
+  /// \effects Stops sampling
+  unsigned long long stop();
+
+  /// \param out An array to copy samples into
+  /// \param max The number of samples out can hold
+  /// \returns The number of samples copied into out
+  /// \requires Only one thread reads samples
+  size_t read(LibPushPedalSample *out, size_t max);
+
+  /// \param channel The pedal input to calibrate
+  /// \param calibration How to map the input's raw readings to values
+  /// \effects Rebuilds the lookup table of the input
+  void set_calibration(unsigned int channel,
+                       const LibPushPedalCalibration &calibration);
+
+private:
+  using Table = std::array<float, LIBPUSH_PEDAL_SAMPLE_RANGE>;
+
+  PedalInterface &pedals;
+  PeriodicTimer timer;
+  byte sample_size;
+
+  std::mutex tables_lock; //< Guards the tables against recalibration while sampling
+  std::array<Table, LIBPUSH_PEDAL_SAMPLE_CHANNELS> tables;
+
+  std::unique_ptr<LibPushPedalSample[]> buffer;
+  size_t capacity;
+  std::atomic<size_t> head; //< Total samples written
+  std::atomic<size_t> tail; //< Total samples read
+  std::atomic<unsigned long long> dropped;
+
+  /// \effects Requests a sample and writes it to the buffer
+  void sample();
+};
@@ -0,0 +1,47 @@
+#include "PeriodicTimer.hpp"
+
+using namespace std;
+
+PeriodicTimer::PeriodicTimer() : running(false) {}
+
+PeriodicTimer::~PeriodicTimer() { this->stop(); }
+
+void PeriodicTimer::start(chrono::microseconds interval,
+                          function<void()> task) {
+  this->stop();
+
+  this->running = true;
+  this->thread = std::thread([this, interval, task]() {
+    auto next_run = chrono::steady_clock::now() + interval;
+    unique_lock<mutex> guard(this->lock);
+    while (this->running) {
+      if (this->stopped.wait_until(guard, next_run,
+                                   [this] { return !this->running; })) {
+        break;
+      }
+
+      guard.unlock();
+      task();
+      guard.lock();
+
+      // Skip runs that were missed instead of running them back to back
+      auto now = chrono::steady_clock::now();
+      next_run += interval;
+      if (next_run < now) {
+        next_run = now + interval;
+      }
+    }
+  });
+}
+
+void PeriodicTimer::stop() {
+  {
+    lock_guard<mutex> guard(this->lock);
+    this->running = false;
+  }
+  this->stopped.notify_all();
+
+  if (this->thread.joinable()) {
+    this->thread.join();
+  }
+}
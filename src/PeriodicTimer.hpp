@@ -0,0 +1,27 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/// Runs a task on a background thread at a fixed interval
+class PeriodicTimer {
+public:
+  PeriodicTimer();
+  ~PeriodicTimer();
+
+  /// \param interval The time between the start of each run of task
+  /// \param task The function to run
+  /// \effects Stops any running task and starts running task every interval
+  void start(std::chrono::microseconds interval, std::function<void()> task);
+
+  /// \effects Stops running the task and waits for the current run to finish
+  void stop();
+
+private:
+  std::mutex lock;
+  std::condition_variable stopped;
+  bool running;
+  std::thread thread;
+};
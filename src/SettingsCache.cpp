@@ -0,0 +1,33 @@
+#include "SettingsCache.hpp"
+
+using namespace std;
+
+SettingsCache::SettingsCache()
+    : DeviceSettings(), palette_changed(), hits(0), misses(0), writes(0),
+      skipped_writes(0) {
+  this->invalidate();
+}
+
+DeviceSettings SettingsCache::copy() {
+  lock_guard<mutex> guard(this->lock);
+  return *this;
+}
+
+void SettingsCache::invalidate() {
+  lock_guard<mutex> guard(this->lock);
+  visit(*this, *this,
+        [](byte, size_t, auto &setting, auto &) { setting.known = false; });
+
+  // Entries set by another application may not have been applied yet
+  this->palette_changed.value = true;
+  this->palette_changed.known = true;
+}
+
+LibPushSettingsCacheStats SettingsCache::get_stats() {
+  LibPushSettingsCacheStats stats;
+  stats.hits = this->hits.load(memory_order_relaxed);
+  stats.misses = this->misses.load(memory_order_relaxed);
+  stats.writes = this->writes.load(memory_order_relaxed);
+  stats.skipped_writes = this->skipped_writes.load(memory_order_relaxed);
+  return stats;
+}
@@ -0,0 +1,273 @@
+#pragma once
+#include "MidiMsg.hpp"
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <mutex>
+
+#define LED_PALETTE_ENTRIES 128
+#define LED_WHITE_BALANCE_GROUPS 11
+#define LED_PWM_FREQ_MIN 20  //< The lowest led pwm frequency in Hz
+#define LED_PWM_FREQ_MAX 116 //< The highest led pwm frequency in Hz
+
+/// A device setting as the library last wrote or read it
+template <typename T> struct CachedSetting {
+  T value;
+  bool known; //< Whether value is what Push has, or the setting has to be read from Push
+};
+
+/// The settings of Push that the library can write with sysex commands
+struct DeviceSettings {
+  /// Identifies each kind of setting, e.g. in a saved snapshot
+  enum Id : byte {
+    LED_BRIGHTNESS = 1,
+    DISPLAY_BRIGHTNESS = 2,
+    LED_PWM_FREQ = 3,
+    AFTERTOUCH_MODE = 4,
+    AFTERTOUCH_RANGE = 5,
+    TOUCH_STRIP_CONFIG = 6,
+    VELOCITY_CURVE = 7,
+    PALETTE_ENTRY = 8,
+    WHITE_BALANCE = 9,
+    PAD_SENSITIVITY = 10,
+    PEDAL_CURVE = 11,
+    PEDAL_CURVE_LIMITS = 12
+  };
+
+  CachedSetting<byte> led_brightness;
+  CachedSetting<byte> display_brightness;
+  CachedSetting<int> led_pwm_freq;
+  CachedSetting<byte> aftertouch_mode;
+  CachedSetting<std::array<unsigned short, 2>> aftertouch_range; //< Low, then high
+  CachedSetting<byte> touch_strip_config; //< As sent to Push
+  CachedSetting<std::array<byte, LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES>>
+      velocity_curve;
+  std::array<CachedSetting<LibPushLedColor>, LED_PALETTE_ENTRIES> palette;
+  std::array<CachedSetting<unsigned short>, LED_WHITE_BALANCE_GROUPS>
+      white_balance;
+  std::array<CachedSetting<byte>,
+             LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM>
+      pad_sensitivity; //< At y * LIBPUSH_PAD_MATRIX_DIM + x
+  std::array<CachedSetting<std::array<byte, LIBPUSH_PEDAL_CURVE_ENTRIES>>,
+             LIBPUSH_PEDAL_CONTACTS>
+      pedal_curves;
+  std::array<CachedSetting<std::array<unsigned short, 2>>,
+             LIBPUSH_PEDAL_CONTACTS>
+      pedal_curve_limits; //< Heel down, then toe down
+
+  /// \param a Settings to visit
+  /// \param b Settings to visit alongside a
+  /// \param visit Called with the id and index of every setting, the setting in a and the same setting in b
+  template <typename A, typename B, typename Visit>
+  static void visit(A &a, B &b, Visit visit) {
+    visit(LED_BRIGHTNESS, 0, a.led_brightness, b.led_brightness);
+    visit(DISPLAY_BRIGHTNESS, 0, a.display_brightness, b.display_brightness);
+    visit(LED_PWM_FREQ, 0, a.led_pwm_freq, b.led_pwm_freq);
+    visit(AFTERTOUCH_MODE, 0, a.aftertouch_mode, b.aftertouch_mode);
+    visit(AFTERTOUCH_RANGE, 0, a.aftertouch_range, b.aftertouch_range);
+    visit(TOUCH_STRIP_CONFIG, 0, a.touch_strip_config, b.touch_strip_config);
+    visit(VELOCITY_CURVE, 0, a.velocity_curve, b.velocity_curve);
+    for (size_t i = 0; i < a.palette.size(); ++i) {
+      visit(PALETTE_ENTRY, i, a.palette[i], b.palette[i]);
+    }
+    for (size_t i = 0; i < a.white_balance.size(); ++i) {
+      visit(WHITE_BALANCE, i, a.white_balance[i], b.white_balance[i]);
+    }
+    for (size_t i = 0; i < a.pad_sensitivity.size(); ++i) {
+      visit(PAD_SENSITIVITY, i, a.pad_sensitivity[i], b.pad_sensitivity[i]);
+    }
+    for (size_t i = 0; i < a.pedal_curves.size(); ++i) {
+      visit(PEDAL_CURVE, i, a.pedal_curves[i], b.pedal_curves[i]);
+    }
+    for (size_t i = 0; i < a.pedal_curve_limits.size(); ++i) {
+      visit(PEDAL_CURVE_LIMITS, i, a.pedal_curve_limits[i],
+            b.pedal_curve_limits[i]);
+    }
+  }
+};
+
+/// The settings of Push that the library can write and read back with sysex commands
+///
+/// Getters answer from the cache while a setting is known, and setters skip writes that
+/// wouldn't change a known setting. A setting becomes known when it's written or read,
+/// and stays known until the cache is invalidated, e.g. because another application
+/// may have changed Push's settings
+class SettingsCache : public DeviceSettings {
+public:
+  SettingsCache();
+
+  /// Whether a palette entry may have changed since the palette was last reapplied
+  CachedSetting<bool> palette_changed;
+
+  /// \param setting A setting of this cache
+  /// \param value Set to the value of the setting, if it's known
+  /// \returns true if the setting is known
+  template <typename T>
+  bool lookup(const CachedSetting<T> &setting, T &value) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (!setting.known) {
+      this->misses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    value = setting.value;
+    this->hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// \param setting A setting of this cache
+  /// \param value The value read from Push
+  /// \effects Remembers the value, unless the setting was written while it was being read
+  template <typename T> void learn(CachedSetting<T> &setting, const T &value) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (!setting.known) {
+      setting.value = value;
+      setting.known = true;
+    }
+  }
+
+  /// \param setting A setting of this cache
+  /// \param value The value Push has
+  /// \effects Remembers the value, e.g. after it was written as part of a batch
+  template <typename T>
+  void remember(CachedSetting<T> &setting, const T &value) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    setting.value = value;
+    setting.known = true;
+  }
+
+  /// \param setting A setting of this cache
+  /// \param read Reads the setting from Push
+  /// \returns The value of the setting, read from Push only if it isn't known
+  template <typename T, typename Read>
+  T read(CachedSetting<T> &setting, Read read) {
+    T value;
+    if (this->lookup(setting, value)) {
+      return value;
+    }
+
+    // Not locked while waiting for Push, so a slow reply doesn't block other settings
+    value = read();
+    this->learn(setting, value);
+    return value;
+  }
+
+  /// \param setting A setting of this cache
+  /// \param value The new value of the setting
+  /// \param write Sends the value to Push
+  /// \returns false if the write was skipped because Push already has the value
+  /// \effects Remembers the value once it's written. If writing throws, the setting is forgotten,
+  /// since the write may have reached Push
+  template <typename T, typename Write>
+  bool write(CachedSetting<T> &setting, const T &value, Write write) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (setting.known && same(setting.value, value)) {
+      this->skipped_writes.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    setting.known = false;
+    write();
+    setting.value = value;
+    setting.known = true;
+    this->writes.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// \param settings Settings of this cache that can be written together
+  /// \param first The index of the first setting to write
+  /// \param count The number of settings to write
+  /// \param values The new value of each setting
+  /// \param write Called with the settings that need to be written, and sends their values to Push
+  /// \returns The number of settings that were written
+  /// \effects Skips the write entirely if Push already has every value
+  template <typename T, size_t N, typename Write>
+  size_t write_each(std::array<CachedSetting<T>, N> &settings, size_t first,
+                    size_t count, const T *values, Write write) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    std::bitset<N> changed;
+    for (size_t i = 0; i < count; ++i) {
+      const CachedSetting<T> &setting = settings[first + i];
+      changed[first + i] = !setting.known || !same(setting.value, values[i]);
+    }
+    this->skipped_writes.fetch_add(count - changed.count(),
+                                   std::memory_order_relaxed);
+    if (changed.none()) {
+      return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      settings[first + i].known &= !changed[first + i];
+    }
+    write(changed);
+    for (size_t i = 0; i < count; ++i) {
+      settings[first + i].value = values[i];
+      settings[first + i].known = true;
+    }
+    this->writes.fetch_add(changed.count(), std::memory_order_relaxed);
+    return changed.count();
+  }
+
+  /// \param saved Settings to restore. Only the known ones are restored
+  /// \param write Called with the saved settings Push may not have, which are the known ones,
+  /// and sends them to Push
+  /// \returns The number of settings that were written
+  /// \effects Skips the write entirely if Push already has every saved setting
+  template <typename Write>
+  size_t restore(const DeviceSettings &saved, Write write) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    DeviceSettings changes = saved;
+    size_t count = 0;
+    size_t skipped = 0;
+    visit(changes, *this, [&](byte, size_t, auto &change, auto &current) {
+      if (!change.known) {
+        return;
+      }
+      if (current.known && same(current.value, change.value)) {
+        change.known = false;
+        ++skipped;
+      } else {
+        current.known = false;
+        ++count;
+      }
+    });
+    this->skipped_writes.fetch_add(skipped, std::memory_order_relaxed);
+    if (!count) {
+      return 0;
+    }
+
+    write(static_cast<const DeviceSettings &>(changes));
+    visit(changes, *this, [](byte, size_t, auto &change, auto &current) {
+      if (change.known) {
+        current = change;
+      }
+    });
+    this->writes.fetch_add(count, std::memory_order_relaxed);
+    return count;
+  }
+
+  /// \returns A copy of the settings, where the settings that aren't cached are unknown
+  DeviceSettings copy();
+
+  /// \effects Forgets every setting, so the next read of each one asks Push
+  void invalidate();
+
+  /// \returns How often getters and setters used the cache since connecting
+  LibPushSettingsCacheStats get_stats();
+
+private:
+  std::mutex lock; //< Guards the settings
+  std::atomic<unsigned long long> hits;
+  std::atomic<unsigned long long> misses;
+  std::atomic<unsigned long long> writes;
+  std::atomic<unsigned long long> skipped_writes;
+
+  template <typename T> static bool same(const T &a, const T &b) {
+    return a == b;
+  }
+
+  static bool same(const LibPushLedColor &a, const LibPushLedColor &b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.w == b.w;
+  }
+};
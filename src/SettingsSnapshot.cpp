@@ -0,0 +1,205 @@
+#include "SettingsSnapshot.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+const char SNAPSHOT_MAGIC[] = {'L', 'P', 'S', 'S'};
+const byte SNAPSHOT_VERSION = 1;
+
+// Each kind of value is written with a fixed length. Numbers are little endian
+
+static size_t encoded_length(byte) { return 1; }
+static size_t encoded_length(unsigned short) { return 2; }
+static size_t encoded_length(int) { return 4; }
+static size_t encoded_length(const LibPushLedColor &) { return 4; }
+template <typename T, size_t N>
+static size_t encoded_length(const array<T, N> &values) {
+  return N * encoded_length(values[0]);
+}
+
+static void encode(byte value, vector<byte> &out) { out.push_back(value); }
+
+static void encode(unsigned short value, vector<byte> &out) {
+  out.push_back(value & 0xFF);
+  out.push_back(value >> 8);
+}
+
+static void encode(int value, vector<byte> &out) {
+  for (int shift = 0; shift < 32; shift += 8) {
+    out.push_back((unsigned int)value >> shift);
+  }
+}
+
+static void encode(const LibPushLedColor &color, vector<byte> &out) {
+  out.insert(out.end(), {color.r, color.g, color.b, color.w});
+}
+
+template <typename T, size_t N>
+static void encode(const array<T, N> &values, vector<byte> &out) {
+  for (const T &value : values) {
+    encode(value, out);
+  }
+}
+
+static void decode(const byte *in, byte &value) { value = in[0]; }
+
+static void decode(const byte *in, unsigned short &value) {
+  value = in[0] | (in[1] << 8);
+}
+
+static void decode(const byte *in, int &value) {
+  unsigned int bits = 0;
+  for (int i = 0; i < 4; ++i) {
+    bits |= (unsigned int)in[i] << (8 * i);
+  }
+  value = (int)bits;
+}
+
+static void decode(const byte *in, LibPushLedColor &color) {
+  color = {in[0], in[1], in[2], in[3]};
+}
+
+template <typename T, size_t N>
+static void decode(const byte *in, array<T, N> &values) {
+  for (T &value : values) {
+    decode(in, value);
+    in += encoded_length(value);
+  }
+}
+
+// Values are checked against what the library would accept for each setting,
+// or what the command that restores it can carry
+
+static bool in_range(long long value, long long low, long long high) {
+  return value >= low && value <= high;
+}
+
+static bool in_range(const LibPushLedColor &, long long, long long) {
+  return true; // Every channel takes a whole byte
+}
+
+template <typename T, size_t N>
+static bool in_range(const array<T, N> &values, long long low,
+                     long long high) {
+  for (const T &value : values) {
+    if (!in_range(value, low, high)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// \returns Whether value is valid for the setting with the given id
+template <typename T> static bool is_valid(byte id, const T &value) {
+  switch (id) {
+  case DeviceSettings::LED_PWM_FREQ:
+    return in_range(value, LED_PWM_FREQ_MIN, LED_PWM_FREQ_MAX);
+  case DeviceSettings::AFTERTOUCH_MODE:
+    return in_range(value, LP_CHANNEL, LP_POLYPHONIC);
+  case DeviceSettings::PAD_SENSITIVITY:
+    return in_range(value, LP_REGULAR_SENSITIVITY, LP_LOW_SENSITIVITY);
+  case DeviceSettings::AFTERTOUCH_RANGE:
+  case DeviceSettings::WHITE_BALANCE:
+  case DeviceSettings::PEDAL_CURVE_LIMITS:
+    return in_range(value, 0, 0x3FFF);
+  case DeviceSettings::DISPLAY_BRIGHTNESS:
+  case DeviceSettings::PALETTE_ENTRY:
+  case DeviceSettings::PEDAL_CURVE:
+    return in_range(value, 0, 0xFF);
+  case DeviceSettings::LED_BRIGHTNESS:
+  case DeviceSettings::TOUCH_STRIP_CONFIG:
+  case DeviceSettings::VELOCITY_CURVE:
+    return in_range(value, 0, 0x7F);
+  default:
+    return true;
+  }
+}
+
+void SettingsSnapshot::save(const string &path,
+                            const DeviceSettings &settings) {
+  vector<byte> data(begin(SNAPSHOT_MAGIC), end(SNAPSHOT_MAGIC));
+  data.push_back(SNAPSHOT_VERSION);
+  DeviceSettings::visit(
+      settings, settings,
+      [&data](byte id, size_t index, const auto &setting, const auto &) {
+        if (setting.known) {
+          data.push_back(id);
+          data.push_back(index);
+          encode(setting.value, data);
+        }
+      });
+
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file) {
+    throw runtime_error("Can't open " + path + " to save settings");
+  }
+  size_t written = fwrite(data.data(), 1, data.size(), file);
+  if (fclose(file) != 0 || written != data.size()) {
+    throw runtime_error("Can't write settings to " + path);
+  }
+}
+
+DeviceSettings SettingsSnapshot::load(const string &path) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    throw runtime_error("Can't open settings snapshot " + path);
+  }
+
+  vector<byte> data;
+  byte chunk[4096];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.insert(data.end(), chunk, chunk + count);
+  }
+  fclose(file);
+
+  size_t header_length = sizeof(SNAPSHOT_MAGIC) + 1;
+  if (data.size() < header_length ||
+      !equal(begin(SNAPSHOT_MAGIC), end(SNAPSHOT_MAGIC), data.begin()) ||
+      data[sizeof(SNAPSHOT_MAGIC)] != SNAPSHOT_VERSION) {
+    throw runtime_error(path + " is not a libpush settings snapshot");
+  }
+
+  DeviceSettings settings;
+  DeviceSettings::visit(settings, settings,
+                        [](byte, size_t, auto &setting, auto &) {
+                          setting.known = false;
+                        });
+
+  size_t position = header_length;
+  while (position < data.size()) {
+    if (data.size() - position < 2) {
+      throw runtime_error("Settings snapshot is truncated or corrupt");
+    }
+    byte id = data[position++];
+    byte index = data[position++];
+
+    // Find the setting the record is for
+    size_t length = 0;
+    DeviceSettings::visit(
+        settings, settings,
+        [&](byte setting_id, size_t setting_index, auto &setting, auto &) {
+          if (setting_id != id || setting_index != index) {
+            return;
+          }
+          length = encoded_length(setting.value);
+          if (length > data.size() - position) {
+            throw runtime_error("Settings snapshot is truncated or corrupt");
+          }
+          decode(&data[position], setting.value);
+          if (!is_valid(id, setting.value)) {
+            throw runtime_error("Settings snapshot has a setting out of range");
+          }
+          setting.known = true;
+        });
+    if (!length) {
+      throw runtime_error("Settings snapshot has an unknown setting");
+    }
+    position += length;
+  }
+  return settings;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "SettingsCache.hpp"
+#include <string>
+
+/// Saves Push's settings to a file and reads them back, so they can be restored on the next start
+///
+/// The file starts with the magic bytes "LPSS" and a version byte, followed by one record per known setting:
+/// the setting's DeviceSettings::Id, its index (e.g. the palette entry or pad), and its value.
+/// Each kind of setting has a value of fixed length, with numbers in little endian order.
+/// A full snapshot of Push takes about 1.5 KB
+class SettingsSnapshot {
+public:
+  /// \param path The file to write
+  /// \param settings The settings to save. Settings that aren't known are left out
+  /// \throws An [std::runtime_error]() exception if the file can't be written
+  static void save(const std::string &path, const DeviceSettings &settings);
+
+  /// \param path A file written by save
+  /// \returns The saved settings. Settings that weren't saved are unknown
+  /// \throws An [std::runtime_error]() exception if the file can't be read or is invalid,
+  /// e.g. a setting is out of range
+  static DeviceSettings load(const std::string &path);
+};
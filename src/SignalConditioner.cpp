@@ -0,0 +1,237 @@
+#include "SignalConditioner.hpp"
+#include <cmath>
+
+using namespace std;
+
+constexpr double NS_PER_S = 1e9;
+// Guards the filters against messages that arrive together
+constexpr double MIN_INTERVAL_S = 1e-4;
+// The fraction of the range within which a value is at the end of the range
+constexpr double END_MARGIN = 1e-3;
+
+/// \param interval_s The time since the last value
+/// \param cutoff_hz The cutoff frequency of the low pass filter
+/// \returns The weight of a new value in an exponential moving average with the cutoff
+static double smoothing_factor(double interval_s, double cutoff_hz) {
+  double time_constant = 1.0 / (2.0 * M_PI * cutoff_hz);
+  return 1.0 / (1.0 + time_constant / interval_s);
+}
+
+SignalConditioner::SignalConditioner() : applied(), channels(), dropped(0) {
+  for (auto &signal : this->settings) {
+    signal.sequence.store(0);
+    signal.enabled.store(false);
+    signal.min_cutoff_hz.store(0);
+    signal.beta.store(0);
+    signal.derivative_cutoff_hz.store(0);
+    signal.max_rate.store(0);
+    signal.hysteresis.store(0);
+    signal.deadband.store(0);
+  }
+}
+
+void SignalConditioner::set_config(LibPushSignal signal,
+                                   const LibPushSignalConfig &config) {
+  if (signal < 0 || signal >= LIBPUSH_SIGNALS) {
+    return;
+  }
+
+  lock_guard<mutex> guard(this->config_lock);
+  Settings &settings = this->settings[signal];
+  unsigned int sequence = settings.sequence.load(memory_order_relaxed);
+  settings.sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  settings.enabled.store(config.enabled, memory_order_relaxed);
+  settings.min_cutoff_hz.store(config.min_cutoff_hz, memory_order_relaxed);
+  settings.beta.store(config.beta, memory_order_relaxed);
+  settings.derivative_cutoff_hz.store(config.derivative_cutoff_hz,
+                                      memory_order_relaxed);
+  settings.max_rate.store(config.max_rate, memory_order_relaxed);
+  settings.hysteresis.store(config.hysteresis, memory_order_relaxed);
+  settings.deadband.store(config.deadband, memory_order_relaxed);
+
+  settings.sequence.store(sequence + 2, memory_order_release);
+}
+
+bool SignalConditioner::load_config(LibPushSignal signal,
+                                    LibPushSignalConfig &config) {
+  Settings &settings = this->settings[signal];
+  unsigned int begin;
+  unsigned int end;
+  do {
+    begin = settings.sequence.load(memory_order_acquire);
+    config.enabled = settings.enabled.load(memory_order_relaxed);
+    config.min_cutoff_hz = settings.min_cutoff_hz.load(memory_order_relaxed);
+    config.beta = settings.beta.load(memory_order_relaxed);
+    config.derivative_cutoff_hz =
+        settings.derivative_cutoff_hz.load(memory_order_relaxed);
+    config.max_rate = settings.max_rate.load(memory_order_relaxed);
+    config.hysteresis = settings.hysteresis.load(memory_order_relaxed);
+    config.deadband = settings.deadband.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    end = settings.sequence.load(memory_order_relaxed);
+  } while (begin != end || (begin & 1));
+
+  if (begin != this->applied[signal]) {
+    this->applied[signal] = begin;
+
+    int first = SIGNAL_AFTERTOUCH_SOURCE;
+    int last = SIGNAL_TOUCH_STRIP_SOURCE;
+    if (signal == LP_SIGNAL_TOUCH_STRIP) {
+      first = SIGNAL_TOUCH_STRIP_SOURCE;
+      last = SIGNAL_PEDAL_SOURCE;
+    } else if (signal == LP_SIGNAL_PEDAL) {
+      first = SIGNAL_PEDAL_SOURCE;
+      last = SIGNAL_SOURCES;
+    }
+    for (int source = first; source < last; ++source) {
+      this->channels[source].primed = false;
+    }
+  }
+
+  return config.enabled;
+}
+
+void SignalConditioner::restart(int source, double value,
+                                unsigned long long timestamp) {
+  Channel &channel = this->channels[source];
+  channel.primed = true;
+  channel.last_ns = timestamp;
+  channel.smoothed = value;
+  channel.slope = 0;
+  channel.limited = value;
+  channel.delivered = value;
+  channel.direction = 0;
+}
+
+bool SignalConditioner::filter(int source, const LibPushSignalConfig &config,
+                               double &value, unsigned long long timestamp,
+                               double low, double high) {
+  Channel &channel = this->channels[source];
+  if (!channel.primed) {
+    this->restart(source, value, timestamp);
+    return true;
+  }
+
+  double interval = timestamp > channel.last_ns
+                        ? (timestamp - channel.last_ns) / NS_PER_S
+                        : 0;
+  interval = max(interval, MIN_INTERVAL_S);
+  channel.last_ns = timestamp;
+
+  double margin = (high - low) * END_MARGIN;
+  bool at_end = value <= low + margin || value >= high - margin;
+
+  // One-Euro filter: an EMA whose cutoff rises with the speed of the value
+  double filtered = value;
+  if (config.min_cutoff_hz > 0 && !at_end) {
+    double derivative_cutoff =
+        config.derivative_cutoff_hz > 0 ? config.derivative_cutoff_hz : 1.0;
+    double speed = (value - channel.smoothed) / interval;
+    channel.slope +=
+        smoothing_factor(interval, derivative_cutoff) * (speed - channel.slope);
+    double cutoff = config.min_cutoff_hz + config.beta * fabs(channel.slope);
+    channel.smoothed +=
+        smoothing_factor(interval, cutoff) * (value - channel.smoothed);
+    filtered = channel.smoothed;
+  } else {
+    channel.smoothed = value;
+  }
+
+  if (config.max_rate > 0) {
+    double step = config.max_rate * interval;
+    filtered =
+        min(max(filtered, channel.limited - step), channel.limited + step);
+  }
+  channel.limited = filtered;
+
+  double change = filtered - channel.delivered;
+  if (change == 0) {
+    return false;
+  }
+
+  int direction = change > 0 ? 1 : -1;
+  if (!at_end || filtered != value) {
+    if (fabs(change) < config.deadband) {
+      return false;
+    }
+    if (channel.direction && direction != channel.direction &&
+        fabs(change) < config.hysteresis) {
+      return false;
+    }
+  }
+
+  channel.delivered = filtered;
+  channel.direction = direction;
+  value = filtered;
+  return true;
+}
+
+bool SignalConditioner::keep(bool deliver) {
+  if (!deliver) {
+    this->dropped.fetch_add(1, memory_order_relaxed);
+  }
+  return deliver;
+}
+
+bool SignalConditioner::condition(LibPushPadEvent &event) {
+  LibPushSignalConfig config;
+  bool enabled = this->load_config(LP_SIGNAL_AFTERTOUCH, config);
+  if (event.x >= LIBPUSH_PAD_MATRIX_DIM || event.y >= LIBPUSH_PAD_MATRIX_DIM) {
+    return true;
+  }
+
+  int source = SIGNAL_AFTERTOUCH_SOURCE +
+               event.y * LIBPUSH_PAD_MATRIX_DIM + event.x;
+  switch (event.event_type) {
+  case LP_PAD_PRESSED:
+    // Aftertouch is filtered from the velocity of the press
+    this->restart(source, event.pressure, event.timestamp);
+    return true;
+  case LP_PAD_RELEASED:
+    this->channels[source].primed = false;
+    return true;
+  case LP_PAD_AFTERTOUCH:
+    break;
+  }
+
+  if (!enabled) {
+    return true;
+  }
+  if (!this->keep(this->filter(source, config, event.pressure, event.timestamp,
+                               0, 1))) {
+    return false;
+  }
+  event.velocity = lround(event.pressure * 127);
+  return true;
+}
+
+bool SignalConditioner::condition(LibPushTouchStripEvent &event) {
+  LibPushSignalConfig config;
+  bool enabled = this->load_config(LP_SIGNAL_TOUCH_STRIP, config);
+  if (event.event_type != LP_TOUCH_STRIP_MOVED) {
+    this->channels[SIGNAL_TOUCH_STRIP_SOURCE].primed = false;
+    return true;
+  }
+
+  return !enabled ||
+         this->keep(this->filter(SIGNAL_TOUCH_STRIP_SOURCE, config,
+                                 event.position, event.timestamp, -1, 1));
+}
+
+bool SignalConditioner::condition(LibPushPedalEvent &event) {
+  LibPushSignalConfig config;
+  bool enabled = this->load_config(LP_SIGNAL_PEDAL, config);
+  if (!enabled || event.contact < 0 ||
+      event.contact >= LIBPUSH_PEDAL_CONTACTS) {
+    return true;
+  }
+
+  return this->keep(this->filter(SIGNAL_PEDAL_SOURCE + event.contact, config,
+                                 event.value, event.timestamp, 0, 1));
+}
+
+unsigned long long SignalConditioner::get_drop_count() {
+  return this->dropped.load(memory_order_relaxed);
+}
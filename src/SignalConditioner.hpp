@@ -0,0 +1,99 @@
+#pragma once
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#define SIGNAL_AFTERTOUCH_SOURCE 0
+#define SIGNAL_TOUCH_STRIP_SOURCE 64
+#define SIGNAL_PEDAL_SOURCE 65
+#define SIGNAL_SOURCES (SIGNAL_PEDAL_SOURCE + LIBPUSH_PEDAL_CONTACTS)
+
+/// Filters continuous input (aftertouch, touch strip, pedals) before it is delivered
+///
+/// Each source has its own filter state, kept in a flat array, and is passed through
+/// a One-Euro filter, a rate limiter, hysteresis and a deadband. Events whose filtered value
+/// equals the last delivered value are dropped.
+///
+/// Filtering happens on the MIDI input thread and doesn't lock or allocate.
+/// The configuration of each signal is guarded by a seqlock, so it can be changed from any thread.
+/// Changing it restarts the filters of the signal
+class SignalConditioner {
+public:
+  SignalConditioner();
+
+  /// \param signal The signal to configure
+  /// \param config The filters to apply
+  void set_config(LibPushSignal signal, const LibPushSignalConfig &config);
+
+  /// \param event A decoded event
+  /// \returns false if the event should be dropped
+  /// \effects Replaces the event's value with the filtered value
+  /// \requires Only one thread conditions events
+  bool condition(LibPushPadEvent &event);
+  bool condition(LibPushTouchStripEvent &event);
+  bool condition(LibPushPedalEvent &event);
+
+  /// Other events are discrete and always delivered
+  bool condition(LibPushButtonEvent &event) { return true; }
+  bool condition(LibPushEncoderEvent &event) { return true; }
+  bool condition(LibPushGestureEvent &event) { return true; }
+
+  /// \returns The number of events dropped since construction
+  unsigned long long get_drop_count();
+
+private:
+  /// The configuration of a signal, written under a seqlock
+  struct Settings {
+    std::atomic<unsigned int> sequence; //< Odd while the configuration is being written
+    std::atomic<bool> enabled;
+    std::atomic<double> min_cutoff_hz;
+    std::atomic<double> beta;
+    std::atomic<double> derivative_cutoff_hz;
+    std::atomic<double> max_rate;
+    std::atomic<double> hysteresis;
+    std::atomic<double> deadband;
+  };
+
+  /// The filter state of a source
+  struct Channel {
+    bool primed; //< Whether a value has been seen since the channel was restarted
+    unsigned long long last_ns; //< The arrival time of the last value
+    double smoothed; //< The output of the One-Euro filter
+    double slope;    //< The filtered rate of change, in units per second
+    double limited;  //< The output of the rate limiter
+    double delivered; //< The last value that was delivered
+    int direction;    //< The direction of the last delivered change, -1, 0 or 1
+  };
+
+  std::mutex config_lock; //< Serializes writers of the settings
+  std::array<Settings, LIBPUSH_SIGNALS> settings;
+  std::array<unsigned int, LIBPUSH_SIGNALS>
+      applied; //< The sequence of the settings the channels were last restarted for
+  std::array<Channel, SIGNAL_SOURCES> channels;
+  std::atomic<unsigned long long> dropped;
+
+  /// \param signal The signal to read
+  /// \param config Filled with a consistent copy of the signal's configuration
+  /// \returns Whether the signal is conditioned
+  /// \effects Restarts the signal's channels if the configuration changed since the last read
+  bool load_config(LibPushSignal signal, LibPushSignalConfig &config);
+
+  /// \param source The channel to restart
+  /// \param value The value the source starts from
+  /// \param timestamp The time of the value
+  void restart(int source, double value, unsigned long long timestamp);
+
+  /// \param source The channel to filter with
+  /// \param config The configuration of the channel's signal
+  /// \param value The decoded value, replaced with the filtered value
+  /// \param timestamp The arrival time of the value
+  /// \param low The lowest value of the signal
+  /// \param high The highest value of the signal
+  /// \returns false if the value should be dropped
+  bool filter(int source, const LibPushSignalConfig &config, double &value,
+              unsigned long long timestamp, double low, double high);
+
+  /// \returns Whether the event can be delivered, counting it if it's dropped
+  bool keep(bool deliver);
+};
@@ -0,0 +1,579 @@
+#include "SimulatedDevice.hpp"
+#include "ButtonInterface.hpp"
+#include "LedInterface.hpp"
+#include "MiscSysexInterface.hpp"
+#include "PadInterface.hpp"
+#include "PedalInterface.hpp"
+#include "SysexInterface.hpp"
+#include "TouchStripInterface.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using Pixel = DisplayInterface::Pixel;
+
+constexpr uint FIRST_PAD_NOTE = 36;
+constexpr uint PAD_COUNT = LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM;
+constexpr uint ENCODER_COUNT = 11;
+constexpr uint WHITE_BALANCE_GROUPS = 11;
+constexpr uint PALETTE_SIZE = 128;
+constexpr uint PEDAL_CONTACTS = 4;
+
+/// Buttons with a cc number that the traffic generator may press
+const vector<byte> SIMULATED_BUTTONS = {
+    LP_PLAY_BTN,       LP_RECORD_BTN,      LP_AUTOMATE_BTN, LP_FIXED_LENGTH_BTN,
+    LP_NEW_BTN,        LP_DUPLICATE_BTN,   LP_QUANTIZE_BTN, LP_DOUBLE_LOOP_BTN,
+    LP_CONVERT_BTN,    LP_UNDO_BTN,        LP_DELETE_BTN,   LP_TAP_TEMPO_BTN,
+    LP_METRONOME_BTN,  LP_ADD_DEVICE_BTN,  LP_ADD_TRACK_BTN, LP_MASTER_BTN,
+    LP_SETUP_BTN,      LP_USER_BTN,        LP_DEVICE_BTN,   LP_BROWSE_BTN,
+    LP_MIX_BTN,        LP_CLIP_BTN,        LP_LEFT_BTN,     LP_UP_BTN,
+    LP_RIGHT_BTN,      LP_DOWN_BTN,        LP_REPEAT_BTN,   LP_ACCENT_BTN,
+    LP_SCALE_BTN,      LP_LAYOUT_BTN,      LP_NOTE_BTN,     LP_SESSION_BTN,
+    LP_PAGE_LEFT_BTN,  LP_PAGE_RIGHT_BTN,  LP_OCTAVE_UP_BTN, LP_OCTAVE_DOWN_BTN,
+    LP_SHIFT_BTN,      LP_SELECT_BTN,
+    102, 103, 104, 105, 106, 107, 108, 109, // Top display row
+    20,  21,  22,  23,  24,  25,  26,  27,  // Bottom display row
+    36,  37,  38,  39,  40,  41,  42,  43}; // Scene column
+
+SimulatedDevice::SimulatedDevice()
+    : input_callback(nullptr), input_context(nullptr),
+      boot_time(Clock::now()), stats(), rng(0), script_position(0),
+      script_loop(false), running(false), expecting_frame_buffer(false),
+      last_frame(new Pixel[DISPLAY_HEIGHT * DISPLAY_WIDTH]),
+      has_last_frame(false) {
+  // Forwarded messages are at most 3 bytes, so keeping the last one never allocates
+  this->last_forwarded.reserve(3);
+
+  // Start with a palette that covers a spread of colors
+  for (uint i = 0; i < PALETTE_SIZE; ++i) {
+    this->state.palette[i][0] = (i & 0x3) * 85;
+    this->state.palette[i][1] = ((i >> 2) & 0x3) * 85;
+    this->state.palette[i][2] = ((i >> 4) & 0x3) * 85;
+    this->state.palette[i][3] = (i >> 6) * 255;
+  }
+  this->state.led_brightness = 127;
+  this->state.display_brightness = 255;
+  fill_n(this->state.white_balance, WHITE_BALANCE_GROUPS, 1024);
+  this->state.touch_strip_config = 0;
+  this->state.aftertouch_mode = LibPushAftertouchMode::LP_CHANNEL;
+  fill_n(&this->state.pad_sensitivity[0][0], PAD_COUNT,
+         LibPushPadSensitivity::LP_REGULAR_SENSITIVITY);
+  for (uint i = 0; i < LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES; ++i) {
+    this->state.velocity_curve[i] = i;
+  }
+  this->state.midi_mode = LibPushMidiMode::LP_LIVE_MODE;
+  fill_n(&this->state.led_colors[0][0], 2 * 128, 0);
+
+  for (auto &source : this->traffic) {
+    source.rate = 0;
+    source.active = false;
+  }
+  fill_n(this->pads_held, PAD_COUNT, false);
+  fill_n(this->buttons_held, 128, false);
+  fill_n(this->encoders_touched, ENCODER_COUNT, false);
+}
+
+SimulatedDevice::~SimulatedDevice() { this->stop(); }
+
+unique_ptr<MidiTransport> SimulatedDevice::create_midi_transport() {
+  return make_unique<SimulatedMidiTransport>(*this);
+}
+
+unique_ptr<DisplayTransport> SimulatedDevice::create_display_transport() {
+  return make_unique<SimulatedDisplayTransport>(*this);
+}
+
+unique_ptr<MidiOutput> SimulatedDevice::create_forwarding_output() {
+  return make_unique<SimulatedMidiOutput>(*this);
+}
+
+void SimulatedDevice::start(MidiTransport::InputCallback callback,
+                            void *context) {
+  if (this->running) {
+    throw runtime_error("Simulated device is already connected");
+  }
+
+  {
+    lock_guard<mutex> lock(this->delivery_lock);
+    this->input_callback = callback;
+    this->input_context = context;
+    this->last_delivery = Clock::now();
+  }
+
+  this->running = true;
+  this->device_thread = thread(&SimulatedDevice::run, this);
+}
+
+void SimulatedDevice::stop() {
+  {
+    lock_guard<mutex> lock(this->state_lock);
+    this->running = false;
+  }
+  this->state_changed.notify_all();
+
+  if (this->device_thread.joinable()) {
+    this->device_thread.join();
+  }
+
+  lock_guard<mutex> lock(this->delivery_lock);
+  this->input_callback = nullptr;
+  this->input_context = nullptr;
+}
+
+void SimulatedDevice::set_traffic(LibPushSimulatorConfig cfg) {
+  {
+    lock_guard<mutex> lock(this->state_lock);
+    uint rates[] = {cfg.pad_rate, cfg.encoder_rate, cfg.button_rate,
+                    cfg.touch_strip_rate};
+    auto now = Clock::now();
+    for (int kind = PAD_TRAFFIC; kind < SCRIPT_TRAFFIC; ++kind) {
+      this->traffic[kind].rate = rates[kind];
+      this->traffic[kind].active = rates[kind] > 0;
+      this->traffic[kind].next_due = now;
+    }
+    this->rng.seed(cfg.seed);
+  }
+  this->state_changed.notify_all();
+}
+
+void SimulatedDevice::play_script(vector<midi_msg> script, uint rate,
+                                  bool loop) {
+  {
+    lock_guard<mutex> lock(this->state_lock);
+    this->script = move(script);
+    this->script_position = 0;
+    this->script_loop = loop;
+    this->traffic[SCRIPT_TRAFFIC].rate = rate;
+    this->traffic[SCRIPT_TRAFFIC].active = !this->script.empty();
+    this->traffic[SCRIPT_TRAFFIC].next_due = Clock::now();
+  }
+  this->state_changed.notify_all();
+}
+
+void SimulatedDevice::inject(midi_msg &message) {
+  {
+    lock_guard<mutex> lock(this->state_lock);
+    this->stats.messages_generated++;
+  }
+  this->deliver(message);
+}
+
+LibPushSimulatorStats SimulatedDevice::get_stats() {
+  lock_guard<mutex> lock(this->state_lock);
+  return this->stats;
+}
+
+bool SimulatedDevice::get_last_forwarded(midi_msg &message) {
+  lock_guard<mutex> lock(this->state_lock);
+  message = this->last_forwarded;
+  return !message.empty();
+}
+
+byte SimulatedDevice::get_led_color(MidiMsgType msg_type, uint midi_number) {
+  lock_guard<mutex> lock(this->state_lock);
+  return this->state.led_colors[msg_type == MidiMsgType::cc]
+                               [midi_number & 0x7F];
+}
+
+bool SimulatedDevice::get_last_frame(
+    Pixel (&pixel_buffer)[DISPLAY_HEIGHT][DISPLAY_WIDTH]) {
+  lock_guard<mutex> lock(this->state_lock);
+  if (!this->has_last_frame) {
+    return false;
+  }
+  copy_n(this->last_frame.get(), DISPLAY_HEIGHT * DISPLAY_WIDTH,
+         &pixel_buffer[0][0]);
+  return true;
+}
+
+void SimulatedDevice::receive_forwarded(midi_msg &message) {
+  lock_guard<mutex> lock(this->state_lock);
+  this->last_forwarded.assign(message.begin(), message.end());
+  this->stats.forwarded_messages++;
+}
+
+void SimulatedDevice::receive_midi(midi_msg &message) {
+  if (message.empty()) {
+    return;
+  }
+
+  lock_guard<mutex> lock(this->state_lock);
+  this->stats.midi_writes++;
+
+  // A write can hold several sysex messages, which are handled one at a time
+  auto end = find(message.begin(), message.end(), SYSEX_SUFFIX);
+  if (message[0] == MidiMsgType::sysex && end != message.end() &&
+      end + 1 != message.end()) {
+    for (auto start = message.begin(); start != message.end();) {
+      end = find(start, message.end(), SYSEX_SUFFIX);
+      end = end == message.end() ? end : end + 1;
+      midi_msg part(start, end);
+      this->handle_midi(part);
+      start = end;
+    }
+    return;
+  }
+  this->handle_midi(message);
+}
+
+void SimulatedDevice::handle_midi(midi_msg &message) {
+  byte msg_type = get_midi_type(message);
+  if (msg_type == MidiMsgType::note_on || msg_type == MidiMsgType::cc) {
+    // Led color change
+    if (message.size() == 3) {
+      this->state.led_colors[msg_type == MidiMsgType::cc][message[1] & 0x7F] =
+          message[2];
+      this->stats.led_messages++;
+    }
+    return;
+  }
+
+  if (msg_type != MidiMsgType::sysex) {
+    return;
+  }
+
+  size_t header_length = SYSEX_PREFIX.size() + 1;
+  if (message.size() < header_length + 1 ||
+      !equal(SYSEX_PREFIX.begin(), SYSEX_PREFIX.end(), message.begin()) ||
+      message.back() != SYSEX_SUFFIX) {
+    this->stats.unknown_commands++;
+    return;
+  }
+
+  this->stats.sysex_commands++;
+  byte command = message[SYSEX_PREFIX.size()];
+  midi_msg args(message.begin() + header_length, message.end() - 1);
+  midi_msg reply_args;
+  if (this->handle_sysex(command, args, reply_args)) {
+    midi_msg reply(SYSEX_PREFIX.begin(), SYSEX_PREFIX.end());
+    reply.push_back(command);
+    reply.insert(reply.end(), reply_args.begin(), reply_args.end());
+    reply.push_back(SYSEX_SUFFIX);
+    this->outgoing.push_back(move(reply));
+    this->state_changed.notify_all();
+  }
+}
+
+bool SimulatedDevice::handle_sysex(byte command, const midi_msg &args,
+                                   midi_msg &reply) {
+  // Missing arguments read as 0
+  auto arg = [&args](size_t i) -> uint {
+    return i < args.size() ? args[i] : 0;
+  };
+  auto arg14 = [&arg](size_t i) -> uint {
+    return arg(i) | (arg(i + 1) << 7);
+  };
+  auto push14 = [&reply](uint val) {
+    reply.push_back(val & 0x7F);
+    reply.push_back((val >> 7) & 0x7F);
+  };
+
+  switch (command) {
+  case LedInterface::SET_LED_COLOR_PALETTE_ENTRY: {
+    unsigned short *color = this->state.palette[arg(0) % PALETTE_SIZE];
+    for (int i = 0; i < 4; ++i) {
+      color[i] = arg14(1 + i * 2);
+    }
+    return false;
+  }
+  case LedInterface::GET_LED_COLOR_PALETTE_ENTRY: {
+    unsigned short *color = this->state.palette[arg(0) % PALETTE_SIZE];
+    reply.push_back(arg(0));
+    for (int i = 0; i < 4; ++i) {
+      push14(color[i]);
+    }
+    return true;
+  }
+  case LedInterface::REAPPLY_COLOR_PALETTE:
+  case LedInterface::SET_LED_PWM_FREQ_CORRECTION:
+    return false;
+  case LedInterface::SET_LED_BRIGHTNESS:
+    this->state.led_brightness = arg(0);
+    return false;
+  case LedInterface::GET_LED_BRIGHTNESS:
+    reply.push_back(this->state.led_brightness);
+    return true;
+  case LedInterface::SET_LED_WHITE_BALANCE:
+    this->state.white_balance[arg(0) % WHITE_BALANCE_GROUPS] = arg14(1);
+    return false;
+  case LedInterface::GET_LED_WHITE_BALANCE:
+    push14(this->state.white_balance[arg(0) % WHITE_BALANCE_GROUPS]);
+    return true;
+  case DisplayInterface::SET_DISPLAY_BRIGHTNESS:
+    this->state.display_brightness = arg14(0);
+    return false;
+  case DisplayInterface::GET_DISPLAY_BRIGHTNESS:
+    push14(this->state.display_brightness);
+    return true;
+  case MiscSysexInterface::SET_MIDI_MODE:
+    this->state.midi_mode = arg(0);
+    return false;
+  case MiscSysexInterface::REQUEST_STATISTICS: {
+    uint uptime = chrono::duration_cast<chrono::seconds>(Clock::now() -
+                                                         this->boot_time)
+                      .count();
+    reply.push_back(LibPushPowerSupplyStatus::LP_EXTERNAL_POWER);
+    reply.push_back(arg(0));
+    for (int shift = 0; shift < 28; shift += 7) {
+      reply.push_back((uptime >> shift) & 0x7F);
+    }
+    return true;
+  }
+  case PedalInterface::SAMPLE_PEDAL_DATA: {
+    // Each contact slowly sweeps through the 12 bit range of the pedal input
+    double t = chrono::duration<double>(Clock::now() - this->boot_time).count();
+    for (uint contact = 0; contact < PEDAL_CONTACTS; ++contact) {
+      push14(2047 + 2047 * sin(t + contact));
+    }
+    return true;
+  }
+  case PedalInterface::SET_PEDAL_CONFIGURATION:
+  case PedalInterface::SET_PEDAL_CURVE_LIMITS:
+  case PedalInterface::SET_PEDAL_CURVE_ENTRIES:
+    return false;
+  case TouchStripInterface::SET_TOUCH_STRIP_CONFIGURATION:
+    this->state.touch_strip_config = arg(0);
+    return false;
+  case TouchStripInterface::GET_TOUCH_STRIP_CONFIGURATION:
+    reply.push_back(this->state.touch_strip_config);
+    return true;
+  case TouchStripInterface::SET_TOUCH_STRIP_LEDS:
+  case PadInterface::SET_PAD_PARAMETERS:
+    return false;
+  case PadInterface::SET_AFTERTOUCH_MODE:
+    this->state.aftertouch_mode = arg(0);
+    return false;
+  case PadInterface::GET_AFTERTOUCH_MODE:
+    reply.push_back(this->state.aftertouch_mode);
+    return true;
+  case PadInterface::SET_PAD_VELOCITY_CURVE_ENTRY:
+    for (size_t i = 1; i < args.size(); ++i) {
+      uint entry = arg(0) + i - 1;
+      if (entry < LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES) {
+        this->state.velocity_curve[entry] = args[i];
+      }
+    }
+    return false;
+  case PadInterface::SELECT_PAD_SETTINGS: {
+    uint row = arg(0);
+    uint col = arg(1);
+    if (row == 0 && col == 0) {
+      // Row and column 0 selects all pads
+      fill_n(&this->state.pad_sensitivity[0][0], PAD_COUNT, arg(2));
+    } else if (row >= 1 && row <= LIBPUSH_PAD_MATRIX_DIM && col >= 1 &&
+               col <= LIBPUSH_PAD_MATRIX_DIM) {
+      this->state.pad_sensitivity[row - 1][col - 1] = arg(2);
+    }
+    return false;
+  }
+  case PadInterface::GET_SELECTED_PAD_SETTINGS: {
+    uint row = max(1u, min(arg(0), (uint)LIBPUSH_PAD_MATRIX_DIM));
+    uint col = max(1u, min(arg(1), (uint)LIBPUSH_PAD_MATRIX_DIM));
+    reply.push_back(arg(0));
+    reply.push_back(arg(1));
+    reply.push_back(this->state.pad_sensitivity[row - 1][col - 1]);
+    return true;
+  }
+  default:
+    this->stats.unknown_commands++;
+    return false;
+  }
+}
+
+int SimulatedDevice::receive_display_data(const unsigned char *data,
+                                          int length) {
+  lock_guard<mutex> lock(this->state_lock);
+
+  if (!this->expecting_frame_buffer) {
+    if (length == FRAME_HEADER_LENGTH &&
+        equal(data, data + length, DisplayInterface::FRAME_HEADER)) {
+      this->expecting_frame_buffer = true;
+      return 0;
+    }
+    this->stats.invalid_frames++;
+    return -1;
+  }
+
+  this->expecting_frame_buffer = false;
+  if (length != FRAME_BUFFER_LENGTH) {
+    this->stats.invalid_frames++;
+    return -1;
+  }
+
+  for (int row = 0; row < DISPLAY_HEIGHT; ++row) {
+    const unsigned char *row_data = data + row * ROW_LENGTH;
+    // The filler bytes at the end of each row are never shaped
+    for (int col = DISPLAY_WIDTH_BYTES; col < ROW_LENGTH; ++col) {
+      if (row_data[col] != 0x00) {
+        this->stats.invalid_frames++;
+        return -1;
+      }
+    }
+  }
+
+  // Undo the signal shaping to recover the pixels
+  Pixel *pixels = this->last_frame.get();
+  for (int row = 0; row < DISPLAY_HEIGHT; ++row) {
+    const unsigned char *row_data = data + row * ROW_LENGTH;
+    int pattr_index = 0;
+    for (int col = 0; col < DISPLAY_WIDTH; ++col) {
+      unsigned char LSB =
+          row_data[col * 2] ^
+          DisplayInterface::SIGNAL_SHAPING_PATTERN
+              [pattr_index++ % SIGNAL_SHAPING_PATTERN_LENGTH];
+      unsigned char MSB =
+          row_data[col * 2 + 1] ^
+          DisplayInterface::SIGNAL_SHAPING_PATTERN
+              [pattr_index++ % SIGNAL_SHAPING_PATTERN_LENGTH];
+      pixels[row * DISPLAY_WIDTH + col] = (MSB << 8) | LSB;
+    }
+  }
+
+  this->has_last_frame = true;
+  this->stats.frames_received++;
+  return 0;
+}
+
+midi_msg SimulatedDevice::generate(TrafficKind kind) {
+  switch (kind) {
+  case PAD_TRAFFIC: {
+    // Press a pad, then send aftertouch until it is released
+    uint pad = this->rng() % PAD_COUNT;
+    byte note = FIRST_PAD_NOTE + pad;
+    if (!this->pads_held[pad]) {
+      this->pads_held[pad] = true;
+      return {MidiMsgType::note_on, note, (byte)(1 + this->rng() % 127)};
+    } else if (this->rng() % 4) {
+      return {MidiMsgType::aftertouch, note, (byte)(this->rng() % 128)};
+    }
+    this->pads_held[pad] = false;
+    return {MidiMsgType::note_off, note, 0};
+  }
+  case ENCODER_TRAFFIC: {
+    uint index = this->rng() % ENCODER_COUNT;
+    if (this->rng() % 10 == 0) {
+      // Touch or release the encoder
+      byte note = index < 2 ? 10 - index : index - 2;
+      this->encoders_touched[index] = !this->encoders_touched[index];
+      return {MidiMsgType::note_on, note,
+              (byte)(this->encoders_touched[index] ? 127 : 0)};
+    }
+    // Turn the encoder by a small 7 bit two's complement amount
+    byte cc = index < 2 ? 14 + index : 71 + index - 2;
+    int amount = 1 + this->rng() % 3;
+    byte val = (this->rng() % 2 ? amount : 128 - amount) & 0x7F;
+    return {MidiMsgType::cc, cc, val};
+  }
+  case BUTTON_TRAFFIC: {
+    byte cc = SIMULATED_BUTTONS[this->rng() % SIMULATED_BUTTONS.size()];
+    this->buttons_held[cc] = !this->buttons_held[cc];
+    return {MidiMsgType::cc, cc, (byte)(this->buttons_held[cc] ? 127 : 0)};
+  }
+  case TOUCH_STRIP_TRAFFIC: {
+    uint pos = this->rng() % 16384;
+    return {MidiMsgType::pitch_bend, (byte)(pos & 0x7F), (byte)(pos >> 7)};
+  }
+  case SCRIPT_TRAFFIC:
+  default: {
+    midi_msg message = this->script[this->script_position++];
+    if (this->script_position >= this->script.size()) {
+      this->script_position = 0;
+      this->traffic[SCRIPT_TRAFFIC].active = this->script_loop;
+    }
+    return message;
+  }
+  }
+}
+
+void SimulatedDevice::run() {
+  unique_lock<mutex> lock(this->state_lock);
+  while (this->running) {
+    if (!this->outgoing.empty()) {
+      midi_msg reply = move(this->outgoing.front());
+      this->outgoing.pop_front();
+      lock.unlock();
+      this->deliver(reply);
+      lock.lock();
+      continue;
+    }
+
+    auto now = Clock::now();
+    auto next_wake = now + chrono::seconds(1);
+    bool delivered = false;
+    for (int kind = 0; kind < TRAFFIC_KINDS && this->running; ++kind) {
+      TrafficSource &source = this->traffic[kind];
+      if (!source.active) {
+        continue;
+      }
+
+      if (source.next_due <= now) {
+        midi_msg message = this->generate(static_cast<TrafficKind>(kind));
+        this->stats.messages_generated++;
+        if (source.rate) {
+          source.next_due += chrono::duration_cast<Clock::duration>(
+              chrono::duration<double>(1.0 / source.rate));
+        }
+        lock.unlock();
+        this->deliver(message);
+        lock.lock();
+        delivered = true;
+      }
+      next_wake = min(next_wake, source.next_due);
+    }
+
+    if (!delivered) {
+      this->state_changed.wait_until(lock, next_wake);
+    }
+  }
+}
+
+void SimulatedDevice::deliver(midi_msg &message) {
+  lock_guard<mutex> lock(this->delivery_lock);
+  auto now = Clock::now();
+  double delta = chrono::duration<double>(now - this->last_delivery).count();
+  this->last_delivery = now;
+  if (this->input_callback) {
+    this->input_callback(delta, &message, this->input_context);
+  }
+}
+
+SimulatedMidiTransport::SimulatedMidiTransport(SimulatedDevice &device)
+    : device(device) {}
+
+void SimulatedMidiTransport::open(LibPushPort port, InputCallback callback,
+                                  void *context) {
+  this->device.start(callback, context);
+}
+
+void SimulatedMidiTransport::close() { this->device.stop(); }
+
+void SimulatedMidiTransport::send(midi_msg &message) {
+  this->device.receive_midi(message);
+}
+
+size_t SimulatedMidiTransport::get_max_write_length() {
+  return MAX_SYSEX_WRITE_LENGTH;
+}
+
+bool SimulatedMidiTransport::inject(midi_msg &message) {
+  this->device.inject(message);
+  return true;
+}
+
+SimulatedMidiOutput::SimulatedMidiOutput(SimulatedDevice &device)
+    : device(device) {}
+
+void SimulatedMidiOutput::send(midi_msg &message) {
+  this->device.receive_forwarded(message);
+}
+
+SimulatedDisplayTransport::SimulatedDisplayTransport(SimulatedDevice &device)
+    : device(device) {}
+
+void SimulatedDisplayTransport::open() {}
+
+void SimulatedDisplayTransport::close() {}
+
+int SimulatedDisplayTransport::write(const unsigned char *data, int length) {
+  return this->device.receive_display_data(data, length);
+}
@@ -0,0 +1,220 @@
+#pragma once
+#include "DisplayInterface.hpp"
+#include "DisplayTransport.hpp"
+#include "MidiMsg.hpp"
+#include "MidiTransport.hpp"
+#include "push.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+/// An in-process stand-in for Push
+///
+/// Keeps a model of the device's settings and answers sysex commands from it,
+/// accepts display frames into a sink that validates their header and encoding,
+/// and generates scripted or random input traffic at configurable rates.
+/// This allows the library to be exercised and benchmarked without hardware.
+///
+/// Messages sent to the host (sysex replies and generated traffic) are delivered
+/// from a device thread, the same way RtMidi delivers input from its own thread.
+class SimulatedDevice {
+public:
+  SimulatedDevice();
+  ~SimulatedDevice();
+
+  /// \returns A transport that connects a MidiInterface to this device
+  std::unique_ptr<MidiTransport> create_midi_transport();
+
+  /// \returns A transport that connects a DisplayInterface to this device
+  std::unique_ptr<DisplayTransport> create_display_transport();
+
+  /// \returns An output that loops forwarded messages back to this device,
+  /// standing in for the port of another application
+  std::unique_ptr<MidiOutput> create_forwarding_output();
+
+  /// \param cfg The rates of random traffic to generate
+  /// \effects Replaces any running random traffic. A rate of 0 disables that kind of traffic
+  void set_traffic(LibPushSimulatorConfig cfg);
+
+  /// \param script The messages to send to the host
+  /// \param rate Messages per second, or 0 to send them as fast as possible
+  /// \param loop Whether to start over when the end of the script is reached
+  /// \effects Replaces any running script
+  void play_script(std::vector<midi_msg> script, uint rate, bool loop);
+
+  /// Deliver a message to the host immediately on the calling thread
+  ///
+  /// \param message The message Push would send
+  /// \effects Calls the host's input callback, serialized with the device thread
+  void inject(midi_msg &message);
+
+  /// \returns Counters describing what the device has received and sent
+  LibPushSimulatorStats get_stats();
+
+  /// \param pixel_buffer Filled with the last valid frame received by the display sink
+  /// \returns false if no valid frame has been received
+  bool get_last_frame(DisplayInterface::Pixel (
+      &pixel_buffer)[DISPLAY_HEIGHT][DISPLAY_WIDTH]);
+
+  /// \param message Filled with the last message received by the forwarding output
+  /// \returns false if no message has been forwarded
+  bool get_last_forwarded(midi_msg &message);
+
+  /// \param msg_type note_on for pad leds, cc for button leds
+  /// \param midi_number (0-127) The number of the led
+  /// \returns The color index the led was last set to
+  byte get_led_color(MidiMsgType msg_type, uint midi_number);
+
+private:
+  friend class SimulatedMidiTransport;
+  friend class SimulatedDisplayTransport;
+  friend class SimulatedMidiOutput;
+
+  using Clock = std::chrono::steady_clock;
+
+  /// Settings that can be changed and read back with sysex commands
+  struct DeviceState {
+    unsigned short palette[128][4];
+    byte led_brightness;
+    unsigned short display_brightness;
+    unsigned short white_balance[11];
+    byte touch_strip_config;
+    byte aftertouch_mode;
+    byte pad_sensitivity[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM];
+    byte velocity_curve[LIBPUSH_PAD_VELOCITY_CURVE_ENTRIES];
+    byte midi_mode;
+    byte led_colors[2][128]; //< Color index of each note and cc led
+  };
+
+  /// Random or scripted traffic that is sent at a fixed rate
+  struct TrafficSource {
+    uint rate; //< Messages per second, 0 sends as fast as possible
+    bool active;
+    Clock::time_point next_due;
+  };
+
+  enum TrafficKind {
+    PAD_TRAFFIC,
+    ENCODER_TRAFFIC,
+    BUTTON_TRAFFIC,
+    TOUCH_STRIP_TRAFFIC,
+    SCRIPT_TRAFFIC,
+    TRAFFIC_KINDS
+  };
+
+  MidiTransport::InputCallback input_callback;
+  void *input_context;
+
+  std::mutex state_lock; //< Guards state, traffic and outgoing
+  std::condition_variable state_changed;
+  DeviceState state;
+  Clock::time_point boot_time;
+  LibPushSimulatorStats stats;
+  std::deque<midi_msg> outgoing; //< Replies waiting for the device thread
+
+  TrafficSource traffic[TRAFFIC_KINDS];
+  std::mt19937 rng;
+  bool pads_held[LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM];
+  bool buttons_held[128];
+  bool encoders_touched[11];
+  std::vector<midi_msg> script;
+  size_t script_position;
+  bool script_loop;
+
+  /// Serializes delivery so the host only ever sees one input thread
+  std::mutex delivery_lock;
+  Clock::time_point last_delivery;
+  std::thread device_thread;
+  bool running;
+
+  /// Display frames arrive as a header transfer followed by a frame buffer transfer
+  bool expecting_frame_buffer;
+  std::unique_ptr<DisplayInterface::Pixel[]> last_frame;
+  bool has_last_frame;
+
+  midi_msg last_forwarded; //< Empty until a message is forwarded
+
+  /// \effects Starts the device thread delivering input to callback
+  void start(MidiTransport::InputCallback callback, void *context);
+
+  /// \effects Stops the device thread and any further input
+  void stop();
+
+  /// \param message A write by the host, a single message or consecutive sysex messages
+  /// \effects Counts the write and handles each message in it
+  void receive_midi(midi_msg &message);
+
+  /// \param message A message sent by the host
+  /// \effects Updates the device state and queues a reply if the message is a sysex command with one
+  /// \requires state_lock is held
+  void handle_midi(midi_msg &message);
+
+  /// \param message A message forwarded by the host
+  /// \effects Counts the message and keeps it as the last forwarded message
+  void receive_forwarded(midi_msg &message);
+
+  /// \param command The sysex command code
+  /// \param args The argument bytes of the command
+  /// \param reply Filled with the argument bytes of the reply
+  /// \returns true if the command has a reply
+  bool handle_sysex(byte command, const midi_msg &args, midi_msg &reply);
+
+  /// \param data The bytes written by the host
+  /// \param length The number of bytes in data
+  /// \returns 0 if the transfer is valid, a negative error code otherwise
+  int receive_display_data(const unsigned char *data, int length);
+
+  /// \param kind Which kind of traffic to generate
+  /// \returns The next message of that kind
+  midi_msg generate(TrafficKind kind);
+
+  /// \effects Delivers queued replies and due traffic until stopped
+  void run();
+
+  /// \param message The message to pass to the host's input callback
+  void deliver(midi_msg &message);
+};
+
+/// A MidiTransport that exchanges messages with a SimulatedDevice
+class SimulatedMidiTransport : public MidiTransport {
+public:
+  SimulatedMidiTransport(SimulatedDevice &device);
+
+  void open(LibPushPort port, InputCallback callback, void *context) override;
+  void close() override;
+  void send(midi_msg &message) override;
+  size_t get_max_write_length() override;
+  bool inject(midi_msg &message) override;
+
+private:
+  SimulatedDevice &device;
+};
+
+/// A MidiOutput that loops forwarded messages back to a SimulatedDevice
+class SimulatedMidiOutput : public MidiOutput {
+public:
+  SimulatedMidiOutput(SimulatedDevice &device);
+
+  void send(midi_msg &message) override;
+
+private:
+  SimulatedDevice &device;
+};
+
+/// A DisplayTransport that writes frames to a SimulatedDevice's display sink
+class SimulatedDisplayTransport : public DisplayTransport {
+public:
+  SimulatedDisplayTransport(SimulatedDevice &device);
+
+  void open() override;
+  void close() override;
+  int write(const unsigned char *data, int length) override;
+
+private:
+  SimulatedDevice &device;
+};
@@ -0,0 +1,40 @@
+#include "SysexBatch.hpp"
+
+using namespace std;
+
+SysexBatch::SysexBatch(size_t capacity) {
+  this->buffer.reserve(capacity);
+  // The smallest message is the prefix, command and suffix
+  this->message_ends.reserve(capacity / (SYSEX_PREFIX.size() + 2));
+}
+
+void SysexBatch::add(byte command, const byte *args, size_t length) {
+  this->buffer.insert(this->buffer.end(), SYSEX_PREFIX.begin(),
+                      SYSEX_PREFIX.end());
+  this->buffer.push_back(command);
+  this->buffer.insert(this->buffer.end(), args, args + length);
+  this->buffer.push_back(SYSEX_SUFFIX);
+  this->message_ends.push_back(this->buffer.size());
+}
+
+void SysexBatch::append(const byte *message, size_t length) {
+  this->buffer.insert(this->buffer.end(), message, message + length);
+  this->message_ends.push_back(this->buffer.size());
+}
+
+void SysexBatch::add(byte command, const midi_msg &args) {
+  this->add(command, args.data(), args.size());
+}
+
+void SysexBatch::clear() {
+  this->buffer.clear();
+  this->message_ends.clear();
+}
+
+size_t SysexBatch::size() const { return this->message_ends.size(); }
+
+midi_msg &SysexBatch::get_buffer() { return this->buffer; }
+
+const vector<size_t> &SysexBatch::get_message_ends() const {
+  return this->message_ends;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "MidiMsg.hpp"
+#include "SysexSchema.hpp"
+#include <vector>
+
+#define DEFAULT_SYSEX_BATCH_CAPACITY 4096 //< Enough for the whole palette and a velocity curve
+
+/// Sysex commands encoded into one buffer, to be sent together with SysexInterface::send_batch
+///
+/// Each command is encoded as a complete sysex message as it is added.
+/// The buffer is reused after clear, so building a batch of the same size again doesn't allocate
+class SysexBatch {
+public:
+  /// \param capacity The number of bytes to preallocate
+  SysexBatch(size_t capacity = DEFAULT_SYSEX_BATCH_CAPACITY);
+
+  /// \param command The command code (defined in the _Sysex enums)
+  /// \param args The argument bytes for the command
+  /// \param length The number of argument bytes
+  /// \requires The command has no reply
+  void add(byte command, const byte *args, size_t length);
+
+  /// \param command The command code (defined in the _Sysex enums)
+  /// \param args The argument bytes for the command
+  /// \requires The command has no reply
+  void add(byte command, const midi_msg &args);
+
+  /// \param message A message built by a SysexCommand
+  /// \requires The command has no reply
+  template <size_t Length> void add(const SysexMessage<Length> &message) {
+    this->append(message.data(), Length);
+  }
+
+  /// \param message A complete sysex message
+  /// \param length The number of bytes in the message
+  /// \requires The command has no reply
+  void append(const byte *message, size_t length);
+
+  /// \effects Removes all commands, keeping the buffer
+  void clear();
+
+  /// \returns The number of commands in the batch
+  size_t size() const;
+
+  /// \returns The encoded messages, one after another
+  midi_msg &get_buffer();
+
+  /// \returns The offset one past the end of each message in the buffer
+  const std::vector<size_t> &get_message_ends() const;
+
+private:
+  midi_msg buffer;
+  std::vector<size_t> message_ends;
+};
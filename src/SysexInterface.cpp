@@ -1,79 +1,343 @@
 #include "SysexInterface.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
 using namespace std;
 
-/// Sequence of bytes that precedes every MIDI sysex message sent or received from Push
-midi_msg SYSEX_PREFIX = {0xF0, 0x00, 0x21, 0x1D, 0x01, 0x01};
-/// Byte marking the end of a sysex message
-byte SYSEX_SUFFIX = 0xF7;
-
-SysexInterface::SysexInterface(MidiInterface &midi) : midi(midi) {
-  for (const byte &command : commands_with_reply) {
-    this->sysex_reply_queues[command] = queue<midi_msg>();
+SysexInterface::ReplySlot::ReplySlot(int echoed_args)
+    : echoed_args(echoed_args), requested(0), received(0), requests() {
+  for (midi_msg &reply : this->replies) {
+    reply.reserve(RESERVED_REPLY_LENGTH);
   }
+}
 
+SysexInterface::SysexInterface(MidiInterface &midi)
+    : midi(midi), reply_timeout_ms(DEFAULT_SYSEX_REPLY_TIMEOUT_MS) {
   this->midi.register_handler(this);
 }
 
-midi_msg SysexInterface::sysex_call(byte command, midi_msg &args) {
-  midi_msg message(SYSEX_PREFIX);
+/// \returns The complete sysex message for a command without a SysexCommand declaration
+static midi_msg format_sysex(byte command, const midi_msg &args) {
+  midi_msg message(SYSEX_PREFIX.begin(), SYSEX_PREFIX.end());
   message.push_back(command);
   message.insert(message.end(), args.begin(), args.end());
   message.push_back(SYSEX_SUFFIX);
-  this->midi.send_message(message);
+  return message;
+}
+
+midi_msg SysexInterface::sysex_call(byte command, midi_msg &args) {
+  return this->sysex_call(command, args, this->reply_timeout_ms.load());
+}
+
+midi_msg SysexInterface::sysex_call(byte command, midi_msg &args,
+                                    unsigned int timeout_ms) {
+  midi_msg message = format_sysex(command, args);
+  return this->sysex_call(message.data(), message.size(), timeout_ms);
+}
+
+midi_msg SysexInterface::sysex_call(const byte *message, size_t length,
+                                    unsigned int timeout_ms) {
+  byte command = message[SYSEX_PREFIX_LENGTH];
+  ReplySlot *slot = this->reply_slots[command & 0x7F].get();
+  if (!slot) {
+    this->midi.send_message(message, length);
+    return midi_msg();
+  }
+
+  Completions lost;
+  int lost_count = 0;
+  unique_lock<mutex> lock(slot->lock);
+  unsigned long long ticket =
+      this->send_request(*slot, message, length, nullptr, nullptr, lost,
+                         lost_count, lock);
+  Request &request = slot->requests[ticket % REPLY_SLOT_DEPTH];
+  request.deadline = Clock::now() + chrono::milliseconds(timeout_ms);
+  request.waiting = true;
+  if (lost_count) {
+    lock.unlock();
+    run(lost, lost_count);
+    lock.lock();
+  }
+
+  // Replies are stored by handle_message with the prefix, command and suffix already removed
+  return this->wait_for_reply(*slot, command, ticket, lock, timeout_ms);
+}
 
+void SysexInterface::sysex_call_async(byte command, midi_msg &args,
+                                      ReplyCallback callback, void *context) {
+  midi_msg message = format_sysex(command, args);
+  this->sysex_call_async(message.data(), message.size(), callback, context);
+}
+
+void SysexInterface::sysex_call_async(const byte *message, size_t length,
+                                      ReplyCallback callback, void *context) {
+  byte command = message[SYSEX_PREFIX_LENGTH];
+  ReplySlot *slot = this->reply_slots[command & 0x7F].get();
+  if (!slot) {
+    throw runtime_error("Sysex command " + to_string(command) +
+                        " has no reply to wait for");
+  }
+
+  Completions lost;
+  int lost_count = 0;
+  {
+    unique_lock<mutex> lock(slot->lock);
+    this->send_request(*slot, message, length, callback, context, lost,
+                       lost_count, lock);
+  }
+  run(lost, lost_count);
+}
+
+future<midi_msg> SysexInterface::sysex_call_async(byte command,
+                                                  midi_msg &args) {
+  midi_msg message = format_sysex(command, args);
+  return this->sysex_call_async(message.data(), message.size());
+}
+
+future<midi_msg> SysexInterface::sysex_call_async(const byte *message,
+                                                  size_t length) {
+  auto reply = make_unique<promise<midi_msg>>();
+  future<midi_msg> result = reply->get_future();
+  this->sysex_call_async(message, length, &SysexInterface::fulfill,
+                         reply.get());
+  reply.release(); // Deleted by fulfill
+  return result;
+}
+
+midi_msg SysexInterface::get_reply(future<midi_msg> &reply, byte command) {
+  ReplySlot *slot = this->reply_slots[command & 0x7F].get();
+  // A call is overdue at most the reply timeout after it was sent, but its reply
+  // is only noticed as lost when the next call of the command is sent
+  while (slot && reply.wait_for(chrono::milliseconds(
+                     this->reply_timeout_ms.load())) != future_status::ready) {
+    Completions lost;
+    int lost_count = 0;
+    {
+      lock_guard<mutex> lock(slot->lock);
+      expire(*slot, Clock::now(), lost, lost_count);
+    }
+    if (lost_count) {
+      slot->reply_received.notify_all();
+    }
+    run(lost, lost_count);
+  }
+  return reply.get();
+}
+
+void SysexInterface::send_batch(SysexBatch &batch) {
+  // A reply would find no call waiting for it
+  const midi_msg &buffer = batch.get_buffer();
+  size_t start = 0;
+  for (size_t end : batch.get_message_ends()) {
+    byte command = buffer[start + SYSEX_PREFIX_LENGTH];
+    if (this->reply_slots[command & 0x7F]) {
+      throw runtime_error("Can't batch sysex command " + to_string(command) +
+                          ", which has a reply");
+    }
+    start = end;
+  }
+
+  this->midi.send_messages(batch.get_buffer(), batch.get_message_ends());
+}
+
+void SysexInterface::register_command_with_reply(byte command,
+                                                 int echoed_args) {
+  if (echoed_args < 0 || echoed_args > MAX_ECHOED_ARGS) {
+    throw runtime_error("Replies can echo at most " +
+                        to_string(MAX_ECHOED_ARGS) + " arguments");
+  }
+  if (!this->reply_slots[command & 0x7F]) {
+    this->reply_slots[command & 0x7F].reset(new ReplySlot(echoed_args));
+  }
+}
+
+void SysexInterface::set_reply_timeout(unsigned int timeout_ms) {
+  this->reply_timeout_ms.store(timeout_ms);
+}
+
+unsigned long long SysexInterface::send_request(
+    ReplySlot &slot, const byte *message, size_t length,
+    ReplyCallback callback, void *context, Completions &lost,
+    int &lost_count, unique_lock<mutex> &lock) {
+  expire(slot, Clock::now(), lost, lost_count);
+  if (lost_count) {
+    slot.reply_received.notify_all();
+  }
+
+  // A call in sysex_call may not have taken its reply yet. Waiting releases the
+  // lock, so another call may take the next ticket, and it's chosen again
+  while (true) {
+    if (slot.requested - slot.received >= REPLY_SLOT_DEPTH) {
+      throw runtime_error("Too many sysex calls waiting for a reply");
+    }
+    if (!slot.requests[(slot.requested + 1) % REPLY_SLOT_DEPTH].waiting) {
+      break;
+    }
+    slot.reply_received.wait(lock);
+  }
+
+  Request &request = slot.requests[(slot.requested + 1) % REPLY_SLOT_DEPTH];
+  request.callback = callback;
+  request.context = context;
+  request.deadline =
+      Clock::now() + chrono::milliseconds(this->reply_timeout_ms.load());
+  request.lost = false;
+  // The arguments are between the command and the suffix
+  const byte *args = message + SYSEX_PREFIX_LENGTH + 1;
+  size_t args_length = length - SYSEX_PREFIX_LENGTH - 2;
+  for (int i = 0; i < slot.echoed_args; ++i) {
+    request.echo[i] = i < (int)args_length ? args[i] : 0;
+  }
+
+  // The ticket is taken and the command sent under the slot's lock, so that
+  // tickets are in the order the calls were sent in
+  unsigned long long ticket = ++slot.requested;
+  try {
+    this->midi.send_message(message, length);
+  } catch (...) {
+    --slot.requested;
+    throw;
+  }
+  return ticket;
+}
+
+midi_msg SysexInterface::wait_for_reply(ReplySlot &slot, byte command,
+                                        unsigned long long ticket,
+                                        unique_lock<mutex> &lock,
+                                        unsigned int timeout_ms) {
+  Request &request = slot.requests[ticket % REPLY_SLOT_DEPTH];
+  bool replied = slot.reply_received.wait_for(
+      lock, chrono::milliseconds(timeout_ms),
+      [&] { return slot.received >= ticket; });
+
+  Completions lost;
+  int lost_count = 0;
+  bool was_lost = replied && request.lost;
   midi_msg reply;
-  if (commands_with_reply.count(command)) {
-    reply = this->get_sysex_reply(command);
-    return midi_msg(reply.begin() + SYSEX_PREFIX.size() + 1, reply.end() - 1);
+  if (replied && !was_lost) {
+    reply = slot.replies[ticket % REPLY_SLOT_DEPTH];
+  } else if (!replied && slot.requested == ticket) {
+    // With no later call waiting, a late reply to this call is dropped
+    // instead of being taken as the reply to the next call
+    while (slot.received < ticket) {
+      complete(slot, slot.received + 1, lost, lost_count, nullptr);
+    }
   }
+  request.waiting = false;
+  lock.unlock();
+  slot.reply_received.notify_all();
+  run(lost, lost_count);
 
+  if (!replied) {
+    throw runtime_error("Timed out waiting for a reply to sysex command " +
+                        to_string(command));
+  }
+  if (was_lost) {
+    throw runtime_error("The reply to sysex command " + to_string(command) +
+                        " was lost");
+  }
   return reply;
 }
 
-void SysexInterface::register_command_with_reply(byte command) {
-  commands_with_reply.insert(command);
+void SysexInterface::expire(ReplySlot &slot, Clock::time_point now,
+                            Completions &lost, int &lost_count) {
+  // Push never replied to overdue calls, or the reply would have been matched by now
+  while (slot.received < slot.requested &&
+         slot.requests[(slot.received + 1) % REPLY_SLOT_DEPTH].deadline <
+             now) {
+    complete(slot, slot.received + 1, lost, lost_count, nullptr);
+  }
 }
 
-midi_msg SysexInterface::get_sysex_reply(byte command) {
-  promise<midi_msg> p;
-  auto f = p.get_future();
-  thread listener(&poll_for_sysex_reply, command, move(p), this);
-  listener.join();
-  return f.get();
+void SysexInterface::complete(ReplySlot &slot, unsigned long long ticket,
+                              Completions &completions, int &count,
+                              const midi_msg *reply) {
+  Request &request = slot.requests[ticket % REPLY_SLOT_DEPTH];
+  request.lost = !reply;
+  slot.received = ticket;
+  if (request.callback) {
+    completions[count++] = {request.callback, request.context, reply};
+    request.callback = nullptr;
+  }
 }
 
-void SysexInterface::poll_for_sysex_reply(byte command,
-                                          std::promise<midi_msg> p,
-                                          SysexInterface *self) {
-  // Poll until a message is queued for the given command
-  while (1) {
-    unique_lock<mutex> lock(self->reply_queues_lock);
+void SysexInterface::run(const Completions &completions, int count) {
+  for (int i = 0; i < count; ++i) {
+    completions[i].callback(completions[i].reply, completions[i].context);
+  }
+}
 
-    auto iter = self->sysex_reply_queues.find(command);
-    if (iter != self->sysex_reply_queues.end()) {
-      queue<midi_msg> &queue = iter->second;
-      if (!queue.empty()) {
-        p.set_value(queue.front());
-        queue.pop();
-        lock.unlock();
-        break;
-      }
-    }
+void SysexInterface::fulfill(const midi_msg *reply, void *context) {
+  unique_ptr<promise<midi_msg>> result(
+      static_cast<promise<midi_msg> *>(context));
+  if (reply) {
+    result->set_value(*reply);
+  } else {
+    result->set_exception(
+        make_exception_ptr(runtime_error("The sysex reply was lost")));
   }
 }
 
-void SysexInterface::handle_message(midi_msg &message) {
+bool SysexInterface::accepts(byte status, byte data1) {
+  return status == MidiMsgType::sysex;
+}
+
+void SysexInterface::handle_message(midi_msg &message,
+                                    unsigned long long timestamp) {
   byte msg_type = get_midi_type(message);
-  if (msg_type != MidiMsgType::sysex) {
+  if (msg_type != MidiMsgType::sysex ||
+      message.size() < SYSEX_PREFIX.size() + 2) {
     return;
   }
 
-  // Put the message args on the reply queue for the command
   auto prefix_end = message.begin() + SYSEX_PREFIX.size();
-  byte command = *prefix_end;
-  if (commands_with_reply.count(command)) {
-    midi_msg args(prefix_end + 1, message.end() - 1);
-    lock_guard<mutex> lock(this->reply_queues_lock);
-    this->sysex_reply_queues[command].push(args);
+  ReplySlot *slot = this->reply_slots[*prefix_end & 0x7F].get();
+  if (!slot) {
+    return;
+  }
+
+  Completions completions;
+  int count = 0;
+  {
+    lock_guard<mutex> lock(slot->lock);
+    // Overdue calls lost their replies, so this can't be the reply to one of them
+    expire(*slot, Clock::now(), completions, count);
+    match_reply(*slot, prefix_end + 1, message.end() - 1, completions, count);
+  }
+  slot->reply_received.notify_all();
+  run(completions, count);
+}
+
+void SysexInterface::match_reply(ReplySlot &slot,
+                                 midi_msg::const_iterator args_begin,
+                                 midi_msg::const_iterator args_end,
+                                 Completions &completions, int &count) {
+  if (slot.received >= slot.requested) {
+    return; // No call is waiting for it
+  }
+
+  // Store the message args as the reply to the oldest call still waiting
+  // whose arguments the reply echoes
+  unsigned long long ticket = slot.received + 1;
+  if (slot.echoed_args) {
+    if (args_end - args_begin < slot.echoed_args) {
+      return;
+    }
+    while (ticket <= slot.requested &&
+           !equal(args_begin, args_begin + slot.echoed_args,
+                  slot.requests[ticket % REPLY_SLOT_DEPTH].echo.begin())) {
+      ++ticket;
+    }
+    if (ticket > slot.requested) {
+      return; // A late reply to a call that was already failed
+    }
+  }
+
+  // Push replies in order, so calls skipped over lost their replies
+  while (slot.received + 1 < ticket) {
+    complete(slot, slot.received + 1, completions, count, nullptr);
   }
+  midi_msg &reply = slot.replies[ticket % REPLY_SLOT_DEPTH];
+  reply.assign(args_begin, args_end);
+  complete(slot, ticket, completions, count, &reply);
 }
@@ -3,14 +3,21 @@
 #include "MidiMessageHandler.hpp"
 #include "MidiMsg.hpp"
 #include "RtMidi.h"
+#include "SysexBatch.hpp"
+#include "SysexSchema.hpp"
 #include "push.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
-#include <thread>
-#include <unordered_map>
-#include <unordered_set>
+
+#define REPLY_SLOT_DEPTH 128 //< The most calls of one command that can wait for replies at once
+#define MAX_ECHOED_ARGS 2 //< The most argument bytes a reply can echo
+#define RESERVED_REPLY_LENGTH 32 //< Replies up to this length are stored without allocating
+#define DEFAULT_SYSEX_REPLY_TIMEOUT_MS 1000
 
 /// Responsible for sending and handling sysex MIDI messages
 class SysexInterface : public MidiMessageHandler {
@@ -23,38 +30,251 @@ public:
   /// \param args The argument bytes for the command
   /// \returns The command's reply if it has one
   /// \effects Sends the sysex command to Push and blocks until a reply is received
+  /// \throws An [std::runtime_error]() exception if no reply is received within the reply timeout
   midi_msg sysex_call(byte command, midi_msg &args);
 
+  /// Send a sysex command to Push
+  ///
+  /// \param command The command code (defined in the _Sysex enums)
+  /// \param args The argument bytes for the command
+  /// \param timeout_ms How long to wait for a reply
+  /// \returns The command's reply if it has one
+  /// \effects Sends the sysex command to Push and blocks until a reply is received
+  /// \throws An [std::runtime_error]() exception if no reply is received within timeout_ms,
+  /// or if REPLY_SLOT_DEPTH calls of the command are already waiting
+  midi_msg sysex_call(byte command, midi_msg &args, unsigned int timeout_ms);
+
+  /// Send a sysex command to Push
+  ///
+  /// \param message A message built by a SysexCommand
+  /// \returns The command's reply if it has one
+  /// \effects Sends the message without allocating, and blocks until a reply is received
+  /// \throws An [std::runtime_error]() exception if no reply is received within the reply timeout
+  template <size_t Length>
+  midi_msg sysex_call(const SysexMessage<Length> &message) {
+    return this->sysex_call(message.data(), Length,
+                            this->reply_timeout_ms.load());
+  }
+
+  /// Send a complete sysex message to Push
+  ///
+  /// \param message The message, from the prefix to the suffix
+  /// \param length The number of bytes in the message
+  /// \param timeout_ms How long to wait for a reply
+  /// \returns The command's reply if it has one
+  /// \throws See the other forms of sysex_call
+  midi_msg sysex_call(const byte *message, size_t length,
+                      unsigned int timeout_ms);
+
+  /// Called when the reply to an asynchronous sysex call arrives
+  ///
+  /// \param reply The data bytes (arguments) of the reply, or nullptr if the reply was lost
+  /// \param context The context passed to sysex_call_async
+  /// \notes Called on the MIDI input thread, or on a thread making a call when it finds the reply was lost
+  using ReplyCallback = void (*)(const midi_msg *reply, void *context);
+
+  /// Send a sysex command to Push without waiting for its reply
+  ///
+  /// \param command The command code of a command registered with a reply
+  /// \param args The argument bytes for the command
+  /// \param callback Called with the reply
+  /// \param context A pointer passed to callback
+  /// \effects Sends the command. Many calls can wait for replies at once, so a bulk read
+  /// takes about one round trip instead of one per call. A call whose reply doesn't arrive
+  /// within the reply timeout is failed the next time the command is sent, or when get_reply
+  /// gives up waiting for a reply to the command
+  /// \throws An [std::runtime_error]() exception if the command isn't registered with a reply,
+  /// or if REPLY_SLOT_DEPTH calls of the command are already waiting
+  void sysex_call_async(byte command, midi_msg &args, ReplyCallback callback,
+                        void *context);
+
+  /// \param command The command code of a command registered with a reply
+  /// \param args The argument bytes for the command
+  /// \returns The future reply. Getting it throws an [std::runtime_error]() exception if the reply was lost.
+  /// Wait for it with get_reply, since a lost reply to the last call of a command isn't noticed otherwise
+  /// \effects Sends the command without waiting for its reply
+  /// \throws See the callback form of sysex_call_async
+  std::future<midi_msg> sysex_call_async(byte command, midi_msg &args);
+
+  /// \param message A message built by a SysexCommand registered with a reply
+  /// \param callback Called with the reply
+  /// \param context A pointer passed to callback
+  /// \effects See the other callback form of sysex_call_async
+  template <size_t Length>
+  void sysex_call_async(const SysexMessage<Length> &message,
+                        ReplyCallback callback, void *context) {
+    this->sysex_call_async(message.data(), Length, callback, context);
+  }
+
+  /// \param message A message built by a SysexCommand registered with a reply
+  /// \returns The future reply, see the other future form of sysex_call_async
+  template <size_t Length>
+  std::future<midi_msg> sysex_call_async(const SysexMessage<Length> &message) {
+    return this->sysex_call_async(message.data(), Length);
+  }
+
+  /// \param message A complete sysex message, from the prefix to the suffix
+  /// \param length The number of bytes in the message
+  /// \param callback Called with the reply
+  /// \param context A pointer passed to callback
+  void sysex_call_async(const byte *message, size_t length,
+                        ReplyCallback callback, void *context);
+
+  /// \param message A complete sysex message, from the prefix to the suffix
+  /// \param length The number of bytes in the message
+  /// \returns The future reply
+  std::future<midi_msg> sysex_call_async(const byte *message, size_t length);
+
+  /// Wait for the reply to an asynchronous sysex call
+  ///
+  /// \param reply A future returned by sysex_call_async
+  /// \param command The command code of the call
+  /// \returns The data bytes (arguments) of the command's reply
+  /// \effects Waits for the reply. Each time the reply timeout passes without it, fails
+  /// the calls of the command whose replies are overdue, including this one once it is
+  /// \throws An [std::runtime_error]() exception if the reply was lost
+  midi_msg get_reply(std::future<midi_msg> &reply, byte command);
+
+  /// Send a batch of sysex commands to Push
+  ///
+  /// \param batch Commands without replies
+  /// \effects Sends the commands in order, in as few writes as the transport allows
+  /// \throws An [std::runtime_error]() exception if a command in the batch expects a reply
+  void send_batch(SysexBatch &batch);
+
   /// Register a command that expects a reply
   ///
   /// \params The command byte code
-  /// \effects Listens for and returns a reply for the given command type when a sysex_call is made for that type
-  void register_command_with_reply(byte command);
+  /// \params echoed_args How many of the first argument bytes Push repeats at the start of the reply,
+  /// e.g. 1 for the palette index of GET_LED_COLOR_PALETTE_ENTRY
+  /// \effects Listens for and returns a reply for the given command type when a sysex_call is made for that type.
+  /// Replies are matched with calls in the order the calls were made, skipping calls whose echoed arguments
+  /// don't match, so a lost reply only fails its own call
+  /// \requires Not connected, since replies are handled without locking the registered commands
+  void register_command_with_reply(byte command, int echoed_args = 0);
+
+  /// \param timeout_ms How long sysex_call waits for a reply when no timeout is given
+  void set_reply_timeout(unsigned int timeout_ms);
 
 private:
+  using Clock = std::chrono::steady_clock;
+
+  /// A call that sent a command and expects a reply
+  struct Request {
+    ReplyCallback callback; //< nullptr for a call waiting in sysex_call
+    void *context;
+    Clock::time_point deadline; //< When the reply is considered lost
+    std::array<byte, MAX_ECHOED_ARGS> echo; //< The arguments the reply should start with
+    bool lost;
+    bool waiting; //< Whether a call in sysex_call hasn't yet taken the reply, so the ticket can't be reused
+  };
+
+  /// Where the replies to one command are delivered
+  ///
+  /// Push replies to the calls of a command in the order they were made, so each call
+  /// takes a ticket when it sends the command and the nth reply is the reply to ticket n,
+  /// unless echoed arguments show that earlier replies were lost
+  struct ReplySlot {
+    ReplySlot(int echoed_args);
+
+    std::mutex lock; //< Guards the tickets, requests and replies, and is held while the command is sent
+    std::condition_variable reply_received;
+    int echoed_args;
+    unsigned long long requested; //< The ticket of the last call that sent the command
+    unsigned long long received; //< The ticket of the last call that was replied to or lost
+    std::array<Request, REPLY_SLOT_DEPTH>
+        requests; //< Each call waiting for a reply, at its ticket modulo REPLY_SLOT_DEPTH
+    std::array<midi_msg, REPLY_SLOT_DEPTH>
+        replies; //< The reply to each ticket, at the ticket modulo REPLY_SLOT_DEPTH
+  };
+
+  /// A callback to call once a slot's lock is released
+  struct Completion {
+    ReplyCallback callback;
+    void *context;
+    const midi_msg *reply;
+  };
+  using Completions = std::array<Completion, REPLY_SLOT_DEPTH + 1>;
+
   MidiInterface &midi;
 
-  /// Stores a message queue for each type of command to hold the command's replies
-  std::unordered_map<byte, std::queue<midi_msg>> sysex_reply_queues;
-  std::mutex reply_queues_lock;
-  std::unordered_set<byte> commands_with_reply;
+  /// The reply slot of each command that expects a reply, allocated when the command is registered
+  std::array<std::unique_ptr<ReplySlot>, 128> reply_slots;
+  std::atomic<unsigned int> reply_timeout_ms;
 
-  /// Blocks until a reply is received for a sysex command
+  /// Sends a command and takes a ticket for its reply
   ///
-  /// \param command The command code that is waiting for a reply
-  /// \returns The data bytes (arguments) of the command's reply
-  /// \effects Creates a thread to poll for a reply, blocks until it is received
-  midi_msg get_sysex_reply(byte command);
+  /// \param slot The reply slot of the command
+  /// \param message The complete sysex message
+  /// \param length The number of bytes in the message
+  /// \param callback The callback of an asynchronous call, or nullptr
+  /// \param context A pointer passed to callback
+  /// \param lost Filled with the callbacks of calls whose replies are overdue
+  /// \param lost_count Set to the number of callbacks in lost
+  /// \param lock Holds the slot's lock
+  /// \returns The ticket of the call
+  /// \throws An [std::runtime_error]() exception if REPLY_SLOT_DEPTH calls are already waiting
+  unsigned long long send_request(ReplySlot &slot, const byte *message,
+                                  size_t length, ReplyCallback callback,
+                                  void *context, Completions &lost,
+                                  int &lost_count,
+                                  std::unique_lock<std::mutex> &lock);
 
-  /// Polls for a reply for a sysex command
+  /// Waits for the reply to a sysex call
   ///
+  /// \param slot The reply slot of the command
   /// \param command The command code that is waiting for a reply
-  /// \param p A promise to hold the reply's data bytes
-  /// \param self A pointer to the MidiInterface object that is requesting the polling
-  static void poll_for_sysex_reply(byte command, std::promise<midi_msg> p,
-                                   SysexInterface *self);
+  /// \param ticket The ticket the call took when it sent the command
+  /// \param lock Holds the slot's lock
+  /// \param timeout_ms How long to wait for the reply
+  /// \returns The data bytes (arguments) of the command's reply
+  /// \throws An [std::runtime_error]() exception if no reply is received within timeout_ms,
+  /// or if the reply was lost
+  midi_msg wait_for_reply(ReplySlot &slot, byte command,
+                          unsigned long long ticket,
+                          std::unique_lock<std::mutex> &lock,
+                          unsigned int timeout_ms);
+
+  /// \param slot The reply slot of the command
+  /// \param now The current time
+  /// \param lost Filled with the callbacks of calls whose replies are overdue
+  /// \param lost_count The number of callbacks in lost
+  /// \effects Fails the calls whose replies are overdue, oldest first
+  /// \requires The slot's lock is held
+  static void expire(ReplySlot &slot, Clock::time_point now, Completions &lost,
+                     int &lost_count);
+
+  /// \param slot The reply slot of the command
+  /// \param args_begin The start of the reply's data bytes
+  /// \param args_end The end of the reply's data bytes
+  /// \param completions Filled with the callbacks of the calls that are completed
+  /// \param count The number of callbacks in completions
+  /// \effects Stores the reply for the call it answers, and fails the calls before it
+  /// \requires The slot's lock is held
+  static void match_reply(ReplySlot &slot, midi_msg::const_iterator args_begin,
+                          midi_msg::const_iterator args_end,
+                          Completions &completions, int &count);
+
+  /// \param slot The reply slot of the command
+  /// \param ticket The ticket of a call waiting for a reply
+  /// \param completions Filled with the callback of the call, if it has one
+  /// \param count The number of callbacks in completions
+  /// \param reply The reply to the call, or nullptr if it was lost
+  /// \effects Marks the call as replied to
+  /// \requires The slot's lock is held
+  static void complete(ReplySlot &slot, unsigned long long ticket,
+                       Completions &completions, int &count,
+                       const midi_msg *reply);
+
+  /// \effects Calls each callback
+  /// \requires No slot's lock is held
+  static void run(const Completions &completions, int count);
+
+  /// Completes the promise passed as context by the future form of sysex_call_async
+  static void fulfill(const midi_msg *reply, void *context);
 
-  void handle_message(midi_msg &message) override;
+  bool accepts(byte status, byte data1) override;
+  void handle_message(midi_msg &message, unsigned long long timestamp) override;
 
   // MidiInterface needs to call handle_sysex_message,
   // but that method shouldn't be public
@@ -0,0 +1,159 @@
+#pragma once
+#include "MidiMsg.hpp"
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#define SYSEX_PREFIX_LENGTH 6
+
+/// Sequence of bytes that precedes every MIDI sysex message sent or received from Push
+constexpr std::array<byte, SYSEX_PREFIX_LENGTH> SYSEX_PREFIX = {
+    {0xF0, 0x00, 0x21, 0x1D, 0x01, 0x01}};
+/// Byte marking the end of a sysex message
+constexpr byte SYSEX_SUFFIX = 0xF7;
+
+/// A number sent as 7 bit groups, least significant group first
+///
+/// \tparam Bits The number of bits in the field, e.g. 14 for a value sent as 2 bytes
+template <size_t Bits> struct SysexNumber {
+  static constexpr size_t length = (Bits + 6) / 7; //< The number of bytes in the field
+
+  /// \effects Writes the value's 7 bit groups to out. Bits above Bits are dropped
+  static constexpr void encode(byte *out, uint value) {
+    for (size_t i = 0; i < length; ++i) {
+      out[i] = (value >> (7 * i)) & 0x7F;
+    }
+  }
+
+  /// \returns The value whose 7 bit groups start at in
+  static constexpr uint decode(const byte *in) {
+    uint value = 0;
+    for (size_t i = 0; i < length; ++i) {
+      value |= (uint)(in[i] & 0x7F) << (7 * i);
+    }
+    return value;
+  }
+};
+
+using SysexU7 = SysexNumber<7>;
+using SysexU14 = SysexNumber<14>;
+using SysexU21 = SysexNumber<21>;
+using SysexU28 = SysexNumber<28>;
+
+/// Count consecutive fields of the same kind, e.g. the entries of a curve
+template <typename Field, size_t Count> struct SysexArray {
+  static constexpr size_t length = Field::length * Count;
+
+  /// \param values Count values, of any type that converts to uint
+  template <typename T>
+  static constexpr void encode(byte *out, const T *values) {
+    for (size_t i = 0; i < Count; ++i) {
+      Field::encode(out + i * Field::length, values[i]);
+    }
+  }
+};
+
+/// Finds field I of a layout and where it starts
+template <size_t I, typename... Fields> struct SysexFieldAt;
+
+template <typename Field, typename... Rest>
+struct SysexFieldAt<0, Field, Rest...> {
+  using type = Field;
+  static constexpr size_t offset = 0;
+};
+
+template <size_t I, typename Field, typename... Rest>
+struct SysexFieldAt<I, Field, Rest...> {
+  using type = typename SysexFieldAt<I - 1, Rest...>::type;
+  static constexpr size_t offset =
+      Field::length + SysexFieldAt<I - 1, Rest...>::offset;
+};
+
+/// The fields of a command's arguments or reply, in the order they are sent
+template <typename... Fields> struct SysexLayout;
+
+template <> struct SysexLayout<> {
+  static constexpr size_t length = 0;
+
+  static constexpr void encode(byte *out) {}
+};
+
+template <typename Field, typename... Rest>
+struct SysexLayout<Field, Rest...> {
+  static constexpr size_t length = Field::length + SysexLayout<Rest...>::length;
+
+  /// \param values The value of each field
+  /// \effects Writes the fields to out
+  template <typename Value, typename... Values>
+  static constexpr void encode(byte *out, Value value, Values... values) {
+    static_assert(sizeof...(Values) == sizeof...(Rest),
+                  "Every field of a sysex layout needs a value");
+    Field::encode(out, value);
+    SysexLayout<Rest...>::encode(out + Field::length, values...);
+  }
+
+  /// \returns The value of field I, which is a number, from fields starting at in
+  template <size_t I> static constexpr uint decode(const byte *in) {
+    using At = SysexFieldAt<I, Field, Rest...>;
+    return At::type::decode(in + At::offset);
+  }
+};
+
+/// A complete sysex message of a fixed length, built without allocating
+template <size_t Length> struct SysexMessage {
+  byte bytes[Length];
+
+  constexpr const byte *data() const { return this->bytes; }
+  constexpr size_t size() const { return Length; }
+};
+
+/// Declares a Push sysex command: its code, the layout of its arguments and of its reply
+///
+/// Commands are declared next to the _Sysex enum of the interface that sends them,
+/// and every layer that sends a command (calls, asynchronous calls and batches)
+/// takes a message built by format
+template <byte Command, typename Args = SysexLayout<>,
+          typename Reply = SysexLayout<>>
+struct SysexCommand {
+  static constexpr byte command = Command;
+  using Arguments = Args;
+  using Replies = Reply;
+
+  /// The length of the complete message, from the prefix to the suffix
+  static constexpr size_t length = SYSEX_PREFIX_LENGTH + 1 + Args::length + 1;
+  using Message = SysexMessage<length>;
+
+  /// \param values The value of each argument field
+  /// \returns The complete sysex message
+  template <typename... Values>
+  static constexpr Message format(Values... values) {
+    Message message{};
+    encode(message.bytes, values...);
+    return message;
+  }
+
+  /// \param out Where to write the message, length bytes long
+  /// \param values The value of each argument field
+  /// \effects Writes the complete sysex message to out
+  template <typename... Values>
+  static constexpr void encode(byte *out, Values... values) {
+    for (size_t i = 0; i < SYSEX_PREFIX_LENGTH; ++i) {
+      out[i] = SYSEX_PREFIX[i];
+    }
+    out[SYSEX_PREFIX_LENGTH] = Command;
+    Args::encode(out + SYSEX_PREFIX_LENGTH + 1, values...);
+    out[length - 1] = SYSEX_SUFFIX;
+  }
+
+  /// \param reply The reply to the command, without the prefix, command and suffix
+  /// \returns The value of reply field I
+  /// \throws An [std::runtime_error]() exception if the reply is too short
+  template <size_t I> static uint reply_field(const midi_msg &reply) {
+    if (reply.size() < Reply::length) {
+      throw std::runtime_error("The reply to sysex command " +
+                               std::to_string(Command) + " is too short");
+    }
+    return Reply::template decode<I>(reply.data());
+  }
+};
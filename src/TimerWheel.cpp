@@ -0,0 +1,111 @@
+#include "TimerWheel.hpp"
+
+TimerWheel::TimerWheel(unsigned long long start) : slots(), current(start) {}
+
+unsigned long long TimerWheel::now() { return this->current; }
+
+void TimerWheel::schedule(Timer &timer, unsigned long long expiry) {
+  this->cancel(timer);
+  timer.expiry = expiry > this->current ? expiry : this->current + 1;
+  this->insert(timer);
+}
+
+void TimerWheel::cancel(Timer &timer) {
+  if (!timer.scheduled) {
+    return;
+  }
+
+  if (timer.prev) {
+    timer.prev->next = timer.next;
+  } else {
+    *timer.head = timer.next;
+  }
+  if (timer.next) {
+    timer.next->prev = timer.prev;
+  }
+
+  timer.prev = nullptr;
+  timer.next = nullptr;
+  timer.head = nullptr;
+  timer.scheduled = false;
+}
+
+void TimerWheel::insert(Timer &timer) {
+  unsigned long long delta = timer.expiry - this->current;
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+    ++level;
+  }
+
+  // Timers beyond the range of the top level wait in its last slot and are reinserted from there
+  unsigned long long expiry = timer.expiry;
+  unsigned long long range = 1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS);
+  if (delta >= range) {
+    expiry = this->current + range - 1;
+  }
+
+  int slot = (expiry >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+  this->link(timer, this->slots[level][slot]);
+}
+
+void TimerWheel::link(Timer &timer, Timer *&head) {
+  timer.prev = nullptr;
+  timer.next = head;
+  if (head) {
+    head->prev = &timer;
+  }
+  head = &timer;
+  timer.head = &head;
+  timer.scheduled = true;
+}
+
+void TimerWheel::cascade(int level, int slot) {
+  Timer *timer = this->slots[level][slot];
+  this->slots[level][slot] = nullptr;
+  while (timer) {
+    Timer *next = timer->next;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    this->insert(*timer);
+    timer = next;
+  }
+}
+
+void TimerWheel::advance(unsigned long long to,
+                         void (*fired)(Timer &timer, void *context),
+                         void *context) {
+  while (this->current < to) {
+    ++this->current;
+
+    // When a wheel wraps around, the next slot of the wheel above it is due to move down
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+      unsigned long long lower_ticks = this->current
+                                       >> (TIMER_WHEEL_SLOT_BITS * (level - 1));
+      if (lower_ticks & (TIMER_WHEEL_SLOTS - 1)) {
+        break;
+      }
+      this->cascade(level, (this->current >> (TIMER_WHEEL_SLOT_BITS * level)) &
+                               (TIMER_WHEEL_SLOTS - 1));
+    }
+
+    // Timers that aren't due yet are only possible when parked beyond the range of the wheel.
+    // They are set aside until the due ones have fired, so fired can still cancel them
+    Timer *&head = this->slots[0][this->current & (TIMER_WHEEL_SLOTS - 1)];
+    Timer *later = nullptr;
+    while (head) {
+      Timer *timer = head;
+      this->cancel(*timer);
+      if (timer->expiry > this->current) {
+        this->link(*timer, later);
+        continue;
+      }
+      fired(*timer, context);
+    }
+    while (later) {
+      Timer *timer = later;
+      this->cancel(*timer);
+      this->insert(*timer);
+    }
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+/// A hierarchical timer wheel
+///
+/// Timers are kept in intrusive lists in one of TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots.
+/// Level n has a resolution of TIMER_WHEEL_SLOTS^n ticks, and its timers are moved down a level
+/// when the wheel below it wraps around. Scheduling and cancelling a timer are O(1) and
+/// don't allocate, no matter how many timers are pending.
+class TimerWheel {
+public:
+  /// A timer that can be scheduled on the wheel. Owned by the caller
+  struct Timer {
+    Timer *prev;
+    Timer *next;
+    Timer **head; //< The head of the list the timer is in
+    unsigned long long expiry; //< The tick the timer fires on
+    bool scheduled;
+    int id; //< Identifies the timer to the caller
+  };
+
+  /// \param start The current tick
+  TimerWheel(unsigned long long start);
+
+  /// \returns The current tick
+  unsigned long long now();
+
+  /// \param timer The timer to schedule. Rescheduled if it is already scheduled
+  /// \param expiry The tick to fire on. Timers due now or in the past fire on the next tick
+  void schedule(Timer &timer, unsigned long long expiry);
+
+  /// \param timer The timer to cancel
+  /// \effects Unschedules the timer if it is scheduled
+  void cancel(Timer &timer);
+
+  /// \param to The tick to advance to
+  /// \param fired Called with each timer that expires, after it's unscheduled
+  /// \param context A pointer passed to fired
+  /// \effects Advances the wheel one tick at a time, firing timers in order of expiry.
+  /// fired may schedule timers, including the one that fired
+  void advance(unsigned long long to, void (*fired)(Timer &timer, void *context),
+               void *context);
+
+private:
+  Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  unsigned long long current;
+
+  /// \param timer An unscheduled timer
+  /// \effects Adds the timer to the slot for its expiry
+  void insert(Timer &timer);
+
+  /// \param timer An unscheduled timer
+  /// \param head The head of the list to add the timer to
+  /// \effects Adds the timer to the front of the list
+  void link(Timer &timer, Timer *&head);
+
+  /// \param level The level of the slot
+  /// \param slot The slot to move down
+  /// \effects Reinserts all timers in the slot, which puts them on lower levels
+  void cascade(int level, int slot);
+};
@@ -3,95 +3,163 @@
 using namespace std;
 
 TouchStripInterface::TouchStripInterface(MidiInterface &midi,
-                                         SysexInterface &sysex)
-    : sysex(sysex), listener(TouchStripInterface::handle_message) {
+                                         SysexInterface &sysex,
+                                         SettingsCache &settings)
+    : sysex(sysex), settings(settings), listener(*this) {
   midi.register_handler(&this->listener);
   sysex.register_command_with_reply(
       TouchStripSysex::GET_TOUCH_STRIP_CONFIGURATION);
 }
 
-void TouchStripInterface::register_callback(LibPushTouchStripCallback cb,
-                                            void *context) {
-  this->listener.register_callback(cb, context);
+int TouchStripInterface::register_callback(LibPushTouchStripCallback cb,
+                                           void *context) {
+  return this->listener.register_callback(cb, context);
 }
 
+bool TouchStripInterface::unregister_callback(int token) {
+  return this->listener.unregister_callback(token);
+}
+
+bool TouchStripInterface::set_callback_filter(
+    int token, const LibPushEventFilter &filter) {
+  return this->listener.set_callback_filter(token, filter);
+}
+
+void TouchStripInterface::set_event_queue(EventQueue *queue) {
+  this->listener.set_event_queue(queue);
+}
+
+void TouchStripInterface::set_callback_runner(CallbackRunner *runner) {
+  this->listener.set_callback_runner(runner);
+}
+
+void TouchStripInterface::set_controller_state(ControllerState *state) {
+  this->listener.set_controller_state(state);
+}
+
+void TouchStripInterface::set_signal_conditioner(
+    SignalConditioner *conditioner) {
+  this->listener.set_signal_conditioner(conditioner);
+}
+
+bool TouchStripInterface::add_event_forwarder(EventObserver *forwarder) {
+  return this->listener.add_event_forwarder(forwarder);
+}
+
+void TouchStripInterface::remove_event_forwarder(EventObserver *forwarder) {
+  this->listener.remove_event_forwarder(forwarder);
+}
+
+LatencyHistogram &TouchStripInterface::get_latency() {
+  return this->listener.get_latency();
+}
+
+void TouchStripInterface::set_coalescing(bool enabled) {
+  this->listener.set_coalescing(enabled);
+}
+
+void TouchStripInterface::flush_coalesced_events() { this->listener.flush(); }
+
 void TouchStripInterface::set_config(LibPushTouchStripConfig cfg) {
-  midi_msg args;
   byte cfg_byte = cfg.controlled_by_host;
   cfg_byte |= (cfg.led_point << 3);
   cfg_byte |= (cfg.bar_starts_at_center << 4);
   cfg_byte |= (cfg.autoreturn << 5);
   cfg_byte |= (cfg.autoreturn_to_center << 6);
-  args.push_back(cfg_byte);
-  sysex.sysex_call(TouchStripSysex::SET_TOUCH_STRIP_CONFIGURATION, args);
+  this->settings.write(this->settings.touch_strip_config, cfg_byte, [&] {
+    sysex.sysex_call(SetConfig::format(cfg_byte));
+  });
 }
 
 LibPushTouchStripConfig TouchStripInterface::get_config() {
-  midi_msg args;
-  midi_msg reply =
-      sysex.sysex_call(TouchStripSysex::GET_TOUCH_STRIP_CONFIGURATION, args);
+  // The configuration is cached as it's sent, so the reply is decoded either way
+  byte cfg_byte = this->settings.read(this->settings.touch_strip_config, [&] {
+    midi_msg reply = sysex.sysex_call(GetConfig::format());
+    return (byte)GetConfig::reply_field<0>(reply);
+  });
 
   LibPushTouchStripConfig cfg;
-  cfg.controlled_by_host = 0x01 & reply[0];
-  cfg.led_point = 0x01 & (reply[0] >> 3);
-  cfg.bar_starts_at_center = 0x01 & (reply[0] >> 4);
-  cfg.autoreturn = 0x01 & (reply[0] >> 5);
-  cfg.autoreturn_to_center = 0x01 & (reply[0] >> 6);
+  cfg.controlled_by_host = 0x01 & cfg_byte;
+  cfg.led_point = 0x01 & (cfg_byte >> 3);
+  cfg.bar_starts_at_center = 0x01 & (cfg_byte >> 4);
+  cfg.autoreturn = 0x01 & (cfg_byte >> 5);
+  cfg.autoreturn_to_center = 0x01 & (cfg_byte >> 6);
   return cfg;
 }
 
 constexpr uint LEDS_PER_BYTE = 2;
 void TouchStripInterface::set_leds(
     byte (&brightness)[LIBPUSH_TOUCH_STRIP_LEDS]) {
-  midi_msg args;
+  byte packed[LIBPUSH_TOUCH_STRIP_LEDS / LEDS_PER_BYTE];
   for (int i = 0; i < LIBPUSH_TOUCH_STRIP_LEDS; i += LEDS_PER_BYTE) {
-    args.push_back((brightness[i] & 0x7) | ((brightness[i + 1] & 0x7) << 3));
+    packed[i / LEDS_PER_BYTE] =
+        (brightness[i] & 0x7) | ((brightness[i + 1] & 0x7) << 3);
+  }
+  sysex.sysex_call(SetLeds::format(packed));
+}
+
+void TouchStripInterface::add_settings(const DeviceSettings &settings,
+                                       SysexBatch &batch) {
+  if (settings.touch_strip_config.known) {
+    batch.add(SetConfig::format(settings.touch_strip_config.value));
   }
-  sysex.sysex_call(TouchStripSysex::SET_TOUCH_STRIP_LEDS, args);
 }
 
 constexpr uint TOUCH_STRIP_NN = 12;
 constexpr uint TOUCH_STRIP_CC = 1;
 
-unique_ptr<LibPushTouchStripEvent>
-TouchStripInterface::handle_message(byte msg_type, midi_msg &message) {
-  if (msg_type != MidiMsgType::cc && msg_type != MidiMsgType::pitch_bend &&
-      msg_type != MidiMsgType::note_on) {
-    return nullptr;
-  }
-
-  if (msg_type == MidiMsgType::note_on &&
-      get_midi_number(msg_type, message) != TOUCH_STRIP_NN) {
-    return nullptr;
+bool TouchStripInterface::accepts_message(byte msg_type, byte number) {
+  switch (msg_type) {
+  case MidiMsgType::note_on:
+    return number == TOUCH_STRIP_NN;
+  case MidiMsgType::cc:
+    return number == TOUCH_STRIP_CC;
+  case MidiMsgType::pitch_bend:
+    return true;
+  default:
+    return false;
   }
+}
 
-  if (msg_type == MidiMsgType::cc &&
-      get_midi_number(msg_type, message) != TOUCH_STRIP_CC) {
-    return nullptr;
+bool TouchStripInterface::decode_message(byte msg_type, midi_msg &message,
+                                         LibPushTouchStripEvent &event) {
+  if (!accepts_message(msg_type, message[1] & 0x7F)) {
+    return false;
   }
 
-  unique_ptr<LibPushTouchStripEvent> event =
-      make_unique<LibPushTouchStripEvent>();
-  uint val = get_midi_value(msg_type, message);
+  uint val = message[2];
 
   switch (msg_type) {
   case MidiMsgType::note_on:
-    event->event_type =
+    event.event_type =
         val ? LibPushTouchStripEventType::LP_TOUCH_STRIP_PRESSED
             : LibPushTouchStripEventType::LP_TOUCH_STRIP_RELEASED;
-    event->position = 0.0;
+    event.position = 0.0;
     break;
   case MidiMsgType::cc:
-    event->event_type = LibPushTouchStripEventType::LP_TOUCH_STRIP_MOVED;
-    event->position = (val - 64.0) / 64.0; //(0-128) -> (-1.0 - 1.0)
+    event.event_type = LibPushTouchStripEventType::LP_TOUCH_STRIP_MOVED;
+    event.position = (val - 64.0) / 64.0; //(0-128) -> (-1.0 - 1.0)
     break;
   case MidiMsgType::pitch_bend:
-    event->event_type = LibPushTouchStripEventType::LP_TOUCH_STRIP_MOVED;
-    // The least significant bit of the pitch value is the 7th bit of the second byte
-    uint lsb = message[1] >> 6;
-    uint complete_val = lsb | (val << 1);
-    event->position = (complete_val - 128.0) / 128.0; //(0-256) -> (-1.0 - 1.0)
+    event.event_type = LibPushTouchStripEventType::LP_TOUCH_STRIP_MOVED;
+    // The second byte holds the 7 least significant bits of the 14 bit pitch value
+    uint lsb = message[1] & 0x7F;
+    uint complete_val = lsb | (val << 7);
+    event.position =
+        (complete_val - 8192.0) / 8192.0; //(0-16383) -> (-1.0 - 1.0)
     break;
   }
-  return event;
+  return true;
+}
+
+int TouchStripInterface::coalescing_key(const LibPushTouchStripEvent &event) {
+  if (event.event_type != LibPushTouchStripEventType::LP_TOUCH_STRIP_MOVED) {
+    return -1;
+  }
+  return 0;
+}
+
+void TouchStripInterface::coalesce(LibPushTouchStripEvent &pending,
+                                   const LibPushTouchStripEvent &event) {
+  pending = event;
 }
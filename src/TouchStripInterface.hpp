@@ -2,6 +2,7 @@
 #include "MidiInterface.hpp"
 #include "MidiMessageListener.hpp"
 #include "MidiMsg.hpp"
+#include "SettingsCache.hpp"
 #include "SysexInterface.hpp"
 #include "push.h"
 #include <memory>
@@ -16,23 +17,94 @@ public:
     SET_TOUCH_STRIP_LEDS = 0x19
   };
 
-  TouchStripInterface(MidiInterface &midi, SysexInterface &sysex);
+  /// The configuration flags packed into one byte
+  using SetConfig =
+      SysexCommand<SET_TOUCH_STRIP_CONFIGURATION, SysexLayout<SysexU7>>;
+  using GetConfig = SysexCommand<GET_TOUCH_STRIP_CONFIGURATION, SysexLayout<>,
+                                 SysexLayout<SysexU7>>;
+  /// The brightness of two leds in each byte, 3 bits each
+  using SetLeds =
+      SysexCommand<SET_TOUCH_STRIP_LEDS,
+                   SysexLayout<SysexArray<SysexU7, LIBPUSH_TOUCH_STRIP_LEDS / 2>>>;
 
-  void register_callback(LibPushTouchStripCallback cb, void *context);
+  TouchStripInterface(MidiInterface &midi, SysexInterface &sysex,
+                      SettingsCache &settings);
+
+  /// \returns A token that identifies the callback
+  int register_callback(LibPushTouchStripCallback cb, void *context);
+
+  /// \param token A token returned by register_callback
+  /// \returns false if no callback of this interface has the token
+  bool unregister_callback(int token);
+
+  /// \param token A token returned by register_callback
+  /// \param filter The events the callback should receive
+  /// \returns false if no callback of this interface has the token
+  bool set_callback_filter(int token, const LibPushEventFilter &filter);
+
+  /// \param queue The queue to write events to, or nullptr to stop queueing events
+  void set_event_queue(EventQueue *queue);
+
+  /// \param runner Calls this interface's callbacks when it is active
+  void set_callback_runner(CallbackRunner *runner);
+
+  /// \param state The state to keep up to date with this interface's events
+  void set_controller_state(ControllerState *state);
+
+  /// \param conditioner Filters this interface's continuous events before they are used, or nullptr
+  void set_signal_conditioner(SignalConditioner *conditioner);
+
+  /// \param forwarder Passed every event of this interface before it is delivered
+  /// \returns false if the interface has no room for another forwarder
+  bool add_event_forwarder(EventObserver *forwarder);
+
+  /// \param forwarder A forwarder passed to add_event_forwarder
+  void remove_event_forwarder(EventObserver *forwarder);
+
+  /// \returns The latency of this interface's events, from arrival to the return of the last callback
+  LatencyHistogram &get_latency();
+
+  /// \param enabled Whether continuous events should be coalesced until the next flush
+  void set_coalescing(bool enabled);
+
+  /// \effects Delivers all pending coalesced events
+  void flush_coalesced_events();
 
   /// \param The configuration object
   /// \effects Updates the touch strip according to the configuration flags
   void set_config(LibPushTouchStripConfig cfg);
 
-  /// \returns The current touch strip configuration
+  /// \returns The current touch strip configuration, read from Push only if it isn't cached
   LibPushTouchStripConfig get_config();
 
   /// \param brightness An array of brightness values corresponding to each led of the touch strip
   void set_leds(byte (&brightness)[LIBPUSH_TOUCH_STRIP_LEDS]);
 
+  /// \param settings Settings to write
+  /// \param batch Filled with the command that writes the configuration, if it's known
+  static void add_settings(const DeviceSettings &settings, SysexBatch &batch);
+
 private:
   SysexInterface &sysex;
-  MidiMessageListener<LibPushTouchStripEvent> listener;
-  static std::unique_ptr<LibPushTouchStripEvent>
-  handle_message(byte msg_type, midi_msg &message);
+  SettingsCache &settings;
+  MidiMessageListener<LibPushTouchStripEvent, TouchStripInterface> listener;
+  friend class MidiMessageListener<LibPushTouchStripEvent,
+                                   TouchStripInterface>;
+
+  /// \param msg_type The type of the incoming message
+  /// \param message The incoming message
+  /// \param event Filled with the touch strip event the message represents
+  /// \returns true if the message is a touch strip event
+  static bool decode_message(byte msg_type, midi_msg &message,
+                             LibPushTouchStripEvent &event);
+
+  /// \returns true for touch strip touches, releases and movements
+  static bool accepts_message(byte msg_type, byte number);
+
+  /// \returns 0 for movements, -1 for touches and releases
+  static int coalescing_key(const LibPushTouchStripEvent &event);
+
+  /// \effects Keeps the latest position
+  static void coalesce(LibPushTouchStripEvent &pending,
+                       const LibPushTouchStripEvent &event);
 };
@@ -0,0 +1,165 @@
+#include "VoiceTracker.hpp"
+#include <cmath>
+
+using namespace std;
+
+VoiceTracker::VoiceTracker(unsigned int max_voices, bool mpe, size_t capacity)
+    : max_voices(max_voices), mpe(mpe), next_id(1), free_head(0),
+      free_count(max_voices), capacity(capacity), head(0), tail(0),
+      dropped(0) {
+  unsigned int limit = mpe ? LIBPUSH_MPE_MAX_VOICES : LIBPUSH_MAX_VOICES;
+  if (!max_voices || max_voices > limit) {
+    throw runtime_error("Voice tracking supports 1 to " + to_string(limit) +
+                        " voices");
+  }
+  // Starts and pressure changes leave room for max_voices releases
+  if (capacity < 2 * (size_t)max_voices) {
+    throw runtime_error(
+        "Voice tracking needs a capacity of at least twice the voices");
+  }
+
+  for (unsigned int slot = 0; slot < max_voices; ++slot) {
+    this->voices[slot].pad = -1;
+    this->voices[slot].published = false;
+    this->free_slots[slot] = slot;
+  }
+  this->pad_voices.fill(-1);
+  this->buffer = make_unique<LibPushVoiceUpdate[]>(capacity);
+}
+
+void VoiceTracker::observe(const LibPushPadEvent &event) {
+  int pad = event.y * LIBPUSH_PAD_MATRIX_DIM + event.x;
+  int slot = this->pad_voices[pad];
+
+  if (event.event_type == LP_PAD_AFTERTOUCH) {
+    if (slot >= 0 && this->voices[slot].published &&
+        this->voices[slot].pressure != event.pressure) {
+      this->voices[slot].pressure = event.pressure;
+      this->publish(LP_VOICE_PRESSURE, slot, event.timestamp, 0);
+    }
+    return;
+  }
+
+  // A press of a pad that is already playing restarts its voice.
+  // A note on with a velocity of 0 is a release
+  if (slot >= 0) {
+    this->release(slot, event.timestamp);
+  }
+  if (event.event_type == LP_PAD_PRESSED && event.velocity &&
+      event.note >= 0) {
+    this->start(pad, event);
+  }
+}
+
+size_t VoiceTracker::read(LibPushVoiceUpdate *out, size_t max) {
+  size_t tail = this->tail.load(memory_order_relaxed);
+  size_t head = this->head.load(memory_order_acquire);
+  size_t count = 0;
+  while (count < max && tail < head) {
+    out[count++] = this->buffer[tail % this->capacity];
+    ++tail;
+  }
+  this->tail.store(tail, memory_order_release);
+  return count;
+}
+
+unsigned long long VoiceTracker::get_dropped_count() {
+  return this->dropped.load();
+}
+
+void VoiceTracker::start(int pad, const LibPushPadEvent &event) {
+  if (!this->free_count) {
+    int oldest = 0;
+    for (unsigned int slot = 1; slot < this->max_voices; ++slot) {
+      if (this->voices[slot].onset_timestamp <
+          this->voices[oldest].onset_timestamp) {
+        oldest = slot;
+      }
+    }
+    this->release(oldest, event.timestamp);
+  }
+
+  int slot = this->free_slots[this->free_head];
+  this->free_head = (this->free_head + 1) % this->max_voices;
+  --this->free_count;
+
+  Voice &voice = this->voices[slot];
+  voice.id = this->next_id++;
+  voice.pad = pad;
+  voice.note = event.note;
+  voice.velocity = event.velocity;
+  voice.pressure = event.pressure;
+  voice.onset_timestamp = event.timestamp;
+  this->pad_voices[pad] = slot;
+
+  voice.published = this->publish(LP_VOICE_ON, slot, event.timestamp, 0);
+}
+
+void VoiceTracker::release(int slot, unsigned long long timestamp) {
+  Voice &voice = this->voices[slot];
+  voice.pressure = 0;
+  if (voice.published) {
+    this->publish(LP_VOICE_OFF, slot, timestamp, timestamp);
+  }
+
+  this->pad_voices[voice.pad] = -1;
+  voice.pad = -1;
+  this->free_slots[(this->free_head + this->free_count) % this->max_voices] =
+      slot;
+  ++this->free_count;
+}
+
+bool VoiceTracker::publish(LibPushVoiceUpdateType type, int slot,
+                           unsigned long long timestamp,
+                           unsigned long long release_timestamp) {
+  // Other updates leave room for the release of every voice, so a release always fits
+  size_t reserved = type == LP_VOICE_OFF ? 0 : this->max_voices;
+  size_t head = this->head.load(memory_order_relaxed);
+  if (head - this->tail.load(memory_order_acquire) + reserved >=
+      this->capacity) {
+    this->dropped.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+
+  const Voice &voice = this->voices[slot];
+  LibPushVoiceUpdate &update = this->buffer[head % this->capacity];
+  update.update_type = type;
+  update.voice_id = voice.id;
+  update.slot = slot;
+  update.x = voice.pad % LIBPUSH_PAD_MATRIX_DIM;
+  update.y = voice.pad / LIBPUSH_PAD_MATRIX_DIM;
+  update.note = voice.note;
+  update.velocity = voice.velocity;
+  update.pressure = voice.pressure;
+  update.onset_timestamp = voice.onset_timestamp;
+  update.release_timestamp = release_timestamp;
+  update.timestamp = timestamp;
+
+  update.mpe_length = 0;
+  if (this->mpe) {
+    // Channel 1 is the MPE master channel, so voices play on the member channels after it
+    byte channel = slot + 1;
+    switch (type) {
+    case LP_VOICE_ON:
+      update.mpe[0] = MidiMsgType::note_on | channel;
+      update.mpe[1] = voice.note;
+      update.mpe[2] = voice.velocity;
+      update.mpe_length = 3;
+      break;
+    case LP_VOICE_PRESSURE:
+      update.mpe[0] = MidiMsgType::channel_pressure | channel;
+      update.mpe[1] = lround(voice.pressure * 127);
+      update.mpe_length = 2;
+      break;
+    case LP_VOICE_OFF:
+      update.mpe[0] = MidiMsgType::note_off | channel;
+      update.mpe[1] = voice.note;
+      update.mpe[2] = 0;
+      update.mpe_length = 3;
+      break;
+    }
+  }
+
+  this->head.store(head + 1, memory_order_release);
+  return true;
+}
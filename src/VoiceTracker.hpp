@@ -0,0 +1,90 @@
+#pragma once
+#include "EventObserver.hpp"
+#include "MidiMsg.hpp"
+#include "push.h"
+#include <array>
+#include <atomic>
+#include <memory>
+
+#define VOICE_PADS (LIBPUSH_PAD_MATRIX_DIM * LIBPUSH_PAD_MATRIX_DIM)
+
+/// Tracks pad presses as voices for polyphonic aftertouch
+///
+/// Observes pad events on the MIDI input thread. Each press is assigned one of a fixed number of
+/// voice slots, taken from a queue of free slots so that the slot released longest ago is reused first,
+/// which gives a released MPE channel's tail the most time to ring out.
+/// When no slot is free the oldest voice is stolen.
+///
+/// Updates are written to a single producer, single consumer ring buffer, so reading them never
+/// blocks or allocates. Starts and pressure changes that don't fit in the buffer are dropped and
+/// counted. They leave room for the release of every voice, so a voice whose start was read is
+/// always released. The pressure changes and release of a voice whose start was dropped are dropped too
+class VoiceTracker : public EventObserver {
+public:
+  /// \param max_voices How many voices can play at once
+  /// \param mpe Whether updates should carry MPE messages
+  /// \param capacity The number of updates the buffer can hold, at least twice max_voices
+  /// \throws An [std::runtime_error]() exception if max_voices is 0 or too many for the form,
+  /// or capacity is too small
+  VoiceTracker(unsigned int max_voices, bool mpe, size_t capacity);
+
+  /// \effects Starts, updates or releases the voice of the pad
+  void observe(const LibPushPadEvent &event) override;
+
+  /// \param out An array to copy updates into
+  /// \param max The number of updates out can hold
+  /// \returns The number of updates copied into out
+  /// \requires Only one thread reads updates
+  size_t read(LibPushVoiceUpdate *out, size_t max);
+
+  /// \returns The number of updates dropped because the buffer was full
+  unsigned long long get_dropped_count();
+
+private:
+  struct Voice {
+    unsigned int id;
+    int pad; //< The pad playing the voice, or -1 if the slot is free
+    byte note;
+    byte velocity;
+    double pressure;
+    unsigned long long onset_timestamp;
+    bool published; //< Whether the voice's start was written to the buffer
+  };
+
+  unsigned int max_voices;
+  bool mpe;
+  unsigned int next_id;
+
+  // Only used on the input thread
+  std::array<Voice, LIBPUSH_MAX_VOICES> voices;
+  std::array<int, VOICE_PADS> pad_voices; //< The slot of the voice each pad plays, or -1
+  std::array<int, LIBPUSH_MAX_VOICES> free_slots; //< A queue of free slots, released longest ago first
+  unsigned int free_head;
+  unsigned int free_count;
+
+  std::unique_ptr<LibPushVoiceUpdate[]> buffer;
+  size_t capacity;
+  std::atomic<size_t> head; //< Total updates written
+  std::atomic<size_t> tail; //< Total updates read
+  std::atomic<unsigned long long> dropped;
+
+  /// \param pad The pad that was pressed
+  /// \param event The press
+  /// \effects Assigns the pad a voice, stealing the oldest one if none is free
+  void start(int pad, const LibPushPadEvent &event);
+
+  /// \param slot The slot of a playing voice
+  /// \param timestamp When the voice ended
+  /// \effects Publishes the release and frees the slot
+  void release(int slot, unsigned long long timestamp);
+
+  /// \param type What happened to the voice
+  /// \param slot The slot of the voice
+  /// \param timestamp When it happened
+  /// \param release_timestamp When the voice ended, or 0
+  /// \returns false if the update was dropped
+  /// \effects Writes an update for the voice to the buffer. Releases use the room other updates leave
+  bool publish(LibPushVoiceUpdateType type, int slot,
+               unsigned long long timestamp,
+               unsigned long long release_timestamp);
+};
@@ -1,120 +1,805 @@
 #include "push.hpp"
+#include <thread>
 
 using namespace std;
 using Pixel = unsigned short int;
 
 PushInterface *push;
+
+/// Pins a pointer that PushInterface frees once it is replaced and its readers are done
+template <typename T> class PinnedPointer {
+public:
+  PinnedPointer(atomic<T *> &pointer, atomic<int> &readers)
+      : readers(readers) {
+    // Registers as a reader before loading, so the pointer can't be freed while it's in use
+    this->readers.fetch_add(1);
+    this->pointer = pointer.load();
+  }
+  ~PinnedPointer() { this->readers.fetch_sub(1); }
+
+  T *get() const { return this->pointer; }
+  T *operator->() const { return this->pointer; }
+
+private:
+  atomic<int> &readers;
+  T *pointer;
+};
+
 const string NOT_CONNECTED_MSG = "Please ensure libpush_connect is successful "
                                  "before using other parts of the API";
 
-PushInterface::PushInterface(LibPushPort port)
-    : sysex(midi), display(sysex), leds(midi, sysex), misc(sysex),
-      pedals(midi, sysex), encoders(midi), pads(midi, sysex, leds),
-      touch_strip(midi, sysex), buttons(midi, leds) {
-  midi.connect(port);
-  display.connect();
+const string NOT_SIMULATED_MSG =
+    "Please connect with libpush_connect_simulated before using the simulator";
+
+PushInterface::PushInterface(LibPushPort port,
+                             unique_ptr<SimulatedDevice> simulator)
+    : simulator(move(simulator)), sysex(midi), display(sysex, settings),
+      leds(midi, sysex, settings), misc(sysex), pedals(midi, sysex, settings),
+      encoders(midi), pads(midi, sysex, leds, settings),
+      touch_strip(midi, sysex, settings), buttons(midi, leds),
+      event_queue(nullptr), event_queue_readers(0), bindings(parameters, state),
+      pedal_sampler(pedals), reflexes(leds), voice_tracker(nullptr),
+      voice_tracker_readers(0) {
+  pads.set_callback_runner(&callback_runner);
+  buttons.set_callback_runner(&callback_runner);
+  encoders.set_callback_runner(&callback_runner);
+  touch_strip.set_callback_runner(&callback_runner);
+  pedals.set_callback_runner(&callback_runner);
+  gestures.set_callback_runner(&callback_runner);
+
+  pads.set_controller_state(&state);
+  buttons.set_controller_state(&state);
+  encoders.set_controller_state(&state);
+  touch_strip.set_controller_state(&state);
+  pedals.set_controller_state(&state);
+
+  pads.set_signal_conditioner(&conditioner);
+  touch_strip.set_signal_conditioner(&conditioner);
+  pedals.set_signal_conditioner(&conditioner);
+
+  encoders.add_event_observer(&bindings);
+
+  pads.add_event_forwarder(&reflexes);
+  buttons.add_event_forwarder(&reflexes);
+
+  pads.add_event_forwarder(&forwarder);
+  encoders.add_event_forwarder(&forwarder);
+  touch_strip.add_event_forwarder(&forwarder);
+
+  if (this->simulator) {
+    midi.connect(this->simulator->create_midi_transport(), port);
+    display.connect(this->simulator->create_display_transport());
+  } else {
+    midi.connect(port);
+    display.connect();
+  }
+}
+
+PushInterface::~PushInterface() {
+  coalescing_timer.stop();
+  LibPushGestureConfig disabled = {};
+  this->set_gesture_config(disabled);
+  parameters.set_notifications(nullptr, nullptr, 0);
+  pedal_sampler.stop();
+  forwarder.stop();
+  midi.disconnect();
+  display.disconnect();
+  callback_runner.set_workers(0, 0);
+}
+
+void PushInterface::set_event_queue(unique_ptr<EventQueue> queue) {
+  this->event_queue.store(queue.get());
+  // Each listener returns once no event is being written to the old queue
+  pads.set_event_queue(queue.get());
+  buttons.set_event_queue(queue.get());
+  encoders.set_event_queue(queue.get());
+  touch_strip.set_event_queue(queue.get());
+  pedals.set_event_queue(queue.get());
+  gestures.set_event_queue(queue.get());
+
+  while (this->event_queue_readers.load()) {
+    this_thread::yield();
+  }
+  this->owned_event_queue = move(queue);
+}
+
+void PushInterface::set_coalescing(bool enabled, unsigned int interval_us) {
+  coalescing_timer.stop();
+
+  pads.set_coalescing(enabled);
+  encoders.set_coalescing(enabled);
+  touch_strip.set_coalescing(enabled);
+
+  if (enabled && interval_us) {
+    coalescing_timer.start(chrono::microseconds(interval_us),
+                           [this]() { this->flush_coalesced_events(); });
+  }
+}
+
+void PushInterface::flush_coalesced_events() {
+  pads.flush_coalesced_events();
+  encoders.flush_coalesced_events();
+  touch_strip.flush_coalesced_events();
+}
+
+void PushInterface::set_gesture_config(const LibPushGestureConfig &config) {
+  gestures.set_config(config);
+
+  if (config.gestures) {
+    pads.add_event_observer(&gestures);
+    buttons.add_event_observer(&gestures);
+  } else {
+    pads.remove_event_observer(&gestures);
+    buttons.remove_event_observer(&gestures);
+  }
+}
+
+void PushInterface::set_voice_tracker(unique_ptr<VoiceTracker> tracker) {
+  VoiceTracker *current = this->voice_tracker.load();
+  if (current) {
+    pads.remove_event_observer(current, true);
+  }
+  if (!tracker) {
+    // The stopped tracker stays current so that its remaining updates can be read
+    return;
+  }
+
+  pads.add_event_observer(tracker.get());
+  this->voice_tracker.store(tracker.get());
+  while (this->voice_tracker_readers.load()) {
+    this_thread::yield();
+  }
+  this->owned_voice_tracker = move(tracker);
+}
+
+void PushInterface::save_settings(const string &path) {
+  // Each getter only asks Push if the setting isn't cached
+  leds.get_global_led_brightness();
+  for (byte group = 0; group < LED_WHITE_BALANCE_GROUPS; ++group) {
+    leds.get_led_white_balance(static_cast<LedInterface::LedColorGroup>(group));
+  }
+  LibPushLedColor palette[LED_PALETTE_ENTRIES];
+  leds.get_led_color_palette_entries(0, LED_PALETTE_ENTRIES, palette);
+  display.get_brightness();
+  pads.get_global_aftertouch_mode();
+  LibPushPadSensitivity sensitivities[LIBPUSH_PAD_MATRIX_DIM]
+                                     [LIBPUSH_PAD_MATRIX_DIM];
+  pads.get_pad_sensitivities(sensitivities);
+  touch_strip.get_config();
+
+  SettingsSnapshot::save(path, settings.copy());
+}
+
+size_t PushInterface::restore_settings(const string &path) {
+  DeviceSettings saved = SettingsSnapshot::load(path);
+  bool palette_restored = false;
+  size_t written =
+      settings.restore(saved, [&](const DeviceSettings &changes) {
+        SysexBatch batch;
+        LedInterface::add_settings(changes, batch);
+        DisplayInterface::add_settings(changes, batch);
+        PadInterface::add_settings(changes, batch);
+        TouchStripInterface::add_settings(changes, batch);
+        PedalInterface::add_settings(changes, batch);
+        sysex.send_batch(batch);
+
+        for (const auto &entry : changes.palette) {
+          palette_restored |= entry.known;
+        }
+      });
+
+  // The batch reapplies the palette after the restored entries
+  if (palette_restored) {
+    settings.remember(settings.palette_changed, false);
+  }
+  return written;
+}
+
+bool libpush_connect(LibPushPort port) {
+  try {
+    push = new PushInterface(port);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool libpush_connect_simulated() {
+  try {
+    push = new PushInterface(LibPushPort::LIVE, make_unique<SimulatedDevice>());
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool libpush_disconnect() {
+  if (!push) {
+    cerr << "Disconnecting when not connected" << endl;
+    return false;
+  }
+
+  try {
+    delete push;
+    push = nullptr;
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+void libpush_draw_frame(
+    Pixel (&buffer)[LIBPUSH_DISPLAY_HEIGHT][LIBPUSH_DISPLAY_WIDTH]) {
+  try {
+    push->display.draw_frame(buffer);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+  }
+}
+
+void libpush_set_display_brightness(unsigned char brightness) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->display.set_brightness(brightness);
+}
+
+unsigned char libpush_get_display_brightness() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  try {
+    return push->display.get_brightness();
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return 0;
+  }
+}
+
+int libpush_register_pad_callback(LibPushPadCallback cb, void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+  return push->pads.register_callback(cb, context);
+}
+
+int libpush_register_button_callback(LibPushButtonCallback cb, void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+  return push->buttons.register_callback(cb, context);
+}
+
+int libpush_register_encoder_callback(LibPushEncoderCallback cb,
+                                      void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+  return push->encoders.register_callback(cb, context);
+}
+
+int libpush_register_touch_strip_callback(LibPushTouchStripCallback cb,
+                                          void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+  return push->touch_strip.register_callback(cb, context);
+}
+
+int libpush_register_pedal_callback(LibPushPedalCallback cb, void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+  return push->pedals.register_callback(cb, context);
+}
+
+int libpush_register_gesture_callback(LibPushGestureCallback cb,
+                                      void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+  return push->gestures.register_callback(cb, context);
+}
+
+void libpush_set_gesture_config(LibPushGestureConfig cfg) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->set_gesture_config(cfg);
+}
+
+bool libpush_set_callback_filter(int token, LibPushEventFilter filter) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+  return push->pads.set_callback_filter(token, filter) ||
+         push->buttons.set_callback_filter(token, filter) ||
+         push->encoders.set_callback_filter(token, filter) ||
+         push->touch_strip.set_callback_filter(token, filter) ||
+         push->pedals.set_callback_filter(token, filter) ||
+         push->gestures.set_callback_filter(token, filter);
+}
+
+bool libpush_unregister_callback(int token) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+  return push->pads.unregister_callback(token) ||
+         push->buttons.unregister_callback(token) ||
+         push->encoders.unregister_callback(token) ||
+         push->touch_strip.unregister_callback(token) ||
+         push->pedals.unregister_callback(token) ||
+         push->gestures.unregister_callback(token);
+}
+
+unsigned long long libpush_pad_region(unsigned char x1, unsigned char y1,
+                                      unsigned char x2, unsigned char y2) {
+  unsigned long long mask = 0;
+  for (uint y = min(y1, y2); y <= max(y1, y2) && y < LIBPUSH_PAD_MATRIX_DIM;
+       ++y) {
+    for (uint x = min(x1, x2); x <= max(x1, x2) && x < LIBPUSH_PAD_MATRIX_DIM;
+         ++x) {
+      mask |= 1ULL << (y * LIBPUSH_PAD_MATRIX_DIM + x);
+    }
+  }
+  return mask;
+}
+
+bool libpush_set_pad_layout(LibPushPadLayout layout) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    push->pads.set_layout(layout);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+int libpush_get_pad_note(unsigned char x, unsigned char y) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+  if (x >= LIBPUSH_PAD_MATRIX_DIM || y >= LIBPUSH_PAD_MATRIX_DIM) {
+    return -1;
+  }
+  return push->pads.get_note(x, y);
+}
+
+void libpush_set_pad_color(unsigned char x, unsigned char y,
+                           unsigned int color_index) {
+  push->pads.set_pad_color(x, y, color_index);
+}
+
+bool libpush_set_callback_workers(unsigned int workers,
+                                  size_t queue_capacity) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    push->callback_runner.set_workers(workers, queue_capacity);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+void libpush_set_callback_budget(unsigned long long budget_ns,
+                                 LibPushSlowCallbackHandler handler,
+                                 void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->callback_runner.set_budget(budget_ns, handler, context);
+}
+
+LibPushWatchdogStats libpush_get_watchdog_stats() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    LibPushWatchdogStats s = {};
+    return s;
+  }
+  return push->callback_runner.get_stats();
+}
+
+void libpush_set_signal_conditioning(LibPushSignal signal,
+                                     LibPushSignalConfig cfg) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->conditioner.set_config(signal, cfg);
+}
+
+unsigned long long libpush_get_conditioned_drop_count() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  return push->conditioner.get_drop_count();
+}
+
+bool libpush_bind_encoder(int encoder, LibPushEncoderBinding binding) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+  return push->bindings.bind(encoder, binding);
+}
+
+double libpush_get_parameter(int parameter) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  return push->parameters.get(parameter);
+}
+
+void libpush_set_parameter(int parameter, double value) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->parameters.set(parameter, value);
+}
+
+unsigned long long libpush_take_parameter_changes() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  return push->parameters.take_changes();
+}
+
+void libpush_set_parameter_notifications(LibPushParameterCallback cb,
+                                         void *context,
+                                         unsigned int interval_us) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->parameters.set_notifications(cb, context, interval_us);
+}
+
+bool libpush_start_pedal_sampling(unsigned int rate_hz,
+                                  unsigned char sample_size, size_t capacity) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    push->pedal_sampler.start(rate_hz, sample_size, capacity);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+unsigned long long libpush_stop_pedal_sampling() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  return push->pedal_sampler.stop();
+}
+
+size_t libpush_read_pedal_samples(LibPushPedalSample *out, size_t max) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  return push->pedal_sampler.read(out, max);
+}
+
+void libpush_set_pedal_calibration(unsigned int channel,
+                                   LibPushPedalCalibration calibration) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->pedal_sampler.set_calibration(channel, calibration);
+}
+
+bool libpush_enable_voice_tracking(unsigned int max_voices, bool mpe,
+                                   size_t capacity) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    push->set_voice_tracker(
+        make_unique<VoiceTracker>(max_voices, mpe, capacity));
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+void libpush_disable_voice_tracking() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->set_voice_tracker(nullptr);
+}
+
+size_t libpush_read_voice_updates(LibPushVoiceUpdate *out, size_t max) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  PinnedPointer<VoiceTracker> tracker(push->voice_tracker,
+                                      push->voice_tracker_readers);
+  return tracker.get() ? tracker->read(out, max) : 0;
+}
+
+unsigned long long libpush_get_dropped_voice_update_count() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return 0;
+  }
+  PinnedPointer<VoiceTracker> tracker(push->voice_tracker,
+                                      push->voice_tracker_readers);
+  return tracker.get() ? tracker->get_dropped_count() : 0;
+}
+
+bool libpush_start_forwarding(const char *port_name, bool virtual_port,
+                              LibPushForwardingConfig cfg) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    unique_ptr<MidiOutput> output;
+    if (push->simulator) {
+      output = push->simulator->create_forwarding_output();
+    } else {
+      output = make_unique<RtMidiOutput>(port_name ? port_name : "",
+                                         virtual_port);
+    }
+    push->forwarder.start(move(output), cfg);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+
+  return true;
+}
+
+void libpush_stop_forwarding() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->forwarder.stop();
+}
+
+LibPushLatencyHistogram libpush_get_forwarding_latency() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    LibPushLatencyHistogram h = {};
+    return h;
+  }
+  return push->forwarder.get_latency().get();
+}
+
+LibPushControllerState libpush_get_state_snapshot() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    LibPushControllerState s = {};
+    return s;
+  }
+  return push->state.snapshot();
+}
+
+unsigned long long libpush_get_time_ns() { return monotonic_time_ns(); }
+
+LibPushLatencyHistogram libpush_get_input_latency(LibPushEventType type) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    LibPushLatencyHistogram h = {};
+    return h;
+  }
+
+  switch (type) {
+  case LP_PAD_EVENT:
+    return push->pads.get_latency().get();
+  case LP_BUTTON_EVENT:
+    return push->buttons.get_latency().get();
+  case LP_ENCODER_EVENT:
+    return push->encoders.get_latency().get();
+  case LP_TOUCH_STRIP_EVENT:
+    return push->touch_strip.get_latency().get();
+  case LP_PEDAL_EVENT:
+    return push->pedals.get_latency().get();
+  case LP_GESTURE_EVENT:
+    return push->gestures.get_latency().get();
+  }
+
+  LibPushLatencyHistogram h = {};
+  return h;
+}
+
+void libpush_reset_input_latency() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->pads.get_latency().reset();
+  push->buttons.get_latency().reset();
+  push->encoders.get_latency().reset();
+  push->touch_strip.get_latency().reset();
+  push->pedals.get_latency().reset();
+  push->gestures.get_latency().reset();
+  push->forwarder.get_latency().reset();
 }
 
-PushInterface::~PushInterface() {
-  midi.disconnect();
-  display.disconnect();
+void libpush_set_event_coalescing(bool enabled, unsigned int interval_us) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->set_coalescing(enabled, interval_us);
 }
 
-bool libpush_connect(LibPushPort port) {
-  try {
-    push = new PushInterface(port);
-  } catch (exception &ex) {
-    cerr << ex.what() << endl;
-    return false;
+void libpush_flush_coalesced_events() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
   }
-
-  return true;
+  push->flush_coalesced_events();
 }
 
-bool libpush_disconnect() {
+bool libpush_start_input_recording(const char *path) {
   if (!push) {
-    cerr << "Disconnecting when not connected" << endl;
+    cerr << NOT_CONNECTED_MSG << endl;
     return false;
   }
 
   try {
-    delete push;
+    push->midi.get_recorder().start(path);
   } catch (exception &ex) {
     cerr << ex.what() << endl;
     return false;
   }
-}
 
-void libpush_draw_frame(
-    Pixel (&buffer)[LIBPUSH_DISPLAY_HEIGHT][LIBPUSH_DISPLAY_WIDTH]) {
-  try {
-    push->display.draw_frame(buffer);
-  } catch (exception &ex) {
-    cerr << ex.what() << endl;
-  }
+  return true;
 }
 
-void libpush_set_display_brightness(unsigned char brightness) {
+unsigned long long libpush_stop_input_recording() {
   if (!push) {
     cerr << NOT_CONNECTED_MSG << endl;
-    return;
+    return 0;
   }
-  push->display.set_brightness(brightness);
+  push->midi.get_recorder().stop();
+  return push->midi.get_recorder().get_dropped_count();
 }
 
-unsigned char libpush_get_display_brightness() {
+long long libpush_replay_input_recording(const char *path,
+                                         bool original_timing) {
   if (!push) {
     cerr << NOT_CONNECTED_MSG << endl;
-    return 0;
+    return -1;
+  }
+
+  try {
+    return push->midi.replay(path, original_timing);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return -1;
   }
-  return push->display.get_brightness();
 }
 
-void libpush_register_pad_callback(LibPushPadCallback cb, void *context) {
+const string NO_EVENT_QUEUE_MSG =
+    "Please enable the event queue with libpush_enable_event_queue first";
+
+bool libpush_enable_event_queue(size_t capacity,
+                                LibPushQueueOverflow overflow) {
   if (!push) {
     cerr << NOT_CONNECTED_MSG << endl;
-    return;
+    return false;
+  }
+
+  try {
+    push->set_event_queue(make_unique<EventQueue>(capacity, overflow));
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
   }
-  push->pads.register_callback(cb, context);
+
+  return true;
 }
 
-void libpush_register_button_callback(LibPushButtonCallback cb, void *context) {
+void libpush_disable_event_queue() {
   if (!push) {
     cerr << NOT_CONNECTED_MSG << endl;
     return;
   }
-  push->buttons.register_callback(cb, context);
+  push->set_event_queue(nullptr);
+}
+
+size_t libpush_poll_events(LibPushEvent *out, size_t max) {
+  return libpush_poll_events_for_cursor(0, out, max);
 }
 
-void libpush_register_encoder_callback(LibPushEncoderCallback cb,
-                                       void *context) {
+int libpush_add_event_cursor() {
   if (!push) {
     cerr << NOT_CONNECTED_MSG << endl;
-    return;
+    return -1;
   }
-  push->encoders.register_callback(cb, context);
+  PinnedPointer<EventQueue> queue(push->event_queue, push->event_queue_readers);
+  if (!queue.get()) {
+    cerr << NO_EVENT_QUEUE_MSG << endl;
+    return -1;
+  }
+  return queue->add_cursor();
 }
 
-void libpush_register_touch_strip_callback(LibPushTouchStripCallback cb,
-                                           void *context) {
+void libpush_remove_event_cursor(int cursor) {
   if (!push) {
-    cerr << NOT_CONNECTED_MSG << endl;
     return;
   }
-  push->touch_strip.register_callback(cb, context);
+  PinnedPointer<EventQueue> queue(push->event_queue, push->event_queue_readers);
+  if (queue.get()) {
+    queue->remove_cursor(cursor);
+  }
 }
 
-void libpush_register_pedal_callback(LibPushPedalCallback cb, void *context) {
+size_t libpush_poll_events_for_cursor(int cursor, LibPushEvent *out,
+                                      size_t max) {
   if (!push) {
     cerr << NOT_CONNECTED_MSG << endl;
-    return;
+    return 0;
+  }
+  PinnedPointer<EventQueue> queue(push->event_queue, push->event_queue_readers);
+  if (!queue.get()) {
+    cerr << NO_EVENT_QUEUE_MSG << endl;
+    return 0;
   }
-  push->pedals.register_callback(cb, context);
+  return queue->poll(cursor, out, max);
 }
 
-void libpush_set_pad_color(unsigned char x, unsigned char y,
-                           unsigned int color_index) {
-  push->pads.set_pad_color(x, y, color_index);
+unsigned long long libpush_get_dropped_event_count(int cursor) {
+  if (!push) {
+    return 0;
+  }
+  PinnedPointer<EventQueue> queue(push->event_queue, push->event_queue_readers);
+  return queue.get() ? queue->get_dropped_count(cursor) : 0;
 }
 
 void libpush_set_global_pad_color(unsigned int color_index) {
@@ -137,7 +822,13 @@ void libpush_set_global_aftertouch_mode(LibPushAftertouchMode mode) {
 }
 
 LibPushAftertouchMode libpush_get_global_aftertouch_mode() {
-  return push->pads.get_global_aftertouch_mode();
+  try {
+    return push->pads.get_global_aftertouch_mode();
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    LibPushAftertouchMode mode = {};
+    return mode;
+  }
 }
 
 void libpush_set_global_pad_velocity_curve(
@@ -147,7 +838,16 @@ void libpush_set_global_pad_velocity_curve(
 
 void libpush_set_pad_sensitivity(unsigned char x, unsigned char y,
                                  LibPushPadSensitivity sensitivity) {
-  push->pads.set_pad_sensitivity(x, y, sensitivity);
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+
+  try {
+    push->pads.set_pad_sensitivity(x, y, sensitivity);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+  }
 }
 
 void libpush_set_global_pad_sensitivity(LibPushPadSensitivity sensitivity) {
@@ -156,19 +856,85 @@ void libpush_set_global_pad_sensitivity(LibPushPadSensitivity sensitivity) {
 
 LibPushPadSensitivity libpush_get_pad_sensitivity(unsigned char x,
                                                   unsigned char y) {
-  return push->pads.get_pad_sensitivity(x, y);
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return LibPushPadSensitivity{};
+  }
+
+  try {
+    return push->pads.get_pad_sensitivity(x, y);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    LibPushPadSensitivity sensitivity = {};
+    return sensitivity;
+  }
+}
+
+void libpush_set_pad_sensitivity_map(
+    const LibPushPadSensitivity (
+        &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+
+  try {
+    push->pads.set_pad_sensitivities(sensitivities);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+  }
+}
+
+bool libpush_get_pad_sensitivity_map(
+    LibPushPadSensitivity (
+        &sensitivities)[LIBPUSH_PAD_MATRIX_DIM][LIBPUSH_PAD_MATRIX_DIM]) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    push->pads.get_pad_sensitivities(sensitivities);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+  return true;
 }
 
 void libpush_set_button_led_color(LibPushButton btn, unsigned int color_index) {
   push->buttons.set_button_led_color(btn, color_index);
 }
 
+void libpush_set_pad_reflex(unsigned long long pads, LibPushLedReflex reflex) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->reflexes.set_pad_reflex(pads, reflex);
+}
+
+bool libpush_set_button_reflex(LibPushButton btn, int index,
+                               LibPushLedReflex reflex) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+  return push->reflexes.set_button_reflex(btn, index, reflex);
+}
+
 void libpush_set_touch_strip_config(LibPushTouchStripConfig cfg) {
   push->touch_strip.set_config(cfg);
 }
 
 LibPushTouchStripConfig libpush_get_touch_strip_config() {
-  return push->touch_strip.get_config();
+  try {
+    return push->touch_strip.get_config();
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    LibPushTouchStripConfig cfg = {};
+    return cfg;
+  }
 };
 
 void libpush_set_touch_strip_leds(
@@ -182,7 +948,14 @@ LibPushPedalSampleData libpush_sample_pedals(unsigned char sample_size) {
     LibPushPedalSampleData d;
     return d;
   }
-  return push->pedals.sample_pedals(sample_size);
+
+  try {
+    return push->pedals.sample_pedals(sample_size);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    LibPushPedalSampleData d = {};
+    return d;
+  }
 }
 
 void libpush_set_pedal_curve_limits(LibPushPedalContact contact,
@@ -214,13 +987,77 @@ void libpush_set_led_color_palette_entry(unsigned char color_index,
   push->leds.set_led_color_palette_entry(color_index, color);
 }
 
+void libpush_set_led_color_palette_entries(unsigned char first,
+                                           unsigned char count,
+                                           const LibPushLedColor *colors,
+                                           bool reapply) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  if (first + count > 128) {
+    cerr << "The palette has 128 entries" << endl;
+    return;
+  }
+
+  try {
+    push->leds.set_led_color_palette_entries(first, count, colors, reapply);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+  }
+}
+
 LibPushLedColor libpush_get_led_color_palette_entry(unsigned char color_index) {
   if (!push) {
     cerr << NOT_CONNECTED_MSG << endl;
     LibPushLedColor c;
     return c;
   }
-  return push->leds.get_led_color_palette_entry(color_index);
+  try {
+    return push->leds.get_led_color_palette_entry(color_index);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    LibPushLedColor c = {};
+    return c;
+  }
+}
+
+bool libpush_get_led_color_palette_entries(unsigned char first,
+                                           unsigned char count,
+                                           LibPushLedColor *colors) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+  if (first + count > 128) {
+    cerr << "The palette has 128 entries" << endl;
+    return false;
+  }
+
+  try {
+    push->leds.get_led_color_palette_entries(first, count, colors);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+  return true;
+}
+
+bool libpush_get_led_color_palette_entry_async(
+    unsigned char color_index, LibPushPaletteEntryCallback cb,
+    void *context) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    push->leds.get_led_color_palette_entry_async(color_index, cb, context);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+  return true;
 }
 
 void libpush_reapply_color_palette() {
@@ -244,7 +1081,12 @@ unsigned char libpush_get_global_led_brightness() {
     cerr << NOT_CONNECTED_MSG << endl;
     return 0;
   }
-  return push->leds.get_global_led_brightness();
+  try {
+    return push->leds.get_global_led_brightness();
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return 0;
+  }
 }
 
 void libpush_set_led_pwm_freq(int freq) {
@@ -252,7 +1094,12 @@ void libpush_set_led_pwm_freq(int freq) {
     cerr << NOT_CONNECTED_MSG << endl;
     return;
   }
-  return push->leds.set_led_pwm_freq(freq);
+
+  try {
+    push->leds.set_led_pwm_freq(freq);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+  }
 }
 
 void libpush_set_midi_mode(LibPushMidiMode mode) {
@@ -269,5 +1116,106 @@ LibPushStats libpush_get_statistics(unsigned char run_id) {
     LibPushStats s;
     return s;
   }
-  return push->misc.get_statistics(run_id);
+  try {
+    return push->misc.get_statistics(run_id);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    LibPushStats s = {};
+    return s;
+  }
+}
+
+void libpush_set_sysex_reply_timeout(unsigned int timeout_ms) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->sysex.set_reply_timeout(timeout_ms);
+}
+
+LibPushSettingsCacheStats libpush_get_settings_cache_stats() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    LibPushSettingsCacheStats s = {};
+    return s;
+  }
+  return push->settings.get_stats();
+}
+
+void libpush_invalidate_settings_cache() {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return;
+  }
+  push->settings.invalidate();
+}
+
+bool libpush_save_state(const char *path) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return false;
+  }
+
+  try {
+    push->save_settings(path);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return false;
+  }
+  return true;
+}
+
+long long libpush_restore_state(const char *path) {
+  if (!push) {
+    cerr << NOT_CONNECTED_MSG << endl;
+    return -1;
+  }
+
+  try {
+    return push->restore_settings(path);
+  } catch (exception &ex) {
+    cerr << ex.what() << endl;
+    return -1;
+  }
+}
+
+void libpush_set_simulated_traffic(LibPushSimulatorConfig cfg) {
+  if (!push || !push->simulator) {
+    cerr << NOT_SIMULATED_MSG << endl;
+    return;
+  }
+  push->simulator->set_traffic(cfg);
+}
+
+void libpush_play_simulated_script(const unsigned char *messages, size_t count,
+                                   unsigned int rate, bool loop) {
+  if (!push || !push->simulator) {
+    cerr << NOT_SIMULATED_MSG << endl;
+    return;
+  }
+
+  vector<midi_msg> script;
+  for (size_t i = 0; i < count; ++i) {
+    script.push_back(midi_msg(messages + i * 3, messages + i * 3 + 3));
+  }
+  push->simulator->play_script(move(script), rate, loop);
+}
+
+void libpush_inject_simulated_message(const unsigned char *message,
+                                      size_t length) {
+  if (!push || !push->simulator) {
+    cerr << NOT_SIMULATED_MSG << endl;
+    return;
+  }
+  midi_msg msg(message, message + length);
+  push->simulator->inject(msg);
+}
+
+LibPushSimulatorStats libpush_get_simulator_stats() {
+  if (!push || !push->simulator) {
+    cerr << NOT_SIMULATED_MSG << endl;
+    LibPushSimulatorStats s = {};
+    return s;
+  }
+  return push->simulator->get_stats();
 }
@@ -1,27 +1,85 @@
 #pragma once
 #include "ButtonInterface.hpp"
+#include "CallbackRunner.hpp"
+#include "ControllerState.hpp"
 #include "DisplayInterface.hpp"
+#include "EncoderBindings.hpp"
 #include "EncoderInterface.hpp"
+#include "EventQueue.hpp"
+#include "GestureInterface.hpp"
 #include "LedInterface.hpp"
+#include "LedReflexes.hpp"
+#include "MidiForwarder.hpp"
 #include "MidiInterface.hpp"
 #include "MiscSysexInterface.hpp"
 #include "PadInterface.hpp"
+#include "ParameterStore.hpp"
 #include "PedalInterface.hpp"
+#include "PedalSampler.hpp"
+#include "PeriodicTimer.hpp"
+#include "SettingsCache.hpp"
+#include "SettingsSnapshot.hpp"
+#include "SignalConditioner.hpp"
+#include "SimulatedDevice.hpp"
 #include "SysexInterface.hpp"
 #include "TouchStripInterface.hpp"
+#include "VoiceTracker.hpp"
 #include "push.h"
+#include <atomic>
 #include <exception>
 #include <iostream>
 #include <string>
 
 class PushInterface {
 public:
-  PushInterface(LibPushPort port);
+  /// \param port The MIDI port to connect to (Live or User)
+  /// \param simulator If set, connect to this simulated device instead of a physical Push
+  PushInterface(LibPushPort port,
+                std::unique_ptr<SimulatedDevice> simulator = nullptr);
   ~PushInterface();
 
-  DisplayInterface display;
+  /// \param queue The queue to write input events to, or nullptr to stop queueing events
+  /// \effects Replaces the current event queue, and frees the old one once no event is being
+  /// written to it and no poll is reading it
+  void set_event_queue(std::unique_ptr<EventQueue> queue);
+
+  /// \param enabled Whether continuous pad, encoder and touch strip events should be coalesced
+  /// \param interval_us How often to flush coalesced events from a background thread, or 0 to never
+  void set_coalescing(bool enabled, unsigned int interval_us);
+
+  /// \effects Delivers all pending coalesced events
+  void flush_coalesced_events();
+
+  /// \param config The gestures to recognize and their timing
+  /// \effects Pad and button events are observed for gestures while any gesture is enabled
+  void set_gesture_config(const LibPushGestureConfig &config);
+
+  /// \param tracker The tracker to pass pad events to, or nullptr to stop tracking voices
+  /// \effects Replaces the current voice tracker, and frees the old one once no pad event is
+  /// being passed to it and no read is using it. A stopped tracker stays current until it's replaced,
+  /// so that its remaining updates can be read
+  /// \requires Not called from within a pad or gesture observer
+  void set_voice_tracker(std::unique_ptr<VoiceTracker> tracker);
+
+  /// \param path The file to save the settings to
+  /// \effects Reads the settings Push can report that aren't cached, then saves every known setting.
+  /// Settings Push can't report, like curves, are only saved if they were set since connecting
+  /// \throws An [std::runtime_error]() exception if a setting can't be read or the file can't be written
+  void save_settings(const std::string &path);
+
+  /// \param path A file written by save_settings
+  /// \returns The number of settings that were written
+  /// \effects Writes the saved settings that Push may not have in a single batch
+  /// \throws An [std::runtime_error]() exception if the file can't be read or is invalid
+  size_t restore_settings(const std::string &path);
+
+  std::unique_ptr<SimulatedDevice> simulator; //< Only set when simulating Push
+
+  SettingsCache settings; //< Push's settings, as the interfaces last wrote or read them
+
   MidiInterface midi;
   SysexInterface sysex;
+  DisplayInterface display; //< After sysex, which it registers a reply with
   MiscSysexInterface misc;
   LedInterface leds;
   PedalInterface pedals;
@@ -29,4 +87,29 @@ public:
   PadInterface pads;
   TouchStripInterface touch_strip;
   ButtonInterface buttons;
+  GestureInterface gestures;
+
+  std::atomic<EventQueue *> event_queue; //< The current event queue, or nullptr
+  std::atomic<int> event_queue_readers; //< The number of C API calls that may be using event_queue
+  std::unique_ptr<EventQueue> owned_event_queue;
+
+  PeriodicTimer coalescing_timer;
+
+  CallbackRunner callback_runner; //< Runs callbacks on workers and times them when enabled
+
+  ControllerState state; //< Kept up to date by the listeners of every interface
+
+  SignalConditioner conditioner; //< Filters aftertouch, touch strip and pedal events
+
+  ParameterStore parameters;
+  EncoderBindings bindings; //< Applies encoder turns to parameters
+
+  PedalSampler pedal_sampler;
+
+  MidiForwarder forwarder; //< Writes pad, encoder and touch strip input to another port
+  LedReflexes reflexes; //< Lights pad and button leds as soon as they are pressed
+
+  std::atomic<VoiceTracker *> voice_tracker; //< The tracker updates are read from, or nullptr
+  std::atomic<int> voice_tracker_readers; //< The number of C API calls that may be using voice_tracker
+  std::unique_ptr<VoiceTracker> owned_voice_tracker;
 };
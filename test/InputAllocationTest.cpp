@@ -0,0 +1,132 @@
+// Checks that handling input doesn't allocate, with every feature that listens to input enabled
+//
+// Messages are injected into the simulator on this thread, so every allocation made on it
+// while they are handled is made by the input path
+#include "push.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+extern PushInterface *push;
+
+static thread_local bool counting = false;
+static thread_local unsigned long long allocations = 0;
+
+void *operator new(size_t size) {
+  if (counting) {
+    ++allocations;
+  }
+  void *memory = malloc(size ? size : 1);
+  if (!memory) {
+    throw bad_alloc();
+  }
+  return memory;
+}
+
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+
+static unsigned long long events = 0;
+
+void pad_callback(LibPushPadEvent event, void *context) { ++events; }
+void button_callback(LibPushButtonEvent event, void *context) { ++events; }
+void encoder_callback(LibPushEncoderEvent event, void *context) { ++events; }
+void touch_strip_callback(LibPushTouchStripEvent event, void *context) {
+  ++events;
+}
+void pedal_callback(LibPushPedalEvent event, void *context) { ++events; }
+void gesture_callback(LibPushGestureEvent event, void *context) { ++events; }
+void parameter_callback(const LibPushParameterChange *changes, size_t count,
+                        void *context) {}
+
+static void enable_every_feature() {
+  libpush_register_pad_callback(pad_callback, nullptr);
+  libpush_register_button_callback(button_callback, nullptr);
+  libpush_register_encoder_callback(encoder_callback, nullptr);
+  libpush_register_touch_strip_callback(touch_strip_callback, nullptr);
+  libpush_register_pedal_callback(pedal_callback, nullptr);
+  int filtered = libpush_register_pad_callback(pad_callback, nullptr);
+  LibPushEventFilter filter = {};
+  filter.event_types = 1 << LP_PAD_EVENT;
+  filter.pads = libpush_pad_region(0, 0, 3, 3);
+  libpush_set_callback_filter(filtered, filter);
+
+  LibPushGestureConfig gestures = {};
+  gestures.gestures = (1 << LP_GESTURE_DOUBLE_TAP) |
+                      (1 << LP_GESTURE_LONG_PRESS) | (1 << LP_GESTURE_REPEAT) |
+                      (1 << LP_GESTURE_CHORD);
+  gestures.double_tap_ms = 250;
+  gestures.long_press_ms = 500;
+  gestures.repeat_delay_ms = 400;
+  gestures.repeat_interval_ms = 100;
+  gestures.chord_ms = 30;
+  libpush_set_gesture_config(gestures);
+  libpush_register_gesture_callback(gesture_callback, nullptr);
+
+  libpush_enable_event_queue(1024, LP_DROP_OLDEST);
+  libpush_add_event_cursor();
+  libpush_set_event_coalescing(true, 1000);
+  libpush_set_callback_workers(2, 256);
+  libpush_set_callback_budget(1000000, nullptr, nullptr);
+
+  LibPushSignalConfig conditioning = {true, 1.0, 0.01, 1.0, 0, 0.01, 0.001};
+  libpush_set_signal_conditioning(LP_SIGNAL_AFTERTOUCH, conditioning);
+  libpush_set_signal_conditioning(LP_SIGNAL_TOUCH_STRIP, conditioning);
+  libpush_set_signal_conditioning(LP_SIGNAL_PEDAL, conditioning);
+
+  LibPushEncoderBinding binding = {0, 0, 1, LP_CURVE_LINEAR, 1, 0.5, 0.1};
+  libpush_bind_encoder(0, binding);
+  libpush_set_parameter_notifications(parameter_callback, nullptr, 10000);
+
+  LibPushPadLayout layout = {};
+  layout.octave = 2;
+  libpush_set_pad_layout(layout);
+  LibPushLedReflex reflex = {};
+  reflex.enabled = true;
+  reflex.press_color = 5;
+  libpush_set_pad_reflex(~0ull, reflex);
+  libpush_set_button_reflex(LP_PLAY_BTN, 0, reflex);
+
+  LibPushForwardingConfig forwarding = {};
+  forwarding.sources = 0xFF;
+  forwarding.encoder_cc = 20;
+  libpush_start_forwarding("", false, forwarding);
+  libpush_enable_voice_tracking(15, true, 1 << 16);
+}
+
+int main() {
+  if (!libpush_connect_simulated()) {
+    return 1;
+  }
+  enable_every_feature();
+
+  // Note off, note on, aftertouch, cc, program change, channel pressure and pitch bend
+  mt19937 random(1);
+  vector<midi_msg> messages;
+  for (int i = 0; i < 4096; ++i) {
+    messages.push_back({(byte)(0x80 + random() % 7 * 16), (byte)(random() % 128),
+                        (byte)(random() % 128)});
+  }
+
+  // The first pass lets each feature reach its steady state
+  for (midi_msg &message : messages) {
+    push->simulator->inject(message);
+  }
+
+  counting = true;
+  for (int pass = 0; pass < 64; ++pass) {
+    for (midi_msg &message : messages) {
+      push->simulator->inject(message);
+    }
+  }
+  counting = false;
+
+  printf("%llu allocations while handling %zu messages\n", allocations,
+         64 * messages.size());
+  libpush_disconnect();
+  return allocations ? 1 : 0;
+}
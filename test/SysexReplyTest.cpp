@@ -0,0 +1,199 @@
+// Checks that sysex calls made from several threads at once each get their own reply
+//
+// Replies come back from a transport that answers every command after a delay, so calls
+// from every thread are waiting for replies at once, and tickets are reused while a
+// synchronous call still holds its reply
+#include "MidiInterface.hpp"
+#include "SysexInterface.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#define ECHOED_COMMAND 0x04
+#define UNECHOED_COMMAND 0x07
+#define THREADS 8
+#define CALLS_PER_THREAD 2000
+#define CALLS_IN_FLIGHT 24 //< Per thread, so that the reply slots are often full
+
+/// Echoes the command and arguments of each sysex message back after a delay
+class SlowReplyTransport : public MidiTransport {
+public:
+  void open(LibPushPort port, InputCallback callback, void *context) override {
+    this->callback = callback;
+    this->context = context;
+    this->replier = thread([this]() { this->reply(); });
+  }
+
+  void close() override {
+    {
+      lock_guard<mutex> guard(this->lock);
+      this->stopped = true;
+    }
+    this->changed.notify_all();
+    this->replier.join();
+  }
+
+  void send(midi_msg &message) override {
+    lock_guard<mutex> guard(this->lock);
+    this->pending.push_back(
+        {chrono::steady_clock::now() + chrono::microseconds(200), message});
+    this->changed.notify_all();
+  }
+
+private:
+  struct Reply {
+    chrono::steady_clock::time_point due;
+    midi_msg message;
+  };
+
+  void reply() {
+    unique_lock<mutex> guard(this->lock);
+    while (!this->stopped) {
+      if (this->pending.empty()) {
+        this->changed.wait(guard);
+        continue;
+      }
+      if (chrono::steady_clock::now() < this->pending.front().due) {
+        this->changed.wait_until(guard, this->pending.front().due);
+        continue;
+      }
+
+      midi_msg message = move(this->pending.front().message);
+      this->pending.pop_front();
+      guard.unlock();
+      this->callback(0, &message, this->context);
+      guard.lock();
+    }
+  }
+
+  InputCallback callback;
+  void *context;
+  thread replier;
+  mutex lock;
+  condition_variable changed;
+  deque<Reply> pending;
+  bool stopped = false;
+};
+
+struct Call {
+  byte arg;
+  atomic<int> replies;
+  atomic<bool> matched;
+  atomic<int> *completed;
+};
+
+static atomic<unsigned long long> failures(0);
+
+/// \returns Whether the call failed because the reply slot was full, so it can be retried
+static bool is_full(const runtime_error &ex) {
+  if (string(ex.what()) == "Too many sysex calls waiting for a reply") {
+    this_thread::yield();
+    return true;
+  }
+  fprintf(stderr, "%s\n", ex.what());
+  failures.fetch_add(1);
+  return false;
+}
+
+void on_reply(const midi_msg *reply, void *context) {
+  Call *call = static_cast<Call *>(context);
+  call->matched.store(reply && !reply->empty() && (*reply)[0] == call->arg);
+  call->replies.fetch_add(1);
+  call->completed->fetch_add(1);
+}
+
+static void make_calls(SysexInterface &sysex, int thread_index,
+                       vector<unique_ptr<Call>> &calls) {
+  atomic<int> completed(0);
+  for (int i = 0; i < CALLS_PER_THREAD; ++i) {
+    while (i - completed.load() >= CALLS_IN_FLIGHT) {
+      this_thread::yield();
+    }
+
+    byte command = i % 2 ? ECHOED_COMMAND : UNECHOED_COMMAND;
+    midi_msg args = {(byte)((thread_index * 31 + i) % 128)};
+    // Synchronous calls hold their ticket until they take the reply
+    if (i % 5 == 0) {
+      completed.fetch_add(1);
+      while (true) {
+        try {
+          midi_msg reply = sysex.sysex_call(command, args);
+          if (reply.empty() || reply[0] != args[0]) {
+            failures.fetch_add(1);
+          }
+          break;
+        } catch (runtime_error &ex) {
+          if (!is_full(ex)) {
+            break;
+          }
+        }
+      }
+      continue;
+    }
+
+    calls.emplace_back(new Call());
+    Call &call = *calls.back();
+    call.arg = args[0];
+    call.replies.store(0);
+    call.matched.store(false);
+    call.completed = &completed;
+    while (true) {
+      try {
+        sysex.sysex_call_async(command, args, on_reply, &call);
+        break;
+      } catch (runtime_error &ex) {
+        if (!is_full(ex)) {
+          call.replies.store(1);
+          call.matched.store(true);
+          completed.fetch_add(1);
+          break;
+        }
+      }
+    }
+  }
+
+  while (completed.load() < CALLS_PER_THREAD) {
+    this_thread::yield();
+  }
+}
+
+int main() {
+  MidiInterface midi;
+  SysexInterface sysex(midi);
+  sysex.register_command_with_reply(ECHOED_COMMAND, 1);
+  sysex.register_command_with_reply(UNECHOED_COMMAND);
+  sysex.set_reply_timeout(5000);
+  midi.connect(unique_ptr<MidiTransport>(new SlowReplyTransport()), LIVE);
+
+  vector<vector<unique_ptr<Call>>> calls(THREADS);
+  vector<thread> threads;
+  for (int i = 0; i < THREADS; ++i) {
+    threads.emplace_back(make_calls, ref(sysex), i, ref(calls[i]));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  midi.disconnect();
+
+  for (auto &thread_calls : calls) {
+    for (auto &call : thread_calls) {
+      if (call->replies.load() != 1 || !call->matched.load()) {
+        failures.fetch_add(1);
+      }
+    }
+  }
+
+  printf("%llu of %zu calls didn't get their own reply exactly once\n",
+         failures.load(), THREADS * (size_t)CALLS_PER_THREAD);
+  return failures.load() ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+// Checks that timers fire exactly on their expiry, against random schedules, cancels and advances
+//
+// Some timers are scheduled beyond the range of the wheel, and some are rescheduled or cancelled
+// by the callback of another timer that fires on the same tick
+#include "TimerWheel.hpp"
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+#define TIMERS 2000
+#define STEPS 20000
+#define WHEEL_RANGE (1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+struct Expected {
+  TimerWheel *wheel;
+  vector<TimerWheel::Timer> *timers;
+  map<int, unsigned long long> expiries; //< The expiry of each scheduled timer, by id
+  mt19937_64 rng;
+  bool touching; //< Whether callbacks cancel and schedule other timers
+  unsigned long long failures;
+};
+
+static void on_fired(TimerWheel::Timer &timer, void *context) {
+  Expected &expected = *static_cast<Expected *>(context);
+  auto found = expected.expiries.find(timer.id);
+  if (found == expected.expiries.end() ||
+      found->second != expected.wheel->now()) {
+    fprintf(stderr, "Timer %d fired on tick %llu\n", timer.id,
+            expected.wheel->now());
+    ++expected.failures;
+  } else {
+    expected.expiries.erase(found);
+  }
+  if (!expected.touching) {
+    return;
+  }
+
+  // Touch another timer from the callback, which may be due on this tick too
+  TimerWheel::Timer &other =
+      (*expected.timers)[expected.rng() % expected.timers->size()];
+  switch (expected.rng() % 8) {
+  case 0:
+    expected.wheel->cancel(other);
+    expected.expiries.erase(other.id);
+    break;
+  case 1: {
+    unsigned long long expiry = expected.wheel->now() + expected.rng() % 100;
+    expected.wheel->schedule(other, expiry);
+    expected.expiries[other.id] = expiry > expected.wheel->now()
+                                      ? expiry
+                                      : expected.wheel->now() + 1;
+    break;
+  }
+  }
+}
+
+/// \returns A delay that is often short, sometimes long and now and then beyond the range of the wheel
+static unsigned long long random_delay(mt19937_64 &rng) {
+  switch (rng() % 8) {
+  case 0:
+    return WHEEL_RANGE + rng() % WHEEL_RANGE;
+  case 1:
+  case 2:
+    return rng() % (1 << 20);
+  default:
+    return rng() % 100;
+  }
+}
+
+static unsigned long long run(unsigned long long start) {
+  TimerWheel wheel(start);
+  vector<TimerWheel::Timer> timers(TIMERS);
+  for (int i = 0; i < TIMERS; ++i) {
+    timers[i] = TimerWheel::Timer();
+    timers[i].id = i;
+  }
+
+  Expected expected;
+  expected.wheel = &wheel;
+  expected.timers = &timers;
+  expected.rng.seed(start);
+  expected.touching = true;
+  expected.failures = 0;
+
+  mt19937_64 rng(start + 1);
+  for (int step = 0; step < STEPS; ++step) {
+    TimerWheel::Timer &timer = timers[rng() % TIMERS];
+    switch (rng() % 4) {
+    case 0:
+    case 1: {
+      unsigned long long expiry = wheel.now() + random_delay(rng);
+      wheel.schedule(timer, expiry);
+      expected.expiries[timer.id] =
+          expiry > wheel.now() ? expiry : wheel.now() + 1;
+      break;
+    }
+    case 2:
+      wheel.cancel(timer);
+      expected.expiries.erase(timer.id);
+      break;
+    default: {
+      // Now and then, advance far enough for parked timers to come due
+      unsigned long long to =
+          wheel.now() + (rng() % 256 ? rng() % 2000 : WHEEL_RANGE);
+      wheel.advance(to, on_fired, &expected);
+      for (auto &expiry : expected.expiries) {
+        if (expiry.second <= to) {
+          fprintf(stderr, "Timer %d didn't fire on tick %llu\n", expiry.first,
+                  expiry.second);
+          ++expected.failures;
+        }
+      }
+      break;
+    }
+    }
+  }
+
+  expected.touching = false;
+  wheel.advance(wheel.now() + 2 * WHEEL_RANGE, on_fired, &expected);
+  return expected.failures + expected.expiries.size();
+}
+
+int main() {
+  unsigned long long failures = 0;
+  for (unsigned long long start : {0ULL, 63ULL, 4095ULL, WHEEL_RANGE - 1,
+                                   123456789ULL}) {
+    failures += run(start);
+  }
+
+  printf("%llu times a timer didn't fire exactly on its expiry\n", failures);
+  return failures ? 1 : 0;
+}